@@ -8,6 +8,96 @@ static void rar_close(ar_archive *ar)
     ar_archive_rar *rar = (ar_archive_rar *)ar;
     free(rar->entry.name);
     rar_clear_uncompress(&rar->uncomp);
+    if (rar->spill.file)
+        fclose(rar->spill.file);
+    free(rar->spill.entries);
+}
+
+static bool rar_spill_seek(struct ar_archive_rar_spill *spill, off64_t pos)
+{
+    if (spill->file_pos == pos)
+        return true;
+#ifdef _MSC_VER
+    if (_fseeki64(spill->file, pos, SEEK_SET) != 0)
+        return false;
+#else
+    if (pos > INT32_MAX || fseek(spill->file, (long)pos, SEEK_SET) != 0)
+        return false;
+#endif
+    spill->file_pos = pos;
+    return true;
+}
+
+static void rar_start_spilling(ar_archive_rar *rar)
+{
+    if (rar->spill.tried)
+        return;
+    rar->spill.tried = true;
+    rar->spill.file = tmpfile();
+    if (!rar->spill.file)
+        log("Couldn't create spill file");
+}
+
+static size_t rar_find_spilled(struct ar_archive_rar_spill *spill, off64_t offset)
+{
+    size_t i;
+    for (i = 0; i < spill->count; i++) {
+        if (spill->entries[i].offset == offset)
+            return i;
+    }
+    return spill->count;
+}
+
+static bool rar_spill_data(ar_archive_rar *rar, const void *buffer, size_t count)
+{
+    struct ar_archive_rar_spill *spill = &rar->spill;
+    if (!rar_spill_seek(spill, spill->size + rar->progress.bytes_done - count))
+        return false;
+    if (fwrite(buffer, 1, count, spill->file) != count) {
+        spill->file_pos = -1;
+        return false;
+    }
+    spill->file_pos += count;
+    return true;
+}
+
+static bool rar_spill_entry_done(ar_archive_rar *rar)
+{
+    struct ar_archive_rar_spill *spill = &rar->spill;
+    if (spill->count == spill->capacity) {
+        size_t capacity = spill->capacity ? spill->capacity * 2 : 64;
+        struct ar_archive_rar_spilled_entry *entries = malloc(capacity * sizeof(*entries));
+        if (!entries)
+            return false;
+        if (spill->count)
+            memcpy(entries, spill->entries, spill->count * sizeof(*entries));
+        free(spill->entries);
+        spill->entries = entries;
+        spill->capacity = capacity;
+    }
+    spill->entries[spill->count].offset = rar->super.entry_offset;
+    spill->entries[spill->count].pos = spill->size;
+    spill->entries[spill->count].size = rar->super.entry_size_uncompressed;
+    spill->count++;
+    spill->size += rar->super.entry_size_uncompressed;
+    return true;
+}
+
+static bool rar_read_spilled(ar_archive_rar *rar, void *buffer, size_t count)
+{
+    struct ar_archive_rar_spill *spill = &rar->spill;
+    if (!rar_spill_seek(spill, spill->entries[spill->current].pos + rar->progress.bytes_done)) {
+        warn("Couldn't seek in spill file");
+        return false;
+    }
+    if (fread(buffer, 1, count, spill->file) != count) {
+        warn("Unexpected EOF in spill file");
+        spill->file_pos = -1;
+        return false;
+    }
+    spill->file_pos += count;
+    rar->progress.bytes_done += count;
+    return true;
 }
 
 static bool rar_parse_entry(ar_archive *ar, off64_t offset)
@@ -15,7 +105,6 @@ static bool rar_parse_entry(ar_archive *ar, off64_t offset)
     ar_archive_rar *rar = (ar_archive_rar *)ar;
     struct rar_header header;
     struct rar_entry entry;
-    bool out_of_order = offset != ar->entry_offset_next;
 
     if (!ar_seek(ar->stream, offset, SEEK_SET)) {
         warn("Couldn't seek to offset %" PRIi64, offset);
@@ -71,16 +160,33 @@ static bool rar_parse_entry(ar_archive *ar, off64_t offset)
                 warn("Splitting files isn't really supported");
             ar->entry_size_uncompressed = (size_t)entry.size;
             ar->entry_filetime = ar_conv_dosdate_to_filetime(entry.dosdate);
-            if (!rar->entry.solid || rar->entry.method == METHOD_STORE || out_of_order) {
+            rar->spill.current = rar_find_spilled(&rar->spill, ar->entry_offset);
+            rar->spill.reading = rar->spill.current < rar->spill.count && !rar->spill.restarting;
+            rar->spill.writing = false;
+            /* entries accessed out of order are likely to be accessed again */
+            if (!rar->spill.reading && (rar->archive_flags & MHD_SOLID) && rar->entry.method != METHOD_STORE &&
+                rar->solid.resume_offset != ar->entry_offset && (rar->solid.resume_offset || rar->solid.size_total)) {
+                rar_start_spilling(rar);
+            }
+            if (rar->spill.reading) {
+                /* the decoder state remains untouched for the following entries */
+            }
+            else if (!rar->entry.solid || rar->entry.method == METHOD_STORE || !rar->solid.resume_offset ||
+                     rar->solid.resume_offset > ar->entry_offset) {
                 rar_clear_uncompress(&rar->uncomp);
                 memset(&rar->solid, 0, sizeof(rar->solid));
             }
-            else {
+            else if (rar->solid.resume_offset == ar->entry_offset) {
                 br_clear_leftover_bits(&rar->uncomp);
             }
+            /* else decompression continues at resume_offset (cf. rar_restart_solid) */
 
-            rar->solid.restart = rar->entry.solid && (out_of_order || !rar->solid.part_done);
-            rar->solid.part_done = !ar->entry_size_uncompressed;
+            if (!rar->spill.reading) {
+                rar->solid.restart = rar->entry.solid && rar->solid.resume_offset != ar->entry_offset;
+                /* the first entry of a solid archive isn't marked as solid itself */
+                rar->spill.writing = rar->spill.file && (rar->entry.solid || (rar->archive_flags & MHD_SOLID)) &&
+                                     rar->entry.method != METHOD_STORE && rar->spill.current == rar->spill.count;
+            }
             rar->progress.data_left = (size_t)header.datasize;
             rar->progress.bytes_done = 0;
             rar->progress.crc = 0;
@@ -136,8 +242,13 @@ static bool rar_restart_solid(ar_archive *ar)
 {
     ar_archive_rar *rar = (ar_archive_rar *)ar;
     off64_t current_offset = ar->entry_offset;
+    /* continue from where the decoder stopped, if that's before the current entry */
+    off64_t start_offset = rar->solid.resume_offset ? rar->solid.resume_offset : ar->entry_offset_first;
     log("Restarting decompression for solid entry");
-    if (!ar_parse_entry_at(ar, ar->entry_offset_first)) {
+    rar_start_spilling(rar);
+    rar->spill.restarting = true;
+    if (!ar_parse_entry_at(ar, start_offset)) {
+        rar->spill.restarting = false;
         ar_parse_entry_at(ar, current_offset);
         return false;
     }
@@ -148,16 +259,19 @@ static bool rar_restart_solid(ar_archive *ar)
             unsigned char buffer[1024];
             size_t count = smin(size, sizeof(buffer));
             if (!ar_entry_uncompress(ar, buffer, count)) {
+                rar->spill.restarting = false;
                 ar_parse_entry_at(ar, current_offset);
                 return false;
             }
             size -= count;
         }
         if (!ar_parse_entry(ar)) {
+            rar->spill.restarting = false;
             ar_parse_entry_at(ar, current_offset);
             return false;
         }
     }
+    rar->spill.restarting = false;
     rar->solid.restart = false;
     return true;
 }
@@ -169,7 +283,11 @@ static bool rar_uncompress(ar_archive *ar, void *buffer, size_t count)
         warn("Requesting too much data (%" PRIuPTR " < %" PRIuPTR ")", ar->entry_size_uncompressed - rar->progress.bytes_done, count);
         return false;
     }
-    if (rar->entry.method == METHOD_STORE) {
+    if (rar->spill.reading) {
+        if (!rar_read_spilled(rar, buffer, count))
+            return false;
+    }
+    else if (rar->entry.method == METHOD_STORE) {
         if (!rar_copy_stored(rar, buffer, count))
             return false;
     }
@@ -180,8 +298,14 @@ static bool rar_uncompress(ar_archive *ar, void *buffer, size_t count)
             warn("Failed to produce the required solid decompression state");
             return false;
         }
+        /* the decoder state is no longer at an entry boundary */
+        rar->solid.resume_offset = 0;
         if (!rar_uncompress_part(rar, buffer, count))
             return false;
+        if (rar->spill.writing && !rar_spill_data(rar, buffer, count)) {
+            log("Couldn't write to spill file");
+            rar->spill.writing = false;
+        }
     }
     else {
         warn("Unknown compression method %#02x", rar->entry.method);
@@ -191,14 +315,20 @@ static bool rar_uncompress(ar_archive *ar, void *buffer, size_t count)
     rar->progress.crc = ar_crc32(rar->progress.crc, buffer, count);
     if (rar->progress.bytes_done < ar->entry_size_uncompressed)
         return true;
-    if (rar->progress.data_left)
-        log("Compressed block has more data than required");
-    rar->solid.part_done = true;
-    rar->solid.size_total += rar->progress.bytes_done;
+    if (!rar->spill.reading) {
+        if (rar->progress.data_left)
+            log("Compressed block has more data than required");
+        rar->solid.size_total += rar->progress.bytes_done;
+        if (rar->entry.method != METHOD_STORE)
+            rar->solid.resume_offset = ar->entry_offset_next;
+    }
     if (rar->progress.crc != rar->entry.crc) {
         warn("Checksum of extracted data doesn't match");
         return false;
     }
+    if (rar->spill.writing && !rar_spill_entry_done(rar))
+        log("Couldn't grow the list of spilled entries");
+    rar->spill.writing = false;
     return true;
 }
 
@@ -236,8 +236,32 @@ struct ar_archive_rar_progress {
 
 struct ar_archive_rar_solid {
     size_t size_total;
-    bool part_done;
     bool restart;
+    /* offset of the entry the decoder state continues with (0 if unknown) */
+    off64_t resume_offset;
+};
+
+struct ar_archive_rar_spilled_entry {
+    off64_t offset;
+    off64_t pos;
+    size_t size;
+};
+
+/* once entries of a solid archive have been accessed out of order, uncompressed
+   entries (including the first one) are written to a temporary file so that they
+   can be read again without restarting (or resetting) the decoder */
+struct ar_archive_rar_spill {
+    FILE *file;
+    off64_t file_pos;
+    off64_t size;
+    struct ar_archive_rar_spilled_entry *entries;
+    size_t count;
+    size_t capacity;
+    size_t current;
+    bool reading;
+    bool writing;
+    bool restarting;
+    bool tried;
 };
 
 struct ar_archive_rar_s {
@@ -247,6 +271,7 @@ struct ar_archive_rar_s {
     struct ar_archive_rar_uncomp uncomp;
     struct ar_archive_rar_progress progress;
     struct ar_archive_rar_solid solid;
+    struct ar_archive_rar_spill spill;
 };
 
 #endif
@@ -96,6 +96,7 @@
                 "../mupdf/source/fitz/draw-imp.h",
                 "../mupdf/source/fitz/draw-mesh.c",
                 "../mupdf/source/fitz/draw-paint.c",
+                "../mupdf/source/fitz/draw-paint-simd.c",
                 "../mupdf/source/fitz/draw-path.c",
                 "../mupdf/source/fitz/draw-scale-simple.c",
                 "../mupdf/source/fitz/draw-unpack.c",
@@ -329,6 +329,31 @@ fz_device *fz_new_draw_device_with_bbox(fz_context *ctx, fz_pixmap *dest, const
 
 fz_device *fz_new_draw_device_type3(fz_context *ctx, fz_pixmap *dest);
 
+/*
+	fz_bench_span_painters: Compare the vectorized span painters
+	used by the draw device against the scalar reference versions
+	for all instruction sets supported by the CPU.
+
+	results: Receives the painter and instruction set names, the
+	time taken by both versions for painting a span iterations
+	times and the number of bytes for which the results differ
+	(which should always be 0).
+
+	Returns the number of results written.
+*/
+typedef struct fz_span_painter_bench_s fz_span_painter_bench;
+
+struct fz_span_painter_bench_s
+{
+	const char *painter;
+	const char *simd;
+	double scalar_ms;
+	double simd_ms;
+	int mismatches;
+};
+
+int fz_bench_span_painters(fz_context *ctx, fz_span_painter_bench *results, int max_results, int iterations);
+
 /* SumatraPDF: GDI+ draw device */
 #ifdef _WIN32
 fz_device *fz_new_gdiplus_device(fz_context *ctx, void *dc, const fz_rect *base_clip);
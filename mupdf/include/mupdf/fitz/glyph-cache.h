@@ -18,6 +18,29 @@ fz_glyph_cache *fz_keep_glyph_cache(fz_context *ctx);
 void fz_drop_glyph_cache_context(fz_context *ctx);
 void fz_purge_glyph_cache(fz_context *ctx);
 
+/*
+	fz_set_glyph_cache_size: Set the number of bytes that rendered
+	glyphs may use before the least recently used ones are evicted.
+	The cache is shared between cloned contexts.
+*/
+void fz_set_glyph_cache_size(fz_context *ctx, unsigned int max_size);
+
+typedef struct fz_glyph_cache_stats_s fz_glyph_cache_stats;
+
+struct fz_glyph_cache_stats_s
+{
+	int size, max_size; /* bytes used by cached glyphs and the limit */
+	int count; /* number of cached glyphs */
+	int hits, misses; /* lookups of cacheable glyphs */
+	int evictions, evicted; /* number and bytes of evicted glyphs */
+};
+
+/*
+	fz_get_glyph_cache_stats: Retrieve the glyph cache's counters
+	(accumulated since the context was created) for tuning its size.
+*/
+void fz_get_glyph_cache_stats(fz_context *ctx, fz_glyph_cache_stats *stats);
+
 fz_path *fz_outline_ft_glyph(fz_context *ctx, fz_font *font, int gid, const fz_matrix *trm);
 fz_path *fz_outline_glyph(fz_context *ctx, fz_font *font, int gid, const fz_matrix *ctm);
 fz_glyph *fz_render_ft_glyph(fz_context *ctx, fz_font *font, int cid, const fz_matrix *trm, int aa);
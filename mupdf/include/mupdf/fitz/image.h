@@ -36,6 +36,23 @@ typedef struct fz_image_s fz_image;
 */
 fz_pixmap *fz_new_pixmap_from_image(fz_context *ctx, fz_image *image, int w, int h);
 
+/*
+	fz_new_pixmap_from_image_area: Like fz_new_pixmap_from_image, but
+	may only decode the part of the image that is actually needed.
+
+	area: The needed part of the image, in image pixels (0,0 being the
+	top-left corner of the image).
+
+	w, h: The desired size of the whole image (see above).
+
+	ctm: The matrix mapping the unit square to the whole image. On
+	return it maps the unit square to the part of the image covered by
+	the returned pixmap.
+
+	Returns a non NULL pixmap pointer. May throw exceptions.
+*/
+fz_pixmap *fz_new_pixmap_from_image_area(fz_context *ctx, fz_image *image, const fz_irect *area, int w, int h, fz_matrix *ctm);
+
 /*
 	fz_drop_image: Drop a reference to an image.
 
@@ -81,6 +98,16 @@ struct fz_image_s
 };
 
 fz_pixmap *fz_load_jpx(fz_context *ctx, unsigned char *data, int size, fz_colorspace *cs, int indexed);
+/*
+	fz_load_jpx_reduced: Like fz_load_jpx, but skips up to *l2factor of
+	the finest resolution levels, halving width and height for each one.
+	On return *l2factor holds the number of levels actually skipped.
+
+	area: If not NULL, only the tiles intersecting this part of the
+	image (in full resolution pixels) are decoded. On return it holds
+	the part of the reduced image that the returned pixmap covers.
+*/
+fz_pixmap *fz_load_jpx_reduced(fz_context *ctx, unsigned char *data, int size, fz_colorspace *cs, int indexed, int *l2factor, fz_irect *area);
 fz_pixmap *fz_load_png(fz_context *ctx, unsigned char *data, int size);
 fz_pixmap *fz_load_tiff(fz_context *ctx, unsigned char *data, int size);
 fz_pixmap *fz_load_jxr(fz_context *ctx, unsigned char *data, int size);
@@ -88,9 +115,16 @@ fz_pixmap *fz_load_jxr(fz_context *ctx, unsigned char *data, int size);
 void fz_load_jpeg_info(fz_context *ctx, unsigned char *data, int size, int *w, int *h, int *xres, int *yres, fz_colorspace **cspace);
 void fz_load_png_info(fz_context *ctx, unsigned char *data, int size, int *w, int *h, int *xres, int *yres, fz_colorspace **cspace);
 void fz_load_tiff_info(fz_context *ctx, unsigned char *data, int size, int *w, int *h, int *xres, int *yres, fz_colorspace **cspace);
+void fz_load_jpx_info(fz_context *ctx, unsigned char *data, int size, int *w, int *h, int *xres, int *yres, fz_colorspace **cspace);
 void fz_load_jxr_info(fz_context *ctx, unsigned char *data, int size, int *w, int *h, int *xres, int *yres, fz_colorspace **cspace);
 
 int fz_load_tiff_subimage_count(fz_context *ctx, unsigned char *buf, int len);
 fz_pixmap *fz_load_tiff_subimage(fz_context *ctx, unsigned char *buf, int len, int subimage);
+/*
+	fz_load_tiff_rows: Decodes only the strips of the first subimage
+	which contain rows y0 to y1 (exclusive). The returned pixmap spans
+	the whole width; its y is set to the first row it contains.
+*/
+fz_pixmap *fz_load_tiff_rows(fz_context *ctx, unsigned char *buf, int len, int y0, int y1);
 
 #endif
@@ -298,6 +298,37 @@ fz_scale_cache *fz_new_scale_cache(fz_context *ctx);
 void fz_free_scale_cache(fz_context *ctx, fz_scale_cache *cache);
 fz_pixmap *fz_scale_pixmap_cached(fz_context *ctx, fz_pixmap *src, float x, float y, float w, float h, const fz_irect *clip, fz_scale_cache *cache_x, fz_scale_cache *cache_y);
 
+/*
+	fz_bench_scale_pixmap: Time the scaling of pixmaps with 1, 2 and 4
+	components and compare the vectorized scaler against the scalar
+	reference version (if the CPU supports SSE2).
+
+	results: Receives for each case the number of components, the
+	method ("sse2" or "box" for integer factor downscales), the source
+	and destination sizes, the time taken by the reference and the
+	method for scaling iterations times and the number of bytes for
+	which the vectorized results differ from the scalar ones (which
+	should always be 0). The timing reference for "box" is the
+	(vectorized) filter used otherwise, its results are compared
+	against the scalar box filter.
+
+	Returns the number of results written.
+*/
+typedef struct fz_scale_bench_s fz_scale_bench;
+
+struct fz_scale_bench_s
+{
+	int n;
+	const char *method;
+	int src_w, src_h;
+	int dst_w, dst_h;
+	double reference_ms;
+	double method_ms;
+	int mismatches;
+};
+
+int fz_bench_scale_pixmap(fz_context *ctx, fz_scale_bench *results, int max_results, int iterations);
+
 void fz_subsample_pixmap(fz_context *ctx, fz_pixmap *tile, int factor);
 
 fz_irect *fz_pixmap_bbox_no_ctx(fz_pixmap *src, fz_irect *bbox);
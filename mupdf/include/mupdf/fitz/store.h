@@ -105,6 +105,12 @@ struct fz_store_type_s
 */
 void fz_new_store_context(fz_context *ctx, unsigned int max);
 
+/*
+	fz_store_max: The maximum size (in bytes) that the store is
+	allowed to grow to (FZ_STORE_UNLIMITED means no limit).
+*/
+unsigned int fz_store_max(fz_context *ctx);
+
 /*
 	fz_drop_store_context: Drop a reference to the store.
 */
@@ -153,7 +153,9 @@ fz_buffer *fz_read_file(fz_context *ctx, const char *filename);
 enum
 {
 	FZ_STREAM_META_PROGRESSIVE = 1,
-	FZ_STREAM_META_LENGTH = 2
+	FZ_STREAM_META_LENGTH = 2,
+	/* SumatraPDF: progressive stream which never has to wait for data */
+	FZ_STREAM_META_DATA_AVAILABLE = 3
 };
 
 int fz_stream_meta(fz_stream *stm, int key, int size, void *ptr);
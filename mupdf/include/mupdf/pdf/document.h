@@ -232,6 +232,8 @@ struct pdf_document_s
 	/* The state for the pdf_progressive_advance parser */
 	int linear_pos;
 	int linear_page_num;
+	/* SumatraPDF: read the main xref on demand instead of throwing FZ_ERROR_TRYLATER */
+	int linear_data_available;
 
 	int hint_object_offset;
 	int hint_object_length;
@@ -289,7 +291,9 @@ struct pdf_document_s
 	fz_font **type3_fonts;
 
 	/* cf. http://bugs.ghostscript.com/show_bug.cgi?id=695761 */
+	/* SumatraPDF: only collected once a page's /Parent chain turns out to be broken */
 	pdf_obj **page_objs;
+	int page_objs_len;
 };
 
 /*
@@ -3,6 +3,7 @@
 
 int pdf_lookup_page_number(pdf_document *doc, pdf_obj *pageobj);
 int pdf_count_pages(pdf_document *doc);
+void pdf_drop_page_objs(pdf_document *doc);
 pdf_obj *pdf_lookup_page_obj(pdf_document *doc, int needle);
 /* SumatraPDF: make pdf_lookup_inherited_page_item externally available */
 pdf_obj *pdf_lookup_inherited_page_item(pdf_document *doc, pdf_obj *node, const char *key);
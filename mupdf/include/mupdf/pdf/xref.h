@@ -107,6 +107,9 @@ void pdf_clear_xref_to_mark(pdf_document *doc);
 int pdf_repair_obj(pdf_document *doc, pdf_lexbuf *buf, int *stmofsp, int *stmlenp, pdf_obj **encrypt, pdf_obj **id, pdf_obj **page, int *tmpofs);
 
 pdf_obj *pdf_progressive_advance(pdf_document *doc, int pagenum);
+/* SumatraPDF: find pages of linearized files without reading the main xref */
+pdf_obj *pdf_lookup_linear_page_obj(pdf_document *doc, int pagenum);
+void pdf_load_linear_xref(pdf_document *doc);
 
 void pdf_print_xref(pdf_document *);
 
@@ -1088,6 +1088,47 @@ fz_transform_pixmap(fz_draw_device *dev, fz_pixmap *image, fz_matrix *ctm, int x
 	return NULL;
 }
 
+/* Decodes only the part of image that is visible within clip (adjusting
+ * ctm, dx and dy to that part) and returns NULL if no part is visible.
+ * A part is placed relative to the grid fitted matrix of the whole image
+ * (if *gridfit is set), so that the parts decoded for neighbouring clips
+ * line up; *gridfit is then cleared, as the part mustn't be fitted again */
+static fz_pixmap *
+fz_draw_get_image_pixmap(fz_context *ctx, fz_image *image, fz_matrix *ctm, const fz_irect *clip, int *dx, int *dy, int *gridfit)
+{
+	fz_matrix inverse, whole, part;
+	fz_rect rect;
+	fz_irect area;
+	fz_pixmap *pixmap;
+
+	if (fz_try_invert_matrix(&inverse, ctm))
+		return fz_new_pixmap_from_image(ctx, image, *dx, *dy);
+
+	/* grid fitting may extend the image by up to a pixel */
+	fz_rect_from_irect(&rect, clip);
+	fz_transform_rect(fz_expand_rect(&rect, 1), &inverse);
+	area.x0 = floorf(fz_clamp(rect.x0, 0, 1) * image->w);
+	area.y0 = floorf(fz_clamp(rect.y0, 0, 1) * image->h);
+	area.x1 = ceilf(fz_clamp(rect.x1, 0, 1) * image->w);
+	area.y1 = ceilf(fz_clamp(rect.y1, 0, 1) * image->h);
+	if (fz_is_empty_irect(&area))
+		return NULL;
+
+	whole = *ctm;
+	if (*gridfit)
+		fz_gridfit_matrix(&whole);
+	part = whole;
+	pixmap = fz_new_pixmap_from_image_area(ctx, image, &area, *dx, *dy, &part);
+	if (memcmp(&part, &whole, sizeof(fz_matrix)) != 0)
+	{
+		*ctm = part;
+		*gridfit = 0;
+	}
+	*dx = sqrtf(ctm->a * ctm->a + ctm->b * ctm->b);
+	*dy = sqrtf(ctm->c * ctm->c + ctm->d * ctm->d);
+	return pixmap;
+}
+
 static void
 fz_draw_fill_image(fz_device *devp, fz_image *image, const fz_matrix *ctm, float alpha)
 {
@@ -1098,6 +1139,7 @@ fz_draw_fill_image(fz_device *devp, fz_image *image, const fz_matrix *ctm, float
 	fz_pixmap *orig_pixmap;
 	int after;
 	int dx, dy;
+	int gridfit = alpha == 1.0f && !(dev->flags & FZ_DRAWDEV_FLAGS_TYPE3);
 	fz_context *ctx = dev->ctx;
 	fz_draw_state *state = &dev->stack[dev->top];
 	fz_colorspace *model = state->dest->colorspace;
@@ -1120,7 +1162,9 @@ fz_draw_fill_image(fz_device *devp, fz_image *image, const fz_matrix *ctm, float
 	dx = sqrtf(local_ctm.a * local_ctm.a + local_ctm.b * local_ctm.b);
 	dy = sqrtf(local_ctm.c * local_ctm.c + local_ctm.d * local_ctm.d);
 
-	pixmap = fz_new_pixmap_from_image(ctx, image, dx, dy);
+	pixmap = fz_draw_get_image_pixmap(ctx, image, &local_ctm, &clip, &dx, &dy, &gridfit);
+	if (!pixmap)
+		return;
 	orig_pixmap = pixmap;
 
 	/* convert images with more components (cmyk->rgb) before scaling */
@@ -1147,7 +1191,6 @@ fz_draw_fill_image(fz_device *devp, fz_image *image, const fz_matrix *ctm, float
 
 		if (dx < pixmap->w && dy < pixmap->h && !(devp->hints & FZ_DONT_INTERPOLATE_IMAGES))
 		{
-			int gridfit = alpha == 1.0f && !(dev->flags & FZ_DRAWDEV_FLAGS_TYPE3);
 			scaled = fz_transform_pixmap(dev, pixmap, &local_ctm, state->dest->x, state->dest->y, dx, dy, gridfit, &clip);
 			if (!scaled)
 			{
@@ -1207,6 +1250,7 @@ fz_draw_fill_image_mask(fz_device *devp, fz_image *image, const fz_matrix *ctm,
 	fz_pixmap *orig_pixmap;
 	int dx, dy;
 	int i;
+	int gridfit = alpha == 1.0f && !(dev->flags & FZ_DRAWDEV_FLAGS_TYPE3);
 	fz_context *ctx = dev->ctx;
 	fz_draw_state *state = &dev->stack[dev->top];
 	fz_colorspace *model = state->dest->colorspace;
@@ -1221,7 +1265,9 @@ fz_draw_fill_image_mask(fz_device *devp, fz_image *image, const fz_matrix *ctm,
 
 	dx = sqrtf(local_ctm.a * local_ctm.a + local_ctm.b * local_ctm.b);
 	dy = sqrtf(local_ctm.c * local_ctm.c + local_ctm.d * local_ctm.d);
-	pixmap = fz_new_pixmap_from_image(ctx, image, dx, dy);
+	pixmap = fz_draw_get_image_pixmap(ctx, image, &local_ctm, &clip, &dx, &dy, &gridfit);
+	if (!pixmap)
+		return;
 	orig_pixmap = pixmap;
 
 	fz_try(ctx)
@@ -1231,7 +1277,6 @@ fz_draw_fill_image_mask(fz_device *devp, fz_image *image, const fz_matrix *ctm,
 
 		if (dx < pixmap->w && dy < pixmap->h)
 		{
-			int gridfit = alpha == 1.0f && !(dev->flags & FZ_DRAWDEV_FLAGS_TYPE3);
 			scaled = fz_transform_pixmap(dev, pixmap, &local_ctm, state->dest->x, state->dest->y, dx, dy, gridfit, &clip);
 			if (!scaled)
 			{
@@ -1281,6 +1326,7 @@ fz_draw_clip_image_mask(fz_device *devp, fz_image *image, const fz_rect *rect, c
 	fz_pixmap *pixmap = NULL;
 	fz_pixmap *orig_pixmap = NULL;
 	int dx, dy;
+	int gridfit = !(dev->flags & FZ_DRAWDEV_FLAGS_TYPE3);
 	fz_draw_state *state = push_stack(dev);
 	fz_colorspace *model = state->dest->colorspace;
 	fz_irect clip;
@@ -1325,7 +1371,14 @@ fz_draw_clip_image_mask(fz_device *devp, fz_image *image, const fz_rect *rect, c
 
 	fz_try(ctx)
 	{
-		pixmap = fz_new_pixmap_from_image(ctx, image, dx, dy);
+		pixmap = fz_draw_get_image_pixmap(ctx, image, &local_ctm, &clip, &dx, &dy, &gridfit);
+		if (!pixmap)
+		{
+			/* no part of the image mask is visible */
+			state[1].scissor = fz_empty_irect;
+			state[1].mask = NULL;
+			break;
+		}
 		orig_pixmap = pixmap;
 
 		state[1].mask = mask = fz_new_pixmap_with_bbox(dev->ctx, NULL, &bbox);
@@ -1344,7 +1397,6 @@ fz_draw_clip_image_mask(fz_device *devp, fz_image *image, const fz_rect *rect, c
 
 		if (dx < pixmap->w && dy < pixmap->h)
 		{
-			int gridfit = !(dev->flags & FZ_DRAWDEV_FLAGS_TYPE3);
 			scaled = fz_transform_pixmap(dev, pixmap, &local_ctm, state->dest->x, state->dest->y, dx, dy, gridfit, &clip);
 			if (!scaled)
 			{
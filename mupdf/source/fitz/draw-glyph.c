@@ -2,8 +2,9 @@
 #include "draw-imp.h"
 
 #define MAX_GLYPH_SIZE 256
-#define MAX_CACHE_SIZE (1024*1024)
+#define MAX_CACHE_SIZE (4*1024*1024)
 
+/* initial size of the hash table, it grows as needed */
 #define GLYPH_HASH_LEN 509
 
 typedef struct fz_glyph_cache_entry_s fz_glyph_cache_entry;
@@ -22,11 +23,8 @@ struct fz_glyph_key_s
 struct fz_glyph_cache_entry_s
 {
 	fz_glyph_key key;
-	unsigned hash;
 	fz_glyph_cache_entry *lru_prev;
 	fz_glyph_cache_entry *lru_next;
-	fz_glyph_cache_entry *bucket_next;
-	fz_glyph_cache_entry *bucket_prev;
 	fz_glyph *val;
 };
 
@@ -34,11 +32,13 @@ struct fz_glyph_cache_s
 {
 	int refs;
 	int total;
-#ifndef NDEBUG
+	int max_size;
+	int count;
+	int hits;
+	int misses;
 	int num_evictions;
 	int evicted;
-#endif
-	fz_glyph_cache_entry *entry[GLYPH_HASH_LEN];
+	fz_hash_table *hash;
 	fz_glyph_cache_entry *lru_head;
 	fz_glyph_cache_entry *lru_tail;
 };
@@ -49,7 +49,17 @@ fz_new_glyph_cache_context(fz_context *ctx)
 	fz_glyph_cache *cache;
 
 	cache = fz_malloc_struct(ctx, fz_glyph_cache);
+	fz_try(ctx)
+	{
+		cache->hash = fz_new_hash_table(ctx, GLYPH_HASH_LEN, sizeof(fz_glyph_key), FZ_LOCK_GLYPHCACHE);
+	}
+	fz_catch(ctx)
+	{
+		fz_free(ctx, cache);
+		fz_rethrow(ctx);
+	}
 	cache->total = 0;
+	cache->max_size = MAX_CACHE_SIZE;
 	cache->refs = 1;
 
 	ctx->glyph_cache = cache;
@@ -69,12 +79,8 @@ drop_glyph_cache_entry(fz_context *ctx, fz_glyph_cache_entry *entry)
 	else
 		cache->lru_head = entry->lru_next;
 	cache->total -= fz_glyph_size(ctx, entry->val);
-	if (entry->bucket_next)
-		entry->bucket_next->bucket_prev = entry->bucket_prev;
-	if (entry->bucket_prev)
-		entry->bucket_prev->bucket_next = entry->bucket_next;
-	else
-		cache->entry[entry->hash] = entry->bucket_next;
+	cache->count--;
+	fz_hash_remove(ctx, cache->hash, &entry->key);
 	fz_drop_font(ctx, entry->key.font);
 	fz_drop_glyph(ctx, entry->val);
 	fz_free(ctx, entry);
@@ -82,16 +88,27 @@ drop_glyph_cache_entry(fz_context *ctx, fz_glyph_cache_entry *entry)
 
 /* The glyph cache lock is always held when this function is called. */
 static void
-do_purge(fz_context *ctx)
+evict_to_size(fz_context *ctx, int size)
 {
 	fz_glyph_cache *cache = ctx->glyph_cache;
-	int i;
 
-	for (i = 0; i < GLYPH_HASH_LEN; i++)
+	/* Glyphs are evicted least recently used first */
+	while (cache->total > size && cache->lru_tail)
 	{
-		while (cache->entry[i])
-			drop_glyph_cache_entry(ctx, cache->entry[i]);
+		cache->num_evictions++;
+		cache->evicted += fz_glyph_size(ctx, cache->lru_tail->val);
+		drop_glyph_cache_entry(ctx, cache->lru_tail);
 	}
+}
+
+/* The glyph cache lock is always held when this function is called. */
+static void
+do_purge(fz_context *ctx)
+{
+	fz_glyph_cache *cache = ctx->glyph_cache;
+
+	while (cache->lru_head)
+		drop_glyph_cache_entry(ctx, cache->lru_head);
 
 	cache->total = 0;
 }
@@ -115,6 +132,7 @@ fz_drop_glyph_cache_context(fz_context *ctx)
 	if (ctx->glyph_cache->refs == 0)
 	{
 		do_purge(ctx);
+		fz_free_hash(ctx, ctx->glyph_cache->hash);
 		fz_free(ctx, ctx->glyph_cache);
 		ctx->glyph_cache = NULL;
 	}
@@ -130,6 +148,35 @@ fz_keep_glyph_cache(fz_context *ctx)
 	return ctx->glyph_cache;
 }
 
+void
+fz_set_glyph_cache_size(fz_context *ctx, unsigned int max_size)
+{
+	fz_glyph_cache *cache = ctx->glyph_cache;
+
+	if (max_size > INT_MAX)
+		max_size = INT_MAX;
+	fz_lock(ctx, FZ_LOCK_GLYPHCACHE);
+	cache->max_size = max_size;
+	evict_to_size(ctx, cache->max_size);
+	fz_unlock(ctx, FZ_LOCK_GLYPHCACHE);
+}
+
+void
+fz_get_glyph_cache_stats(fz_context *ctx, fz_glyph_cache_stats *stats)
+{
+	fz_glyph_cache *cache = ctx->glyph_cache;
+
+	fz_lock(ctx, FZ_LOCK_GLYPHCACHE);
+	stats->size = cache->total;
+	stats->max_size = cache->max_size;
+	stats->count = cache->count;
+	stats->hits = cache->hits;
+	stats->misses = cache->misses;
+	stats->evictions = cache->num_evictions;
+	stats->evicted = cache->evicted;
+	fz_unlock(ctx, FZ_LOCK_GLYPHCACHE);
+}
+
 float
 fz_subpixel_adjust(fz_matrix *ctm, fz_matrix *subpix_ctm, unsigned char *qe, unsigned char *qf)
 {
@@ -204,22 +251,6 @@ fz_render_stroked_glyph_pixmap(fz_context *ctx, fz_font *font, int gid, fz_matri
 	return fz_render_glyph_pixmap(ctx, font, gid, trm, NULL, scissor);
 }
 
-static unsigned do_hash(unsigned char *s, int len)
-{
-	unsigned val = 0;
-	int i;
-	for (i = 0; i < len; i++)
-	{
-		val += s[i];
-		val += (val << 10);
-		val ^= (val >> 6);
-	}
-	val += (val << 3);
-	val ^= (val >> 11);
-	val += (val << 15);
-	return val;
-}
-
 static inline void
 move_to_front(fz_glyph_cache *cache, fz_glyph_cache_entry *entry)
 {
@@ -251,7 +282,6 @@ fz_render_glyph(fz_context *ctx, fz_font *font, int gid, fz_matrix *ctm, fz_colo
 	fz_glyph *val;
 	int do_cache, locked, caching;
 	fz_glyph_cache_entry *entry;
-	unsigned hash;
 
 	fz_var(locked);
 	fz_var(caching);
@@ -288,19 +318,17 @@ fz_render_glyph(fz_context *ctx, fz_font *font, int gid, fz_matrix *ctm, fz_colo
 	key.aa = fz_aa_level(ctx);
 
 	fz_lock(ctx, FZ_LOCK_GLYPHCACHE);
-	hash = do_hash((unsigned char *)&key, sizeof(key)) % GLYPH_HASH_LEN;
-	entry = cache->entry[hash];
-	while (entry)
+	entry = fz_hash_find(ctx, cache->hash, &key);
+	if (entry)
 	{
-		if (memcmp(&entry->key, &key, sizeof(key)) == 0)
-		{
-			move_to_front(cache, entry);
-			val = fz_keep_glyph(ctx, entry->val);
-			fz_unlock(ctx, FZ_LOCK_GLYPHCACHE);
-			return val;
-		}
-		entry = entry->bucket_next;
+		cache->hits++;
+		move_to_front(cache, entry);
+		val = fz_keep_glyph(ctx, entry->val);
+		fz_unlock(ctx, FZ_LOCK_GLYPHCACHE);
+		return val;
 	}
+	if (do_cache)
+		cache->misses++;
 
 	locked = 1;
 	caching = 0;
@@ -344,27 +372,27 @@ fz_render_glyph(fz_context *ctx, fz_font *font, int gid, fz_matrix *ctm, fz_colo
 				{
 					/* We had to unlock. Someone else might
 					 * have rendered in the meantime */
-					entry = cache->entry[hash];
-					while (entry)
+					entry = fz_hash_find(ctx, cache->hash, &key);
+					if (entry)
 					{
-						if (memcmp(&entry->key, &key, sizeof(key)) == 0)
-						{
-							fz_drop_glyph(ctx, val);
-							move_to_front(cache, entry);
-							val = fz_keep_glyph(ctx, entry->val);
-							goto unlock_and_return_val;
-						}
-						entry = entry->bucket_next;
+						fz_drop_glyph(ctx, val);
+						move_to_front(cache, entry);
+						val = fz_keep_glyph(ctx, entry->val);
+						goto unlock_and_return_val;
 					}
 				}
 
 				entry = fz_malloc_struct(ctx, fz_glyph_cache_entry);
 				entry->key = key;
-				entry->hash = hash;
-				entry->bucket_next = cache->entry[hash];
-				if (entry->bucket_next)
-					entry->bucket_next->bucket_prev = entry;
-				cache->entry[hash] = entry;
+				fz_try(ctx)
+				{
+					fz_hash_insert(ctx, cache->hash, &entry->key, entry);
+				}
+				fz_catch(ctx)
+				{
+					fz_free(ctx, entry);
+					fz_rethrow(ctx);
+				}
 				entry->val = fz_keep_glyph(ctx, val);
 				fz_keep_font(ctx, key.font);
 
@@ -376,15 +404,8 @@ fz_render_glyph(fz_context *ctx, fz_font *font, int gid, fz_matrix *ctm, fz_colo
 				cache->lru_head = entry;
 
 				cache->total += fz_glyph_size(ctx, val);
-				while (cache->total > MAX_CACHE_SIZE)
-				{
-#ifndef NDEBUG
-					cache->num_evictions++;
-					cache->evicted += fz_glyph_size(ctx, cache->lru_tail->val);
-#endif
-					drop_glyph_cache_entry(ctx, cache->lru_tail);
-				}
-
+				cache->count++;
+				evict_to_size(ctx, cache->max_size);
 			}
 		}
 unlock_and_return_val:
@@ -454,8 +475,7 @@ fz_dump_glyph_cache_stats(fz_context *ctx)
 {
 	fz_glyph_cache *cache = ctx->glyph_cache;
 
-	printf("Glyph Cache Size: %d\n", cache->total);
-#ifndef NDEBUG
+	printf("Glyph Cache Size: %d of %d (%d glyphs)\n", cache->total, cache->max_size, cache->count);
+	printf("Glyph Cache Hits: %d, Misses: %d\n", cache->hits, cache->misses);
 	printf("Glyph Cache Evictions: %d (%d bytes)\n", cache->num_evictions, cache->evicted);
-#endif
 }
@@ -46,4 +46,51 @@ void fz_blend_pixel(unsigned char dp[3], unsigned char bp[3], unsigned char sp[3
 
 void fz_paint_glyph(unsigned char *colorbv, fz_pixmap *dst, unsigned char *dp, fz_glyph *glyph, int w, int h, int skip_x, int skip_y);
 
+/*
+ * Span painters for the common cases n == 2 and n == 4, with vectorized
+ * versions (cf. draw-paint-simd.c) selected at runtime.
+ */
+
+enum { FZ_SIMD_NONE, FZ_SIMD_SSE2, FZ_SIMD_AVX2 };
+
+/* HAVE_SSE2/HAVE_AVX2 are defined when the compiler can generate code for
+ * these instruction sets, which may then only be run after checking for
+ * them with fz_detect_simd. Functions using intrinsics are declared with
+ * TARGET_SSE2 resp. TARGET_AVX2. */
+#if defined(_MSC_VER) && (defined(_M_IX86) || defined(_M_X64))
+#define HAVE_SSE2
+#if _MSC_VER >= 1700
+#define HAVE_AVX2
+#endif
+#define TARGET_SSE2
+#define TARGET_AVX2
+#elif (defined(__GNUC__) || defined(__clang__)) && (defined(__i386__) || defined(__x86_64__))
+#define HAVE_SSE2
+#define HAVE_AVX2
+#define TARGET_SSE2 __attribute__((target("sse2")))
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+
+typedef struct fz_span_painters_s fz_span_painters;
+
+struct fz_span_painters_s
+{
+	const char *name;
+	void (*solid_color_2)(unsigned char * restrict dp, int w, unsigned char *color);
+	void (*solid_color_4)(unsigned char * restrict dp, int w, unsigned char *color);
+	void (*span_with_color_2)(unsigned char * restrict dp, unsigned char * restrict mp, int w, unsigned char *color);
+	void (*span_with_color_4)(unsigned char * restrict dp, unsigned char * restrict mp, int w, unsigned char *color);
+	void (*span_with_mask_2)(unsigned char * restrict dp, unsigned char * restrict sp, unsigned char * restrict mp, int w);
+	void (*span_with_mask_4)(unsigned char * restrict dp, unsigned char * restrict sp, unsigned char * restrict mp, int w);
+	void (*span_2_with_alpha)(unsigned char * restrict dp, unsigned char * restrict sp, int w, int alpha);
+	void (*span_4_with_alpha)(unsigned char * restrict dp, unsigned char * restrict sp, int w, int alpha);
+};
+
+extern const fz_span_painters fz_span_painters_scalar;
+
+/* Returns the best FZ_SIMD_* instruction set supported by the CPU and OS */
+int fz_detect_simd(void);
+/* Returns the painters for the given FZ_SIMD_* level (NULL if not compiled in) */
+const fz_span_painters *fz_get_span_painters(int simd);
+
 #endif
@@ -73,6 +73,12 @@ and stick to using the premultiplied form.
 
 typedef unsigned char byte;
 
+/* Spans shorter than this are painted inline, as calling the vectorized
+ * painters through a function pointer wouldn't pay off */
+#define MIN_SIMD_SPAN 8
+
+static const fz_span_painters *get_span_painters(void);
+
 /* These are used by the non-aa scan converter */
 
 void
@@ -192,8 +198,18 @@ fz_paint_solid_color(byte * restrict dp, int n, int w, byte *color)
 {
 	switch (n)
 	{
-	case 2: fz_paint_solid_color_2(dp, w, color); break;
-	case 4: fz_paint_solid_color_4(dp, w, color); break;
+	case 2:
+		if (w >= MIN_SIMD_SPAN)
+			get_span_painters()->solid_color_2(dp, w, color);
+		else
+			fz_paint_solid_color_2(dp, w, color);
+		break;
+	case 4:
+		if (w >= MIN_SIMD_SPAN)
+			get_span_painters()->solid_color_4(dp, w, color);
+		else
+			fz_paint_solid_color_4(dp, w, color);
+		break;
 	default: fz_paint_solid_color_N(dp, n, w, color); break;
 	}
 }
@@ -362,8 +378,18 @@ fz_paint_span_with_color(byte * restrict dp, byte * restrict mp, int n, int w, b
 {
 	switch (n)
 	{
-	case 2: fz_paint_span_with_color_2(dp, mp, w, color); break;
-	case 4: fz_paint_span_with_color_4(dp, mp, w, color); break;
+	case 2:
+		if (w >= MIN_SIMD_SPAN)
+			get_span_painters()->span_with_color_2(dp, mp, w, color);
+		else
+			fz_paint_span_with_color_2(dp, mp, w, color);
+		break;
+	case 4:
+		if (w >= MIN_SIMD_SPAN)
+			get_span_painters()->span_with_color_4(dp, mp, w, color);
+		else
+			fz_paint_span_with_color_4(dp, mp, w, color);
+		break;
 	default: fz_paint_span_with_color_N(dp, mp, n, w, color); break;
 	}
 }
@@ -520,8 +546,18 @@ fz_paint_span_with_mask(byte * restrict dp, byte * restrict sp, byte * restrict
 {
 	switch (n)
 	{
-	case 2: fz_paint_span_with_mask_2(dp, sp, mp, w); break;
-	case 4: fz_paint_span_with_mask_4(dp, sp, mp, w); break;
+	case 2:
+		if (w >= MIN_SIMD_SPAN)
+			get_span_painters()->span_with_mask_2(dp, sp, mp, w);
+		else
+			fz_paint_span_with_mask_2(dp, sp, mp, w);
+		break;
+	case 4:
+		if (w >= MIN_SIMD_SPAN)
+			get_span_painters()->span_with_mask_4(dp, sp, mp, w);
+		else
+			fz_paint_span_with_mask_4(dp, sp, mp, w);
+		break;
 	default: fz_paint_span_with_mask_N(dp, sp, mp, n, w); break;
 	}
 }
@@ -702,13 +738,51 @@ fz_paint_span(byte * restrict dp, byte * restrict sp, int n, int w, int alpha)
 	{
 		switch (n)
 		{
-		case 2: fz_paint_span_2_with_alpha(dp, sp, w, alpha); break;
-		case 4: fz_paint_span_4_with_alpha(dp, sp, w, alpha); break;
+		case 2:
+			if (w >= MIN_SIMD_SPAN)
+				get_span_painters()->span_2_with_alpha(dp, sp, w, alpha);
+			else
+				fz_paint_span_2_with_alpha(dp, sp, w, alpha);
+			break;
+		case 4:
+			if (w >= MIN_SIMD_SPAN)
+				get_span_painters()->span_4_with_alpha(dp, sp, w, alpha);
+			else
+				fz_paint_span_4_with_alpha(dp, sp, w, alpha);
+			break;
 		default: fz_paint_span_N_with_alpha(dp, sp, n, w, alpha); break;
 		}
 	}
 }
 
+/*
+ * Selection of the span painters
+ */
+
+const fz_span_painters fz_span_painters_scalar =
+{
+	"scalar",
+	fz_paint_solid_color_2,
+	fz_paint_solid_color_4,
+	fz_paint_span_with_color_2,
+	fz_paint_span_with_color_4,
+	fz_paint_span_with_mask_2,
+	fz_paint_span_with_mask_4,
+	fz_paint_span_2_with_alpha,
+	fz_paint_span_4_with_alpha,
+};
+
+static const fz_span_painters *span_painters = NULL;
+
+static const fz_span_painters *
+get_span_painters(void)
+{
+	/* Racing threads all arrive at the same result, so no locking is needed */
+	if (!span_painters)
+		span_painters = fz_get_span_painters(fz_detect_simd());
+	return span_painters;
+}
+
 /*
  * Pixmap blending functions
  */
@@ -1171,6 +1245,12 @@ solid_run:
 					if (len > ww)
 						len = ww;
 					ww -= len;
+					if ((n == 2 || n == 4) && len >= MIN_SIMD_SPAN)
+					{
+						fz_paint_solid_color(ddp, n, len, colorbv);
+						ddp += len * n;
+						break;
+					}
 					do
 					{
 						int k = 0;
@@ -1190,6 +1270,14 @@ intermediate_run:
 					if (len > ww)
 						len = ww;
 					ww -= len;
+					/* the painters blend with a solid color the same way */
+					if ((n == 2 || n == 4) && len >= MIN_SIMD_SPAN)
+					{
+						fz_paint_span_with_color(ddp, runp, n, len, colorbv);
+						ddp += len * n;
+						runp += len;
+						break;
+					}
 					do
 					{
 						int k = 0;
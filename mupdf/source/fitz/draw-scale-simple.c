@@ -13,6 +13,11 @@ intermediate results rather than ints.
 #include "mupdf/fitz.h"
 #include "draw-imp.h"
 
+#include <time.h>
+#ifdef HAVE_SSE2
+#include <emmintrin.h>
+#endif
+
 /* Do we special case handling of single pixel high/wide images? The
  * 'purest' handling is given by not special casing them, but certain
  * files that use such images 'stack' them to give full images. Not
@@ -1059,6 +1064,390 @@ scale_row_from_temp(unsigned char *dst, unsigned char *src, fz_weights *weights,
 }
 #endif
 
+#ifdef HAVE_SSE2
+
+/*
+SSE2 versions of the row scalers above for the common cases. Samples are
+zero extended to 16 bits and multiplied with pairs of weights using
+_mm_madd_epi16, which requires all weights to fit into 16 bits (see
+weights_fit_16bit). The sums are 32 bits wide just as in the scalar
+versions, so that the results are bit-exact, including the truncation
+of (val>>8) to a byte.
+*/
+
+static int
+weights_fit_16bit(fz_weights *weights)
+{
+	int *contrib;
+	int i, j, len;
+
+	for (i = 0; i < weights->count; i++)
+	{
+		contrib = &weights->index[weights->index[i]];
+		len = contrib[1];
+		for (j = 0; j < len; j++)
+		{
+			if (contrib[2+j] < -32768 || contrib[2+j] > 32767)
+				return 0;
+		}
+	}
+	return 1;
+}
+
+static inline int
+load_int(const unsigned char *p)
+{
+	int v;
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+/* Returns the 16 bit weight pair (contrib[0], contrib[1]) in all 32 bit lanes */
+static inline TARGET_SSE2 __m128i
+weight_pair_sse2(const int *contrib)
+{
+	__m128i w = _mm_packs_epi32(_mm_loadl_epi64((const __m128i *)contrib), _mm_setzero_si128());
+	return _mm_shuffle_epi32(w, _MM_SHUFFLE(0, 0, 0, 0));
+}
+
+/* Converts sums (including the rounding 128) to bytes as (unsigned char)(val>>8) */
+static inline TARGET_SSE2 __m128i
+pack_sums_sse2(__m128i v0, __m128i v1, __m128i v2, __m128i v3)
+{
+	__m128i mask = _mm_set1_epi32(0xFF);
+	v0 = _mm_and_si128(_mm_srai_epi32(v0, 8), mask);
+	v1 = _mm_and_si128(_mm_srai_epi32(v1, 8), mask);
+	v2 = _mm_and_si128(_mm_srai_epi32(v2, 8), mask);
+	v3 = _mm_and_si128(_mm_srai_epi32(v3, 8), mask);
+	return _mm_packus_epi16(_mm_packs_epi32(v0, v1), _mm_packs_epi32(v2, v3));
+}
+
+static TARGET_SSE2 void
+scale_row_to_temp1_sse2(unsigned char *dst, unsigned char *src, fz_weights *weights)
+{
+	int *contrib = &weights->index[weights->index[0]];
+	__m128i zero = _mm_setzero_si128();
+	int len, i, val, step = 1;
+	unsigned char *min;
+
+	assert(weights->n == 1);
+	if (weights->flip)
+	{
+		dst += weights->count - 1;
+		step = -1;
+	}
+	for (i=weights->count; i > 0; i--)
+	{
+		__m128i acc = zero;
+		min = &src[*contrib++];
+		len = *contrib++;
+		for (; len >= 8; len -= 8)
+		{
+			__m128i s = _mm_unpacklo_epi8(_mm_loadl_epi64((__m128i *)min), zero);
+			__m128i w = _mm_packs_epi32(_mm_loadu_si128((__m128i *)contrib), _mm_loadu_si128((__m128i *)(contrib + 4)));
+			acc = _mm_add_epi32(acc, _mm_madd_epi16(s, w));
+			min += 8;
+			contrib += 8;
+		}
+		if (len >= 4)
+		{
+			__m128i s = _mm_unpacklo_epi8(_mm_cvtsi32_si128(load_int(min)), zero);
+			__m128i w = _mm_packs_epi32(_mm_loadu_si128((__m128i *)contrib), zero);
+			acc = _mm_add_epi32(acc, _mm_madd_epi16(s, w));
+			min += 4;
+			contrib += 4;
+			len -= 4;
+		}
+		acc = _mm_add_epi32(acc, _mm_srli_si128(acc, 8));
+		acc = _mm_add_epi32(acc, _mm_srli_si128(acc, 4));
+		val = 128 + _mm_cvtsi128_si32(acc);
+		while (len-- > 0)
+		{
+			val += *min++ * *contrib++;
+		}
+		*dst = (unsigned char)(val>>8);
+		dst += step;
+	}
+}
+
+static TARGET_SSE2 void
+scale_row_to_temp2_sse2(unsigned char *dst, unsigned char *src, fz_weights *weights)
+{
+	int *contrib = &weights->index[weights->index[0]];
+	__m128i zero = _mm_setzero_si128();
+	int len, i, c1, c2, step = 2;
+	unsigned char *min;
+
+	assert(weights->n == 2);
+	if (weights->flip)
+	{
+		dst += 2*(weights->count - 1);
+		step = -2;
+	}
+	for (i=weights->count; i > 0; i--)
+	{
+		__m128i acc = zero;
+		min = &src[2 * *contrib++];
+		len = *contrib++;
+		for (; len >= 4; len -= 4)
+		{
+			/* g0 a0 g1 a1 g2 a2 g3 a3 -> g0 g1 a0 a1 g2 g3 a2 a3 */
+			__m128i s = _mm_unpacklo_epi8(_mm_loadl_epi64((__m128i *)min), zero);
+			__m128i w = _mm_packs_epi32(_mm_loadu_si128((__m128i *)contrib), zero);
+			s = _mm_shufflelo_epi16(s, _MM_SHUFFLE(3, 1, 2, 0));
+			s = _mm_shufflehi_epi16(s, _MM_SHUFFLE(3, 1, 2, 0));
+			/* w0 w1 w2 w3 -> w0 w1 w0 w1 w2 w3 w2 w3 */
+			w = _mm_unpacklo_epi32(w, w);
+			acc = _mm_add_epi32(acc, _mm_madd_epi16(s, w));
+			min += 8;
+			contrib += 4;
+		}
+		acc = _mm_add_epi32(acc, _mm_srli_si128(acc, 8));
+		c1 = 128 + _mm_cvtsi128_si32(acc);
+		c2 = 128 + _mm_cvtsi128_si32(_mm_srli_si128(acc, 4));
+		while (len-- > 0)
+		{
+			c1 += *min++ * *contrib;
+			c2 += *min++ * *contrib++;
+		}
+		dst[0] = (unsigned char)(c1>>8);
+		dst[1] = (unsigned char)(c2>>8);
+		dst += step;
+	}
+}
+
+static TARGET_SSE2 void
+scale_row_to_temp4_sse2(unsigned char *dst, unsigned char *src, fz_weights *weights)
+{
+	int *contrib = &weights->index[weights->index[0]];
+	__m128i zero = _mm_setzero_si128();
+	__m128i round = _mm_set1_epi32(128);
+	int len, i, val, step = 4;
+	unsigned char *min;
+
+	assert(weights->n == 4);
+	if (weights->flip)
+	{
+		dst += 4*(weights->count - 1);
+		step = -4;
+	}
+	for (i=weights->count; i > 0; i--)
+	{
+		__m128i acc = round;
+		min = &src[4 * *contrib++];
+		len = *contrib++;
+		for (; len >= 4; len -= 4)
+		{
+			__m128i p = _mm_loadu_si128((__m128i *)min);
+			__m128i w = _mm_packs_epi32(_mm_loadu_si128((__m128i *)contrib), zero);
+			__m128i lo = _mm_unpacklo_epi8(p, zero);
+			__m128i hi = _mm_unpackhi_epi8(p, zero);
+			/* r0 g0 b0 a0 r1 g1 b1 a1 -> r0 r1 g0 g1 b0 b1 a0 a1 */
+			lo = _mm_unpacklo_epi16(lo, _mm_srli_si128(lo, 8));
+			hi = _mm_unpacklo_epi16(hi, _mm_srli_si128(hi, 8));
+			acc = _mm_add_epi32(acc, _mm_madd_epi16(lo, _mm_shuffle_epi32(w, _MM_SHUFFLE(0, 0, 0, 0))));
+			acc = _mm_add_epi32(acc, _mm_madd_epi16(hi, _mm_shuffle_epi32(w, _MM_SHUFFLE(1, 1, 1, 1))));
+			min += 16;
+			contrib += 4;
+		}
+		if (len >= 2)
+		{
+			__m128i lo = _mm_unpacklo_epi8(_mm_loadl_epi64((__m128i *)min), zero);
+			lo = _mm_unpacklo_epi16(lo, _mm_srli_si128(lo, 8));
+			acc = _mm_add_epi32(acc, _mm_madd_epi16(lo, weight_pair_sse2(contrib)));
+			min += 8;
+			contrib += 2;
+			len -= 2;
+		}
+		if (len > 0)
+		{
+			__m128i lo = _mm_unpacklo_epi8(_mm_cvtsi32_si128(load_int(min)), zero);
+			lo = _mm_unpacklo_epi16(lo, zero);
+			acc = _mm_add_epi32(acc, _mm_madd_epi16(lo, _mm_set1_epi32(*contrib & 0xFFFF)));
+			contrib++;
+		}
+		val = _mm_cvtsi128_si32(pack_sums_sse2(acc, zero, zero, zero));
+		memcpy(dst, &val, 4);
+		dst += step;
+	}
+}
+
+static TARGET_SSE2 void
+scale_row_from_temp_sse2(unsigned char *dst, unsigned char *src, fz_weights *weights, int width, int row)
+{
+	int *contrib = &weights->index[weights->index[row]];
+	__m128i zero = _mm_setzero_si128();
+	__m128i round = _mm_set1_epi32(128);
+	int len, x, i;
+
+	contrib++; /* Skip min */
+	len = *contrib++;
+	for (x = 0; x + 16 <= width; x += 16)
+	{
+		__m128i acc0 = round;
+		__m128i acc1 = round;
+		__m128i acc2 = round;
+		__m128i acc3 = round;
+		unsigned char *min = src + x;
+
+		/* Interleave two rows at a time, so that each _mm_madd_epi16
+		 * applies a pair of weights */
+		for (i = 0; i < len; i += 2)
+		{
+			__m128i a = _mm_loadu_si128((__m128i *)min);
+			__m128i b, w, lo, hi;
+			if (i + 1 < len)
+			{
+				b = _mm_loadu_si128((__m128i *)(min + width));
+				w = weight_pair_sse2(&contrib[i]);
+			}
+			else
+			{
+				b = zero;
+				w = _mm_set1_epi32(contrib[i] & 0xFFFF);
+			}
+			lo = _mm_unpacklo_epi8(a, b);
+			hi = _mm_unpackhi_epi8(a, b);
+			acc0 = _mm_add_epi32(acc0, _mm_madd_epi16(_mm_unpacklo_epi8(lo, zero), w));
+			acc1 = _mm_add_epi32(acc1, _mm_madd_epi16(_mm_unpackhi_epi8(lo, zero), w));
+			acc2 = _mm_add_epi32(acc2, _mm_madd_epi16(_mm_unpacklo_epi8(hi, zero), w));
+			acc3 = _mm_add_epi32(acc3, _mm_madd_epi16(_mm_unpackhi_epi8(hi, zero), w));
+			min += 2 * width;
+		}
+		_mm_storeu_si128((__m128i *)(dst + x), pack_sums_sse2(acc0, acc1, acc2, acc3));
+	}
+	for (; x < width; x++)
+	{
+		unsigned char *min = src + x;
+		int val = 128;
+
+		for (i = 0; i < len; i++)
+		{
+			val += *min * contrib[i];
+			min += width;
+		}
+		dst[x] = (unsigned char)(val>>8);
+	}
+}
+
+/* sums[k] += s[k] for k < len, for the box filter below */
+static TARGET_SSE2 void
+add_row_sse2(int *sums, const unsigned char *s, int len)
+{
+	__m128i zero = _mm_setzero_si128();
+	int k;
+
+	for (k = 0; k + 16 <= len; k += 16)
+	{
+		__m128i p = _mm_loadu_si128((const __m128i *)(s + k));
+		__m128i lo = _mm_unpacklo_epi8(p, zero);
+		__m128i hi = _mm_unpackhi_epi8(p, zero);
+		__m128i *d = (__m128i *)(sums + k);
+		_mm_storeu_si128(d, _mm_add_epi32(_mm_loadu_si128(d), _mm_unpacklo_epi16(lo, zero)));
+		_mm_storeu_si128(d + 1, _mm_add_epi32(_mm_loadu_si128(d + 1), _mm_unpackhi_epi16(lo, zero)));
+		_mm_storeu_si128(d + 2, _mm_add_epi32(_mm_loadu_si128(d + 2), _mm_unpacklo_epi16(hi, zero)));
+		_mm_storeu_si128(d + 3, _mm_add_epi32(_mm_loadu_si128(d + 3), _mm_unpackhi_epi16(hi, zero)));
+	}
+	for (; k < len; k++)
+		sums[k] += s[k];
+}
+
+/* Averages blocks of fx pixels (for n == 4) from sums, dividing exactly
+ * through multiplying with recip (see scale_pixmap_box) */
+static TARGET_SSE2 void
+average_blocks4_sse2(unsigned char *d, const int *sums, int w, int fx, int area, int flip_x, unsigned int recip)
+{
+	__m128i half = _mm_set1_epi32(area / 2);
+	__m128i r = _mm_set1_epi32((int)recip);
+	__m128i odd = _mm_set_epi32(-1, 0, -1, 0);
+	int x, i, val;
+
+	for (x = 0; x < w; x++)
+	{
+		const int *sum = &sums[(flip_x ? w - 1 - x : x) * fx * 4];
+		__m128i v = half;
+		__m128i even;
+		for (i = 0; i < fx; i++)
+			v = _mm_add_epi32(v, _mm_loadu_si128((const __m128i *)(sum + 4 * i)));
+		/* (v * recip) >> 32 for lanes 0 and 2 resp. 1 and 3 */
+		even = _mm_srli_epi64(_mm_mul_epu32(v, r), 32);
+		v = _mm_and_si128(_mm_mul_epu32(_mm_srli_epi64(v, 32), r), odd);
+		v = _mm_or_si128(even, v);
+		v = _mm_packs_epi32(v, v);
+		val = _mm_cvtsi128_si32(_mm_packus_epi16(v, v));
+		memcpy(d, &val, 4);
+		d += 4;
+	}
+}
+
+#endif /* HAVE_SSE2 */
+
+/*
+Downscaling by integer factors fx and fy (e.g. for grid fitted images)
+averages blocks of fx*fy source pixels instead of applying the filter
+(as fz_subsample_pixmap does for the power of 2 factors used when
+decoding images). This only needs a single pass over the source with
+one addition per sample and is considerably faster for large factors.
+
+sums must hold dst->w * fx * dst->n ints. patch and the flip flags are
+the ones otherwise passed to make_weights for the columns resp. rows,
+so that the blocks patch->x0 to patch->x1 of each row are used.
+*/
+static void
+scale_pixmap_box(fz_pixmap *dst, fz_pixmap *src, int *sums, int fx, int fy, const fz_rect *patch, int flip_x, int flip_y, int simd)
+{
+	int n = src->n;
+	int area = fx * fy;
+	int span = dst->w * fx * n;
+	int x, y, i, j, k, v;
+	unsigned char *d = dst->samples;
+	/* v / area == (v * recip) >> 32 for all 0 <= v <= 256 * area as long
+	 * as area < 4096 (larger areas fall back to dividing) */
+	uint64_t recip = area < 4096 ? ((uint64_t)1 << 32) / area + 1 : 0;
+
+	for (y = 0; y < dst->h; y++)
+	{
+		j = (int)patch->y0 + y;
+		if (flip_y)
+			j = src->h / fy - 1 - j;
+		/* Sum up the columns of fy rows... */
+		memset(sums, 0, span * sizeof(int));
+		for (i = 0; i < fy; i++)
+		{
+			unsigned char *s = &src->samples[((j * fy + i) * src->w + (int)patch->x0 * fx) * n];
+#ifdef HAVE_SSE2
+			if (simd != FZ_SIMD_NONE)
+			{
+				add_row_sse2(sums, s, span);
+				continue;
+			}
+#endif
+			for (k = 0; k < span; k++)
+				sums[k] += s[k];
+		}
+		/* ...and then fx columns at a time */
+#ifdef HAVE_SSE2
+		if (simd != FZ_SIMD_NONE && n == 4 && recip)
+		{
+			average_blocks4_sse2(d, sums, dst->w, fx, area, flip_x, (unsigned int)recip);
+			d += dst->w * 4;
+			continue;
+		}
+#endif
+		for (x = 0; x < dst->w; x++)
+		{
+			int *sum = &sums[(flip_x ? dst->w - 1 - x : x) * fx * n];
+			for (k = 0; k < n; k++)
+			{
+				v = area / 2;
+				for (i = 0; i < fx; i++)
+					v += sum[i * n + k];
+				*d++ = (unsigned char)(recip ? (v * recip) >> 32 : v / area);
+			}
+		}
+	}
+}
+
 #ifdef SINGLE_PIXEL_SPECIALS
 static void
 duplicate_single_pixel(unsigned char *dst, unsigned char *src, int n, int w, int h)
@@ -1206,14 +1595,10 @@ scale_single_col(unsigned char *dst, unsigned char *src, fz_weights *weights, in
 }
 #endif /* SINGLE_PIXEL_SPECIALS */
 
-fz_pixmap *
-fz_scale_pixmap(fz_context *ctx, fz_pixmap *src, float x, float y, float w, float h, fz_irect *clip)
-{
-	return fz_scale_pixmap_cached(ctx, src, x, y, w, h, clip, NULL, NULL);
-}
-
-fz_pixmap *
-fz_scale_pixmap_cached(fz_context *ctx, fz_pixmap *src, float x, float y, float w, float h, const fz_irect *clip, fz_scale_cache *cache_x, fz_scale_cache *cache_y)
+/* simd is the FZ_SIMD_* level to use for the row scalers, allow_box enables
+ * the box filter for integer factor downscales (cf. scale_pixmap_box) */
+static fz_pixmap *
+scale_pixmap(fz_context *ctx, fz_pixmap *src, float x, float y, float w, float h, const fz_irect *clip, fz_scale_cache *cache_x, fz_scale_cache *cache_y, int simd, int allow_box)
 {
 	fz_scale_filter *filter = &fz_scale_filter_simple;
 	fz_weights *contrib_rows = NULL;
@@ -1376,6 +1761,34 @@ fz_scale_pixmap_cached(fz_context *ctx, fz_pixmap *src, float x, float y, float
 	if (patch.x0 >= patch.x1 || patch.y0 >= patch.y1)
 		return NULL;
 
+	/* Integer factor downscales without sub pixel offsets use a box filter */
+	if (allow_box && x == 0 && y == 0 && w == (float)dst_w_int && h == (float)dst_h_int &&
+		src->w % dst_w_int == 0 && src->h % dst_h_int == 0 &&
+		(src->w > dst_w_int || src->h > dst_h_int))
+	{
+		int box_x = src->w / dst_w_int;
+		int box_y = src->h / dst_h_int;
+		int *sums = NULL;
+
+		fz_var(output);
+
+		fz_try(ctx)
+		{
+			output = fz_new_pixmap(ctx, src->colorspace, patch.x1 - patch.x0, patch.y1 - patch.y0);
+			sums = fz_malloc_array(ctx, output->w * box_x * output->n, sizeof(int));
+		}
+		fz_catch(ctx)
+		{
+			fz_drop_pixmap(ctx, output);
+			fz_rethrow(ctx);
+		}
+		output->x = dst_x_int;
+		output->y = dst_y_int;
+		scale_pixmap_box(output, src, sums, box_x, box_y, &patch, flip_x, flip_y, simd);
+		fz_free(ctx, sums);
+		return output;
+	}
+
 	fz_try(ctx)
 	{
 		/* Step 1: Calculate the weights for columns and rows */
@@ -1430,6 +1843,7 @@ fz_scale_pixmap_cached(fz_context *ctx, fz_pixmap *src, float x, float y, float
 #endif /* SINGLE_PIXEL_SPECIALS */
 	{
 		void (*row_scale)(unsigned char *dst, unsigned char *src, fz_weights *weights);
+		void (*row_scale_from_temp)(unsigned char *dst, unsigned char *src, fz_weights *weights, int width, int row) = scale_row_from_temp;
 
 		temp_span = contrib_cols->count * src->n;
 		temp_rows = contrib_rows->max_len;
@@ -1463,6 +1877,18 @@ fz_scale_pixmap_cached(fz_context *ctx, fz_pixmap *src, float x, float y, float
 			row_scale = scale_row_to_temp4;
 			break;
 		}
+#ifdef HAVE_SSE2
+		if (simd != FZ_SIMD_NONE && weights_fit_16bit(contrib_cols) && weights_fit_16bit(contrib_rows))
+		{
+			switch (src->n)
+			{
+			case 1: row_scale = scale_row_to_temp1_sse2; break;
+			case 2: row_scale = scale_row_to_temp2_sse2; break;
+			case 4: row_scale = scale_row_to_temp4_sse2; break;
+			}
+			row_scale_from_temp = scale_row_from_temp_sse2;
+		}
+#endif
 		max_row = contrib_rows->index[contrib_rows->index[0]];
 		for (row = 0; row < contrib_rows->count; row++)
 		{
@@ -1484,7 +1910,7 @@ fz_scale_pixmap_cached(fz_context *ctx, fz_pixmap *src, float x, float y, float
 			}
 
 			DBUG(("scaling row %d from temp\n", row));
-			scale_row_from_temp(&output->samples[row*output->w*output->n], temp, contrib_rows, temp_span, row);
+			(*row_scale_from_temp)(&output->samples[row*output->w*output->n], temp, contrib_rows, temp_span, row);
 		}
 		fz_free(ctx, temp);
 	}
@@ -1497,6 +1923,29 @@ cleanup:
 	return output;
 }
 
+static int scale_simd = -1;
+
+static int
+get_scale_simd(void)
+{
+	/* Racing threads all arrive at the same result, so no locking is needed */
+	if (scale_simd < 0)
+		scale_simd = fz_detect_simd();
+	return scale_simd;
+}
+
+fz_pixmap *
+fz_scale_pixmap(fz_context *ctx, fz_pixmap *src, float x, float y, float w, float h, fz_irect *clip)
+{
+	return fz_scale_pixmap_cached(ctx, src, x, y, w, h, clip, NULL, NULL);
+}
+
+fz_pixmap *
+fz_scale_pixmap_cached(fz_context *ctx, fz_pixmap *src, float x, float y, float w, float h, const fz_irect *clip, fz_scale_cache *cache_x, fz_scale_cache *cache_y)
+{
+	return scale_pixmap(ctx, src, x, y, w, h, clip, cache_x, cache_y, get_scale_simd(), 1);
+}
+
 void
 fz_free_scale_cache(fz_context *ctx, fz_scale_cache *sc)
 {
@@ -1511,3 +1960,190 @@ fz_new_scale_cache(fz_context *ctx)
 {
 	return fz_malloc_struct(ctx, fz_scale_cache);
 }
+
+/*
+ * Comparison of the vectorized scaler against the scalar one
+ */
+
+#define BENCH_SRC_SIZE 1200
+#define BENCH_RANDOM_SCALES 300
+
+static unsigned int
+bench_random(unsigned int *seed)
+{
+	*seed = *seed * 1103515245 + 12345;
+	return (*seed >> 16) & 0x7FFF;
+}
+
+static fz_pixmap *
+bench_new_pixmap(fz_context *ctx, unsigned int *seed, int n, int w, int h)
+{
+	fz_colorspace *cs = n == 4 ? fz_device_rgb(ctx) : n == 2 ? fz_device_gray(ctx) : NULL;
+	fz_pixmap *pix = fz_new_pixmap(ctx, cs, w, h);
+	int i;
+
+	for (i = 0; i < w * h * n; i++)
+		pix->samples[i] = bench_random(seed) & 0xFF;
+	return pix;
+}
+
+/* Returns the number of bytes that differ between a and b */
+static int
+bench_compare(fz_pixmap *a, fz_pixmap *b)
+{
+	int i, count = 0;
+
+	if (!a || !b)
+		return a != b;
+	if (a->x != b->x || a->y != b->y || a->w != b->w || a->h != b->h)
+		return a->w * a->h * a->n;
+	for (i = 0; i < a->w * a->h * a->n; i++)
+		if (a->samples[i] != b->samples[i])
+			count++;
+	return count;
+}
+
+/* Scales src iterations times the way the draw device does (i.e. with
+ * cached weights) and returns the time taken in ms */
+static double
+bench_scale(fz_context *ctx, fz_pixmap *src, float w, float h, int iterations, int simd, int allow_box, fz_pixmap **result)
+{
+	fz_scale_cache *cache_x = fz_new_scale_cache(ctx);
+	fz_scale_cache *cache_y = fz_new_scale_cache(ctx);
+	clock_t start = clock();
+	int i;
+
+	for (i = 0; i < iterations; i++)
+	{
+		fz_drop_pixmap(ctx, *result);
+		*result = scale_pixmap(ctx, src, 0, 0, w, h, NULL, cache_x, cache_y, simd, allow_box);
+	}
+	fz_free_scale_cache(ctx, cache_x);
+	fz_free_scale_cache(ctx, cache_y);
+	return (double)(clock() - start) * 1000 / CLOCKS_PER_SEC;
+}
+
+int
+fz_bench_scale_pixmap(fz_context *ctx, fz_scale_bench *results, int max_results, int iterations)
+{
+	static const int components[] = { 1, 2, 4 };
+	int simd = get_scale_simd();
+	int count = 0;
+	int c, i, n;
+	unsigned int seed = 1;
+
+	for (c = 0; c < nelem(components); c++)
+	{
+		fz_pixmap *src, *ref = NULL, *pix = NULL;
+		fz_scale_bench *result;
+
+		n = components[c];
+		src = bench_new_pixmap(ctx, &seed, n, BENCH_SRC_SIZE, BENCH_SRC_SIZE);
+
+		if (simd != FZ_SIMD_NONE && count + 2 <= max_results)
+		{
+			/* downscaling (as for most images) and upscaling by non-integer factors */
+			for (i = 0; i < 2; i++)
+			{
+				float w = i == 0 ? BENCH_SRC_SIZE / 2.9f : BENCH_SRC_SIZE / 4 * 1.7f;
+				float h = i == 0 ? BENCH_SRC_SIZE / 3.1f : BENCH_SRC_SIZE / 4 * 1.3f;
+				fz_pixmap *part = i == 0 ? src : fz_new_pixmap_with_data(ctx, src->colorspace, BENCH_SRC_SIZE / 4, BENCH_SRC_SIZE / 4, src->samples);
+				result = &results[count++];
+				result->n = n;
+				result->method = "sse2";
+				result->src_w = part->w;
+				result->src_h = part->h;
+				result->reference_ms = bench_scale(ctx, part, w, h, iterations, FZ_SIMD_NONE, 0, &ref);
+				result->method_ms = bench_scale(ctx, part, w, h, iterations, simd, 0, &pix);
+				result->dst_w = pix ? pix->w : 0;
+				result->dst_h = pix ? pix->h : 0;
+				result->mismatches = bench_compare(ref, pix);
+				if (part != src)
+					fz_drop_pixmap(ctx, part);
+			}
+
+			/* random sizes, offsets, flips and clips */
+			for (i = 0; i < BENCH_RANDOM_SCALES; i++)
+			{
+				fz_pixmap *small = bench_new_pixmap(ctx, &seed, n, 1 + bench_random(&seed) % 80, 1 + bench_random(&seed) % 80);
+				float x = (bench_random(&seed) % 1000) / 100.0f - 5;
+				float y = (bench_random(&seed) % 1000) / 100.0f - 5;
+				float w = (bench_random(&seed) % 32000) / 100.0f - 160;
+				float h = (bench_random(&seed) % 32000) / 100.0f - 160;
+				fz_irect clip, *cp = NULL;
+				if (bench_random(&seed) % 2)
+				{
+					clip.x0 = bench_random(&seed) % 200 - 150;
+					clip.y0 = bench_random(&seed) % 200 - 150;
+					clip.x1 = clip.x0 + bench_random(&seed) % 200;
+					clip.y1 = clip.y0 + bench_random(&seed) % 200;
+					cp = &clip;
+				}
+				fz_drop_pixmap(ctx, ref);
+				fz_drop_pixmap(ctx, pix);
+				ref = scale_pixmap(ctx, small, x, y, w, h, cp, NULL, NULL, FZ_SIMD_NONE, 0);
+				pix = scale_pixmap(ctx, small, x, y, w, h, cp, NULL, NULL, simd, 0);
+				results[count - 2].mismatches += bench_compare(ref, pix);
+				fz_drop_pixmap(ctx, small);
+			}
+		}
+
+		if (count < max_results)
+		{
+			/* integer factor downscaling, compared to the filter otherwise used */
+			result = &results[count++];
+			result->n = n;
+			result->method = "box";
+			result->src_w = src->w;
+			result->src_h = src->h;
+			result->reference_ms = bench_scale(ctx, src, BENCH_SRC_SIZE / 3, BENCH_SRC_SIZE / 3, iterations, simd, 0, &ref);
+			result->method_ms = bench_scale(ctx, src, BENCH_SRC_SIZE / 3, BENCH_SRC_SIZE / 3, iterations, simd, 1, &pix);
+			result->dst_w = pix->w;
+			result->dst_h = pix->h;
+			result->mismatches = 0;
+
+			if (simd != FZ_SIMD_NONE)
+			{
+				/* compare the vectorized box filter against the scalar one */
+				fz_drop_pixmap(ctx, ref);
+				ref = scale_pixmap(ctx, src, 0, 0, BENCH_SRC_SIZE / 3, BENCH_SRC_SIZE / 3, NULL, NULL, NULL, FZ_SIMD_NONE, 1);
+				result->mismatches = bench_compare(ref, pix);
+
+				/* random integer factors, offsets, flips and clips */
+				for (i = 0; i < BENCH_RANDOM_SCALES; i++)
+				{
+					int dw = 1 + bench_random(&seed) % 40;
+					int dh = 1 + bench_random(&seed) % 40;
+					int fx = 1 + bench_random(&seed) % 5;
+					int fy = 1 + bench_random(&seed) % 5;
+					fz_pixmap *small = bench_new_pixmap(ctx, &seed, n, dw * fx, dh * fy);
+					float x = (float)(bench_random(&seed) % 11) - 5;
+					float y = (float)(bench_random(&seed) % 11) - 5;
+					float w = bench_random(&seed) % 2 ? -dw : dw;
+					float h = bench_random(&seed) % 2 ? -dh : dh;
+					fz_irect clip, *cp = NULL;
+					if (bench_random(&seed) % 2)
+					{
+						clip.x0 = bench_random(&seed) % 60 - 45;
+						clip.y0 = bench_random(&seed) % 60 - 45;
+						clip.x1 = clip.x0 + bench_random(&seed) % 60;
+						clip.y1 = clip.y0 + bench_random(&seed) % 60;
+						cp = &clip;
+					}
+					fz_drop_pixmap(ctx, ref);
+					fz_drop_pixmap(ctx, pix);
+					ref = scale_pixmap(ctx, small, x, y, w, h, cp, NULL, NULL, FZ_SIMD_NONE, 1);
+					pix = scale_pixmap(ctx, small, x, y, w, h, cp, NULL, NULL, simd, 1);
+					result->mismatches += bench_compare(ref, pix);
+					fz_drop_pixmap(ctx, small);
+				}
+			}
+		}
+
+		fz_drop_pixmap(ctx, ref);
+		fz_drop_pixmap(ctx, pix);
+		fz_drop_pixmap(ctx, src);
+	}
+
+	return count;
+}
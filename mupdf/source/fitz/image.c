@@ -32,15 +32,29 @@ struct fz_image_key_s {
 	int refs;
 	fz_image *image;
 	int l2factor;
+	fz_irect area; /* empty for tiles of the whole image */
 };
 
+/* Partially decoded tiles cover areas aligned to a grid of cells of
+ * 256x256 pixels (see fz_new_pixmap_from_image_area) */
+#define AREA_CELL_BITS 8
+
 static int
 fz_make_hash_image_key(fz_store_hash *hash, void *key_)
 {
 	fz_image_key *key = (fz_image_key *)key_;
 
-	hash->u.pi.ptr = key->image;
-	hash->u.pi.i = key->l2factor;
+	if (fz_is_empty_irect(&key->area))
+	{
+		hash->u.pi.ptr = key->image;
+		hash->u.pi.i = key->l2factor;
+		return 1;
+	}
+	/* the area's cells fit into 12 bits each for any pixmap that
+	 * could be allocated */
+	hash->u.i.ptr = key->image;
+	hash->u.i.i0 = (key->area.x0 >> AREA_CELL_BITS) | (key->area.y0 >> AREA_CELL_BITS) << 12 | key->l2factor << 24;
+	hash->u.i.i1 = ((key->area.x1 - 1) >> AREA_CELL_BITS) | ((key->area.y1 - 1) >> AREA_CELL_BITS) << 12 | 1 << 24;
 	return 1;
 }
 
@@ -80,7 +94,9 @@ fz_cmp_image_key(void *k0_, void *k1_)
 	fz_image_key *k0 = (fz_image_key *)k0_;
 	fz_image_key *k1 = (fz_image_key *)k1_;
 
-	return k0->image == k1->image && k0->l2factor == k1->l2factor;
+	return k0->image == k1->image && k0->l2factor == k1->l2factor &&
+		k0->area.x0 == k1->area.x0 && k0->area.y0 == k1->area.y0 &&
+		k0->area.x1 == k1->area.x1 && k0->area.y1 == k1->area.y1;
 }
 
 #ifndef NDEBUG
@@ -89,7 +105,11 @@ fz_debug_image(FILE *out, void *key_)
 {
 	fz_image_key *key = (fz_image_key *)key_;
 
-	fprintf(out, "(image %d x %d sf=%d) ", key->image->w, key->image->h, key->l2factor);
+	if (fz_is_empty_irect(&key->area))
+		fprintf(out, "(image %d x %d sf=%d) ", key->image->w, key->image->h, key->l2factor);
+	else
+		fprintf(out, "(image %d x %d sf=%d area=%d,%d-%d,%d) ", key->image->w, key->image->h, key->l2factor,
+			key->area.x0, key->area.y0, key->area.x1, key->area.y1);
 }
 #endif
 
@@ -321,25 +341,218 @@ fz_free_image(fz_context *ctx, fz_storable *image_)
 	fz_free(ctx, image);
 }
 
-fz_pixmap *
-fz_image_get_pixmap(fz_context *ctx, fz_image *image, int w, int h)
+/* Decodes as many rows of a stream as are needed for area (at
+ * l2factor) and unpacks only the columns within area */
+static fz_pixmap *
+decomp_image_area_from_stream(fz_context *ctx, fz_stream *stm, fz_image *image, int indexed, int l2factor, int native_l2factor, const fz_irect *area)
+{
+	fz_pixmap *tile = NULL, *band = NULL;
+	unsigned char *samples = NULL;
+	int f = 1 << native_l2factor;
+	int w = (image->w + f-1) >> native_l2factor;
+	int h = (image->h + f-1) >> native_l2factor;
+	int s = l2factor - native_l2factor;
+	int x0 = area->x0 << s, x1 = fz_mini(area->x1 << s, w);
+	int y0 = area->y0 << s, y1 = fz_mini(area->y1 << s, h);
+	int stride = (w * image->n * image->bpc + 7) / 8;
+	/* x0 is a multiple of 256 and thus always starts at a byte boundary */
+	int skip = x0 * image->n * image->bpc / 8;
+	int band_h = fz_clampi((1 << 16) / stride, 1, 64);
+	int y, rows, len, i, truncated = 0;
+
+	fz_var(tile);
+	fz_var(band);
+	fz_var(samples);
+
+	fz_try(ctx)
+	{
+		tile = fz_new_pixmap(ctx, image->colorspace, x1 - x0, y1 - y0);
+		tile->interpolate = image->interpolate;
+		samples = fz_malloc_array(ctx, band_h, stride);
+
+		for (y = 0; y < y1; y += rows)
+		{
+			rows = fz_mini(band_h, y1 - y);
+			len = truncated ? 0 : fz_read(stm, samples, rows * stride);
+			/* Pad truncated images */
+			if (len < rows * stride)
+			{
+				if (!truncated)
+					fz_warn(ctx, "padding truncated image");
+				truncated = 1;
+				memset(samples + len, 0, rows * stride - len);
+			}
+			/* rows above the area have to be decompressed but not unpacked */
+			if (y + rows <= y0)
+				continue;
+
+			/* Invert 1-bit image masks */
+			if (image->imagemask)
+			{
+				/* 0=opaque and 1=transparent so we need to invert */
+				len = rows * stride;
+				for (i = 0; i < len; i++)
+					samples[i] = ~samples[i];
+			}
+
+			if (y < y0)
+			{
+				band = fz_new_pixmap_with_data(ctx, image->colorspace, tile->w, y + rows - y0, tile->samples);
+				fz_unpack_tile(band, samples + (y0 - y) * stride + skip, image->n, image->bpc, stride, indexed);
+			}
+			else
+			{
+				band = fz_new_pixmap_with_data(ctx, image->colorspace, tile->w, rows, tile->samples + (y - y0) * tile->w * tile->n);
+				fz_unpack_tile(band, samples + skip, image->n, image->bpc, stride, indexed);
+			}
+			tile->has_alpha = band->has_alpha; /* SumatraPDF: allow optimizing non-alpha pixmaps */
+			tile->single_bit = band->single_bit; /* SumatraPDF: allow optimizing 1-bit pixmaps */
+			fz_drop_pixmap(ctx, band);
+			band = NULL;
+		}
+
+		/* color keyed transparency */
+		if (image->usecolorkey && !image->mask)
+			fz_mask_color_key(tile, image->n, image->colorkey);
+
+		if (indexed)
+		{
+			fz_pixmap *conv;
+			fz_decode_indexed_tile(tile, image->decode, (1 << image->bpc) - 1);
+			conv = fz_expand_indexed_pixmap(ctx, tile);
+			fz_drop_pixmap(ctx, tile);
+			tile = conv;
+		}
+		else
+		{
+			fz_decode_tile(tile, image->decode);
+		}
+	}
+	fz_always(ctx)
+	{
+		fz_free(ctx, samples);
+		fz_close(stm);
+	}
+	fz_catch(ctx)
+	{
+		fz_drop_pixmap(ctx, band);
+		fz_drop_pixmap(ctx, tile);
+		fz_rethrow(ctx);
+	}
+
+	if (s > 0)
+		fz_subsample_pixmap(ctx, tile, s);
+
+	return tile;
+}
+
+/* Copies area out of tile (positioned at tile->x, tile->y) */
+static fz_pixmap *
+crop_tile(fz_context *ctx, fz_pixmap *tile, const fz_irect *area)
+{
+	fz_pixmap *part = NULL;
+
+	fz_try(ctx)
+	{
+		part = fz_new_pixmap_with_bbox(ctx, tile->colorspace, area);
+		fz_clear_pixmap(ctx, part);
+		fz_copy_pixmap_rect(ctx, part, tile, area);
+		part->x = part->y = 0;
+		part->xres = tile->xres;
+		part->yres = tile->yres;
+		part->interpolate = tile->interpolate;
+		part->has_alpha = tile->has_alpha; /* SumatraPDF: allow optimizing non-alpha pixmaps */
+		part->single_bit = tile->single_bit; /* SumatraPDF: allow optimizing 1-bit pixmaps */
+	}
+	fz_always(ctx)
+	{
+		fz_drop_pixmap(ctx, tile);
+	}
+	fz_catch(ctx)
+	{
+		fz_rethrow(ctx);
+	}
+
+	return part;
+}
+
+/* Decodes a JPX image at l2factor, either completely or (if area
+ * isn't NULL) only the part covering area */
+static fz_pixmap *
+decomp_jpx_tile(fz_context *ctx, fz_image *image, int l2factor, const fz_irect *area)
 {
 	fz_pixmap *tile;
-	fz_stream *stm;
-	int l2factor;
-	fz_image_key key;
-	int native_l2factor;
-	int indexed;
-	fz_image_key *keyp;
+	fz_colorspace *cs = image->colorspace;
+	int indexed = fz_colorspace_is_indexed(cs);
+	int native_l2factor = l2factor;
+	fz_irect jpx_area;
+
+	/* device colorspaces are what fz_load_jpx picks anyway */
+	if (cs == fz_device_gray(ctx) || cs == fz_device_rgb(ctx) || cs == fz_device_cmyk(ctx))
+		cs = NULL;
+	if (area)
+	{
+		jpx_area.x0 = area->x0 << l2factor;
+		jpx_area.y0 = area->y0 << l2factor;
+		jpx_area.x1 = fz_mini(area->x1 << l2factor, image->w);
+		jpx_area.y1 = fz_mini(area->y1 << l2factor, image->h);
+	}
 
-	/* Check for 'simple' images which are just pixmaps */
-	if (image->buffer == NULL)
+	/* Let OpenJPEG skip the resolution levels we'd subsample away */
+	tile = fz_load_jpx_reduced(ctx, image->buffer->buffer->data, image->buffer->buffer->len, cs, indexed, &native_l2factor, area ? &jpx_area : NULL);
+	if (!indexed && tile->n - 1 == image->n)
+		fz_decode_tile(tile, image->decode);
+	if (native_l2factor != l2factor)
+		fz_subsample_pixmap(ctx, tile, l2factor - native_l2factor);
+
+	if (area)
 	{
-		tile = image->tile;
-		if (!tile)
-			return NULL;
-		return fz_keep_pixmap(ctx, tile); /* That's all we can give you! */
+		tile->x = jpx_area.x0 >> (l2factor - native_l2factor);
+		tile->y = jpx_area.y0 >> (l2factor - native_l2factor);
+		if (tile->x != area->x0 || tile->y != area->y0 || tile->x + tile->w != area->x1 || tile->y + tile->h != area->y1)
+			return crop_tile(ctx, tile, area);
+		tile->x = tile->y = 0;
+	}
+
+	return tile;
+}
+
+/* Scan JPEG stream and patch missing height values in header */
+static void
+fz_patch_jpeg_height(fz_image *image)
+{
+	unsigned char *s = image->buffer->buffer->data;
+	unsigned char *e = s + image->buffer->buffer->len;
+	unsigned char *d;
+	for (d = s + 2; s < d && d < e - 9 && d[0] == 0xFF; d += (d[2] << 8 | d[3]) + 2)
+	{
+		if (d[1] < 0xC0 || (0xC3 < d[1] && d[1] < 0xC9) || 0xCB < d[1])
+			continue;
+		if ((d[5] == 0 && d[6] == 0) || ((d[5] << 8) | d[6]) > image->h)
+		{
+			d[5] = (image->h >> 8) & 0xFF;
+			d[6] = image->h & 0xFF;
+		}
 	}
+}
+
+static void
+fz_invert_cmyk_jpeg_tile(fz_context *ctx, fz_image *image, fz_pixmap *tile)
+{
+	/* CMYK JPEGs in XPS documents have to be inverted */
+	if (image->invert_cmyk_jpeg &&
+		image->buffer->params.type == FZ_IMAGE_JPEG &&
+		image->colorspace == fz_device_cmyk(ctx) &&
+		image->buffer->params.u.jpeg.color_transform)
+	{
+		fz_invert_pixmap(ctx, tile);
+	}
+}
+
+static int
+fz_image_l2factor(fz_image *image, int w, int h)
+{
+	int l2factor;
 
 	/* Ensure our expectations for tile size are reasonable */
 	if (w < 0 || w > image->w)
@@ -356,7 +569,16 @@ fz_image_get_pixmap(fz_context *ctx, fz_image *image, int w, int h)
 	else
 		for (l2factor=0; image->w>>(l2factor+1) >= w+2 && image->h>>(l2factor+1) >= h+2 && l2factor < 8; l2factor++);
 
-	/* Can we find any suitable tiles in the cache? */
+	return l2factor;
+}
+
+/* Looks for a tile of the whole image at l2factor or any finer resolution */
+static fz_pixmap *
+fz_find_image_tile(fz_context *ctx, fz_image *image, int l2factor)
+{
+	fz_pixmap *tile;
+	fz_image_key key = { 0 };
+
 	key.refs = 1;
 	key.image = image;
 	key.l2factor = l2factor;
@@ -369,6 +591,73 @@ fz_image_get_pixmap(fz_context *ctx, fz_image *image, int w, int h)
 	}
 	while (key.l2factor >= 0);
 
+	return NULL;
+}
+
+static fz_pixmap *
+fz_store_image_tile(fz_context *ctx, fz_image *image, int l2factor, const fz_irect *area, fz_pixmap *tile)
+{
+	fz_image_key *keyp = NULL;
+
+	/* Now we try to cache the pixmap. Any failure here will just result
+	 * in us not caching. */
+	fz_var(keyp);
+	fz_try(ctx)
+	{
+		fz_pixmap *existing_tile;
+
+		keyp = fz_malloc_struct(ctx, fz_image_key);
+		keyp->refs = 1;
+		keyp->image = fz_keep_image(ctx, image);
+		keyp->l2factor = l2factor;
+		if (area)
+			keyp->area = *area;
+		existing_tile = fz_store_item(ctx, keyp, tile, fz_pixmap_size(ctx, tile), &fz_image_store_type);
+		if (existing_tile)
+		{
+			/* We already have a tile. This must have been produced by a
+			 * racing thread. We'll throw away ours and use that one. */
+			fz_drop_pixmap(ctx, tile);
+			tile = existing_tile;
+		}
+	}
+	fz_always(ctx)
+	{
+		fz_drop_image_key(ctx, keyp);
+	}
+	fz_catch(ctx)
+	{
+		/* Do nothing */
+	}
+
+	return tile;
+}
+
+fz_pixmap *
+fz_image_get_pixmap(fz_context *ctx, fz_image *image, int w, int h)
+{
+	fz_pixmap *tile;
+	fz_stream *stm;
+	int l2factor;
+	int native_l2factor;
+	int indexed;
+
+	/* Check for 'simple' images which are just pixmaps */
+	if (image->buffer == NULL)
+	{
+		tile = image->tile;
+		if (!tile)
+			return NULL;
+		return fz_keep_pixmap(ctx, tile); /* That's all we can give you! */
+	}
+
+	l2factor = fz_image_l2factor(image, w, h);
+
+	/* Can we find any suitable tiles in the cache? */
+	tile = fz_find_image_tile(ctx, image, l2factor);
+	if (tile)
+		return tile;
+
 	/* We need to make a new one. */
 	/* First check for ones that we can't decode using streams */
 	switch (image->buffer->params.type)
@@ -382,23 +671,11 @@ fz_image_get_pixmap(fz_context *ctx, fz_image *image, int w, int h)
 	case FZ_IMAGE_JXR:
 		tile = fz_load_jxr(ctx, image->buffer->buffer->data, image->buffer->buffer->len);
 		break;
+	case FZ_IMAGE_JPX:
+		tile = decomp_jpx_tile(ctx, image, l2factor, NULL);
+		break;
 	case FZ_IMAGE_JPEG:
-		/* Scan JPEG stream and patch missing height values in header */
-		{
-			unsigned char *s = image->buffer->buffer->data;
-			unsigned char *e = s + image->buffer->buffer->len;
-			unsigned char *d;
-			for (d = s + 2; s < d && d < e - 9 && d[0] == 0xFF; d += (d[2] << 8 | d[3]) + 2)
-			{
-				if (d[1] < 0xC0 || (0xC3 < d[1] && d[1] < 0xC9) || 0xCB < d[1])
-					continue;
-				if ((d[5] == 0 && d[6] == 0) || ((d[5] << 8) | d[6]) > image->h)
-				{
-					d[5] = (image->h >> 8) & 0xFF;
-					d[6] = image->h & 0xFF;
-				}
-			}
-		}
+		fz_patch_jpeg_height(image);
 		/* fall through */
 
 	default:
@@ -407,48 +684,124 @@ fz_image_get_pixmap(fz_context *ctx, fz_image *image, int w, int h)
 
 		indexed = fz_colorspace_is_indexed(image->colorspace);
 		tile = fz_decomp_image_from_stream(ctx, stm, image, indexed, l2factor, native_l2factor);
-
-		/* CMYK JPEGs in XPS documents have to be inverted */
-		if (image->invert_cmyk_jpeg &&
-			image->buffer->params.type == FZ_IMAGE_JPEG &&
-			image->colorspace == fz_device_cmyk(ctx) &&
-			image->buffer->params.u.jpeg.color_transform)
-		{
-			fz_invert_pixmap(ctx, tile);
-		}
+		fz_invert_cmyk_jpeg_tile(ctx, image, tile);
 
 		break;
 	}
 
-	/* Now we try to cache the pixmap. Any failure here will just result
-	 * in us not caching. */
-	fz_var(keyp);
-	fz_try(ctx)
+	return fz_store_image_tile(ctx, image, l2factor, NULL, tile);
+}
+
+/* Decodes the part of image covering area (at l2factor) */
+static fz_pixmap *
+fz_image_get_area_pixmap(fz_context *ctx, fz_image *image, int l2factor, const fz_irect *area)
+{
+	fz_pixmap *tile;
+	fz_stream *stm;
+	fz_image_key key = { 0 };
+	fz_irect full_area;
+	int native_l2factor;
+
+	key.refs = 1;
+	key.image = image;
+	key.l2factor = l2factor;
+	key.area = *area;
+	tile = fz_find_item(ctx, fz_free_pixmap_imp, &key, &fz_image_store_type);
+	if (tile)
+		return tile;
+
+	switch (image->buffer->params.type)
 	{
-		fz_pixmap *existing_tile;
+	case FZ_IMAGE_JPX:
+		tile = decomp_jpx_tile(ctx, image, l2factor, area);
+		break;
+	case FZ_IMAGE_TIFF:
+		/* only the strips containing the area are decoded */
+		full_area.x0 = area->x0 << l2factor;
+		full_area.y0 = area->y0 << l2factor;
+		full_area.x1 = fz_mini(area->x1 << l2factor, image->w);
+		full_area.y1 = fz_mini(area->y1 << l2factor, image->h);
+		tile = fz_load_tiff_rows(ctx, image->buffer->buffer->data, image->buffer->buffer->len, full_area.y0, full_area.y1);
+		tile = crop_tile(ctx, tile, &full_area);
+		if (l2factor > 0)
+			fz_subsample_pixmap(ctx, tile, l2factor);
+		break;
+	case FZ_IMAGE_JPEG:
+		fz_patch_jpeg_height(image);
+		/* fall through */
 
-		keyp = fz_malloc_struct(ctx, fz_image_key);
-		keyp->refs = 1;
-		keyp->image = fz_keep_image(ctx, image);
-		keyp->l2factor = l2factor;
-		existing_tile = fz_store_item(ctx, keyp, tile, fz_pixmap_size(ctx, tile), &fz_image_store_type);
-		if (existing_tile)
-		{
-			/* We already have a tile. This must have been produced by a
-			 * racing thread. We'll throw away ours and use that one. */
-			fz_drop_pixmap(ctx, tile);
-			tile = existing_tile;
-		}
+	default:
+		native_l2factor = l2factor;
+		stm = fz_open_image_decomp_stream_from_buffer(ctx, image->buffer, &native_l2factor);
+		tile = decomp_image_area_from_stream(ctx, stm, image, fz_colorspace_is_indexed(image->colorspace), l2factor, native_l2factor, area);
+		fz_invert_cmyk_jpeg_tile(ctx, image, tile);
+		break;
 	}
-	fz_always(ctx)
+
+	return fz_store_image_tile(ctx, image, l2factor, area, tile);
+}
+
+fz_pixmap *
+fz_new_pixmap_from_image_area(fz_context *ctx, fz_image *image, const fz_irect *area, int w, int h, fz_matrix *ctm)
+{
+	fz_pixmap *tile;
+	fz_matrix sub;
+	fz_irect r;
+	int l2factor, f, rw, rh, cell = (1 << AREA_CELL_BITS) - 1;
+
+	if (!area || !image->buffer || image->get_pixmap != fz_image_get_pixmap)
+		return fz_new_pixmap_from_image(ctx, image, w, h);
+	switch (image->buffer->params.type)
 	{
-		fz_drop_image_key(ctx, keyp);
+	case FZ_IMAGE_PNG:
+	case FZ_IMAGE_JXR:
+		return fz_new_pixmap_from_image(ctx, image, w, h);
 	}
-	fz_catch(ctx)
+	/* pre-blended matte colors need the whole mask */
+	if (image->usecolorkey && image->mask)
+		return fz_new_pixmap_from_image(ctx, image, w, h);
+
+	l2factor = fz_image_l2factor(image, w, h);
+	f = 1 << l2factor;
+	rw = (image->w + f - 1) >> l2factor;
+	rh = (image->h + f - 1) >> l2factor;
+
+	/* Extend the area by a margin of two pixels for interpolation and
+	 * align it to the grid of cells so that tiles can be reused */
+	r.x0 = fz_clampi((area->x0 >> l2factor) - 2, 0, rw) & ~cell;
+	r.y0 = fz_clampi((area->y0 >> l2factor) - 2, 0, rh) & ~cell;
+	r.x1 = fz_mini((fz_clampi(((area->x1 + f - 1) >> l2factor) + 2, 0, rw) + cell) & ~cell, rw);
+	r.y1 = fz_mini((fz_clampi(((area->y1 + f - 1) >> l2factor) + 2, 0, rh) + cell) & ~cell, rh);
+
+	/* Decoding everything is cheaper than repeatedly decoding large parts */
+	if (r.x0 >= r.x1 || r.y0 >= r.y1 || (float)(r.x1 - r.x0) * (r.y1 - r.y0) * 2 > (float)rw * rh)
+		return fz_new_pixmap_from_image(ctx, image, w, h);
+
+	/* Streams have to be decompressed from the top for every part, so
+	 * they're only decoded partially if the whole image can't be cached */
+	if (image->buffer->params.type != FZ_IMAGE_JPX && image->buffer->params.type != FZ_IMAGE_TIFF)
 	{
-		/* Do nothing */
+		unsigned int max = fz_store_max(ctx);
+		int n = fz_colorspace_is_indexed(image->colorspace) ? 4 : image->n;
+		if (max == FZ_STORE_UNLIMITED || (float)rw * rh * (n + 1) <= (float)max)
+			return fz_new_pixmap_from_image(ctx, image, w, h);
 	}
 
+	/* A cached tile of the whole image is just as good */
+	tile = fz_find_image_tile(ctx, image, l2factor);
+	if (tile)
+		return tile;
+
+	tile = fz_image_get_area_pixmap(ctx, image, l2factor, &r);
+
+	/* map the unit square to the part of the image the tile covers */
+	sub.a = (float)(r.x1 - r.x0) / rw;
+	sub.b = sub.c = 0;
+	sub.d = (float)(r.y1 - r.y0) / rh;
+	sub.e = (float)r.x0 / rw;
+	sub.f = (float)r.y0 / rh;
+	fz_concat(ctm, &sub, ctm);
+
 	return tile;
 }
 
@@ -592,6 +945,11 @@ fz_new_image_from_buffer(fz_context *ctx, fz_buffer *buffer)
 			bc->params.type = FZ_IMAGE_PNG;
 			fz_load_png_info(ctx, buf, len, &w, &h, &xres, &yres, &cspace);
 		}
+		else if ((len >= 12 && memcmp(buf, "\0\0\0\x0CjP  \r\n\x87\n", 12) == 0) || memcmp(buf, "\xFF\x4F\xFF\x51", 4) == 0)
+		{
+			bc->params.type = FZ_IMAGE_JPX;
+			fz_load_jpx_info(ctx, buf, len, &w, &h, &xres, &yres, &cspace);
+		}
 		else if (memcmp(buf, "II", 2) == 0 && buf[2] == 0xBC)
 		{
 			bc->params.type = FZ_IMAGE_JXR;
@@ -58,7 +58,7 @@ static OPJ_OFF_T fz_opj_stream_skip(OPJ_OFF_T skip, void * p_user_data)
 	if (skip > sb->size - sb->pos)
 		skip = sb->size - sb->pos;
 	sb->pos += skip;
-	return sb->pos;
+	return skip;
 }
 
 static OPJ_BOOL fz_opj_stream_seek(OPJ_OFF_T seek_pos, void * p_user_data)
@@ -79,26 +79,127 @@ static inline unsigned int read_value(const unsigned char *data, int bytes)
 	return value;
 }
 
-fz_pixmap *
-fz_load_jpx(fz_context *ctx, unsigned char *data, int size, fz_colorspace *defcs, int indexed)
+/* SumatraPDF: extract image resolution (TODO: make openjpeg do this) */
+static void
+jpx_read_resolution(fz_context *ctx, unsigned char *data, int size, int *xres, int *yres)
+{
+	unsigned char *base = data;
+	int rest = size, ix = 0, level = 0;
+
+	/* bare J2K streams carry no resolution */
+	if (size < 2 || (data[0] == 0xFF && data[1] == 0x4F))
+		return;
+
+	while (ix < rest - 8)
+	{
+		int lbox = read_value(base + ix, 4);
+		unsigned int tbox = read_value(base + ix + 4, 4);
+		if (lbox < 8 || lbox > rest - ix)
+		{
+			fz_warn(ctx, "impossibly small or large JP2 box (%x, %d)", tbox, lbox);
+			break;
+		}
+		if (level == 0 && tbox == 0x6A703268 /* jp2h */ || level == 1 && tbox == 0x72657320 /* res  */)
+		{
+			base += ix + 8;
+			rest = lbox - 8;
+			ix = 0;
+			level++;
+		}
+		else if (level == 2 && tbox == 0x72657363 /* resc */ && lbox == 18 && rest - ix >= 18)
+		{
+			int vrn = read_value((base += ix + 8), 2);
+			int vrd = read_value(base + 2, 2);
+			int hrn = read_value(base + 4, 2);
+			int hrd = read_value(base + 6, 2);
+			int vre = (char)base[8], hre = (char)base[9];
+			*xres = (int)((float)hrn / hrd * pow(10, hre - 2) * 2.54f);
+			*yres = (int)((float)vrn / vrd * pow(10, vre - 2) * 2.54f);
+			if (*xres <= 0 || *yres <= 0)
+			{
+				fz_warn(ctx, "invalid image resolution (%d, %d)", *xres, *yres);
+				*xres = *yres = 96;
+			}
+			break;
+		}
+		else
+		{
+			ix += lbox;
+		}
+	}
+}
+
+/* Determines the color space and the number of components that
+ * opj_jp2_decode produces from the colr, pclr and cmap boxes, as
+ * opj_jp2_read_header doesn't apply them to the image header */
+static void
+jpx_read_color(fz_context *ctx, unsigned char *data, int size, OPJ_COLOR_SPACE *color_space, int *numcomps)
+{
+	unsigned char *base = data;
+	int rest = size, ix = 0, level = 0, has_colr = 0, has_pclr = 0, cmap_channels = 0;
+
+	/* bare J2K streams carry no color information */
+	if (size < 2 || (data[0] == 0xFF && data[1] == 0x4F))
+		return;
+
+	while (ix < rest - 8)
+	{
+		int lbox = read_value(base + ix, 4);
+		unsigned int tbox = read_value(base + ix + 4, 4);
+		if (lbox < 8 || lbox > rest - ix)
+			break;
+		if (level == 0 && tbox == 0x6A703268 /* jp2h */)
+		{
+			base += ix + 8;
+			rest = lbox - 8;
+			ix = 0;
+			level++;
+			continue;
+		}
+		if (level == 1 && tbox == 0x636F6C72 /* colr */ && !has_colr && lbox >= 15)
+		{
+			/* only the first colr box counts, enumerated color spaces only */
+			has_colr = 1;
+			if (base[ix + 8] == 1)
+			{
+				switch (read_value(base + ix + 11, 4))
+				{
+				case 16: *color_space = OPJ_CLRSPC_SRGB; break;
+				case 17: *color_space = OPJ_CLRSPC_GRAY; break;
+				case 18: *color_space = OPJ_CLRSPC_SYCC; break;
+				case 24: *color_space = OPJ_CLRSPC_EYCC; break;
+				default: *color_space = OPJ_CLRSPC_UNKNOWN; break;
+				}
+			}
+			else
+				*color_space = OPJ_CLRSPC_UNKNOWN;
+		}
+		else if (level == 1 && tbox == 0x70636C72 /* pclr */)
+			has_pclr = 1;
+		else if (level == 1 && tbox == 0x636D6170 /* cmap */)
+			cmap_channels = (lbox - 8) / 4;
+		ix += lbox;
+	}
+
+	/* palettes are only applied together with a component mapping */
+	if (has_pclr && cmap_channels > 0)
+		*numcomps = cmap_channels;
+}
+
+/* Creates a decoder for the J2K or JP2 data in sb and reads the main
+ * header. The caller has to destroy the returned codec, *stream and *jpx. */
+static opj_codec_t *
+jpx_read_header(fz_context *ctx, stream_block *sb, int indexed, opj_stream_t **stream, opj_image_t **jpx)
 {
-	fz_pixmap *img;
 	opj_dparameters_t params;
 	opj_codec_t *codec;
-	opj_image_t *jpx;
-	opj_stream_t *stream;
-	fz_colorspace *colorspace;
-	unsigned char *p;
 	OPJ_CODEC_FORMAT format;
-	int a, n, w, h, depth, sgnd;
-	int x, y, k, v;
-	stream_block sb;
 
-	if (size < 2)
+	if (sb->size < 2)
 		fz_throw(ctx, FZ_ERROR_GENERIC, "not enough data to determine image format");
 
 	/* Check for SOC marker -- if found we have a bare J2K stream */
-	if (data[0] == 0xFF && data[1] == 0x4F)
+	if (sb->data[0] == 0xFF && sb->data[1] == 0x4F)
 		format = OPJ_CODEC_J2K;
 	else
 		format = OPJ_CODEC_JP2;
@@ -117,30 +218,136 @@ fz_load_jpx(fz_context *ctx, unsigned char *data, int size, fz_colorspace *defcs
 		fz_throw(ctx, FZ_ERROR_GENERIC, "j2k decode failed");
 	}
 
-	stream = opj_stream_default_create(OPJ_TRUE);
-	sb.data = data;
-	sb.pos = 0;
-	sb.size = size;
-
-	opj_stream_set_read_function(stream, fz_opj_stream_read);
-	opj_stream_set_skip_function(stream, fz_opj_stream_skip);
-	opj_stream_set_seek_function(stream, fz_opj_stream_seek);
-	opj_stream_set_user_data(stream, &sb, NULL);
+	*stream = opj_stream_default_create(OPJ_TRUE);
+	opj_stream_set_read_function(*stream, fz_opj_stream_read);
+	opj_stream_set_skip_function(*stream, fz_opj_stream_skip);
+	opj_stream_set_seek_function(*stream, fz_opj_stream_seek);
+	opj_stream_set_user_data(*stream, sb, NULL);
 	/* Set the length to avoid an assert */
-	opj_stream_set_user_data_length(stream, size);
+	opj_stream_set_user_data_length(*stream, sb->size);
 
-	if (!opj_read_header(stream, codec, &jpx))
+	if (!opj_read_header(*stream, codec, jpx))
 	{
-		opj_stream_destroy(stream);
+		opj_stream_destroy(*stream);
 		opj_destroy_codec(codec);
 		fz_throw(ctx, FZ_ERROR_GENERIC, "Failed to read JPX header");
 	}
 
+	return codec;
+}
+
+/* Returns how often the image can be halved by skipping resolution
+ * levels, i.e. the number of wavelet decompositions of the component
+ * with the fewest of them. */
+static int
+jpx_max_l2factor(opj_codec_t *codec)
+{
+	opj_codestream_info_v2_t *info = opj_get_cstr_info(codec);
+	int k, factor;
+
+	if (!info)
+		return 0;
+	if (!info->m_default_tile_info.tccp_info || info->nbcomps == 0)
+	{
+		opj_destroy_cstr_info(&info);
+		return 0;
+	}
+	factor = info->m_default_tile_info.tccp_info[0].numresolutions - 1;
+	for (k = 1; k < (int)info->nbcomps; k++)
+		factor = fz_mini(factor, info->m_default_tile_info.tccp_info[k].numresolutions - 1);
+	opj_destroy_cstr_info(&info);
+
+	return fz_maxi(factor, 0);
+}
+
+/* Determines the number of color components (n) and whether there is
+ * an additional alpha component (a) */
+static void
+jpx_get_components(int numcomps, OPJ_COLOR_SPACE color_space, int *n, int *a)
+{
+	*n = numcomps;
+	if (color_space == OPJ_CLRSPC_SRGB && *n == 4) { *n = 3; *a = 1; }
+	else if (color_space == OPJ_CLRSPC_SYCC && *n == 4) { *n = 3; *a = 1; }
+	else if (*n == 2) { *n = 1; *a = 1; }
+	else if (*n > 4) { *n = 4; *a = 1; }
+	else { *a = 0; }
+}
+
+#define ceildivpow2(v, f) (((v) + (1 << (f)) - 1) >> (f))
+
+fz_pixmap *
+fz_load_jpx_reduced(fz_context *ctx, unsigned char *data, int size, fz_colorspace *defcs, int indexed, int *l2factor, fz_irect *area)
+{
+	fz_pixmap *img;
+	opj_codec_t *codec;
+	opj_image_t *jpx;
+	opj_stream_t *stream;
+	fz_colorspace *colorspace;
+	unsigned char *p;
+	int a, n, w, h, depth, sgnd;
+	int x, y, k, v;
+	int factor, x0, y0;
+	fz_irect *decode_area;
+	stream_block sb;
+
+	sb.data = data;
+	sb.pos = 0;
+	sb.size = size;
+
+	codec = jpx_read_header(ctx, &sb, indexed, &stream, &jpx);
+
+	/* Skip the finest resolution levels instead of decoding them only
+	 * to have them subsampled away afterwards */
+	factor = fz_mini(fz_maxi(*l2factor, 0), jpx_max_l2factor(codec));
+	x0 = jpx->x0;
+	y0 = jpx->y0;
+	/* the decoded area has to start at a (reduced) pixel boundary */
+	decode_area = area;
+	if (area && ((x0 | y0) & ((1 << factor) - 1)))
+		decode_area = NULL;
+	if (decode_area)
+	{
+		fz_irect bounds = { 0, 0, jpx->x1 - x0, jpx->y1 - y0 };
+		fz_intersect_irect(decode_area, &bounds);
+		if (fz_is_empty_irect(decode_area))
+			*decode_area = bounds;
+	}
+	if (factor > 0 || decode_area)
+	{
+		/* OpenJPEG 2.1 only shrinks the output components when the
+		 * decode area is set, so (re)set it even for the whole image.
+		 * Only the tiles intersecting the area are decoded. */
+		for (k = 0; k < (int)jpx->numcomps; k++)
+			jpx->comps[k].factor = factor;
+		if (!opj_set_decoded_resolution_factor(codec, factor) ||
+			!(decode_area ? opj_set_decode_area(codec, jpx, x0 + decode_area->x0, y0 + decode_area->y0, x0 + decode_area->x1, y0 + decode_area->y1) :
+				opj_set_decode_area(codec, jpx, jpx->x0, jpx->y0, jpx->x1, jpx->y1)))
+		{
+			opj_stream_destroy(stream);
+			opj_destroy_codec(codec);
+			opj_image_destroy(jpx);
+			*l2factor = 0;
+			if (factor > 0)
+				return fz_load_jpx_reduced(ctx, data, size, defcs, indexed, l2factor, area);
+			img = fz_load_jpx_reduced(ctx, data, size, defcs, indexed, l2factor, NULL);
+			area->x0 = area->y0 = 0;
+			area->x1 = img->w;
+			area->y1 = img->h;
+			return img;
+		}
+	}
+
 	if (!opj_decode(codec, stream, jpx))
 	{
 		opj_stream_destroy(stream);
 		opj_destroy_codec(codec);
 		opj_image_destroy(jpx);
+		/* tiles may have fewer resolution levels than announced by the main header */
+		if (factor > 0)
+		{
+			*l2factor = 0;
+			return fz_load_jpx_reduced(ctx, data, size, defcs, indexed, l2factor, area);
+		}
 		fz_throw(ctx, FZ_ERROR_GENERIC, "Failed to decode JPX image");
 	}
 
@@ -175,17 +382,24 @@ fz_load_jpx(fz_context *ctx, unsigned char *data, int size, fz_colorspace *defcs
 		}
 	}
 
-	n = jpx->numcomps;
 	w = jpx->comps[0].w;
 	h = jpx->comps[0].h;
 	depth = jpx->comps[0].prec;
 	sgnd = jpx->comps[0].sgnd;
-
-	if (jpx->color_space == OPJ_CLRSPC_SRGB && n == 4) { n = 3; a = 1; }
-	else if (jpx->color_space == OPJ_CLRSPC_SYCC && n == 4) { n = 3; a = 1; }
-	else if (n == 2) { n = 1; a = 1; }
-	else if (n > 4) { n = 4; a = 1; }
-	else { a = 0; }
+	jpx_get_components(jpx->numcomps, jpx->color_space, &n, &a);
+	*l2factor = factor;
+	if (area)
+	{
+		if (decode_area)
+		{
+			area->x0 = ceildivpow2(x0 + area->x0, factor) - ceildivpow2(x0, factor);
+			area->y0 = ceildivpow2(y0 + area->y0, factor) - ceildivpow2(y0, factor);
+		}
+		else
+			area->x0 = area->y0 = 0;
+		area->x1 = area->x0 + w;
+		area->y1 = area->y0 + h;
+	}
 
 	if (defcs)
 	{
@@ -253,49 +467,59 @@ fz_load_jpx(fz_context *ctx, unsigned char *data, int size, fz_colorspace *defcs
 		fz_premultiply_pixmap(ctx, img);
 	}
 
-	/* SumatraPDF: extract image resolution (TODO: make openjpeg do this) */
-	if (format == OPJ_CODEC_JP2)
+	jpx_read_resolution(ctx, data, size, &img->xres, &img->yres);
+
+	return img;
+}
+
+fz_pixmap *
+fz_load_jpx(fz_context *ctx, unsigned char *data, int size, fz_colorspace *defcs, int indexed)
+{
+	int l2factor = 0;
+	return fz_load_jpx_reduced(ctx, data, size, defcs, indexed, &l2factor, NULL);
+}
+
+void
+fz_load_jpx_info(fz_context *ctx, unsigned char *data, int size, int *wp, int *hp, int *xresp, int *yresp, fz_colorspace **cspacep)
+{
+	opj_codec_t *codec;
+	opj_image_t *jpx;
+	opj_stream_t *stream;
+	OPJ_COLOR_SPACE color_space;
+	stream_block sb;
+	int n, a, numcomps;
+
+	sb.data = data;
+	sb.pos = 0;
+	sb.size = size;
+
+	codec = jpx_read_header(ctx, &sb, 0, &stream, &jpx);
+	opj_stream_destroy(stream);
+	opj_destroy_codec(codec);
+
+	if (!jpx || jpx->numcomps == 0)
 	{
-		unsigned char *base = data;
-		int rest = size, ix = 0, level = 0;
-		while (ix < rest - 8)
-		{
-			int lbox = read_value(base + ix, 4);
-			unsigned int tbox = read_value(base + ix + 4, 4);
-			if (lbox < 8 || lbox > rest - ix)
-			{
-				fz_warn(ctx, "impossibly small or large JP2 box (%x, %d)", tbox, lbox);
-				break;
-			}
-			if (level == 0 && tbox == 0x6A703268 /* jp2h */ || level == 1 && tbox == 0x72657320 /* res  */)
-			{
-				base += ix + 8;
-				rest = lbox - 8;
-				ix = 0;
-				level++;
-			}
-			else if (level == 2 && tbox == 0x72657363 /* resc */ && lbox == 18 && rest - ix >= 18)
-			{
-				int vrn = read_value((base += ix + 8), 2);
-				int vrd = read_value(base + 2, 2);
-				int hrn = read_value(base + 4, 2);
-				int hrd = read_value(base + 6, 2);
-				int vre = (char)base[8], hre = (char)base[9];
-				img->xres = (int)((float)hrn / hrd * pow(10, hre - 2) * 2.54f);
-				img->yres = (int)((float)vrn / vrd * pow(10, vre - 2) * 2.54f);
-				if (img->xres <= 0 || img->yres <= 0)
-				{
-					fz_warn(ctx, "invalid image resolution (%d, %d)", img->xres, img->yres);
-					img->xres = img->yres = 96;
-				}
-				break;
-			}
-			else
-			{
-				ix += lbox;
-			}
-		}
+		opj_image_destroy(jpx);
+		fz_throw(ctx, FZ_ERROR_GENERIC, "JPX image has no components");
 	}
 
-	return img;
+	*wp = jpx->comps[0].w;
+	*hp = jpx->comps[0].h;
+	numcomps = jpx->numcomps;
+	color_space = jpx->color_space;
+	opj_image_destroy(jpx);
+
+	jpx_read_color(ctx, data, size, &color_space, &numcomps);
+	jpx_get_components(numcomps, color_space, &n, &a);
+
+	/* fz_load_jpx converts CMYK with alpha to RGB */
+	if (n == 1)
+		*cspacep = fz_device_gray(ctx);
+	else if (n == 3 || a)
+		*cspacep = fz_device_rgb(ctx);
+	else
+		*cspacep = fz_device_cmyk(ctx);
+
+	*xresp = *yresp = 96;
+	jpx_read_resolution(ctx, data, size, xresp, yresp);
 }
@@ -6,6 +6,7 @@
  * Limited bit depths (1,2,4,8).
  * Limited planar configurations (1=chunky).
  * No tiles (easy fix if necessary).
+ * Strips outside of a requested range of rows can be skipped.
  * TODO: RGBPal images
  */
 
@@ -822,11 +823,42 @@ fz_decode_tiff_ifd(fz_context *ctx, struct tiff *tiff)
 	}
 }
 
-fz_pixmap *
-fz_load_tiff_subimage(fz_context *ctx, unsigned char *buf, int len, int subimage)
+/* Restricts decoding to the strips containing rows y0 to y1 and
+ * returns the first row of the first of these strips */
+static unsigned
+fz_select_tiff_strips(struct tiff *tiff, unsigned y0, unsigned y1)
+{
+	unsigned first, last;
+
+	if (!tiff->rowsperstrip || !tiff->stripoffsets || !tiff->stripbytecounts)
+		return 0;
+	if (y1 > tiff->imagelength)
+		y1 = tiff->imagelength;
+	if (y0 >= y1)
+		return 0;
+
+	first = y0 / tiff->rowsperstrip;
+	last = (y1 - 1) / tiff->rowsperstrip;
+	if (first >= tiff->stripoffsetslen || first >= tiff->stripbytecountslen)
+		return 0;
+
+	tiff->stripoffsets += first;
+	tiff->stripbytecounts += first;
+	tiff->stripoffsetslen -= first;
+	tiff->stripbytecountslen -= first;
+	tiff->imagelength = fz_mini(tiff->imagelength, (last + 1) * tiff->rowsperstrip) - first * tiff->rowsperstrip;
+
+	return first * tiff->rowsperstrip;
+}
+
+static fz_pixmap *
+fz_load_tiff_imp(fz_context *ctx, unsigned char *buf, int len, int subimage, int y0, int y1)
 {
 	fz_pixmap *image;
 	struct tiff tiff = { 0 };
+	unsigned first_row = 0, first_strip = 0;
+
+	fz_var(first_strip);
 
 	fz_try(ctx)
 	{
@@ -839,6 +871,12 @@ fz_load_tiff_subimage(fz_context *ctx, unsigned char *buf, int len, int subimage
 		if (tiff.rowsperstrip > tiff.imagelength)
 			tiff.rowsperstrip = tiff.imagelength;
 
+		if (y0 < y1)
+		{
+			first_row = fz_select_tiff_strips(&tiff, y0, y1);
+			first_strip = tiff.rowsperstrip ? first_row / tiff.rowsperstrip : 0;
+		}
+
 		fz_decode_tiff_strips(&tiff);
 
 		/* Byte swap 16-bit images to big endian if necessary */
@@ -850,6 +888,7 @@ fz_load_tiff_subimage(fz_context *ctx, unsigned char *buf, int len, int subimage
 		image = fz_new_pixmap(tiff.ctx, tiff.colorspace, tiff.imagewidth, tiff.imagelength);
 		image->xres = tiff.xresolution;
 		image->yres = tiff.yresolution;
+		image->y = first_row;
 
 		fz_unpack_tile(image, tiff.samples, tiff.samplesperpixel, tiff.bitspersample, tiff.stride, 0);
 
@@ -863,6 +902,7 @@ fz_load_tiff_subimage(fz_context *ctx, unsigned char *buf, int len, int subimage
 				fz_convert_pixmap(tiff.ctx, rgb, image);
 				rgb->xres = image->xres;
 				rgb->yres = image->yres;
+				rgb->y = image->y;
 				fz_drop_pixmap(ctx, image);
 				image = rgb;
 			}
@@ -873,8 +913,8 @@ fz_load_tiff_subimage(fz_context *ctx, unsigned char *buf, int len, int subimage
 	{
 		/* Clean up scratch memory */
 		if (tiff.colormap) fz_free(ctx, tiff.colormap);
-		if (tiff.stripoffsets) fz_free(ctx, tiff.stripoffsets);
-		if (tiff.stripbytecounts) fz_free(ctx, tiff.stripbytecounts);
+		if (tiff.stripoffsets) fz_free(ctx, tiff.stripoffsets - first_strip);
+		if (tiff.stripbytecounts) fz_free(ctx, tiff.stripbytecounts - first_strip);
 		if (tiff.samples) fz_free(ctx, tiff.samples);
 		if (tiff.profile) fz_free(ctx, tiff.profile);
 	}
@@ -886,12 +926,24 @@ fz_load_tiff_subimage(fz_context *ctx, unsigned char *buf, int len, int subimage
 	return image;
 }
 
+fz_pixmap *
+fz_load_tiff_subimage(fz_context *ctx, unsigned char *buf, int len, int subimage)
+{
+	return fz_load_tiff_imp(ctx, buf, len, subimage, 0, 0);
+}
+
 fz_pixmap *
 fz_load_tiff(fz_context *ctx, unsigned char *buf, int len)
 {
 	return fz_load_tiff_subimage(ctx, buf, len, 0);
 }
 
+fz_pixmap *
+fz_load_tiff_rows(fz_context *ctx, unsigned char *buf, int len, int y0, int y1)
+{
+	return fz_load_tiff_imp(ctx, buf, len, 0, y0, y1);
+}
+
 void
 fz_load_tiff_info_subimage(fz_context *ctx, unsigned char *buf, int len, int *wp, int *hp, int *xresp, int *yresp, fz_colorspace **cspacep, int subimage)
 {
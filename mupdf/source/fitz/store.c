@@ -53,6 +53,12 @@ fz_new_store_context(fz_context *ctx, unsigned int max)
 	ctx->store = store;
 }
 
+unsigned int
+fz_store_max(fz_context *ctx)
+{
+	return ctx->store ? ctx->store->max : FZ_STORE_UNLIMITED;
+}
+
 void *
 fz_keep_storable(fz_context *ctx, fz_storable *s)
 {
@@ -136,7 +136,8 @@ fz_test_fill_image(fz_device *dev, fz_image *image, const fz_matrix *ctm, float
 	if (*t->is_color || !image->colorspace || image->colorspace == fz_device_gray(ctx))
 		return;
 
-	if (image->buffer && image->bpc == 8)
+	/* JPX images can't be decoded through a stream */
+	if (image->buffer && image->bpc == 8 && image->buffer->params.type != FZ_IMAGE_JPX)
 	{
 		fz_stream *stream = fz_open_compressed_buffer(ctx, image->buffer);
 		count = (unsigned int)image->w * (unsigned int)image->h;
@@ -208,13 +208,16 @@ pdf_load_jpx(pdf_document *doc, pdf_obj *dict, int forcemask)
 {
 	fz_buffer *buf = NULL;
 	fz_colorspace *colorspace = NULL;
-	fz_pixmap *img = NULL;
+	fz_colorspace *jpx_colorspace;
+	fz_compressed_buffer *bc;
+	fz_image *image = NULL;
 	pdf_obj *obj;
 	fz_context *ctx = doc->ctx;
 	int indexed = 0;
 	fz_image *mask = NULL;
+	float decode[FZ_MAX_COLORS * 2];
+	int w, h, xres, yres, i;
 
-	fz_var(img);
 	fz_var(buf);
 	fz_var(colorspace);
 	fz_var(mask);
@@ -224,14 +227,20 @@ pdf_load_jpx(pdf_document *doc, pdf_obj *dict, int forcemask)
 	/* FIXME: We can't handle decode arrays for indexed images currently */
 	fz_try(ctx)
 	{
+		/* Only parse the header here; the image is decoded by
+		 * fz_image_get_pixmap at the resolution it is drawn at */
+		fz_load_jpx_info(ctx, buf->data, buf->len, &w, &h, &xres, &yres, &jpx_colorspace);
+
 		obj = pdf_dict_gets(dict, "ColorSpace");
 		if (obj)
 		{
+			/* mismatches are only detected (and warned about) when
+			 * decoding, as the JPX colorspace is just a guess before */
 			colorspace = pdf_load_colorspace(doc, obj);
 			indexed = fz_colorspace_is_indexed(colorspace);
 		}
-
-		img = fz_load_jpx(ctx, buf->data, buf->len, colorspace, indexed);
+		if (!colorspace)
+			colorspace = fz_keep_colorspace(ctx, jpx_colorspace);
 
 		obj = pdf_dict_getsa(dict, "SMask", "Mask");
 		if (pdf_is_dict(obj))
@@ -245,27 +254,29 @@ pdf_load_jpx(pdf_document *doc, pdf_obj *dict, int forcemask)
 		obj = pdf_dict_getsa(dict, "Decode", "D");
 		if (obj && !indexed)
 		{
-			float decode[FZ_MAX_COLORS * 2];
-			int i;
-
-			for (i = 0; i < img->n * 2; i++)
+			for (i = 0; i < colorspace->n * 2; i++)
 				decode[i] = pdf_to_real(pdf_array_get(obj, i));
-
-			fz_decode_tile(img, decode);
 		}
-	}
-	fz_always(ctx)
-	{
-		fz_drop_colorspace(ctx, colorspace);
-		fz_drop_buffer(ctx, buf);
+		else
+			obj = NULL;
+
+		bc = fz_malloc_struct(ctx, fz_compressed_buffer);
+		bc->buffer = buf;
+		bc->params.type = FZ_IMAGE_JPX;
+		buf = NULL;
+
+		image = fz_new_image(ctx, w, h, 8, colorspace, xres, yres, 0, 0, obj ? decode : NULL, NULL, bc, mask);
 	}
 	fz_catch(ctx)
 	{
-		fz_drop_pixmap(ctx, img);
+		/* fz_new_image frees bc (and the buffer it holds) on failure */
+		fz_drop_buffer(ctx, buf);
+		fz_drop_colorspace(ctx, colorspace);
+		fz_drop_image(ctx, mask);
 		fz_rethrow(ctx);
 	}
 
-	return fz_new_image_from_pixmap(ctx, img, mask);
+	return image;
 }
 
 static int
@@ -159,27 +159,135 @@ pdf_count_pages_before_kid(pdf_document *doc, pdf_obj *parent, int kid_num)
 	fz_throw(doc->ctx, FZ_ERROR_GENERIC, "kid not found in parent's kids array");
 }
 
-int
-pdf_lookup_page_number(pdf_document *doc, pdf_obj *node)
+void
+pdf_drop_page_objs(pdf_document *doc)
+{
+	int i;
+
+	if (!doc->page_objs)
+		return;
+	for (i = 0; i < doc->page_objs_len; i++)
+		pdf_drop_obj(doc->page_objs[i]);
+	fz_free(doc->ctx, doc->page_objs);
+	doc->page_objs = NULL;
+	doc->page_objs_len = 0;
+}
+
+typedef struct pdf_page_objs_frame_s
+{
+	pdf_obj *kids;
+	int i, len;
+	int next_page_no;
+} pdf_page_objs_frame;
+
+/* SumatraPDF: collect all page objects in a single walk of the page tree
+ * (pages are numbered as by pdf_lookup_page_obj, i.e. subtrees with fewer
+ * pages than their /Count claim still take up /Count page numbers) */
+static void
+pdf_load_page_objs(pdf_document *doc)
 {
 	fz_context *ctx = doc->ctx;
-	int needle = pdf_to_num(node);
-	int total = 0;
-	pdf_obj *parent, *parent2;
+	int count = pdf_count_pages(doc);
+	pdf_obj **page_objs = NULL;
+	pdf_page_objs_frame *stack = NULL;
+	pdf_page_objs_frame top;
+	int stack_len = 0, stack_max = 0, page_no = 0, i;
+
+	top.kids = pdf_dict_getp(pdf_trailer(doc), "Root/Pages/Kids");
+	top.i = -1;
+	top.len = pdf_array_len(top.kids);
+	top.next_page_no = 0;
+	if (pdf_mark_obj(top.kids))
+		fz_throw(ctx, FZ_ERROR_GENERIC, "cycle in page tree");
+
+	fz_var(page_objs);
+	fz_var(stack);
+	fz_var(stack_len);
+	fz_var(top);
 
-	if (strcmp(pdf_to_name(pdf_dict_gets(node, "Type")), "Page") != 0)
-		fz_throw(ctx, FZ_ERROR_GENERIC, "invalid page object");
+	fz_try(ctx)
+	{
+		page_objs = fz_calloc(ctx, count, sizeof(pdf_obj *));
+		for (;;)
+		{
+			pdf_obj *kid;
+			char *type;
 
-	/* cf. http://bugs.ghostscript.com/show_bug.cgi?id=695761 */
-	if (doc->page_objs)
+			top.i++;
+			if (top.i == top.len)
+			{
+				pdf_unmark_obj(top.kids);
+				if (page_no < top.next_page_no)
+					page_no = top.next_page_no;
+				if (stack_len == 0)
+					break;
+				top = stack[--stack_len];
+				continue;
+			}
+
+			kid = pdf_array_get(top.kids, top.i);
+			type = pdf_to_name(pdf_dict_gets(kid, "Type"));
+			if (*type ? !strcmp(type, "Pages") : pdf_dict_gets(kid, "Kids") && !pdf_dict_gets(kid, "MediaBox"))
+			{
+				int kid_count = pdf_to_int(pdf_dict_gets(kid, "Count"));
+				if (kid_count > 0)
+				{
+					if (stack_len == stack_max)
+					{
+						stack_max = stack_max ? stack_max * 2 : 16;
+						stack = fz_resize_array(ctx, stack, stack_max, sizeof(*stack));
+					}
+					stack[stack_len++] = top;
+					top.kids = pdf_dict_gets(kid, "Kids");
+					top.i = -1;
+					top.len = pdf_array_len(top.kids);
+					top.next_page_no = page_no + kid_count;
+					if (pdf_mark_obj(top.kids))
+					{
+						top = stack[--stack_len];
+						fz_throw(ctx, FZ_ERROR_GENERIC, "cycle in page tree");
+					}
+				}
+			}
+			else
+			{
+				if (*type ? strcmp(type, "Page") != 0 : !pdf_dict_gets(kid, "MediaBox"))
+					fz_warn(ctx, "non-page object in page tree (%s)", type);
+				if (page_no >= count)
+					fz_throw(ctx, FZ_ERROR_GENERIC, "found more /Page objects than anticipated");
+				page_objs[page_no++] = pdf_keep_obj(kid);
+			}
+		}
+	}
+	fz_always(ctx)
 	{
-		int i;
-		for (i = 0; i < doc->page_count; i++)
-			if (!pdf_objcmp(doc->page_objs[i], node))
-				return i;
-		fz_throw(ctx, FZ_ERROR_GENERIC, "invalid page object");
+		fz_free(ctx, stack);
+	}
+	fz_catch(ctx)
+	{
+		if (top.i < top.len)
+			pdf_unmark_obj(top.kids);
+		for (i = 0; i < stack_len; i++)
+			pdf_unmark_obj(stack[i].kids);
+		if (page_objs)
+			for (i = 0; i < count; i++)
+				pdf_drop_obj(page_objs[i]);
+		fz_free(ctx, page_objs);
+		fz_rethrow(ctx);
 	}
 
+	doc->page_objs = page_objs;
+	doc->page_objs_len = count;
+}
+
+static int
+pdf_lookup_page_number_from_parents(pdf_document *doc, pdf_obj *node)
+{
+	fz_context *ctx = doc->ctx;
+	int needle = pdf_to_num(node);
+	int total = 0;
+	pdf_obj *parent, *parent2;
+
 	parent2 = parent = pdf_dict_gets(node, "Parent");
 	fz_var(parent);
 	fz_try(ctx)
@@ -212,6 +320,42 @@ pdf_lookup_page_number(pdf_document *doc, pdf_obj *node)
 	return total;
 }
 
+int
+pdf_lookup_page_number(pdf_document *doc, pdf_obj *node)
+{
+	fz_context *ctx = doc->ctx;
+	int i, number = -1;
+
+	if (strcmp(pdf_to_name(pdf_dict_gets(node, "Type")), "Page") != 0)
+		fz_throw(ctx, FZ_ERROR_GENERIC, "invalid page object");
+
+	/* cf. http://bugs.ghostscript.com/show_bug.cgi?id=695761 */
+	/* SumatraPDF: only walk the whole page tree if the /Parent chain
+	 * doesn't lead back to the same page */
+	if (!doc->page_objs)
+	{
+		fz_try(ctx)
+		{
+			number = pdf_lookup_page_number_from_parents(doc, node);
+			if (pdf_objcmp(pdf_lookup_page_obj(doc, number), node))
+				number = -1;
+		}
+		fz_catch(ctx)
+		{
+			number = -1;
+		}
+		if (number >= 0)
+			return number;
+		pdf_load_page_objs(doc);
+	}
+
+	for (i = 0; i < doc->page_objs_len; i++)
+		if (!pdf_objcmp(doc->page_objs[i], node))
+			return i;
+	fz_throw(ctx, FZ_ERROR_GENERIC, "invalid page object");
+	return -1;
+}
+
 /* SumatraPDF: make pdf_lookup_inherited_page_item externally available */
 pdf_obj *
 pdf_lookup_inherited_page_item(pdf_document *doc, pdf_obj *node, const char *key)
@@ -615,6 +759,7 @@ pdf_delete_page(pdf_document *doc, int at)
 	}
 
 	doc->page_count = 0; /* invalidate cached value */
+	pdf_drop_page_objs(doc);
 }
 
 void
@@ -685,6 +830,7 @@ pdf_insert_page(pdf_document *doc, pdf_page *page, int at)
 	}
 
 	doc->page_count = 0; /* invalidate cached value */
+	pdf_drop_page_objs(doc);
 }
 
 void
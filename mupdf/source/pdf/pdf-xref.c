@@ -1284,12 +1284,21 @@ pdf_init_document(pdf_document *doc)
 		/* Check to see if we should work in progressive mode */
 		if (fz_stream_meta(doc->file, FZ_STREAM_META_PROGRESSIVE, 0, NULL) > 0)
 			doc->file_reading_linearly = 1;
+		/* SumatraPDF: allow reading linearized files progressively even if all data is available */
+		doc->linear_data_available = fz_stream_meta(doc->file, FZ_STREAM_META_DATA_AVAILABLE, 0, NULL) > 0;
 
 		/* Try to load the linearized file if we are in progressive
 		 * mode. */
 		if (doc->file_reading_linearly)
 			pdf_load_linear(doc);
 
+		/* SumatraPDF: never throw FZ_ERROR_TRYLATER for files which aren't linearized */
+		if (!doc->file_reading_linearly && doc->linear_data_available)
+		{
+			doc->linear_data_available = 0;
+			doc->file_length = 0;
+		}
+
 		/* If we aren't in progressive mode (or the linear load failed
 		 * and has set us back to non-progressive mode), load normally.
 		 */
@@ -1302,6 +1311,12 @@ pdf_init_document(pdf_document *doc)
 		fz_rethrow_if(ctx, FZ_ERROR_TRYLATER);
 		fz_warn(ctx, "trying to repair broken xref");
 		repaired = 1;
+		/* SumatraPDF: the repaired xref is complete */
+		if (doc->linear_data_available)
+		{
+			doc->linear_data_available = 0;
+			doc->file_length = 0;
+		}
 	}
 
 	fz_try(ctx)
@@ -1444,6 +1459,7 @@ pdf_close_document(pdf_document *doc)
 		}
 		fz_free(ctx, doc->linear_page_refs);
 	}
+	pdf_drop_page_objs(doc);
 	fz_free(ctx, doc->hint_page);
 	fz_free(ctx, doc->hint_shared_ref);
 	fz_free(ctx, doc->hint_shared);
@@ -1773,6 +1789,9 @@ pdf_load_hinted_page(pdf_document *doc, int pagenum)
 
 }
 
+/* SumatraPDF: number of objects to parse while looking for an unhinted object */
+#define MAX_HINTED_OBJECT_SCAN 256
+
 static int
 read_hinted_object(pdf_document *doc, int num)
 {
@@ -1783,6 +1802,7 @@ read_hinted_object(pdf_document *doc, int num)
 	int expected = num;
 	int curr_pos;
 	int start, offset;
+	int scanned = 0, gave_up = 0;
 
 	while (doc->hint_obj_offsets[expected] == 0 && expected > 0)
 		expected--;
@@ -1795,6 +1815,8 @@ read_hinted_object(pdf_document *doc, int num)
 	offset = doc->hint_obj_offsets[expected];
 
 	fz_var(expected);
+	fz_var(scanned);
+	fz_var(gave_up);
 
 	fz_try(ctx)
 	{
@@ -1803,10 +1825,19 @@ read_hinted_object(pdf_document *doc, int num)
 		/* Try to read forward from there */
 		do
 		{
+			/* SumatraPDF: rather read the main xref than most of the file */
+			if (doc->linear_data_available && ++scanned > MAX_HINTED_OBJECT_SCAN)
+			{
+				gave_up = 1;
+				break;
+			}
 			start = offset;
 			DEBUGMESS((ctx, "Searching for object %d @ %d", expected, offset));
 			pdf_obj_read(doc, &offset, &found, 0);
 			DEBUGMESS((ctx, "Found object %d - next will be @ %d", found, offset));
+			/* SumatraPDF: don't write outside of hint_obj_offsets */
+			if (found <= 0 || found + 1 >= doc->hint_obj_offsets_max)
+				fz_throw(ctx, FZ_ERROR_GENERIC, "object %d out of hinted range", found);
 			if (found <= expected)
 			{
 				/* We found the right one (or one earlier than
@@ -1841,9 +1872,12 @@ read_hinted_object(pdf_document *doc, int num)
 		/* FIXME: Currently we ignore the hint. Perhaps we should
 		 * drop back to non-hinted operation here. */
 		doc->hint_obj_offsets[expected] = 0;
+		/* SumatraPDF: fall back to the main xref instead */
+		if (doc->linear_data_available)
+			return 0;
 		fz_rethrow(ctx);
 	}
-	return 1;
+	return !gave_up;
 }
 
 pdf_xref_entry *
@@ -1929,10 +1963,17 @@ object_updated:
 				fz_throw(ctx, FZ_ERROR_GENERIC, "object (%d %d R) was not found in its object stream", num, gen);
 		}
 	}
-	else if (doc->hint_obj_offsets && read_hinted_object(doc, num))
+	/* SumatraPDF: hint_obj_offsets doesn't grow with the xref */
+	else if (doc->hint_obj_offsets && num < doc->hint_obj_offsets_max && read_hinted_object(doc, num))
 	{
 		goto object_updated;
 	}
+	/* SumatraPDF: read the main xref once objects outside the hinted sections are needed */
+	else if (doc->linear_data_available && doc->linear_pos < doc->file_length)
+	{
+		pdf_load_linear_xref(doc);
+		goto object_updated;
+	}
 	else if (doc->file_length && doc->linear_pos < doc->file_length)
 	{
 		fz_throw(ctx, FZ_ERROR_TRYLATER, "cannot find object in xref (%d %d R) - not loaded yet?", num, gen);
@@ -2468,12 +2509,17 @@ pdf_load_hints(pdf_document *doc, int objnum, int gennum)
 		doc->hint_shared[i].number = j;
 
 		/* Now, actually use the data we have gathered. */
+		/* SumatraPDF: don't trust the object numbers in the hint stream */
 		for (i = 0 /*shared_obj_count_page1*/; i < shared_obj_count_total; i++)
 		{
+			if (doc->hint_shared[i].number <= 0 || doc->hint_shared[i].number >= max_object_num)
+				fz_throw(ctx, FZ_ERROR_GENERIC, "malformed hint stream (shared object numbers)");
 			doc->hint_obj_offsets[doc->hint_shared[i].number] = doc->hint_shared[i].offset;
 		}
 		for (i = 0; i < doc->page_count; i++)
 		{
+			if (doc->hint_page[i].number <= 0 || doc->hint_page[i].number >= max_object_num)
+				fz_throw(ctx, FZ_ERROR_GENERIC, "malformed hint stream (page object numbers)");
 			doc->hint_obj_offsets[doc->hint_page[i].number] = doc->hint_page[i].offset;
 		}
 	}
@@ -2610,6 +2656,58 @@ pdf_obj *pdf_progressive_advance(pdf_document *doc, int pagenum)
 	return doc->linear_page_refs[pagenum];
 }
 
+/* SumatraPDF: for linearized files with all data available, page 1 is
+ * displayed from the first page's xref section and the other pages are
+ * found through the hint tables, so that the main xref is only read once
+ * an object outside of the hinted page sections is needed */
+pdf_obj *
+pdf_lookup_linear_page_obj(pdf_document *doc, int pagenum)
+{
+	fz_context *ctx = doc->ctx;
+
+	if (!doc->linear_data_available || !doc->linear_page_refs)
+		return NULL;
+	if (pagenum < 0 || pagenum >= doc->page_count)
+		return NULL;
+
+	if (pagenum > 0 && !doc->hints_loaded && doc->hint_object_offset > 0)
+	{
+		fz_try(ctx)
+		{
+			pdf_load_hint_object(doc);
+		}
+		fz_catch(ctx)
+		{
+			fz_warn(ctx, "ignoring broken hint tables");
+		}
+		doc->hints_loaded = 1;
+	}
+
+	if (doc->hint_page)
+		pdf_load_hinted_page(doc, pagenum);
+	return doc->linear_page_refs[pagenum];
+}
+
+void
+pdf_load_linear_xref(pdf_document *doc)
+{
+	fz_context *ctx = doc->ctx;
+
+	if (!doc->linear_data_available || doc->linear_pos >= doc->file_length)
+		return;
+
+	doc->linear_pos = doc->file_length;
+	fz_try(ctx)
+	{
+		pdf_load_xref(doc, &doc->lexbuf.base);
+	}
+	fz_catch(ctx)
+	{
+		fz_warn(ctx, "trying to repair broken xref");
+		pdf_repair_xref(doc, &doc->lexbuf.base);
+	}
+}
+
 pdf_document *pdf_specifics(fz_document *doc)
 {
 	return (pdf_document *)((doc && doc->close == (fz_document_close_fn *)pdf_close_document) ? doc : NULL);
@@ -192,6 +192,18 @@ FixedPageUI = [
 	Field("InvertColors", Bool, False,
 		"if true, TextColor and BackgroundColor will be temporarily swapped",
 		internal=True),
+	Field("RenderThreads", Int, 0,
+		"number of threads rendering pages in the background (if this value isn't " +
+		"positive, one thread per processor core is used, up to 4)",
+		version="3.2"),
+	Field("BitmapCacheSize", Int, 256,
+		"maximum amount of memory (in MB) used for caching rendered pages and tiles " +
+		"(between 16 and 1024)",
+		version="3.2"),
+	Field("DisplayListCacheSize", Int, 0,
+		"maximum amount of disk space (in MB) used for caching the parsed content of " +
+		"PDF pages which take long to load (0 disables this cache)",
+		version="3.2"),
 ]
 
 EbookUI = [
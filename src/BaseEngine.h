@@ -224,6 +224,13 @@ public:
     virtual const WCHAR *FileName() const = 0;
     // number of pages the loaded document contains
     virtual int PageCount() const = 0;
+    // engines which lay out pages in the background (e.g. for ebooks) make
+    // PageCount() wait for the layout to complete - unless this has been
+    // called, after which PageCount() only grows with each call (to include
+    // the pages laid out so far resp. at least up to minPageCount);
+    // returns false once all pages have been laid out
+    // note: call this only from the thread owning the engine's consumers
+    virtual bool UpdatePageCount(int minPageCount=0) { return false; }
 
     // the box containing the visible page content (usually RectD(0, 0, pageWidth, pageHeight))
     virtual RectD PageMediabox(int pageNo) = 0;
@@ -242,6 +249,15 @@ public:
                          RectD *pageRect=nullptr, /* if nullptr: defaults to the page's mediabox */
                          RenderTarget target=Target_View, AbortCookie **cookie_out=nullptr) = 0;
     // for both rendering methods: *cookie_out must be deleted after the call returns
+    // whether RenderBitmap may be called from several threads at once without
+    // the calls blocking each other (else RenderCache uses one thread at a time)
+    virtual bool AllowsConcurrentRendering() const { return false; }
+    // renders a quick, lower quality approximation of a page (to be displayed
+    // scaled up until the page has been rendered with RenderBitmap)
+    virtual RenderedBitmap *RenderPreviewBitmap(int pageNo, float zoom, int rotation,
+                         RectD *pageRect=nullptr, AbortCookie **cookie_out=nullptr) {
+        return RenderBitmap(pageNo, zoom, rotation, pageRect, Target_View, cookie_out);
+    }
 
     // applies zoom and rotation to a point in user/page space converting
     // it into device/screen space - or in the inverse direction
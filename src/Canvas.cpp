@@ -1357,6 +1357,25 @@ static void OnTimer(WindowInfo& win, HWND hwnd, WPARAM timerId)
                 tab->AsEbook()->TriggerLayout();
         }
         break;
+
+    case PAGE_COUNT_TIMER_ID:
+        // don't change the page count underneath a running search
+        if (win.findThread)
+            break;
+        // only the current tab is updated (LoadModelIntoTab restarts the timer)
+        if (!win.AsFixed())
+            KillTimer(hwnd, PAGE_COUNT_TIMER_ID);
+        else {
+            DisplayModel *dm = win.AsFixed();
+            int pageCount = dm->PageCount();
+            if (!dm->UpdatePageCount())
+                KillTimer(hwnd, PAGE_COUNT_TIMER_ID);
+            if (dm->PageCount() != pageCount) {
+                UpdateToolbarPageText(&win, dm->PageCount(), true);
+                win.RepaintAsync();
+            }
+        }
+        break;
     }
 }
 
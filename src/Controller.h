@@ -19,6 +19,10 @@ public:
     virtual void Repaint() = 0;
     virtual void UpdateScrollbars(SizeI canvas) = 0;
     virtual void RequestRendering(int pageNo) = 0;
+    // render pages ahead of the visible ones at low priority (in the given order)
+    // resp. drop such requests again, e.g. when the scroll direction changes
+    virtual void RequestPrefetching(int fromPageNo, int toPageNo) = 0;
+    virtual void CancelPrefetching() = 0;
     virtual void CleanUp(DisplayModel *dm) = 0;
     virtual void RenderThumbnail(DisplayModel *dm, SizeI size, const std::function<void(RenderedBitmap*)>&) = 0;
     // ChmModel //
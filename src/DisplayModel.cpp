@@ -61,8 +61,15 @@
 // doesn't map to chm features well.
 
 // if true, we pre-render the pages right before and after the visible pages
+// (and further pages in scroll direction, depending on the scroll speed)
 static bool gPredictiveRender = true;
 
+// how many seconds of scrolling at the current speed to prerender
+#define PREFETCH_LOOKAHEAD_SECS 2.0
+#define MAX_PREFETCH_PAGES      16
+// the scroll speed is measured anew after a pause of this length
+#define SCROLL_PAUSE_MS         1000
+
 static int ColumnsFromDisplayMode(DisplayMode displayMode)
 {
     if (!IsSingle(displayMode))
@@ -155,9 +162,13 @@ DisplayModel::DisplayModel(BaseEngine *engine, EngineType type, ControllerCallba
     rotation(0), dpiFactor(1.0f), displayR2L(false),
     presentationMode(false), presZoomVirtual(INVALID_ZOOM),
     presDisplayMode(DM_AUTOMATIC), navHistoryIx(0),
+    scrollPos(0), scrollTime(0), scrollSpeed(0), scrollDir(0),
     dontRenderFlag(false)
 {
-    CrashIf(!engine || engine->PageCount() <= 0);
+    // only wait for the first few pages of engines which lay out in the background
+    CrashIf(!engine);
+    engine->UpdatePageCount();
+    CrashIf(engine->PageCount() <= 0);
 
     if (!engine->IsImageCollection()) {
         windowMargin = gGlobalPrefs->fixedPageUI.windowMargin;
@@ -206,6 +217,8 @@ void DisplayModel::SetInitialViewSettings(DisplayMode newDisplayMode, int newSta
 {
     totalViewPortSize = viewPort;
     dpiFactor = 1.0f * screenDPI / engine->GetFileDPI();
+    if (newStartPage > PageCount())
+        UpdatePageCount(newStartPage);
     if (ValidPageNo(newStartPage))
         startPage = newStartPage;
 
@@ -226,11 +239,16 @@ void DisplayModel::SetInitialViewSettings(DisplayMode newDisplayMode, int newSta
     BuildPagesInfo();
 }
 
-void DisplayModel::BuildPagesInfo()
+void DisplayModel::BuildPagesInfo(int fromPageNo)
 {
-    assert(!pagesInfo);
     int pageCount = PageCount();
-    pagesInfo = AllocArray<PageInfo>(pageCount);
+    if (1 == fromPageNo) {
+        assert(!pagesInfo);
+        pagesInfo = AllocArray<PageInfo>(pageCount);
+    }
+    else {
+        GrowArrayCrash(&pagesInfo, fromPageNo - 1, pageCount);
+    }
 
     WCHAR unitSystem[2] = { 0 };
     GetLocaleInfo(LOCALE_USER_DEFAULT, LOCALE_IMEASURE, unitSystem, dimof(unitSystem));
@@ -244,7 +262,7 @@ void DisplayModel::BuildPagesInfo()
     int newStartPage = startPage;
     if (IsBookView(displayMode) && newStartPage == 1 && columns > 1)
         newStartPage--;
-    for (int pageNo = 1; pageNo <= pageCount; pageNo++) {
+    for (int pageNo = fromPageNo; pageNo <= pageCount; pageNo++) {
         PageInfo *pageInfo = GetPageInfo(pageNo);
         pageInfo->page = engine->PageMediabox(pageNo);
         // layout pages with an empty mediabox as A4 size (resp. letter size)
@@ -259,6 +277,29 @@ void DisplayModel::BuildPagesInfo()
     }
 }
 
+// picks up the pages an engine has laid out in the background since the
+// last call (cf. BaseEngine::UpdatePageCount) while keeping the current
+// scroll position; returns false once all pages are available
+// note: must not be called while a search is running
+bool DisplayModel::UpdatePageCount(int minPageCount)
+{
+    int oldPageCount = PageCount();
+    bool more = engine->UpdatePageCount(minPageCount);
+    if (PageCount() == oldPageCount)
+        return more;
+
+    textCache->UpdatePageCount();
+    textSearch->UpdatePageCount();
+    if (!pagesInfo)
+        return more;
+
+    BuildPagesInfo(oldPageCount + 1);
+    ScrollState ss = GetScrollState();
+    Relayout(zoomVirtual, rotation);
+    SetScrollState(ss);
+    return more;
+}
+
 // TODO: a better name e.g. ShouldShow() to better distinguish between
 // before-layout info and after-layout visibility checks
 bool DisplayModel::PageShown(int pageNo) const
@@ -830,6 +871,49 @@ bool DisplayModel::IsOverText(PointI pt)
     return textSelection->IsOverGlyph(pageNo, pos.x, pos.y);
 }
 
+// prerender the pages the user is about to scroll to (at low priority)
+// based on the speed and direction of the most recent scrolling
+void DisplayModel::PrefetchPages(int firstVisiblePage, int lastVisiblePage)
+{
+    // determine the reading position with sub-page precision, so that
+    // both scrolling and page navigation (in all display modes) count
+    PageInfo *pageInfo = GetPageInfo(firstVisiblePage);
+    double pos = firstVisiblePage;
+    if (pageInfo->pageOnScreen.dy > 0)
+        pos += limitValue(-pageInfo->pageOnScreen.y / (double)pageInfo->pageOnScreen.dy, 0.0, 1.0);
+
+    DWORD now = GetTickCount();
+    DWORD elapsed = now - scrollTime;
+    double delta = pos - scrollPos;
+    scrollPos = pos;
+    scrollTime = now;
+
+    int dir = delta > 0 ? 1 : delta < 0 ? -1 : 0;
+    if (dir != 0) {
+        double speed = fabs(delta) * 1000 / std::max(elapsed, (DWORD)10);
+        if (dir != scrollDir) {
+            // the pages prefetched for the other direction aren't needed anymore
+            if (scrollDir != 0)
+                cb->CancelPrefetching();
+            scrollDir = dir;
+            scrollSpeed = speed;
+        }
+        else if (elapsed > SCROLL_PAUSE_MS)
+            scrollSpeed = speed;
+        else
+            scrollSpeed = (scrollSpeed + speed) / 2;
+    }
+    if (0 == scrollDir)
+        return;
+
+    int count = (int)ceil(scrollSpeed * PREFETCH_LOOKAHEAD_SECS);
+    count = std::min(count, MAX_PREFETCH_PAGES);
+    int fromPageNo = scrollDir > 0 ? lastVisiblePage + 1 : firstVisiblePage - 1;
+    int toPageNo = limitValue(fromPageNo + scrollDir * (count - 1), 1, PageCount());
+    if (count > 0 && ValidPageNo(fromPageNo))
+        cb->RequestPrefetching(fromPageNo, toPageNo);
+}
+
 void DisplayModel::RenderVisibleParts()
 {
     int firstVisiblePage = 0;
@@ -869,6 +953,7 @@ void DisplayModel::RenderVisibleParts()
             cb->RequestRendering(firstVisiblePage - 1);
         if (lastVisiblePage < PageCount())
             cb->RequestRendering(lastVisiblePage + 1);
+        PrefetchPages(firstVisiblePage, lastVisiblePage);
     }
 
     // request the visible pages last so that the above requested
@@ -177,6 +177,7 @@ public:
     void            SetInitialViewSettings(DisplayMode displayMode, int newStartPage, SizeI viewPort, int screenDPI);
     void            SetDisplayR2L(bool r2l) { displayR2L = r2l; }
     bool            GetDisplayR2L() const { return displayR2L; }
+    bool            UpdatePageCount(int minPageCount=0);
 
     bool            ShouldCacheRendering(int pageNo);
     // called when we decide that the display needs to be redrawn
@@ -189,13 +190,14 @@ public:
 
 protected:
 
-    void            BuildPagesInfo();
+    void            BuildPagesInfo(int fromPageNo=1);
     float           ZoomRealFromVirtualForPage(float zoomVirtual, int pageNo) const;
     SizeD           PageSizeAfterRotation(int pageNo, bool fitToContent=false) const;
     void            ChangeStartPage(int startPage);
     PointI          GetContentStart(int pageNo);
     void            RecalcVisibleParts();
     void            RenderVisibleParts();
+    void            PrefetchPages(int firstVisiblePage, int lastVisiblePage);
     void            AddNavPoint();
     RectD           GetContentBox(int pageNo, RenderTarget target=Target_View);
     void            CalcZoomVirtual(float zoomVirtual);
@@ -248,6 +250,15 @@ protected:
     /* index of the "current" history entry (to be updated on navigation),
        resp. number of Back history entries */
     size_t          navHistoryIx;
+
+    /* reading position (in pages) and time of the last call to RenderVisibleParts,
+       used for predicting which pages will be needed next */
+    double          scrollPos;
+    DWORD           scrollTime;
+    /* smoothed scroll speed (in pages per second) in scrollDir direction
+       (1 for forward, -1 for backward, 0 if the user hasn't scrolled yet) */
+    double          scrollSpeed;
+    int             scrollDir;
 };
 
 int     NormalizeRotation(int rotation);
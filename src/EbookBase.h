@@ -9,6 +9,15 @@ struct ImageData {
     size_t      len;
 };
 
+// implemented by documents which load image data on demand (and might
+// unload it again in order to keep memory usage bounded)
+class ImageDataSource {
+public:
+    // returns a copy of the image's data (caller must free() the result)
+    virtual char *LoadImageData(size_t imageId, size_t *lenOut) = 0;
+    virtual ~ImageDataSource() { }
+};
+
 class EbookTocVisitor {
 public:
     virtual void Visit(const WCHAR *name, const WCHAR *url, int level) = 0;
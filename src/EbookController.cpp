@@ -4,6 +4,8 @@
 // utils
 #include "BaseUtil.h"
 #include "ArchUtil.h"
+#include "CryptoUtil.h"
+#include "FileUtil.h"
 #include "GdiPlusUtil.h"
 #include "HtmlParserLookup.h"
 #include "HtmlPullParser.h"
@@ -69,15 +71,95 @@ public:
     virtual WCHAR *GetDestValue() const { return str::Dup(url); }
 };
 
+#define LAYOUT_CACHE_VERSION 1
+// the least recently written files beyond this number are deleted
+#define MAX_LAYOUT_CACHE_FILES 256
+
+static WCHAR *gLayoutCacheDir = nullptr;
+
+void SetEbookLayoutCacheDir(const WCHAR *dir)
+{
+    free(gLayoutCacheDir);
+    gLayoutCacheDir = dir ? str::Dup(dir) : nullptr;
+}
+
+// the cache file name is a fingerprint of the document (path, size and
+// modification time) and of all the arguments which affect its layout
+static WCHAR *GetLayoutCachePath(Doc& doc, HtmlFormatterArgs *args)
+{
+    const WCHAR *filePath = doc.GetFilePath();
+    if (!gLayoutCacheDir || !filePath)
+        return nullptr;
+    FILETIME modified = file::GetModificationTime(filePath);
+    ScopedMem<char> key(str::Format("%S|%I64d|%x%08x|%S|%.2f|%.2f|%.2f|%d",
+        filePath, file::GetSize(filePath), modified.dwHighDateTime, modified.dwLowDateTime,
+        args->GetFontName(), args->fontSize, args->pageDx, args->pageDy, (int)args->textRenderMethod));
+    unsigned char digest[16];
+    CalcMD5Digest((unsigned char *)key.Get(), str::Len(key), digest);
+    ScopedMem<char> fingerprint(_MemToHex(&digest));
+    return str::Format(L"%s\\%S.layout", gLayoutCacheDir, fingerprint.Get());
+}
+
+static bool LoadLayoutCache(const WCHAR *path, Vec<int>& pageStarts)
+{
+    size_t len;
+    ScopedMem<char> data(file::ReadAll(path, &len));
+    if (!data || len < 2 * sizeof(int) || len % sizeof(int) != 0)
+        return false;
+    int *values = (int *)data.Get();
+    if (values[0] != LAYOUT_CACHE_VERSION)
+        return false;
+    size_t count = len / sizeof(int) - 1;
+    for (size_t i = 1; i <= count; i++) {
+        if (values[i] < 0 || (i > 1 && values[i] <= values[i - 1]))
+            return false;
+    }
+    pageStarts.Append(values + 1, count);
+    return true;
+}
+
+static void SaveLayoutCache(const WCHAR *path, Vec<int>& pageStarts)
+{
+    Vec<int> data;
+    data.Append(LAYOUT_CACHE_VERSION);
+    data.Append(pageStarts.LendData(), pageStarts.Count());
+    dir::CreateAll(gLayoutCacheDir);
+    if (!file::WriteAll(path, data.LendData(), data.Count() * sizeof(int)))
+        return;
+
+    // a file is added at a time, so deleting the oldest one suffices
+    ScopedMem<WCHAR> pattern(path::Join(gLayoutCacheDir, L"*.layout"));
+    WIN32_FIND_DATA fdata;
+    HANDLE hfind = FindFirstFile(pattern, &fdata);
+    if (INVALID_HANDLE_VALUE == hfind)
+        return;
+    size_t count = 0;
+    FILETIME oldestTime = fdata.ftLastWriteTime;
+    ScopedMem<WCHAR> oldest(str::Dup(fdata.cFileName));
+    do {
+        count++;
+        if (CompareFileTime(&fdata.ftLastWriteTime, &oldestTime) < 0) {
+            oldestTime = fdata.ftLastWriteTime;
+            oldest.Set(str::Dup(fdata.cFileName));
+        }
+    } while (FindNextFile(hfind, &fdata));
+    FindClose(hfind);
+    if (count > MAX_LAYOUT_CACHE_FILES)
+        file::Delete(ScopedMem<WCHAR>(path::Join(gLayoutCacheDir, oldest)));
+}
+
 struct EbookFormattingData {
     enum { MAX_PAGES = 256 };
     HtmlPage *         pages[MAX_PAGES];
     size_t             pageCount;
     bool               finished;
     LONG               threadNo;
+    // if set, pages are the ones starting at this page number, formatted
+    // from a cached page start (instead of the next pages from the beginning)
+    int                previewPageNo;
 
-    EbookFormattingData(HtmlPage **pages, size_t pageCount, bool finished, LONG threadNo) :
-        pageCount(pageCount), finished(finished), threadNo(threadNo) {
+    EbookFormattingData(HtmlPage **pages, size_t pageCount, bool finished, LONG threadNo, int previewPageNo=0) :
+        pageCount(pageCount), finished(finished), threadNo(threadNo), previewPageNo(previewPageNo) {
         CrashIf(pageCount > MAX_PAGES);
         memcpy(this->pages, pages, pageCount * sizeof(*pages));
     }
@@ -100,20 +182,28 @@ class EbookFormattingThread : public ThreadBase {
     int         reparseIdx;
     int         pagesAfterReparseIdx;
 
+    // the page containing reparseIdx and its start, if
+    // known from a cached layout (0 and -1 otherwise)
+    int         previewPageNo;
+    int         previewReparseIdx;
+
 public:
     void        SendPagesIfNecessary(bool force, bool finished);
+    void        FormatPreview();
     bool        Format();
 
-    EbookFormattingThread(Doc doc, HtmlFormatterArgs *args,
-                          EbookController *ctrl, int reparseIdx, ControllerCallback *cb);
+    EbookFormattingThread(Doc doc, HtmlFormatterArgs *args, EbookController *ctrl, int reparseIdx,
+                          ControllerCallback *cb, int previewPageNo=0, int previewReparseIdx=-1);
     virtual ~EbookFormattingThread();
 
     // ThreadBase
     virtual void Run();
 };
 
-EbookFormattingThread::EbookFormattingThread(Doc doc, HtmlFormatterArgs *args, EbookController *ctrl, int reparseIdx, ControllerCallback *cb) :
-    doc(doc), formatterArgs(args), cb(cb), controller(ctrl), pageCount(0), reparseIdx(reparseIdx), pagesAfterReparseIdx(0)
+EbookFormattingThread::EbookFormattingThread(Doc doc, HtmlFormatterArgs *args, EbookController *ctrl, int reparseIdx,
+                                             ControllerCallback *cb, int previewPageNo, int previewReparseIdx) :
+    doc(doc), formatterArgs(args), cb(cb), controller(ctrl), pageCount(0), reparseIdx(reparseIdx), pagesAfterReparseIdx(0),
+    previewPageNo(previewPageNo), previewReparseIdx(previewReparseIdx)
 {
     CrashIf(reparseIdx < 0);
     AssertCrash(doc.IsDocLoaded() || (doc.IsNone() && (nullptr != args->htmlStr)));
@@ -139,10 +229,41 @@ void EbookFormattingThread::SendPagesIfNecessary(bool force, bool finished)
     cb->HandleLayoutedPages(controller, msg);
 }
 
+// layout the (2 to accomodate a possible 2 page view) pages starting at
+// the cached start of the page containing reparseIdx, so that they can be
+// shown before the layout from the beginning has gotten there
+void EbookFormattingThread::FormatPreview()
+{
+    formatterArgs->reparseIdx = previewReparseIdx;
+    HtmlFormatter *formatter = doc.CreateFormatter(formatterArgs);
+    while (pageCount < 2 && !WasCancelRequested()) {
+        HtmlPage *pd = formatter->Next();
+        if (!pd)
+            break;
+        pages[pageCount++] = pd;
+    }
+    delete formatter;
+
+    if (WasCancelRequested() || 0 == pageCount) {
+        for (int i = 0; i < pageCount; i++) {
+            delete pages[i];
+        }
+        pageCount = 0;
+        return;
+    }
+    EbookFormattingData *msg = new EbookFormattingData(pages, pageCount, false, GetNo(), previewPageNo);
+    pageCount = 0;
+    memset(pages, 0, sizeof(pages));
+    cb->HandleLayoutedPages(controller, msg);
+}
+
 // layout pages from a given reparse point (beginning if nullptr)
 // returns true if layout thread was cancelled
 bool EbookFormattingThread::Format()
 {
+    if (previewPageNo > 0)
+        FormatPreview();
+
     //lf("Started laying out ebook, reparseIdx=%d", reparseIdx);
     int totalPageCount = 0;
     formatterArgs->reparseIdx = 0;
@@ -198,7 +319,7 @@ static void DeletePages(Vec<HtmlPage*>** toDeletePtr)
 }
 
 EbookController::EbookController(EbookControls *ctrls, ControllerCallback *cb) :
-    Controller(cb), ctrls(ctrls), pages(nullptr), incomingPages(nullptr),
+    Controller(cb), ctrls(ctrls), pages(nullptr), incomingPages(nullptr), previewPages(nullptr),
     currPageNo(0), pageSize(0, 0), formattingThread(nullptr), formattingThreadNo(-1),
     currPageReparseIdx(0), handleMsgs(true), pageAnchorIds(nullptr), pageAnchorIdxs(nullptr),
     navHistoryIx(0)
@@ -258,6 +379,32 @@ void EbookController::StopFormattingThread()
     formattingThread = nullptr;
     formattingThreadNo = -1;
     DeletePages(&incomingPages);
+    DeletePreviewPages();
+}
+
+void EbookController::DeletePreviewPages()
+{
+    if (!previewPages)
+        return;
+    PageControl *page1 = ctrls->pagesLayout->GetPage1();
+    PageControl *page2 = ctrls->pagesLayout->GetPage2();
+    if (previewPages->Contains(page1->GetPage()))
+        page1->SetPage(nullptr);
+    if (previewPages->Contains(page2->GetPage()))
+        page2->SetPage(nullptr);
+    DeletePages(&previewPages);
+}
+
+// remembers the page starts of a completed layout (cf. TriggerLayout)
+void EbookController::UpdateLayoutCache()
+{
+    if (!layoutCachePath || !pages)
+        return;
+    Vec<int> pageStarts;
+    for (size_t i = 0; i < pages->Count(); i++) {
+        pageStarts.Append(pages->At(i)->reparseIdx);
+    }
+    SaveLayoutCache(layoutCachePath, pageStarts);
 }
 
 void EbookController::CloseCurrentDocument()
@@ -317,6 +464,21 @@ void EbookController::HandlePagesFromEbookLayout(EbookFormattingData *ft)
         return;
     }
     //lf("EbookController::HandlePagesFromEbookLayout() %d pages, ft=0x%x", ft->pageCount, (int)ft);
+    if (ft->previewPageNo != 0) {
+        CrashIf(!incomingPages || previewPages);
+        previewPages = new Vec<HtmlPage*>();
+        previewPages->Append(ft->pages, ft->pageCount);
+        currPageNo = ft->previewPageNo;
+        ctrls->pagesLayout->GetPage1()->SetPage(previewPages->At(0));
+        if (IsDoublePage() && previewPages->Count() > 1)
+            ctrls->pagesLayout->GetPage2()->SetPage(previewPages->At(1));
+        else
+            ctrls->pagesLayout->GetPage2()->SetPage(nullptr);
+        cb->PageNoChanged(currPageNo);
+        UpdateStatus();
+        delete ft;
+        return;
+    }
     if (incomingPages) {
         for (size_t i = 0; i < ft->pageCount; i++) {
             incomingPages->Append(ft->pages[i]);
@@ -328,6 +490,7 @@ void EbookController::HandlePagesFromEbookLayout(EbookFormattingData *ft)
             incomingPages = nullptr;
             DeletePages(&toDelete);
             GoToPage(pageNo, false);
+            DeletePreviewPages();
         }
     } else {
         CrashIf(!pages);
@@ -338,6 +501,7 @@ void EbookController::HandlePagesFromEbookLayout(EbookFormattingData *ft)
 
     if (ft->finished) {
         CrashIf(!pages);
+        UpdateLayoutCache();
         StopFormattingThread();
     }
     UpdateStatus();
@@ -369,7 +533,21 @@ void EbookController::TriggerLayout()
     incomingPages = new Vec<HtmlPage*>(1024);
 
     HtmlFormatterArgs *args = CreateFormatterArgsDoc(doc, size.dx, size.dy, &textAllocator);
-    formattingThread = new EbookFormattingThread(doc, args, this, currPageReparseIdx, cb);
+    // if this layout has been done before, the current page can
+    // be shown right away (e.g. when reopening a document)
+    int previewPageNo = 0;
+    Vec<int> pageStarts;
+    layoutCachePath.Set(GetLayoutCachePath(doc, args));
+    if (layoutCachePath && LoadLayoutCache(layoutCachePath, pageStarts)) {
+        for (size_t i = 0; i < pageStarts.Count() && pageStarts.At(i) <= currPageReparseIdx; i++) {
+            previewPageNo = (int)i + 1;
+        }
+    }
+    // the first pages are laid out quickly enough anyway
+    if (previewPageNo > 2)
+        formattingThread = new EbookFormattingThread(doc, args, this, currPageReparseIdx, cb, previewPageNo, pageStarts.At(previewPageNo - 1));
+    else
+        formattingThread = new EbookFormattingThread(doc, args, this, currPageReparseIdx, cb);
     formattingThreadNo = formattingThread->GetNo();
     formattingThread->Start();
     UpdateStatus();
@@ -409,6 +587,10 @@ void EbookController::ClickedProgress(Control *c, int x, int y)
 
 void EbookController::OnClickedLink(int pageNo, DrawInstr *link)
 {
+    // pageNo can't be resolved for preview pages
+    if (previewPages)
+        return;
+
     ScopedMem<WCHAR> url(str::conv::FromHtmlUtf8(link->str.s, link->str.len));
     if (url::IsAbsolute(url)) {
         EbookTocDest dest(nullptr, url);
@@ -84,6 +84,13 @@ protected:
 
     // pages being sent from background formatting thread
     Vec<HtmlPage*> *    incomingPages;
+    // the current page(s) formatted from a cached page start, shown
+    // until incomingPages have been formatted up to currPageReparseIdx
+    Vec<HtmlPage*> *    previewPages;
+
+    // where to remember the page starts of the current layout
+    // (cf. SetEbookLayoutCacheDir)
+    ScopedMem<WCHAR>    layoutCachePath;
 
     // currPageNo is in range 1..$numberOfPages.
     int             currPageNo;
@@ -110,6 +117,8 @@ protected:
     void        UpdateStatus();
     bool        FormattingInProgress() const { return formattingThread != nullptr; }
     void        StopFormattingThread();
+    void        DeletePreviewPages();
+    void        UpdateLayoutCache();
     void        CloseCurrentDocument();
     int         GetMaxPageCount() const;
     bool        IsDoublePage() const;
@@ -126,4 +135,8 @@ protected:
     void        ClickedPage2(Control *c, int x, int y);
 };
 
+// persists the page starts of reflowed ebooks in <dir>, so that the
+// last page can be shown before the layout is complete (nullptr disables this)
+void SetEbookLayoutCacheDir(const WCHAR *dir);
+
 HtmlFormatterArgs *CreateFormatterArgsDoc(Doc doc, int dx, int dy, Allocator *textAllocator=nullptr);
@@ -4,7 +4,9 @@
 // utils
 #include "BaseUtil.h"
 #include "ArchUtil.h"
+#include "Dict.h"
 #include "FileUtil.h"
+#include "GdiPlusUtil.h"
 #include "HtmlParserLookup.h"
 #include "HtmlPullParser.h"
 #include "PalmDbReader.h"
@@ -230,24 +232,56 @@ const char *EPUB_OPF_NS = "http://www.idpf.org/2007/opf";
 const char *EPUB_NCX_NS = "http://www.daisy.org/z3986/2005/ncx/";
 const char *EPUB_ENC_NS = "http://www.w3.org/2001/04/xmlenc#";
 
+// images and stylesheets are unloaded (least recently used first)
+// once they take up more than this many bytes
+#define MAX_EPUB_RESOURCES_SIZE (32 * 1024 * 1024)
+
 EpubDoc::EpubDoc(const WCHAR *fileName) :
     zip(fileName, true), fileName(str::Dup(fileName)),
-    isNcxToc(false), isRtlDoc(false) { }
+    resourceIdx(nullptr), resources(nullptr), resourcesSize(0), resourcesUsed(0),
+    isNcxToc(false), isRtlDoc(false)
+{
+    InitializeCriticalSection(&zipAccess);
+}
 
 EpubDoc::EpubDoc(IStream *stream) :
     zip(stream, true), fileName(nullptr),
-    isNcxToc(false), isRtlDoc(false) { }
+    resourceIdx(nullptr), resources(nullptr), resourcesSize(0), resourcesUsed(0),
+    isNcxToc(false), isRtlDoc(false)
+{
+    InitializeCriticalSection(&zipAccess);
+}
 
 EpubDoc::~EpubDoc()
 {
-    for (size_t i = 0; i < images.Count(); i++) {
-        free(images.At(i).base.data);
-        free(images.At(i).id);
+    if (resources) {
+        for (size_t i = 0; i < zip.GetFileCount(); i++) {
+            free(resources[i].data);
+        }
+        free(resources);
     }
+    delete resourceIdx;
+    for (size_t i = 0; i < spine.Count(); i++) {
+        free(spine.At(i).data);
+        free(spine.At(i).path);
+    }
+    DeleteCriticalSection(&zipAccess);
 }
 
 bool EpubDoc::Load()
 {
+    size_t fileCount = zip.GetFileCount();
+    resourceIdx = new dict::MapWStrToInt(std::max(fileCount, (size_t)64));
+    resources = AllocArray<EpubResource>(fileCount);
+    if (!resources)
+        return false;
+    for (size_t i = 0; i < fileCount; i++) {
+        ScopedMem<WCHAR> path(str::Dup(zip.GetFileName(i)));
+        str::ToLower(path);
+        // for duplicates, the first file wins (as for ZipFile::GetFileIndex)
+        resourceIdx->Insert(path, (int)i, nullptr);
+    }
+
     ScopedMem<char> container(zip.GetFileDataByName(L"META-INF/container.xml"));
     if (!container)
         return false;
@@ -301,23 +335,8 @@ bool EpubDoc::Load()
 
     for (node = node->down; node; node = node->next) {
         ScopedMem<WCHAR> mediatype(node->GetAttribute("media-type"));
-        if (str::Eq(mediatype, L"image/png")  ||
-            str::Eq(mediatype, L"image/jpeg") ||
-            str::Eq(mediatype, L"image/gif")) {
-            ScopedMem<WCHAR> imgPath(node->GetAttribute("href"));
-            if (!imgPath)
-                continue;
-            url::DecodeInPlace(imgPath);
-            imgPath.Set(str::Join(contentPath, imgPath));
-            if (encList.Contains(imgPath))
-                continue;
-            // load the image lazily
-            ImageData2 data = { 0 };
-            data.id = str::conv::ToUtf8(imgPath);
-            data.idx = zip.GetFileIndex(imgPath);
-            images.Append(data);
-        }
-        else if (str::Eq(mediatype, L"application/xhtml+xml") ||
+        // images are looked up by path when needed (cf. FindImage)
+        if (str::Eq(mediatype, L"application/xhtml+xml") ||
                  str::Eq(mediatype, L"application/html+xml") ||
                  str::Eq(mediatype, L"application/x-dtbncx+xml") ||
                  str::Eq(mediatype, L"text/html") ||
@@ -361,22 +380,35 @@ bool EpubDoc::Load()
             continue;
 
         ScopedMem<WCHAR> fullPath(str::Join(contentPath, pathList.At(idList.Find(idref))));
-        ScopedMem<char> html(zip.GetFileDataByName(fullPath));
-        if (!html)
-            continue;
-        html.Set(DecodeTextToUtf8(html, true));
-        if (!html)
+        // the html is only decompressed when needed (cf. GetSpineData)
+        EpubSpineItem item = { 0 };
+        item.idx = zip.GetFileIndex(fullPath);
+        if (item.idx == (size_t)-1)
             continue;
-        // insert explicit page-breaks between sections including
-        // an anchor with the file name at the top (for internal links)
-        ScopedMem<char> utf8_path(str::conv::ToUtf8(fullPath));
-        CrashIfDebugOnly(str::FindChar(utf8_path, '"'));
-        str::TransChars(utf8_path, "\"", "'");
-        htmlData.AppendFmt("<pagebreak page_path=\"%s\" page_marker />", utf8_path.Get());
-        htmlData.Append(html);
+        item.path = str::conv::ToUtf8(fullPath);
+        CrashIfDebugOnly(str::FindChar(item.path, '"'));
+        str::TransChars(item.path, "\"", "'");
+        spine.Append(item);
     }
 
-    return htmlData.Count() > 0;
+    return spine.Count() > 0;
+}
+
+// returns the item's page marker and html (or just the page marker
+// if the html can't be loaded); must be called with zipAccess held
+char *EpubDoc::LoadSpineHtml(EpubSpineItem *item, size_t *lenOut)
+{
+    str::Str<char> data;
+    // insert explicit page-breaks between sections including
+    // an anchor with the file name at the top (for internal links)
+    data.AppendFmt("<pagebreak page_path=\"%s\" page_marker />", item->path);
+    ScopedMem<char> html(zip.GetFileDataByIdx(item->idx));
+    if (html)
+        html.Set(DecodeTextToUtf8(html, true));
+    if (html)
+        data.Append(html);
+    *lenOut = data.Size();
+    return data.StealData();
 }
 
 void EpubDoc::ParseMetadata(const char *content)
@@ -421,19 +453,106 @@ void EpubDoc::ParseMetadata(const char *content)
     }
 }
 
-const char *EpubDoc::GetHtmlData(size_t *lenOut) const
+// returns the concatenation of all spine items, which is created on first
+// use (offsets into it are the same as for a formatter loading them one at
+// a time through GetSpineData, cf. EpubFormatter::LoadNextHtmlChunk)
+const char *EpubDoc::GetHtmlData(size_t *lenOut)
 {
+    ScopedCritSec scope(&zipAccess);
+
+    if (htmlData.Size() == 0) {
+        for (size_t i = 0; i < spine.Count(); i++) {
+            EpubSpineItem *item = &spine.At(i);
+            if (item->data) {
+                htmlData.Append(item->data, item->len);
+                continue;
+            }
+            // don't keep a second copy of the html around
+            size_t len;
+            ScopedMem<char> data(LoadSpineHtml(item, &len));
+            htmlData.Append(data, len);
+        }
+    }
+
     *lenOut = htmlData.Size();
     return htmlData.Get();
 }
 
-size_t EpubDoc::GetHtmlDataSize() const
+size_t EpubDoc::GetHtmlDataSize()
 {
-    return htmlData.Size();
+    size_t len;
+    GetHtmlData(&len);
+    return len;
+}
+
+size_t EpubDoc::GetSpineCount() const
+{
+    return spine.Count();
 }
 
-ImageData *EpubDoc::GetImageData(const char *id, const char *pagePath)
+// decompresses and decodes a spine item on first use; the returned
+// data remains valid for the lifetime of the document
+const char *EpubDoc::GetSpineData(size_t idx, size_t *lenOut)
 {
+    ScopedCritSec scope(&zipAccess);
+
+    CrashIf(idx >= spine.Count());
+    EpubSpineItem *item = &spine.At(idx);
+    if (!item->data)
+        item->data = LoadSpineHtml(item, &item->len);
+    *lenOut = item->len;
+    return item->data;
+}
+
+// returns the zip index of the file at url (or (size_t)-1)
+size_t EpubDoc::GetResourceIdx(const char *url)
+{
+    ScopedMem<WCHAR> path(str::conv::FromUtf8(url));
+    // some EPUB producers use wrong path separators
+    str::TransChars(path, L"\\", L"/");
+    str::ToLower(path);
+    int idx;
+    if (!resourceIdx->Get(path, &idx))
+        return (size_t)-1;
+    return (size_t)idx;
+}
+
+// decompresses a resource on first use and unloads the least recently
+// used other resources if they then take up too much memory;
+// must be called with zipAccess held
+EpubResource *EpubDoc::LoadResource(size_t idx)
+{
+    if (idx >= zip.GetFileCount())
+        return nullptr;
+    EpubResource *res = &resources[idx];
+    res->lastUse = ++resourcesUsed;
+    if (res->data)
+        return res;
+    res->data = zip.GetFileDataByIdx(idx, &res->len);
+    if (!res->data)
+        return nullptr;
+    resourcesSize += res->len;
+
+    while (resourcesSize > MAX_EPUB_RESOURCES_SIZE) {
+        EpubResource *lru = nullptr;
+        for (size_t i = 0; i < zip.GetFileCount(); i++) {
+            EpubResource *r = &resources[i];
+            if (r->data && r != res && (!lru || r->lastUse < lru->lastUse))
+                lru = r;
+        }
+        if (!lru)
+            break;
+        resourcesSize -= lru->len;
+        free(lru->data);
+        lru->data = nullptr;
+    }
+    return res;
+}
+
+size_t EpubDoc::FindImage(const char *id, const char *pagePath)
+{
+    ScopedCritSec scope(&zipAccess);
+
     if (!pagePath) {
         CrashIf(true);
         // if we're reparsing, we might not have pagePath, which is needed to
@@ -443,46 +562,45 @@ ImageData *EpubDoc::GetImageData(const char *id, const char *pagePath)
         // styling related state (such as nextPageStyle, listDepth, etc. including
         // format specific state such as hiddenDepth and titleCount) and store it
         // in every HtmlPage, but this should work well enough for now
-        for (size_t i = 0; i < images.Count(); i++) {
-            ImageData2 *img = &images.At(i);
-            if (str::EndsWithI(img->id, id)) {
-                if (!img->base.data)
-                    img->base.data = zip.GetFileDataByIdx(img->idx, &img->base.len);
-                if (img->base.data)
-                    return &img->base;
-            }
+        ScopedMem<WCHAR> path(str::conv::FromUtf8(id));
+        for (size_t i = 0; i < zip.GetFileCount(); i++) {
+            if (str::EndsWithI(zip.GetFileName(i), path))
+                return i;
         }
-        return nullptr;
+        return (size_t)-1;
     }
 
     ScopedMem<char> url(NormalizeURL(id, pagePath));
-    // some EPUB producers use wrong path separators
-    if (str::FindChar(url, '\\'))
-        str::TransChars(url, "\\", "/");
-    for (size_t i = 0; i < images.Count(); i++) {
-        ImageData2 *img = &images.At(i);
-        if (str::Eq(img->id, url)) {
-            if (!img->base.data)
-                img->base.data = zip.GetFileDataByIdx(img->idx, &img->base.len);
-            if (img->base.data)
-                return &img->base;
-        }
-    }
+    return GetResourceIdx(url);
+}
 
-    // try to also load images which aren't registered in the manifest
-    ImageData2 data = { 0 };
-    ScopedMem<WCHAR> imgPath(str::conv::FromUtf8(url));
-    data.idx = zip.GetFileIndex(imgPath);
-    if (data.idx != (size_t)-1) {
-        data.base.data = zip.GetFileDataByIdx(data.idx, &data.base.len);
-        if (data.base.data) {
-            data.id = str::Dup(url);
-            images.Append(data);
-            return &images.Last().base;
-        }
+// the size is determined when an image is first loaded, so that
+// later layouts don't have to load the image again
+SizeI EpubDoc::GetImageSize(size_t imageId)
+{
+    ScopedCritSec scope(&zipAccess);
+
+    if (imageId >= zip.GetFileCount())
+        return SizeI();
+    EpubResource *res = &resources[imageId];
+    if (!res->imageSizeKnown && LoadResource(imageId)) {
+        Size size = BitmapSizeFromData(res->data, res->len);
+        res->imageSize = SizeI(size.Width, size.Height);
+        res->imageSizeKnown = true;
     }
+    return res->imageSize;
+}
 
-    return nullptr;
+char *EpubDoc::LoadImageData(size_t imageId, size_t *lenOut)
+{
+    ScopedCritSec scope(&zipAccess);
+
+    EpubResource *res = LoadResource(imageId);
+    if (!res)
+        return nullptr;
+    *lenOut = res->len;
+    // include the zero-termination added by ZipFile
+    return (char *)memdup(res->data, res->len + 1);
 }
 
 char *EpubDoc::GetFileData(const char *relPath, const char *pagePath, size_t *lenOut)
@@ -493,8 +611,14 @@ char *EpubDoc::GetFileData(const char *relPath, const char *pagePath, size_t *le
     }
 
     ScopedMem<char> url(NormalizeURL(relPath, pagePath));
-    ScopedMem<WCHAR> zipPath(str::conv::FromUtf8(url));
-    return zip.GetFileDataByName(zipPath, lenOut);
+    ScopedCritSec scope(&zipAccess);
+    // stylesheets are usually shared by all spine items
+    EpubResource *res = LoadResource(GetResourceIdx(url));
+    if (!res)
+        return nullptr;
+    if (lenOut)
+        *lenOut = res->len;
+    return (char *)memdup(res->data, res->len + 1);
 }
 
 WCHAR *EpubDoc::GetProperty(DocumentProperty prop) const
@@ -624,7 +748,11 @@ bool EpubDoc::ParseToc(EbookTocVisitor *visitor)
     if (!tocPath)
         return false;
     size_t tocDataLen;
-    ScopedMem<char> tocData(zip.GetFileDataByName(tocPath, &tocDataLen));
+    ScopedMem<char> tocData;
+    {
+        ScopedCritSec scope(&zipAccess);
+        tocData.Set(zip.GetFileDataByName(tocPath, &tocDataLen));
+    }
     if (!tocData)
         return false;
 
@@ -3,6 +3,7 @@
 
 class HtmlPullParser;
 struct HtmlToken;
+namespace dict { class MapWStrToInt; }
 
 struct ImageData2 {
     ImageData base;
@@ -24,10 +25,40 @@ public:
 
 /* ********** EPUB ********** */
 
-class EpubDoc {
+// a document from an EPUB's spine (decompressed and decoded on demand)
+struct EpubSpineItem {
+    char *  path; // for the page marker preceding the document's html
+    size_t  idx;  // index of the document in the zip file
+    char *  data; // page marker and UTF-8 html (nullptr until loaded)
+    size_t  len;
+};
+
+// a file from an EPUB which isn't part of the spine (e.g. an image or
+// a stylesheet); decompressed on demand and unloaded again when other
+// resources have been used more recently (cf. EpubDoc::LoadResource)
+struct EpubResource {
+    char *  data; // nullptr while not loaded
+    size_t  len;
+    size_t  lastUse;
+    SizeI   imageSize;
+    bool    imageSizeKnown;
+};
+
+class EpubDoc : public ImageDataSource {
     ZipFile zip;
+    // zip can be accessed both from a formatter (loading
+    // spine items and images) and the UI (e.g. for the ToC)
+    CRITICAL_SECTION zipAccess;
+    Vec<EpubSpineItem> spine;
+    // all spine items concatenated (only created when requested)
     str::Str<char> htmlData;
-    Vec<ImageData2> images;
+    // maps lower-cased paths to zip indices (which are also
+    // indices into resources)
+    dict::MapWStrToInt *resourceIdx;
+    EpubResource *resources;
+    // total size of all currently loaded resources
+    size_t resourcesSize;
+    size_t resourcesUsed;
     ScopedMem<WCHAR> tocPath;
     ScopedMem<WCHAR> fileName;
     PropertyMap props;
@@ -35,6 +66,9 @@ class EpubDoc {
     bool isRtlDoc;
 
     bool Load();
+    char *LoadSpineHtml(EpubSpineItem *item, size_t *lenOut);
+    size_t GetResourceIdx(const char *url);
+    EpubResource *LoadResource(size_t idx);
     void ParseMetadata(const char *content);
     bool ParseNavToc(const char *data, size_t dataLen, const char *pagePath, EbookTocVisitor *visitor);
     bool ParseNcxToc(const char *data, size_t dataLen, const char *pagePath, EbookTocVisitor *visitor);
@@ -44,9 +78,15 @@ public:
     explicit EpubDoc(IStream *stream);
     ~EpubDoc();
 
-    const char *GetHtmlData(size_t *lenOut) const;
-    size_t GetHtmlDataSize() const;
-    ImageData *GetImageData(const char *id, const char *pagePath);
+    const char *GetHtmlData(size_t *lenOut);
+    size_t GetHtmlDataSize();
+    size_t GetSpineCount() const;
+    const char *GetSpineData(size_t idx, size_t *lenOut);
+    // returns an image's id for GetImageSize and LoadImageData
+    // (or (size_t)-1 if there's no file at that path)
+    size_t FindImage(const char *id, const char *pagePath);
+    SizeI GetImageSize(size_t imageId);
+    virtual char *LoadImageData(size_t imageId, size_t *lenOut);
     char *GetFileData(const char *relPath, const char *pagePath, size_t *lenOut);
 
     WCHAR *GetProperty(DocumentProperty prop) const;
@@ -14,6 +14,7 @@
 #include "HtmlPullParser.h"
 #include "Mui.h"
 #include "PalmDbReader.h"
+#include "ThreadUtil.h"
 #include "TrivialHtmlParser.h"
 #include "WinUtil.h"
 #include "ZipUtil.h"
@@ -51,6 +52,24 @@ void SetDefaultEbookFont(const WCHAR *name, float size)
 
 /* common classes for EPUB, FictionBook2, Mobi, PalmDOC, CHM, HTML and TXT engines */
 
+// number of pages laid out before loading a document returns
+// (the remaining pages are laid out in the background)
+#define EBOOK_INITIAL_PAGES 8
+// maximum number of threads laying out the parts of a document
+// in addition to EbookLayoutThread (cf. CreatePartFormatter)
+#define MAX_PART_LAYOUT_THREADS 7
+
+class EbookLayoutThread;
+class EbookPartLayoutThread;
+
+// returns 0 if there's no use in laying out parts of a document in parallel
+static int GetPartLayoutThreadCount()
+{
+    SYSTEM_INFO si;
+    GetSystemInfo(&si);
+    return limitValue((int)si.dwNumberOfProcessors - 1, 0, MAX_PART_LAYOUT_THREADS);
+}
+
 struct PageAnchor {
     DrawInstr *instr;
     int pageNo;
@@ -71,7 +90,8 @@ public:
     virtual ~EbookEngine();
 
     virtual const WCHAR *FileName() const { return fileName; };
-    virtual int PageCount() const { return pages ? (int)pages->Count() : 0; }
+    virtual int PageCount() const;
+    virtual bool UpdatePageCount(int minPageCount=0);
 
     virtual RectD PageMediabox(int pageNo) { return pageRect; }
     virtual RectD PageContentBox(int pageNo, RenderTarget target=Target_View) {
@@ -118,10 +138,35 @@ protected:
     // contains for each page the last anchor indicating
     // a break between two merged documents
     Vec<DrawInstr *> baseAnchors;
+    DrawInstr *lastBaseAnchor;
     // needed so that memory allocated by ResolveHtmlEntities isn't leaked
     PoolAllocator allocator;
-    // TODO: still needed?
+    // protects pages, anchors and baseAnchors while
+    // the remaining pages are laid out in the background
     CRITICAL_SECTION pagesAccess;
+
+    // after the first EBOOK_INITIAL_PAGES pages, formatter is
+    // used by layoutThread until all pages have been laid out
+    HtmlFormatter *formatter;
+    bool skipEmptyPages;
+    // for documents laid out in several parts, formatter only
+    // lays out the first one (cf. CreatePartFormatter)
+    size_t partCount;
+    // text allocators of the parts laid out by EbookPartLayoutThreads
+    // (PoolAllocator isn't thread-safe)
+    Vec<PoolAllocator *> partAllocators;
+    EbookLayoutThread *layoutThread;
+    // signaled once layoutThread is done
+    HANDLE layoutDone;
+    // signaled whenever layoutThread has added a page
+    HANDLE pageAdded;
+    // set by layoutThread and read by all other threads
+    // (use IsLayoutComplete/SetLayoutComplete)
+    LONG layoutComplete;
+    // the number of pages returned by PageCount() once
+    // UpdatePageCount has been called (cf. BaseEngine::UpdatePageCount)
+    int visiblePageCount;
+    bool incrementalLayout;
     // access to userAnnots is protected by pagesAccess
     Vec<PageAnnotation> userAnnots;
     // page dimensions can vary between filetypes
@@ -131,19 +176,184 @@ protected:
     void GetTransform(Matrix& m, float zoom, int rotation) {
         GetBaseTransform(m, pageRect.ToGdipRectF(), zoom, rotation);
     }
-    bool ExtractPageAnchors();
+    friend class EbookLayoutThread;
+    friend class EbookPartLayoutThread;
+    bool StartLayout(HtmlFormatter *formatter, bool skipEmptyPages, bool inBackground=true, size_t partCount=1);
+    bool LayoutNextPage();
+    void AppendPage(HtmlPage *page);
+    int LaidOutPageCount();
+    bool IsLayoutComplete() const;
+    void SetLayoutComplete();
+    void WaitForPageAdded(int minPageCount);
+    void WaitForLayout() const;
+    void WaitForPage(int pageNo);
+    void StopLayout();
+    PageDestination *FindNamedDest(const WCHAR *name);
+    void ExtractPageAnchors(HtmlPage *page, int pageNo);
     WCHAR *ExtractFontList();
 
     virtual PageElement *CreatePageLink(DrawInstr *link, RectI rect, int pageNo);
 
+    // documents consisting of parts which always start on a new page (such as
+    // EPUB spine items) can be laid out on several threads at once; the returned
+    // formatter only lays out the given part and its reparse points are relative
+    // to the part's html (which is GetPartHtmlLen bytes long)
+    virtual HtmlFormatter *CreatePartFormatter(size_t partIdx, Allocator *textAllocator) { return nullptr; }
+    virtual size_t GetPartHtmlLen(size_t partIdx) { return 0; }
+
+    // note: a page's instructions don't change once it has been laid out
     Vec<DrawInstr> *GetHtmlPage(int pageNo) {
-        CrashIf(pageNo < 1 || PageCount() < pageNo);
-        if (pageNo < 1 || PageCount() < pageNo)
+        ScopedCritSec scope(&pagesAccess);
+        CrashIf(pageNo < 1 || (int)pages->Count() < pageNo);
+        if (pageNo < 1 || (int)pages->Count() < pageNo)
             return nullptr;
         return &pages->At(pageNo - 1)->instructions;
     }
 };
 
+// lays out the parts of a document not yet claimed by other threads
+class EbookPartLayoutThread : public ThreadBase {
+    EbookLayoutThread *layout;
+
+public:
+    explicit EbookPartLayoutThread(EbookLayoutThread *layout) :
+        ThreadBase("EbookPartLayoutThread"), layout(layout) { }
+
+    virtual void Run();
+};
+
+class EbookLayoutThread : public ThreadBase {
+    EbookEngine *engine;
+
+    // for documents laid out in several parts: the first part is laid out
+    // by this thread while partThreads lay out the others, whose pages
+    // are then appended in order
+    Vec<EbookPartLayoutThread *> partThreads;
+    size_t nextPartIdx;
+    // the pages of each part (once it has been laid out)
+    Vec<HtmlPage *> **partPages;
+    CRITICAL_SECTION partsAccess;
+    // signaled whenever a part has been laid out
+    HANDLE partDone;
+
+    void StartPartLayout();
+    void FinishPartLayout();
+
+    friend class EbookPartLayoutThread;
+
+public:
+    explicit EbookLayoutThread(EbookEngine *engine) : ThreadBase("EbookLayoutThread"), engine(engine),
+        nextPartIdx(1), partPages(nullptr), partDone(nullptr) {
+        InitializeCriticalSection(&partsAccess);
+    }
+    virtual ~EbookLayoutThread() {
+        DeleteCriticalSection(&partsAccess);
+    }
+
+    virtual void Run() {
+        if (engine->partCount > 1)
+            StartPartLayout();
+        while (!WasCancelRequested() && engine->formatter && engine->LayoutNextPage()) {
+            // continue until all pages have been laid out
+        }
+        // the formatter measures text with this thread's Graphics
+        delete engine->formatter;
+        engine->formatter = nullptr;
+        if (engine->partCount > 1)
+            FinishPartLayout();
+        SetEvent(engine->layoutDone);
+    }
+};
+
+void EbookLayoutThread::StartPartLayout()
+{
+    size_t count = engine->partCount;
+    partPages = AllocArray<Vec<HtmlPage *> *>(count);
+    partDone = CreateEvent(nullptr, FALSE, FALSE, nullptr);
+    // the first part uses the engine's allocator
+    for (size_t i = 1; i < count; i++) {
+        engine->partAllocators.Append(new PoolAllocator());
+    }
+    int threadCount = limitValue(GetPartLayoutThreadCount(), 1, (int)count - 1);
+    for (int i = 0; i < threadCount; i++) {
+        EbookPartLayoutThread *thread = new EbookPartLayoutThread(this);
+        partThreads.Append(thread);
+        thread->Start();
+    }
+}
+
+void EbookLayoutThread::FinishPartLayout()
+{
+    // the parts' reparse points are relative to their own html
+    size_t partOffset = 0;
+    for (size_t i = 1; i < engine->partCount && !WasCancelRequested(); i++) {
+        Vec<HtmlPage *> *pages = nullptr;
+        for (;;) {
+            EnterCriticalSection(&partsAccess);
+            pages = partPages[i];
+            LeaveCriticalSection(&partsAccess);
+            if (pages || WasCancelRequested())
+                break;
+            WaitForSingleObject(partDone, 100);
+        }
+        if (!pages)
+            break;
+        partOffset += engine->GetPartHtmlLen(i - 1);
+        for (HtmlPage *page : *pages) {
+            CrashIf(partOffset + page->reparseIdx > INT_MAX);
+            page->reparseIdx += (int)partOffset;
+            engine->AppendPage(page);
+        }
+        pages->Reset();
+    }
+    if (!WasCancelRequested())
+        engine->SetLayoutComplete();
+
+    for (EbookPartLayoutThread *thread : partThreads) {
+        thread->RequestCancel();
+    }
+    for (EbookPartLayoutThread *thread : partThreads) {
+        thread->Join();
+        delete thread;
+    }
+    partThreads.Reset();
+    for (size_t i = 1; i < engine->partCount; i++) {
+        if (partPages[i])
+            DeleteVecMembers(*partPages[i]);
+        delete partPages[i];
+    }
+    free(partPages);
+    partPages = nullptr;
+    CloseHandle(partDone);
+    partDone = nullptr;
+}
+
+void EbookPartLayoutThread::Run()
+{
+    EbookEngine *engine = layout->engine;
+    while (!WasCancelRequested()) {
+        EnterCriticalSection(&layout->partsAccess);
+        size_t partIdx = layout->nextPartIdx++;
+        LeaveCriticalSection(&layout->partsAccess);
+        if (partIdx >= engine->partCount)
+            break;
+
+        // the formatter (and its Graphics for measuring text) belongs to this thread
+        HtmlFormatter *formatter = engine->CreatePartFormatter(partIdx, engine->partAllocators.At(partIdx - 1));
+        Vec<HtmlPage *> *pages = new Vec<HtmlPage *>();
+        HtmlPage *page;
+        while (!WasCancelRequested() && (page = formatter->Next(engine->skipEmptyPages)) != nullptr) {
+            pages->Append(page);
+        }
+        delete formatter;
+
+        EnterCriticalSection(&layout->partsAccess);
+        layout->partPages[partIdx] = pages;
+        LeaveCriticalSection(&layout->partsAccess);
+        SetEvent(layout->partDone);
+    }
+}
+
 class SimpleDest2 : public PageDestination {
 protected:
     int pageNo;
@@ -191,12 +401,12 @@ public:
 
 class ImageDataElement : public PageElement {
     int pageNo;
-    ImageData *id; // owned by *EngineImpl::pages
+    DrawInstr *instr; // owned by *EngineImpl::pages
     RectI bbox;
 
 public:
-    ImageDataElement(int pageNo, ImageData *id, RectI bbox) :
-        pageNo(pageNo), id(id), bbox(bbox) { }
+    ImageDataElement(int pageNo, DrawInstr *instr, RectI bbox) :
+        pageNo(pageNo), instr(instr), bbox(bbox) { }
 
     virtual PageElementType GetType() const { return Element_Image; }
     virtual int GetPageNo() const { return pageNo; }
@@ -205,7 +415,7 @@ public:
 
     virtual RenderedBitmap *GetImage() {
         HBITMAP hbmp;
-        Bitmap *bmp = BitmapFromData(id->data, id->len);
+        Bitmap *bmp = BitmapFromImageInstr(instr);
         if (!bmp || bmp->GetHBITMAP((ARGB)Color::White, &hbmp) != Ok) {
             delete bmp;
             return nullptr;
@@ -227,7 +437,9 @@ public:
     virtual PageDestination *GetLink() { return dest; }
 };
 
-EbookEngine::EbookEngine() : fileName(nullptr), pages(nullptr),
+EbookEngine::EbookEngine() : fileName(nullptr), pages(nullptr), lastBaseAnchor(nullptr),
+    formatter(nullptr), skipEmptyPages(true), partCount(1), layoutThread(nullptr), layoutDone(nullptr), pageAdded(nullptr), layoutComplete(0),
+    visiblePageCount(0), incrementalLayout(false),
     pageRect(0, 0, 5.12 * GetFileDPI(), 7.8 * GetFileDPI()), // "B Format" paperback
     pageBorder(0.4f * GetFileDPI())
 {
@@ -236,40 +448,177 @@ EbookEngine::EbookEngine() : fileName(nullptr), pages(nullptr),
 
 EbookEngine::~EbookEngine()
 {
+    StopLayout();
+
     EnterCriticalSection(&pagesAccess);
 
     if (pages)
         DeleteVecMembers(*pages);
     delete pages;
+    DeleteVecMembers(partAllocators);
     free(fileName);
+    if (layoutDone)
+        CloseHandle(layoutDone);
+    if (pageAdded)
+        CloseHandle(pageAdded);
 
     LeaveCriticalSection(&pagesAccess);
     DeleteCriticalSection(&pagesAccess);
 }
 
-bool EbookEngine::ExtractPageAnchors()
+// lays out the first pages of a document and (if inBackground is set) the
+// remaining ones on a separate thread (takes ownership of formatter, which
+// only lays out the first part if partCount > 1)
+bool EbookEngine::StartLayout(HtmlFormatter *formatter, bool skipEmptyPages, bool inBackground, size_t partCount)
+{
+    CrashIf(pages || this->formatter);
+    CrashIf(partCount > 1 && !inBackground);
+    this->formatter = formatter;
+    this->skipEmptyPages = skipEmptyPages;
+    this->partCount = partCount;
+    pages = new Vec<HtmlPage *>();
+
+    while (pages->Count() < EBOOK_INITIAL_PAGES && LayoutNextPage()) {
+        // the first pages are needed right away
+    }
+    if (!IsLayoutComplete() && !inBackground) {
+        while (LayoutNextPage());
+    }
+    if (0 == pages->Count() && IsLayoutComplete())
+        return false;
+
+    if (!IsLayoutComplete()) {
+        if (this->formatter)
+            this->formatter->ReleaseTextMeasure();
+        layoutDone = CreateEvent(nullptr, TRUE, FALSE, nullptr);
+        pageAdded = CreateEvent(nullptr, FALSE, FALSE, nullptr);
+        layoutThread = new EbookLayoutThread(this);
+        layoutThread->Start();
+        // the first part might not have contained any pages
+        WaitForPageAdded(1);
+    }
+    visiblePageCount = LaidOutPageCount();
+    return visiblePageCount > 0;
+}
+
+// returns false once formatter has laid out all its pages
+bool EbookEngine::LayoutNextPage()
+{
+    HtmlPage *page = formatter->Next(skipEmptyPages);
+    if (!page) {
+        delete formatter;
+        formatter = nullptr;
+        // the remaining parts are laid out by EbookLayoutThread
+        if (partCount <= 1)
+            SetLayoutComplete();
+        return false;
+    }
+    AppendPage(page);
+    return true;
+}
+
+void EbookEngine::AppendPage(HtmlPage *page)
 {
     ScopedCritSec scope(&pagesAccess);
+    pages->Append(page);
+    ExtractPageAnchors(page, (int)pages->Count());
+    if (pageAdded)
+        SetEvent(pageAdded);
+}
 
-    DrawInstr *baseAnchor = nullptr;
-    for (int pageNo = 1; pageNo <= PageCount(); pageNo++) {
-        Vec<DrawInstr> *pageInstrs = GetHtmlPage(pageNo);
-        if (!pageInstrs)
-            return false;
+int EbookEngine::LaidOutPageCount()
+{
+    ScopedCritSec scope(&pagesAccess);
+    return (int)pages->Count();
+}
 
-        for (size_t k = 0; k < pageInstrs->Count(); k++) {
-            DrawInstr *i = &pageInstrs->At(k);
-            if (InstrAnchor != i->type)
-                continue;
-            anchors.Append(PageAnchor(i, pageNo));
-            if (k < 2 && str::StartsWith(i->str.s + i->str.len, "\" page_marker />"))
-                baseAnchor = i;
-        }
-        baseAnchors.Append(baseAnchor);
+bool EbookEngine::IsLayoutComplete() const
+{
+    return InterlockedCompareExchange((LONG volatile *)&layoutComplete, 0, 0) != 0;
+}
+
+void EbookEngine::SetLayoutComplete()
+{
+    InterlockedExchange(&layoutComplete, 1);
+}
+
+// note: the following must not be called while holding pagesAccess
+
+// waits until at least minPageCount pages have been laid out
+// or until layoutThread is done
+void EbookEngine::WaitForPageAdded(int minPageCount)
+{
+    HANDLE events[] = { pageAdded, layoutDone };
+    while (!IsLayoutComplete() && LaidOutPageCount() < minPageCount) {
+        if (WaitForMultipleObjects(dimof(events), events, FALSE, INFINITE) != WAIT_OBJECT_0)
+            break;
+    }
+}
+
+void EbookEngine::WaitForLayout() const
+{
+    if (!IsLayoutComplete() && layoutDone)
+        WaitForSingleObject(layoutDone, INFINITE);
+}
+
+// pages beyond PageCount() can be requested e.g. by clones
+// which haven't been laid out as far as the original
+void EbookEngine::WaitForPage(int pageNo)
+{
+    if (!IsLayoutComplete() && LaidOutPageCount() < pageNo)
+        WaitForLayout();
+}
+
+void EbookEngine::StopLayout()
+{
+    if (layoutThread) {
+        layoutThread->RequestCancel();
+        layoutThread->Join();
+        delete layoutThread;
+        layoutThread = nullptr;
     }
+    delete formatter;
+    formatter = nullptr;
+}
+
+int EbookEngine::PageCount() const
+{
+    if (incrementalLayout)
+        return visiblePageCount;
+    WaitForLayout();
+    return pages ? (int)pages->Count() : 0;
+}
+
+bool EbookEngine::UpdatePageCount(int minPageCount)
+{
+    incrementalLayout = true;
+    // wait for pages which are needed right away (e.g. for restoring the
+    // last viewed page); PageCount() can remain below minPageCount, though
+    if (layoutThread)
+        WaitForPageAdded(minPageCount);
+    // all pages have been added before layoutComplete is set
+    bool complete = IsLayoutComplete();
+    visiblePageCount = LaidOutPageCount();
+    return !complete;
+}
+
+// must be called for all pages in order
+void EbookEngine::ExtractPageAnchors(HtmlPage *page, int pageNo)
+{
+    ScopedCritSec scope(&pagesAccess);
+
+    Vec<DrawInstr> *pageInstrs = &page->instructions;
+    for (size_t k = 0; k < pageInstrs->Count(); k++) {
+        DrawInstr *i = &pageInstrs->At(k);
+        if (InstrAnchor != i->type)
+            continue;
+        anchors.Append(PageAnchor(i, pageNo));
+        if (k < 2 && str::StartsWith(i->str.s + i->str.len, "\" page_marker />"))
+            lastBaseAnchor = i;
+    }
+    baseAnchors.Append(lastBaseAnchor);
 
     CrashIf(baseAnchors.Count() != pages->Count());
-    return true;
 }
 
 PointD EbookEngine::Transform(PointD pt, int pageNo, float zoom, int rotation, bool inverse)
@@ -400,6 +749,7 @@ bool EbookEngine::RenderPage(HDC hDC, RectI screenRect, int pageNo, float zoom,
     if (cookie_out)
         *cookie_out = cookie = new EbookAbortCookie();
 
+    WaitForPage(pageNo);
     ScopedCritSec scope(&pagesAccess);
 
     mui::ITextRender *textDraw = mui::TextRenderGdiplus::Create(&g);
@@ -419,6 +769,7 @@ static RectI GetInstrBbox(DrawInstr& instr, float pageBorder)
 
 WCHAR *EbookEngine::ExtractPageText(int pageNo, const WCHAR *lineSep, RectI **coords_out, RenderTarget target)
 {
+    WaitForPage(pageNo);
     ScopedCritSec scope(&pagesAccess);
 
     str::Str<WCHAR> content;
@@ -510,7 +861,11 @@ PageElement *EbookEngine::CreatePageLink(DrawInstr *link, RectI rect, int pageNo
     if (url::IsAbsolute(url))
         return new EbookLink(link, rect, nullptr, pageNo);
 
-    DrawInstr *baseAnchor = baseAnchors.At(pageNo-1);
+    DrawInstr *baseAnchor;
+    {
+        ScopedCritSec scope(&pagesAccess);
+        baseAnchor = baseAnchors.At(pageNo-1);
+    }
     if (baseAnchor) {
         ScopedMem<char> basePath(str::DupN(baseAnchor->str.s, baseAnchor->str.len));
         ScopedMem<char> relPath(ResolveHtmlEntities(link->str.s, link->str.len));
@@ -528,10 +883,11 @@ Vec<PageElement *> *EbookEngine::GetElements(int pageNo)
 {
     Vec<PageElement *> *els = new Vec<PageElement *>();
 
+    WaitForPage(pageNo);
     Vec<DrawInstr> *pageInstrs = GetHtmlPage(pageNo);
     for (DrawInstr& i : *pageInstrs) {
-        if (InstrImage == i.type)
-            els->Append(new ImageDataElement(pageNo, &i.img, GetInstrBbox(i, pageBorder)));
+        if (InstrImage == i.type || InstrImageRef == i.type)
+            els->Append(new ImageDataElement(pageNo, &i, GetInstrBbox(i, pageBorder)));
         else if (InstrLinkStart == i.type && !i.bbox.IsEmptyArea()) {
             PageElement *link = CreatePageLink(&i, GetInstrBbox(i, pageBorder), pageNo);
             if (link)
@@ -563,6 +919,19 @@ PageElement *EbookEngine::GetElementAtPos(int pageNo, PointD pt)
 
 PageDestination *EbookEngine::GetNamedDest(const WCHAR *name)
 {
+    PageDestination *dest = FindNamedDest(name);
+    // the destination might be on a page that hasn't been laid out yet
+    if (!dest && !IsLayoutComplete()) {
+        WaitForLayout();
+        dest = FindNamedDest(name);
+    }
+    return dest;
+}
+
+PageDestination *EbookEngine::FindNamedDest(const WCHAR *name)
+{
+    ScopedCritSec scope(&pagesAccess);
+
     ScopedMem<char> name_utf8(str::conv::ToUtf8(name));
     const char *id = name_utf8;
     if (str::FindChar(id, '#'))
@@ -605,7 +974,8 @@ PageDestination *EbookEngine::GetNamedDest(const WCHAR *name)
     }
 
     // don't fail if an ID doesn't exist in a merged document
-    if (basePageNo != 0) {
+    // (unless it might still be found on a page that's being laid out)
+    if (basePageNo != 0 && IsLayoutComplete()) {
         RectD rect(0, pageBorder, pageRect.dx, 10);
         rect.Inflate(-pageBorder, 0);
         return new SimpleDest2(basePageNo, rect);
@@ -616,12 +986,13 @@ PageDestination *EbookEngine::GetNamedDest(const WCHAR *name)
 
 WCHAR *EbookEngine::ExtractFontList()
 {
+    WaitForLayout();
     ScopedCritSec scope(&pagesAccess);
 
     Vec<mui::CachedFont *> seenFonts;
     WStrVec fonts;
 
-    for (int pageNo = 1; pageNo <= PageCount(); pageNo++) {
+    for (int pageNo = 1; pageNo <= (int)pages->Count(); pageNo++) {
         Vec<DrawInstr> *pageInstrs = GetHtmlPage(pageNo);
         if (!pageInstrs)
             continue;
@@ -747,10 +1118,23 @@ protected:
     bool Load(const WCHAR *fileName);
     bool Load(IStream *stream);
     bool FinishLoading();
+    EpubFormatter *CreateFormatter(size_t spineIdx, Allocator *textAllocator, bool streamSpine=false);
+
+    // each spine item is laid out as a separate part
+    virtual HtmlFormatter *CreatePartFormatter(size_t partIdx, Allocator *textAllocator) {
+        return CreateFormatter(partIdx, textAllocator);
+    }
+    virtual size_t GetPartHtmlLen(size_t partIdx) {
+        size_t len;
+        doc->GetSpineData(partIdx, &len);
+        return len;
+    }
 };
 
 EpubEngineImpl::~EpubEngineImpl()
 {
+    // the background layout uses doc
+    StopLayout();
     delete doc;
     if (stream)
         stream->Release();
@@ -783,20 +1167,27 @@ bool EpubEngineImpl::FinishLoading()
     if (!doc)
         return false;
 
+    // spine items always start on a new page, so they
+    // can be laid out on several threads at once
+    size_t spineCount = doc->GetSpineCount();
+    if (spineCount > 1 && GetPartLayoutThreadCount() > 0)
+        return StartLayout(CreateFormatter(0, &allocator), false, true, spineCount);
+    // else the remaining spine items are only loaded as the layout progresses
+    return StartLayout(CreateFormatter(0, &allocator, true), false);
+}
+
+EpubFormatter *EpubEngineImpl::CreateFormatter(size_t spineIdx, Allocator *textAllocator, bool streamSpine)
+{
     HtmlFormatterArgs args;
-    args.htmlStr = doc->GetHtmlData(&args.htmlStrLen);
+    args.htmlStr = doc->GetSpineData(spineIdx, &args.htmlStrLen);
     args.pageDx = (float)pageRect.dx - 2 * pageBorder;
     args.pageDy = (float)pageRect.dy - 2 * pageBorder;
     args.SetFontName(GetDefaultFontName());
     args.fontSize = GetDefaultFontSize();
-    args.textAllocator = &allocator;
+    args.textAllocator = textAllocator;
     args.textRenderMethod = mui::TextRenderMethodGdiplusQuick;
 
-    pages = EpubFormatter(&args, doc).FormatAllPages(false);
-    if (!ExtractPageAnchors())
-        return false;
-
-    return pages->Count() > 0;
+    return new EpubFormatter(&args, doc, streamSpine);
 }
 
 unsigned char *EpubEngineImpl::GetFileData(size_t *cbCount)
@@ -889,7 +1280,10 @@ BaseEngine *CreateFromStream(IStream *stream)
 class Fb2EngineImpl : public EbookEngine {
 public:
     Fb2EngineImpl() : EbookEngine(), doc(nullptr) { }
-    virtual ~Fb2EngineImpl() { delete doc; }
+    virtual ~Fb2EngineImpl() {
+        StopLayout();
+        delete doc;
+    }
     virtual BaseEngine *Clone() {
         return fileName ? CreateFromFile(fileName) : nullptr;
     }
@@ -942,11 +1336,7 @@ bool Fb2EngineImpl::FinishLoading()
     args.textAllocator = &allocator;
     args.textRenderMethod = mui::TextRenderMethodGdiplusQuick;
 
-    pages = Fb2Formatter(&args, doc).FormatAllPages(false);
-    if (!ExtractPageAnchors())
-        return false;
-
-    return pages->Count() > 0;
+    return StartLayout(new Fb2Formatter(&args, doc), false);
 }
 
 DocTocItem *Fb2EngineImpl::GetTocTree()
@@ -1005,7 +1395,10 @@ BaseEngine *CreateFromStream(IStream *stream)
 class MobiEngineImpl : public EbookEngine {
 public:
     MobiEngineImpl() : EbookEngine(), doc(nullptr) { }
-    virtual ~MobiEngineImpl() { delete doc; }
+    virtual ~MobiEngineImpl() {
+        StopLayout();
+        delete doc;
+    }
     virtual BaseEngine *Clone() {
         return fileName ? CreateFromFile(fileName) : nullptr;
     }
@@ -1057,11 +1450,7 @@ bool MobiEngineImpl::FinishLoading()
     args.textAllocator = &allocator;
     args.textRenderMethod = mui::TextRenderMethodGdiplusQuick;
 
-    pages = MobiFormatter(&args, doc).FormatAllPages();
-    if (!ExtractPageAnchors())
-        return false;
-
-    return pages->Count() > 0;
+    return StartLayout(new MobiFormatter(&args, doc), true);
 }
 
 PageDestination *MobiEngineImpl::GetNamedDest(const WCHAR *name)
@@ -1069,12 +1458,13 @@ PageDestination *MobiEngineImpl::GetNamedDest(const WCHAR *name)
     int filePos = _wtoi(name);
     if (filePos < 0 || 0 == filePos && *name != '0')
         return nullptr;
+    WaitForLayout();
     int pageNo;
-    for (pageNo = 1; pageNo < PageCount(); pageNo++) {
+    for (pageNo = 1; pageNo < (int)pages->Count(); pageNo++) {
         if (pages->At(pageNo)->reparseIdx > filePos)
             break;
     }
-    CrashIf(pageNo < 1 || pageNo > PageCount());
+    CrashIf(pageNo < 1 || pageNo > (int)pages->Count());
 
     size_t htmlLen;
     char *start = doc->GetHtmlData(htmlLen);
@@ -1153,7 +1543,10 @@ BaseEngine *CreateFromStream(IStream *stream)
 class PdbEngineImpl : public EbookEngine {
 public:
     PdbEngineImpl() : EbookEngine(), doc(nullptr) { }
-    virtual ~PdbEngineImpl() { delete doc; }
+    virtual ~PdbEngineImpl() {
+        StopLayout();
+        delete doc;
+    }
     virtual BaseEngine *Clone() {
         return fileName ? CreateFromFile(fileName) : nullptr;
     }
@@ -1191,11 +1584,7 @@ bool PdbEngineImpl::Load(const WCHAR *fileName)
     args.textAllocator = &allocator;
     args.textRenderMethod = mui::TextRenderMethodGdiplusQuick;
 
-    pages = HtmlFormatter(&args).FormatAllPages();
-    if (!ExtractPageAnchors())
-        return false;
-
-    return pages->Count() > 0;
+    return StartLayout(new HtmlFormatter(&args), true);
 }
 
 DocTocItem *PdbEngineImpl::GetTocTree()
@@ -1494,11 +1883,8 @@ bool Chm2EngineImpl::Load(const WCHAR *fileName)
     args.textAllocator = &allocator;
     args.textRenderMethod = mui::TextRenderMethodGdiplusQuick;
 
-    pages = ChmFormatter(&args, dataCache).FormatAllPages(false);
-    if (!ExtractPageAnchors())
-        return false;
-
-    return pages->Count() > 0;
+    // ChmDoc can't be accessed concurrently, so lay out all pages right away
+    return StartLayout(new ChmFormatter(&args, dataCache), false, false);
 }
 
 DocTocItem *Chm2EngineImpl::GetTocTree()
@@ -1594,6 +1980,7 @@ public:
         pageRect = RectD(0, 0, 8.27 * GetFileDPI(), 11.693 * GetFileDPI());
     }
     virtual ~HtmlEngineImpl() {
+        StopLayout();
         delete doc;
     }
     virtual BaseEngine *Clone() {
@@ -1633,11 +2020,7 @@ bool HtmlEngineImpl::Load(const WCHAR *fileName)
     args.textAllocator = &allocator;
     args.textRenderMethod = mui::TextRenderMethodGdiplus;
 
-    pages = HtmlFileFormatter(&args, doc).FormatAllPages(false);
-    if (!ExtractPageAnchors())
-        return false;
-
-    return pages->Count() > 0;
+    return StartLayout(new HtmlFileFormatter(&args, doc), false);
 }
 
 class RemoteHtmlDest : public SimpleDest2 {
@@ -1703,7 +2086,10 @@ public:
         // ISO 216 A4 (210mm x 297mm)
         pageRect = RectD(0, 0, 8.27 * GetFileDPI(), 11.693 * GetFileDPI());
     }
-    virtual ~TxtEngineImpl() { delete doc; }
+    virtual ~TxtEngineImpl() {
+        StopLayout();
+        delete doc;
+    }
     virtual BaseEngine *Clone() {
         return fileName ? CreateFromFile(fileName) : nullptr;
     }
@@ -1749,11 +2135,7 @@ bool TxtEngineImpl::Load(const WCHAR *fileName)
     args.textAllocator = &allocator;
     args.textRenderMethod = mui::TextRenderMethodGdiplus;
 
-    pages = TxtFormatter(&args).FormatAllPages(false);
-    if (!ExtractPageAnchors())
-        return false;
-
-    return pages->Count() > 0;
+    return StartLayout(new TxtFormatter(&args), false);
 }
 
 DocTocItem *TxtEngineImpl::GetTocTree()
@@ -141,8 +141,8 @@ void EpubFormatter::HandleTagImg(HtmlToken *t)
     if (attr) {
         ScopedMem<char> src(str::DupN(attr->val, attr->valLen));
         url::DecodeInPlace(src);
-        ImageData *img = epubDoc->GetImageData(src, pagePath);
-        needAlt = !img || !EmitImage(img);
+        size_t imageId = epubDoc->FindImage(src, pagePath);
+        needAlt = (size_t)-1 == imageId || !EmitImageRef(epubDoc, imageId, epubDoc->GetImageSize(imageId));
     }
     if (needAlt && (attr = t->GetAttrByName("alt")) != nullptr)
         HandleText(attr->val, attr->valLen);
@@ -162,6 +162,39 @@ void EpubFormatter::HandleTagPagebreak(HtmlToken *t)
     }
 }
 
+EpubFormatter::EpubFormatter(HtmlFormatterArgs *args, EpubDoc *doc, bool streamSpine) :
+    HtmlFormatter(args), epubDoc(doc), hiddenDepth(0),
+    streamSpine(streamSpine), nextSpineIdx(1)
+{
+    CrashIf(streamSpine && args->reparseIdx != 0);
+    if (0 == args->reparseIdx)
+        return;
+    // when resuming in the middle of the document, the page path (needed for
+    // resolving images and links) is the one of the preceding page marker
+    const char *marker = "<pagebreak page_path=\"";
+    const char *end = args->htmlStr + args->reparseIdx;
+    const char *last = nullptr;
+    for (const char *s = str::Find(args->htmlStr, marker); s && s < end; s = str::Find(s + 1, marker)) {
+        last = s;
+    }
+    if (!last)
+        return;
+    const char *path = last + str::Len(marker);
+    const char *pathEnd = str::FindChar(path, '"');
+    if (pathEnd)
+        pagePath.Set(str::DupN(path, pathEnd - path));
+}
+
+bool EpubFormatter::LoadNextHtmlChunk()
+{
+    if (!streamSpine || nextSpineIdx >= epubDoc->GetSpineCount())
+        return false;
+    size_t len;
+    const char *data = epubDoc->GetSpineData(nextSpineIdx++, &len);
+    SetHtmlChunk(data, len);
+    return true;
+}
+
 void EpubFormatter::HandleTagLink(HtmlToken *t)
 {
     CrashIf(!epubDoc);
@@ -197,9 +230,9 @@ void EpubFormatter::HandleTagSvgImage(HtmlToken *t)
         return;
     ScopedMem<char> src(str::DupN(attr->val, attr->valLen));
     url::DecodeInPlace(src);
-    ImageData *img = epubDoc->GetImageData(src, pagePath);
-    if (img)
-        EmitImage(img);
+    size_t imageId = epubDoc->FindImage(src, pagePath);
+    if (imageId != (size_t)-1)
+        EmitImageRef(epubDoc, imageId, epubDoc->GetImageSize(imageId));
 }
 
 void EpubFormatter::HandleHtmlTag(HtmlToken *t)
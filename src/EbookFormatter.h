@@ -29,15 +29,22 @@ class EpubFormatter : public HtmlFormatter {
     virtual void HandleHtmlTag(HtmlToken *t);
     virtual bool IgnoreText();
 
+    virtual bool LoadNextHtmlChunk();
+
     void HandleTagSvgImage(HtmlToken *t);
 
     EpubDoc *epubDoc;
     ScopedMem<char> pagePath;
     size_t hiddenDepth;
+    // set if the spine items are loaded one at a time
+    bool streamSpine;
+    size_t nextSpineIdx;
 
 public:
-    EpubFormatter(HtmlFormatterArgs *args, EpubDoc *doc) :
-        HtmlFormatter(args), epubDoc(doc), hiddenDepth(0) { }
+    // if streamSpine is set, args->htmlStr must be the data of the first
+    // spine item and the others are loaded as needed (instead of
+    // formatting all of EpubDoc::GetHtmlData at once)
+    EpubFormatter(HtmlFormatterArgs *args, EpubDoc *doc, bool streamSpine=false);
 };
 
 /* formatting extensions for FictionBook */
@@ -101,6 +101,15 @@ DrawInstr DrawInstr::Image(char *data, size_t len, RectF bbox)
     return di;
 }
 
+DrawInstr DrawInstr::ImageRef(ImageDataSource *source, size_t id, RectF bbox)
+{
+    DrawInstr di(InstrImageRef);
+    di.imgRef.source = source;
+    di.imgRef.id = id;
+    di.bbox = bbox;
+    return di;
+}
+
 DrawInstr DrawInstr::LinkStart(const char *s, size_t len)
 {
     DrawInstr di(InstrLinkStart);
@@ -183,16 +192,16 @@ HtmlFormatter::HtmlFormatter(HtmlFormatterArgs *args) :
     textAllocator(args->textAllocator), currLineReparseIdx(0),
     currX(0), currY(0), currLineTopPadding(0), currLinkIdx(0),
     listDepth(0), preFormatted(false), dirRtl(false), currPage(nullptr),
-    finishedParsing(false), pageCount(0),
+    htmlOffset(0), finishedParsing(false), pageCount(0),
     keepTagNesting(false)
 {
     currReparseIdx = args->reparseIdx;
     htmlParser = new HtmlPullParser(args->htmlStr, args->htmlStrLen);
     htmlParser->SetCurrPosOff(currReparseIdx);
-    CrashIf(!ValidReparseIdx(currReparseIdx, htmlParser));
+    CrashIf(!ValidReparseIdx(currReparseIdx - htmlOffset, htmlParser));
 
-    gfx = mui::AllocGraphicsForMeasureText();
-    textMeasure = CreateTextRender(args->textRenderMethod, gfx, 10, 10);
+    textRenderMethod = args->textRenderMethod;
+    AllocTextMeasure();
     defaultFontName.Set(str::Dup(args->GetFontName()));
     defaultFontSize = args->fontSize;
 
@@ -219,9 +228,39 @@ HtmlFormatter::~HtmlFormatter()
     // delete all pages that were not consumed by the caller
     DeleteVecMembers(pagesToSend);
     delete currPage;
+    ReleaseTextMeasure();
+    delete htmlParser;
+}
+
+void HtmlFormatter::AllocTextMeasure()
+{
+    gfx = mui::AllocGraphicsForMeasureText();
+    textMeasure = CreateTextRender(textRenderMethod, gfx, 10, 10);
+    // all Graphics for measuring text are set up the same way,
+    // so measurements can be shared between formatters
+    textMeasure->cacheMeasure = true;
+}
+
+// the Graphics used for measuring text belong to the thread which allocated
+// them, so this must be called on that thread before a different thread
+// continues the layout (Next() then allocates that thread's own Graphics)
+void HtmlFormatter::ReleaseTextMeasure()
+{
+    if (!textMeasure)
+        return;
     delete textMeasure;
+    textMeasure = nullptr;
     mui::FreeGraphicsForMeasureText(gfx);
+    gfx = nullptr;
+}
+
+// continues formatting with the data following htmlParser's (all
+// previous data must remain valid for the instructions emitted so far)
+void HtmlFormatter::SetHtmlChunk(const char *s, size_t len)
+{
+    htmlOffset += htmlParser->Len();
     delete htmlParser;
+    htmlParser = new HtmlPullParser(s, len);
 }
 
 void HtmlFormatter::AppendInstr(DrawInstr di)
@@ -229,7 +268,7 @@ void HtmlFormatter::AppendInstr(DrawInstr di)
     currLineInstr.Append(di);
     if (-1 == currLineReparseIdx) {
         currLineReparseIdx = currReparseIdx;
-        CrashIf(!ValidReparseIdx(currReparseIdx, htmlParser));
+        CrashIf(!ValidReparseIdx(currReparseIdx - htmlOffset, htmlParser));
     }
 }
 
@@ -302,7 +341,7 @@ static bool IsVisibleDrawInstr(DrawInstr& i)
     switch (i.type) {
         case InstrString: case InstrRtlString:
         case InstrLine:
-        case InstrImage:
+        case InstrImage: case InstrImageRef:
             return true;
     }
     return false;
@@ -316,7 +355,7 @@ REAL HtmlFormatter::CurrLineDx()
     for (DrawInstr& i : currLineInstr) {
         if (InstrString == i.type || InstrRtlString == i.type) {
             dx += i.bbox.Width;
-        } else if (InstrImage == i.type) {
+        } else if (InstrImage == i.type || InstrImageRef == i.type) {
             dx += i.bbox.Width;
         } else if (InstrElasticSpace == i.type) {
             dx += spaceDx;
@@ -362,7 +401,7 @@ void HtmlFormatter::LayoutLeftStartingAt(REAL offX)
 
     REAL x = offX + NewLineX();
     for (DrawInstr& i : currLineInstr) {
-        if (InstrString == i.type || InstrRtlString == i.type || InstrImage == i.type) {
+        if (InstrString == i.type || InstrRtlString == i.type || InstrImage == i.type || InstrImageRef == i.type) {
             i.bbox.X = x;
             x += i.bbox.Width;
             lastInstr = &i;
@@ -375,7 +414,7 @@ void HtmlFormatter::LayoutLeftStartingAt(REAL offX)
     }
 
     // center a single image
-    if (instrCount == 1 && InstrImage == lastInstr->type)
+    if (instrCount == 1 && (InstrImage == lastInstr->type || InstrImageRef == lastInstr->type))
         lastInstr->bbox.X = (pageDx - lastInstr->bbox.Width) / 2.f;
 }
 
@@ -416,7 +455,7 @@ void HtmlFormatter::JustifyLineBoth()
         }
         else if (InstrString == i.type || InstrRtlString == i.type)
             endsWithSpace = false;
-        else if (InstrImage == i.type)
+        else if (InstrImage == i.type || InstrImageRef == i.type)
             endsWithSpace = false;
     }
     // don't take a space at the end of the line into account
@@ -432,7 +471,7 @@ void HtmlFormatter::JustifyLineBoth()
     for (DrawInstr& i : currLineInstr) {
         if (InstrElasticSpace == i.type)
             offX += extraSpaceDx;
-        else if (InstrString == i.type || InstrRtlString == i.type || InstrImage == i.type) {
+        else if (InstrString == i.type || InstrRtlString == i.type || InstrImage == i.type || InstrImageRef == i.type) {
             i.bbox.X += offX;
             lastStr = &i;
         }
@@ -616,7 +655,7 @@ static bool HasPreviousLineSingleImage(Vec<DrawInstr>& instrs)
             // it must be completely above it (previous line)
             return i.bbox.Y + i.bbox.Height <= imageY;
         }
-        if (InstrImage != i.type)
+        if (InstrImage != i.type && InstrImageRef != i.type)
             return false;
         imageY = i.bbox.Y;
     }
@@ -627,6 +666,17 @@ bool HtmlFormatter::EmitImage(ImageData *img)
 {
     CrashIf(!img->data);
     Size imgSize = BitmapSizeFromData(img->data, img->len);
+    return EmitImageInstr(DrawInstr::Image(img->data, img->len, RectF()), imgSize);
+}
+
+// for images which are only loaded when they're drawn
+bool HtmlFormatter::EmitImageRef(ImageDataSource *source, size_t imageId, SizeI imgSize)
+{
+    return EmitImageInstr(DrawInstr::ImageRef(source, imageId, RectF()), Size(imgSize.dx, imgSize.dy));
+}
+
+bool HtmlFormatter::EmitImageInstr(DrawInstr instr, Size imgSize)
+{
     if (imgSize.Empty())
         return false;
 
@@ -656,7 +706,8 @@ bool HtmlFormatter::EmitImage(ImageData *img)
     }
 
     RectF bbox(PointF(currX, 0), newSize);
-    AppendInstr(DrawInstr::Image(img->data, img->len, bbox));
+    instr.bbox = bbox;
+    AppendInstr(instr);
     currX += bbox.Width;
 
     return true;
@@ -725,8 +776,8 @@ void HtmlFormatter::EmitElasticSpace()
 // a text run is a string of consecutive text with uniform style
 void HtmlFormatter::EmitTextRun(const char *s, const char *end)
 {
-    currReparseIdx = s - htmlParser->Start();
-    CrashIf(!ValidReparseIdx(currReparseIdx, htmlParser));
+    currReparseIdx = ReparseIdxOf(s);
+    CrashIf(!ValidReparseIdx(currReparseIdx - htmlOffset, htmlParser));
     CrashIf(IsSpaceOnly(s, end) && !preFormatted);
     const char *tmp = ResolveHtmlEntities(s, end, textAllocator);
     bool resolved = tmp != s;
@@ -738,7 +789,7 @@ void HtmlFormatter::EmitTextRun(const char *s, const char *end)
     while (s < end) {
         // don't update the reparseIdx if s doesn't point into the original source
         if (!resolved)
-            currReparseIdx = s - htmlParser->Start();
+            currReparseIdx = ReparseIdxOf(s);
 
         size_t strLen = str::Utf8ToWcharBuf(s, end - s, buf, dimof(buf));
         textMeasure->SetFont(CurrFont());
@@ -1231,7 +1282,7 @@ void HtmlFormatter::HandleText(const char *s, size_t sLen)
         // don't collapse whitespace and respect text newlines
         while (curr < end) {
             const char *text = curr;
-            currReparseIdx = curr - htmlParser->Start();
+            currReparseIdx = ReparseIdxOf(curr);
             // skip to the next newline
             for (; curr < end && *curr != '\n'; curr++);
             if (curr < end && curr > text && *(curr - 1) == '\r')
@@ -1249,13 +1300,13 @@ void HtmlFormatter::HandleText(const char *s, size_t sLen)
     // whitespace or all non-whitespace
     while (curr < end) {
         // collapse multiple, consecutive white-spaces into a single space
-        currReparseIdx = curr - htmlParser->Start();
+        currReparseIdx = ReparseIdxOf(curr);
         bool skipped = SkipWs(curr, end);
         if (skipped)
             EmitElasticSpace();
 
         const char *text = curr;
-        currReparseIdx = curr - htmlParser->Start();
+        currReparseIdx = ReparseIdxOf(curr);
         skipped = SkipNonWs(curr, end);
         if (skipped)
             EmitTextRun(text, curr);
@@ -1317,12 +1368,16 @@ HtmlPage *HtmlFormatter::Next(bool skipEmptyPages)
         // that case and really end parsing
         if (finishedParsing)
             return nullptr;
+        if (!textMeasure)
+            AllocTextMeasure();
         HtmlToken *t = htmlParser->Next();
+        if (!t && LoadNextHtmlChunk())
+            continue;
         if (!t || t->IsError())
             break;
 
-        currReparseIdx = t->GetReparsePoint() - htmlParser->Start();
-        CrashIf(!ValidReparseIdx(currReparseIdx, htmlParser));
+        currReparseIdx = ReparseIdxOf(t->GetReparsePoint());
+        CrashIf(!ValidReparseIdx(currReparseIdx - htmlOffset, htmlParser));
         if (t->IsTag())
             HandleHtmlTag(t);
         else if (!IgnoreText())
@@ -1350,6 +1405,18 @@ Vec<HtmlPage*> *HtmlFormatter::FormatAllPages(bool skipEmptyPages)
     return pages;
 }
 
+Bitmap *BitmapFromImageInstr(DrawInstr *instr)
+{
+    if (InstrImage == instr->type)
+        return BitmapFromData(instr->img.data, instr->img.len);
+    CrashIf(InstrImageRef != instr->type);
+    size_t len;
+    ScopedMem<char> data(instr->imgRef.source->LoadImageData(instr->imgRef.id, &len));
+    if (!data)
+        return nullptr;
+    return BitmapFromData(data, len);
+}
+
 // TODO: draw link in the appropriate format (blue text, underlined, should show hand cursor when
 // mouse is over a link. There's a slight complication here: we only get explicit information about
 // strings, not about the whitespace and we should underline the whitespace as well. Also the text
@@ -1400,9 +1467,9 @@ void DrawHtmlPage(Graphics *g, mui::ITextRender *textDraw, Vec<DrawInstr> *drawI
             }
             status = g->DrawLine(&linePen, p1, p2);
             CrashIf(status != Ok);
-        } else if (InstrImage == i.type) {
+        } else if (InstrImage == i.type || InstrImageRef == i.type) {
             // TODO: cache the bitmap somewhere (?)
-            Bitmap *bmp = BitmapFromData(i.img.data, i.img.len);
+            Bitmap *bmp = BitmapFromImageInstr(&i);
             if (bmp) {
                 status = g->DrawImage(bmp, bbox, 0, 0, (REAL)bmp->GetWidth(), (REAL)bmp->GetHeight(), UnitPixel);
                 // GDI+ sometimes seems to succeed in loading an image because it lazily decodes it
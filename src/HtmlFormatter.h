@@ -20,6 +20,8 @@ enum DrawInstrType {
     InstrSetFont,
     // an image (raw data for e.g. BitmapFromData)
     InstrImage,
+    // an image whose data is loaded from an ImageDataSource when needed
+    InstrImageRef,
     // marks the beginning of a link (<a> tag)
     InstrLinkStart,
     // marks end of the link (must have matching InstrLinkStart)
@@ -40,6 +42,10 @@ struct DrawInstr {
         } str;          // InstrString, InstrLinkStart, InstrAnchor, InstrRtlString
         mui::CachedFont *font;        // InstrSetFont
         ImageData       img;          // InstrImage
+        struct {
+            ImageDataSource *source;
+            size_t      id;
+        } imgRef;       // InstrImageRef
     };
     RectF bbox; // common to most instructions
 
@@ -50,6 +56,7 @@ struct DrawInstr {
     // helper constructors for instructions that need additional arguments
     static DrawInstr Str(const char *s, size_t len, RectF bbox, bool rtl=false);
     static DrawInstr Image(char *data, size_t len, RectF bbox);
+    static DrawInstr ImageRef(ImageDataSource *source, size_t id, RectF bbox);
     static DrawInstr SetFont(mui::CachedFont *font);
     static DrawInstr FixedSpace(float dx);
     static DrawInstr LinkStart(const char *s, size_t len);
@@ -157,6 +164,12 @@ protected:
     virtual void HandleTagImg(HtmlToken *t) { }
     virtual void HandleTagPagebreak(HtmlToken *t) { }
     virtual void HandleTagLink(HtmlToken *t) { }
+    // called when htmlParser has run out of data, so that formatters for
+    // documents consisting of several parts can continue with the next
+    // one (cf. SetHtmlChunk); returns false if there's nothing left to format
+    virtual bool LoadNextHtmlChunk() { return false; }
+    void  SetHtmlChunk(const char *s, size_t len);
+    ptrdiff_t ReparseIdxOf(const char *s) const { return htmlOffset + (s - htmlParser->Start()); }
 
     float CurrLineDx();
     float CurrLineDy();
@@ -168,6 +181,8 @@ protected:
     void  UpdateLinkBboxes(HtmlPage *page);
 
     bool  EmitImage(ImageData *img);
+    bool  EmitImageRef(ImageDataSource *source, size_t imageId, SizeI imgSize);
+    bool  EmitImageInstr(DrawInstr instr, Size imgSize);
     void  EmitHr();
     void  EmitTextRun(const char *s, const char *end);
     void  EmitElasticSpace();
@@ -194,6 +209,7 @@ protected:
     virtual bool IgnoreText();
 
     void DumpLineDebugInfo();
+    void AllocTextMeasure();
 
     // constant during layout process
     float               pageDx;
@@ -204,6 +220,7 @@ protected:
     ScopedMem<WCHAR>    defaultFontName;
     float               defaultFontSize;
     Allocator *         textAllocator;
+    mui::TextRenderMethod textRenderMethod;
     mui::ITextRender *  textMeasure;
 
     // style stack of the current line
@@ -240,6 +257,8 @@ protected:
     ptrdiff_t           currReparseIdx;
 
     HtmlPullParser *    htmlParser;
+    // offset of htmlParser's data within the document (for reparse points)
+    ptrdiff_t           htmlOffset;
 
     // list of pages that we've created but haven't yet sent to client
     Vec<HtmlPage*>      pagesToSend;
@@ -257,9 +276,12 @@ public:
 
     HtmlPage *Next(bool skipEmptyPages=true);
     Vec<HtmlPage*> *FormatAllPages(bool skipEmptyPages=true);
+
+    void ReleaseTextMeasure();
 };
 
 void DrawHtmlPage(Graphics *g, mui::ITextRender *textRender, Vec<DrawInstr> *drawInstructions, REAL offX, REAL offY, bool showBbox, Color textColor, bool *abortCookie=nullptr);
+Bitmap *BitmapFromImageInstr(DrawInstr *instr);
 
 mui::TextRenderMethod GetTextRenderMethod();
 void SetTextRenderMethod(mui::TextRenderMethod method);
@@ -9,14 +9,17 @@
 #include "HtmlParserLookup.h"
 #include "HtmlPullParser.h"
 #include "JsonParser.h"
+#include "ThreadUtil.h"
 #include "WinUtil.h"
 // rendering engines
 #include "BaseEngine.h"
 #include "ImagesEngine.h"
 #include "PdfCreator.h"
 
-// number of decoded bitmaps to cache for quicker rendering
-#define MAX_IMAGE_PAGE_CACHE    10
+// maximum size (in bytes) of decoded bitmaps to cache for quicker rendering
+#define MAX_IMAGE_PAGE_CACHE_SIZE   (128 * 1024 * 1024)
+// number of pages decoded while determining page sizes (instead of just parsing their headers)
+#define MAX_PREFILLED_PAGES         10
 
 ///// ImagesEngine methods apply to all types of engines handling full-page images /////
 
@@ -25,11 +28,20 @@ struct ImagePage {
     Bitmap *bmp;
     bool ownBmp;
     int refs;
+    // approximate size of the decoded bitmap
+    size_t size;
 
     ImagePage(int pageNo, Bitmap *bmp) :
-        pageNo(pageNo), bmp(bmp), ownBmp(true), refs(1) { }
+        pageNo(pageNo), bmp(bmp), ownBmp(true), refs(1), size(0) { }
 };
 
+static size_t GetDecodedSize(Bitmap *bmp)
+{
+    if (!bmp)
+        return 0;
+    return (size_t)bmp->GetWidth() * bmp->GetHeight() * 4;
+}
+
 class ImageElement;
 
 class ImagesEngine : public BaseEngine {
@@ -80,18 +92,24 @@ protected:
 
     CRITICAL_SECTION cacheAccess;
     Vec<ImagePage *> pageCache;
+    size_t pageCacheSize;
     Vec<RectD> mediaboxes;
 
     void GetTransform(Matrix& m, int pageNo, float zoom, int rotation);
+    bool ShouldPrefillCache() const {
+        return pageCache.Count() < MAX_PREFILLED_PAGES && pageCacheSize < MAX_IMAGE_PAGE_CACHE_SIZE;
+    }
 
     virtual Bitmap *LoadBitmap(int pageNo, bool& deleteAfterUse) = 0;
     virtual RectD LoadMediabox(int pageNo) = 0;
+    // called whenever a page is about to be displayed
+    virtual void ReadAhead(int pageNo) { }
 
     ImagePage *GetPage(int pageNo, bool tryOnly=false);
     void DropPage(ImagePage *page, bool forceRemove=false);
 };
 
-ImagesEngine::ImagesEngine() : fileName(nullptr)
+ImagesEngine::ImagesEngine() : fileName(nullptr), pageCacheSize(0)
 {
     InitializeCriticalSection(&cacheAccess);
 }
@@ -145,6 +163,8 @@ bool ImagesEngine::RenderPage(HDC hDC, RectI screenRect, int pageNo, float zoom,
     ImagePage *page = GetPage(pageNo);
     if (!page)
         return false;
+    if (Target_View == target)
+        ReadAhead(pageNo);
 
     RectD pageRc = pageRect ? *pageRect : PageMediabox(pageNo);
     RectI screen = Transform(pageRc, pageNo, zoom, rotation).Round();
@@ -287,15 +307,16 @@ ImagePage *ImagesEngine::GetPage(int pageNo, bool tryOnly)
     if (!result && tryOnly)
         return nullptr;
     if (!result) {
-        // TODO: drop most memory intensive pages first
-        // (i.e. formats which aren't IsGdiPlusNativeFormat)?
-        if (pageCache.Count() >= MAX_IMAGE_PAGE_CACHE) {
-            CrashIf(pageCache.Count() != MAX_IMAGE_PAGE_CACHE);
-            DropPage(pageCache.Last(), true);
-        }
         result = new ImagePage(pageNo, nullptr);
         result->bmp = LoadBitmap(pageNo, result->ownBmp);
+        result->size = GetDecodedSize(result->bmp);
+        // drop the least recently used pages until the new one fits
+        // (always keeping at least the new page, no matter its size)
+        while (pageCache.Count() > 0 && pageCacheSize + result->size > MAX_IMAGE_PAGE_CACHE_SIZE) {
+            DropPage(pageCache.Last(), true);
+        }
         pageCache.InsertAt(0, result);
+        pageCacheSize += result->size;
     }
     else if (result != pageCache.At(0)) {
         // keep the list Most Recently Used first
@@ -316,8 +337,8 @@ void ImagesEngine::DropPage(ImagePage *page, bool forceRemove)
     ScopedCritSec scope(&cacheAccess);
     page->refs--;
 
-    if (0 == page->refs || forceRemove)
-        pageCache.Remove(page);
+    if ((0 == page->refs || forceRemove) && pageCache.Remove(page))
+        pageCacheSize -= page->size;
 
     if (0 == page->refs) {
         if (page->ownBmp)
@@ -510,7 +531,7 @@ RectD ImageEngineImpl::LoadMediabox(int pageNo)
         return RectD(0, 0, image->GetWidth(), image->GetHeight());
 
     // fill the cache to prevent the first few frames from being unpacked twice
-    ImagePage *page = GetPage(pageNo, MAX_IMAGE_PAGE_CACHE == pageCache.Count());
+    ImagePage *page = GetPage(pageNo, !ShouldPrefillCache());
     if (page) {
         RectD mbox(0, 0, page->bmp->GetWidth(), page->bmp->GetHeight());
         DropPage(page);
@@ -808,10 +829,51 @@ BaseEngine *CreateFromFile(const WCHAR *fileName)
 
 enum CbxFormat { Arch_Zip, Arch_Rar, Arch_7z, Arch_Tar };
 
+// number of pages to extract and decode in the direction of reading
+// (resp. in the opposite direction) while the current page is displayed
+#define READ_AHEAD_PAGES        4
+#define READ_AHEAD_PAGES_BEHIND 2
+// maximum size (in bytes) of read-ahead pages which haven't been displayed yet
+#define MAX_READ_AHEAD_SIZE     (64 * 1024 * 1024)
+#define MAX_READ_AHEAD_THREADS  3
+
+static bool gReadAheadDisabled = false;
+
+// a page extracted and decoded in the background before it's requested
+struct ReadAheadPage {
+    enum State { Queued, Extracting, Extracted, Decoding, Decoded, Failed };
+
+    int pageNo;
+    State state;
+    // compressed image data (between extraction and decoding)
+    char *data;
+    size_t len;
+    Bitmap *bmp;
+    size_t size;
+
+    explicit ReadAheadPage(int pageNo) : pageNo(pageNo), state(Queued), data(nullptr), len(0), bmp(nullptr), size(0) { }
+    ~ReadAheadPage() {
+        free(data);
+        delete bmp;
+    }
+};
+
+class CbxEngineImpl;
+
+class ReadAheadThread : public ThreadBase {
+    CbxEngineImpl *engine;
+
+public:
+    explicit ReadAheadThread(CbxEngineImpl *engine) : ThreadBase("ReadAheadThread"), engine(engine) { }
+    virtual void Run();
+};
+
 class CbxEngineImpl : public ImagesEngine, public json::ValueVisitor {
+    friend ReadAheadThread;
+
 public:
-    CbxEngineImpl(ArchFile *arch, CbxFormat cbxFormat) : cbxFile(arch), cbxFormat(cbxFormat) { }
-    virtual ~CbxEngineImpl() { delete cbxFile; }
+    CbxEngineImpl(ArchFile *arch, CbxFormat cbxFormat);
+    virtual ~CbxEngineImpl();
 
     virtual BaseEngine *Clone() {
         if (fileStream) {
@@ -852,10 +914,34 @@ protected:
     char *GetImageData(int pageNo, size_t& len);
     void ParseComicInfoXml(const char *xmlData);
 
+    virtual void ReadAhead(int pageNo);
+    void RunReadAhead();
+    ReadAheadPage *NextReadAheadJob();
+    ReadAheadPage *FindReadAheadPage(int pageNo);
+    void RemoveReadAheadPage(ReadAheadPage *page);
+    Bitmap *TakeReadAheadBitmap(int pageNo, char **dataOut, size_t *lenOut);
+
     ArchFile *cbxFile;
+    // serializes all access to cbxFile (which isn't thread-safe)
+    CRITICAL_SECTION archiveAccess;
     CbxFormat cbxFormat;
     Vec<size_t> fileIdxs;
 
+    // state for extracting and decoding pages in the background
+    // (only ever accessed while holding readAheadAccess)
+    CRITICAL_SECTION readAheadAccess;
+    Vec<ReadAheadPage *> readAheadPages;
+    Vec<ReadAheadThread *> readAheadThreads;
+    // signaled whenever there might be work for a ReadAheadThread
+    HANDLE readAheadWork;
+    // signaled whenever a ReadAheadThread has finished a job
+    HANDLE readAheadProgress;
+    size_t readAheadSize;
+    int readAheadLastPageNo;
+    // extraction is serialized (through archiveAccess) anyway
+    bool readAheadExtracting;
+    bool readAheadStop;
+
     // extracted metadata
     ScopedMem<WCHAR> propTitle;
     WStrVec propAuthors;
@@ -867,6 +953,36 @@ protected:
     ScopedMem<WCHAR> propAuthorTmp;
 };
 
+CbxEngineImpl::CbxEngineImpl(ArchFile *arch, CbxFormat cbxFormat) :
+    cbxFile(arch), cbxFormat(cbxFormat), readAheadSize(0), readAheadLastPageNo(0),
+    readAheadExtracting(false), readAheadStop(false)
+{
+    InitializeCriticalSection(&archiveAccess);
+    InitializeCriticalSection(&readAheadAccess);
+    readAheadWork = CreateEvent(nullptr, TRUE, FALSE, nullptr);
+    readAheadProgress = CreateEvent(nullptr, TRUE, FALSE, nullptr);
+}
+
+CbxEngineImpl::~CbxEngineImpl()
+{
+    EnterCriticalSection(&readAheadAccess);
+    readAheadStop = true;
+    SetEvent(readAheadWork);
+    LeaveCriticalSection(&readAheadAccess);
+    for (ReadAheadThread *thread : readAheadThreads) {
+        thread->RequestCancel();
+        thread->Join();
+        delete thread;
+    }
+    DeleteVecMembers(readAheadPages);
+    CloseHandle(readAheadWork);
+    CloseHandle(readAheadProgress);
+    DeleteCriticalSection(&readAheadAccess);
+
+    delete cbxFile;
+    DeleteCriticalSection(&archiveAccess);
+}
+
 bool CbxEngineImpl::LoadFromFile(const WCHAR *file)
 {
     if (!file)
@@ -941,10 +1057,214 @@ bool CbxEngineImpl::FinishLoading()
 char *CbxEngineImpl::GetImageData(int pageNo, size_t& len)
 {
     AssertCrash(1 <= pageNo && pageNo <= PageCount());
-    ScopedCritSec scope(&cacheAccess);
+    ScopedCritSec scope(&archiveAccess);
     return cbxFile->GetFileDataByIdx(fileIdxs.At(pageNo - 1), &len);
 }
 
+ReadAheadPage *CbxEngineImpl::FindReadAheadPage(int pageNo)
+{
+    for (ReadAheadPage *page : readAheadPages) {
+        if (page->pageNo == pageNo)
+            return page;
+    }
+    return nullptr;
+}
+
+void CbxEngineImpl::RemoveReadAheadPage(ReadAheadPage *page)
+{
+    readAheadPages.Remove(page);
+    if (page->bmp)
+        readAheadSize -= page->size;
+    delete page;
+}
+
+// (re)fills the read-ahead queue with the pages around pageNo, closest ones first
+void CbxEngineImpl::ReadAhead(int pageNo)
+{
+    if (gReadAheadDisabled)
+        return;
+
+    ScopedCritSec scope(&cacheAccess);
+    ScopedCritSec scope2(&readAheadAccess);
+
+    int dir = pageNo >= readAheadLastPageNo ? 1 : -1;
+    readAheadLastPageNo = pageNo;
+    Vec<int> wanted;
+    for (int i = 1; i <= READ_AHEAD_PAGES; i++) {
+        wanted.Append(pageNo + i * dir);
+        if (i <= READ_AHEAD_PAGES_BEHIND)
+            wanted.Append(pageNo - i * dir);
+    }
+
+    // pages which are no longer wanted are dropped (including their bitmaps),
+    // pages which are already being worked on are simply forgotten about
+    for (size_t i = readAheadPages.Count(); i > 0; i--) {
+        ReadAheadPage *page = readAheadPages.At(i - 1);
+        if (!wanted.Contains(page->pageNo))
+            RemoveReadAheadPage(page);
+    }
+    Vec<ReadAheadPage *> queue;
+    for (int wantedNo : wanted) {
+        if (wantedNo < 1 || wantedNo > PageCount())
+            continue;
+        ReadAheadPage *page = FindReadAheadPage(wantedNo);
+        if (!page) {
+            bool isCached = false;
+            for (size_t i = 0; i < pageCache.Count() && !isCached; i++) {
+                isCached = pageCache.At(i)->pageNo == wantedNo;
+            }
+            if (isCached)
+                continue;
+            page = new ReadAheadPage(wantedNo);
+        }
+        queue.Append(page);
+    }
+    readAheadPages.Reset();
+    readAheadPages.Append(queue.LendData(), queue.Count());
+    if (readAheadPages.Count() == 0)
+        return;
+
+    // the threads are only started when a page is displayed for the first time
+    if (readAheadThreads.Count() == 0) {
+        SYSTEM_INFO si;
+        GetSystemInfo(&si);
+        int threadCount = limitValue((int)si.dwNumberOfProcessors - 1, 1, MAX_READ_AHEAD_THREADS);
+        for (int i = 0; i < threadCount; i++) {
+            readAheadThreads.Append(new ReadAheadThread(this));
+            readAheadThreads.Last()->Start();
+        }
+    }
+    SetEvent(readAheadWork);
+}
+
+// must be called while holding readAheadAccess; decoding extracted pages
+// is preferred, as it frees their compressed data (and can happen in parallel)
+ReadAheadPage *CbxEngineImpl::NextReadAheadJob()
+{
+    if (readAheadSize < MAX_READ_AHEAD_SIZE) {
+        for (ReadAheadPage *page : readAheadPages) {
+            if (ReadAheadPage::Extracted == page->state) {
+                page->state = ReadAheadPage::Decoding;
+                return page;
+            }
+        }
+    }
+    if (!readAheadExtracting) {
+        for (ReadAheadPage *page : readAheadPages) {
+            if (ReadAheadPage::Queued == page->state) {
+                page->state = ReadAheadPage::Extracting;
+                readAheadExtracting = true;
+                return page;
+            }
+        }
+    }
+    return nullptr;
+}
+
+void ReadAheadThread::Run()
+{
+    engine->RunReadAhead();
+}
+
+void CbxEngineImpl::RunReadAhead()
+{
+    for (;;) {
+        WaitForSingleObject(readAheadWork, INFINITE);
+        EnterCriticalSection(&readAheadAccess);
+        if (readAheadStop) {
+            LeaveCriticalSection(&readAheadAccess);
+            return;
+        }
+        ReadAheadPage *page = NextReadAheadJob();
+        if (!page) {
+            ResetEvent(readAheadWork);
+            LeaveCriticalSection(&readAheadAccess);
+            continue;
+        }
+        // page might be dropped by ReadAhead while we're working on it,
+        // so only its number and data are used outside of readAheadAccess
+        int pageNo = page->pageNo;
+        ReadAheadPage::State state = page->state;
+        char *data = page->data;
+        size_t len = page->len;
+        page->data = nullptr;
+        LeaveCriticalSection(&readAheadAccess);
+
+        Bitmap *bmp = nullptr;
+        if (ReadAheadPage::Extracting == state) {
+            data = GetImageData(pageNo, len);
+        }
+        else {
+            bmp = BitmapFromData(data, len);
+            // GDI+ decodes lazily, so force decoding here instead of when drawing
+            if (bmp && bmp->GetLastStatus() == Ok) {
+                Bitmap *decoded = bmp->Clone(0, 0, bmp->GetWidth(), bmp->GetHeight(), PixelFormat32bppPARGB);
+                if (decoded && decoded->GetLastStatus() == Ok) {
+                    delete bmp;
+                    bmp = decoded;
+                }
+                else {
+                    delete decoded;
+                }
+            }
+            free(data);
+            data = nullptr;
+        }
+
+        ScopedCritSec scope(&readAheadAccess);
+        if (ReadAheadPage::Extracting == state)
+            readAheadExtracting = false;
+        page = FindReadAheadPage(pageNo);
+        if (!page || page->state != state) {
+            free(data);
+            delete bmp;
+        }
+        else if (ReadAheadPage::Extracting == state) {
+            page->state = data ? ReadAheadPage::Extracted : ReadAheadPage::Failed;
+            page->data = data;
+            page->len = len;
+        }
+        else {
+            page->state = bmp ? ReadAheadPage::Decoded : ReadAheadPage::Failed;
+            page->bmp = bmp;
+            page->size = GetDecodedSize(bmp);
+            readAheadSize += page->size;
+        }
+        SetEvent(readAheadProgress);
+    }
+}
+
+// returns the bitmap for pageNo if it has been decoded in the background
+// (waiting for it if it's currently being extracted or decoded) or its data
+// in dataOut if it has only been extracted so far
+Bitmap *CbxEngineImpl::TakeReadAheadBitmap(int pageNo, char **dataOut, size_t *lenOut)
+{
+    ScopedCritSec scope(&readAheadAccess);
+    for (;;) {
+        ReadAheadPage *page = FindReadAheadPage(pageNo);
+        if (!page)
+            return nullptr;
+        if (ReadAheadPage::Extracting == page->state || ReadAheadPage::Decoding == page->state) {
+            ResetEvent(readAheadProgress);
+            LeaveCriticalSection(&readAheadAccess);
+            // the timeout prevents a lost wakeup if several threads wait at once
+            WaitForSingleObject(readAheadProgress, 50);
+            EnterCriticalSection(&readAheadAccess);
+            continue;
+        }
+        Bitmap *bmp = page->bmp;
+        page->bmp = nullptr;
+        readAheadSize -= page->size;
+        *dataOut = page->data;
+        *lenOut = page->len;
+        page->data = nullptr;
+        RemoveReadAheadPage(page);
+        // more pages might now fit into the budget
+        SetEvent(readAheadWork);
+        return bmp;
+    }
+}
+
 static char *GetTextContent(HtmlPullParser& parser)
 {
     HtmlToken *tok = parser.Next();
@@ -1085,8 +1405,14 @@ const WCHAR *CbxEngineImpl::GetDefaultFileExt() const
 
 Bitmap *CbxEngineImpl::LoadBitmap(int pageNo, bool& deleteAfterUse)
 {
-    size_t len;
-    ScopedMem<char> bmpData(GetImageData(pageNo, len));
+    char *data = nullptr;
+    size_t len = 0;
+    Bitmap *bmp = TakeReadAheadBitmap(pageNo, &data, &len);
+    if (bmp) {
+        deleteAfterUse = true;
+        return bmp;
+    }
+    ScopedMem<char> bmpData(data ? data : GetImageData(pageNo, len));
     if (bmpData) {
         deleteAfterUse = true;
         return BitmapFromData(bmpData, len);
@@ -1097,7 +1423,7 @@ Bitmap *CbxEngineImpl::LoadBitmap(int pageNo, bool& deleteAfterUse)
 RectD CbxEngineImpl::LoadMediabox(int pageNo)
 {
     // fill the cache to prevent the first few images from being unpacked twice
-    ImagePage *page = GetPage(pageNo, MAX_IMAGE_PAGE_CACHE == pageCache.Count());
+    ImagePage *page = GetPage(pageNo, !ShouldPrefillCache());
     if (page) {
         RectD mbox(0, 0, page->bmp->GetWidth(), page->bmp->GetHeight());
         DropPage(page);
@@ -1180,6 +1506,11 @@ BaseEngine *CbxEngineImpl::CreateFromStream(IStream *stream)
 
 namespace CbxEngine {
 
+void DebugDisableReadAhead(bool disable)
+{
+    gReadAheadDisabled = disable;
+}
+
 bool IsSupportedFile(const WCHAR *fileName, bool sniff)
 {
     if (sniff) {
@@ -22,4 +22,7 @@ bool IsSupportedFile(const WCHAR *fileName, bool sniff=false);
 BaseEngine *CreateFromFile(const WCHAR *fileName);
 BaseEngine *CreateFromStream(IStream *stream);
 
+// for benchmarking page turns without extracting and decoding pages in the background
+void DebugDisableReadAhead(bool disable);
+
 }
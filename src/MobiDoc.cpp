@@ -10,6 +10,8 @@
 #include "HtmlParserLookup.h"
 #include "HtmlPullParser.h"
 #include "PalmDbReader.h"
+#include "ThreadUtil.h"
+#include "Timer.h"
 #include "TrivialHtmlParser.h"
 // rendering engines
 #include "BaseEngine.h"
@@ -32,6 +34,9 @@
 #define ENCRYPTION_OLD  1
 #define ENCRYPTION_NEW  2
 
+#define MAX_DECOMPRESSION_THREADS 8
+#define MIN_RECORDS_PER_THREAD 32
+
 struct PalmDocHeader
 {
     uint16      compressionType;
@@ -193,6 +198,23 @@ static_assert(kCdicHeaderLen == sizeof(CdicHeader), "wrong size of CdicHeader st
 
 #define kCdicsMax 32
 
+// number of bits looked up at once by the table-driven decoder
+#define kMultiSymBits   12
+#define kMultiSymMax    4
+
+// all codes which fit completely into kMultiSymBits bits (up to kMultiSymMax)
+struct MultiSymEntry {
+    uint8       count; // 0 if the first code is longer than kMultiSymBits
+    uint8       bitsUsed;
+    uint32      codes[kMultiSymMax];
+};
+
+// fully expanded non-terminal dictionary entry
+struct ExpandedSym {
+    uint32      len;
+    char        s[1];
+};
+
 class HuffDicDecompressor
 {
     uint32      cacheTable[kCacheItemCount];
@@ -202,23 +224,92 @@ class HuffDicDecompressor
     // owned by the creator (in our case: by the PdbReader)
     uint8 *     dicts[kCdicsMax];
     uint32      dictSize[kCdicsMax];
+    // memoized expansions of non-terminal entries (one slot per code)
+    ExpandedSym **expanded[kCdicsMax];
+    uint32      expandedCount[kCdicsMax];
 
     uint32      codeLength;
 
-    Vec<uint32> recursionGuard;
+    MultiSymEntry *multiSymTable;
+
+    bool LookupCode(uint32 bits, uint32 *codeOut, uint32 *codeLenOut) const;
+    void BuildMultiSymTable();
+    bool Decompress(uint8 *src, size_t octets, str::Str<char>& dst, Vec<uint32>& recursionGuard, bool useTables);
+    bool DecodeBits(BitReader& br, str::Str<char>& dst, Vec<uint32>& recursionGuard, bool useTables);
+    bool DecodeOne(uint32 code, str::Str<char>& dst, Vec<uint32>& recursionGuard, bool useTables);
 
 public:
     HuffDicDecompressor();
+    ~HuffDicDecompressor();
 
     bool SetHuffData(uint8 *huffData, size_t huffDataLen);
     bool AddCdicData(uint8 *cdicData, uint32 cdicDataLen);
-    bool Decompress(uint8 *src, size_t octets, str::Str<char>& dst);
-    bool DecodeOne(uint32 code, str::Str<char>& dst);
+    // can be called from several threads at once
+    // (useTables=false decodes one code at a time without any memoization)
+    bool Decompress(uint8 *src, size_t octets, str::Str<char>& dst, bool useTables=true);
 };
 
-HuffDicDecompressor::HuffDicDecompressor() : codeLength(0), dictsCount(0) { }
+HuffDicDecompressor::HuffDicDecompressor() : codeLength(0), dictsCount(0), multiSymTable(nullptr) { }
+
+HuffDicDecompressor::~HuffDicDecompressor()
+{
+    for (size_t i = 0; i < dictsCount; i++) {
+        for (uint32 code = 0; code < expandedCount[i]; code++) {
+            free(expanded[i][code]);
+        }
+        free(expanded[i]);
+    }
+    free(multiSymTable);
+}
+
+// determines the code at the start of bits (which must be MSB aligned)
+bool HuffDicDecompressor::LookupCode(uint32 bits, uint32 *codeOut, uint32 *codeLenOut) const
+{
+    uint32 v = cacheTable[bits >> 24];
+    uint32 codeLen = v & 0x1f;
+    if (!codeLen)
+        return false;
+    bool isTerminal = (v & 0x80) != 0;
+
+    uint32 code;
+    if (isTerminal) {
+        code = (v >> 8) - (bits >> (32 - codeLen));
+    } else {
+        uint32 baseVal;
+        codeLen -= 1;
+        do {
+            codeLen++;
+            if (codeLen > 32)
+                return false;
+            baseVal = baseTable[codeLen * 2 - 2];
+            code = (bits >> (32 - codeLen));
+        } while (baseVal > code);
+        code = baseTable[codeLen * 2 - 1] - (bits >> (32 - codeLen));
+    }
+    *codeOut = code;
+    *codeLenOut = codeLen;
+    return true;
+}
 
-bool HuffDicDecompressor::DecodeOne(uint32 code, str::Str<char>& dst)
+// precomputes for every kMultiSymBits bit prefix all the codes it completely contains
+// (canonical codes only depend on their own bits, so the zero padding doesn't matter)
+void HuffDicDecompressor::BuildMultiSymTable()
+{
+    multiSymTable = AllocArray<MultiSymEntry>(1 << kMultiSymBits);
+    for (uint32 prefix = 0; prefix < (1 << kMultiSymBits); prefix++) {
+        MultiSymEntry& e = multiSymTable[prefix];
+        while (e.count < kMultiSymMax) {
+            uint32 bits = (prefix << (32 - kMultiSymBits)) << e.bitsUsed;
+            uint32 code, codeLen;
+            if (!LookupCode(bits, &code, &codeLen) || e.bitsUsed + codeLen > kMultiSymBits)
+                break;
+            e.codes[e.count++] = code;
+            e.bitsUsed += (uint8)codeLen;
+        }
+    }
+}
+
+bool HuffDicDecompressor::DecodeOne(uint32 code, str::Str<char>& dst, Vec<uint32>& recursionGuard, bool useTables)
 {
     uint16 dict = (uint16)(code >> codeLength);
     if (dict >= dictsCount) {
@@ -240,14 +331,37 @@ bool HuffDicDecompressor::DecodeOne(uint32 code, str::Str<char>& dst)
     }
 
     if (!(symLen & 0x8000)) {
+        ExpandedSym *sym = useTables ? expanded[dict][code] : nullptr;
+        if (sym) {
+            dst.Append(sym->s, sym->len);
+            return true;
+        }
         if (recursionGuard.Contains(code)) {
             lf("infinite recursion");
             return false;
         }
         recursionGuard.Push(code);
-        if (!Decompress(p, symLen, dst))
+        if (!useTables) {
+            if (!Decompress(p, symLen, dst, recursionGuard, false))
+                return false;
+            recursionGuard.Pop();
+            return true;
+        }
+        str::Str<char> tmp(256);
+        if (!Decompress(p, symLen, tmp, recursionGuard, true))
             return false;
         recursionGuard.Pop();
+        sym = (ExpandedSym *)malloc(sizeof(ExpandedSym) + tmp.Size());
+        if (!sym) {
+            dst.Append(tmp.Get(), tmp.Size());
+            return true;
+        }
+        sym->len = (uint32)tmp.Size();
+        memcpy(sym->s, tmp.Get(), tmp.Size() + 1);
+        // another thread might have expanded the same entry in the meantime
+        if (InterlockedCompareExchangePointer((PVOID volatile *)&expanded[dict][code], sym, nullptr))
+            free(sym);
+        dst.Append(tmp.Get(), tmp.Size());
     } else {
         symLen &= 0x7fff;
         if (symLen > 127) {
@@ -259,12 +373,55 @@ bool HuffDicDecompressor::DecodeOne(uint32 code, str::Str<char>& dst)
     return true;
 }
 
-bool HuffDicDecompressor::Decompress(uint8 *src, size_t srcSize, str::Str<char>& dst)
+bool HuffDicDecompressor::Decompress(uint8 *src, size_t srcSize, str::Str<char>& dst, bool useTables)
 {
-    uint32    bitsConsumed = 0;
-    uint32    bits = 0;
+    Vec<uint32> recursionGuard;
+    return Decompress(src, srcSize, dst, recursionGuard, useTables);
+}
+
+// returns the 32 bits starting at bitPos (at least 5 bytes must be available)
+static inline uint32 PeekBitsBE(const uint8 *src, size_t bitPos)
+{
+    const uint8 *p = src + bitPos / 8;
+    uint64 v = ((uint64)p[0] << 32) | ((uint64)p[1] << 24) | ((uint64)p[2] << 16) | ((uint64)p[3] << 8) | p[4];
+    return (uint32)(v >> (8 - bitPos % 8));
+}
+
+bool HuffDicDecompressor::Decompress(uint8 *src, size_t srcSize, str::Str<char>& dst, Vec<uint32>& recursionGuard, bool useTables)
+{
+    size_t bitPos = 0;
+    // while enough data is left, decode up to kMultiSymMax codes per lookup
+    // (the final bits are handled by DecodeBits because of the zero padding)
+    while (useTables && multiSymTable && bitPos + 40 <= srcSize * 8) {
+        uint32 bits = PeekBitsBE(src, bitPos);
+        MultiSymEntry& e = multiSymTable[bits >> (32 - kMultiSymBits)];
+        if (e.count > 0) {
+            for (uint8 i = 0; i < e.count; i++) {
+                if (!DecodeOne(e.codes[i], dst, recursionGuard, true))
+                    return false;
+            }
+            bitPos += e.bitsUsed;
+            continue;
+        }
+        uint32 code, codeLen;
+        if (!LookupCode(bits, &code, &codeLen)) {
+            lf("corrupted table");
+            return false;
+        }
+        if (!DecodeOne(code, dst, recursionGuard, true))
+            return false;
+        bitPos += codeLen;
+    }
 
     BitReader br(src, srcSize);
+    br.Eat(bitPos);
+    return DecodeBits(br, dst, recursionGuard, useTables);
+}
+
+bool HuffDicDecompressor::DecodeBits(BitReader& br, str::Str<char>& dst, Vec<uint32>& recursionGuard, bool useTables)
+{
+    uint32    bitsConsumed = 0;
+    uint32    bits = 0;
 
     for (;;) {
         if (bitsConsumed > br.BitsLeft()) {
@@ -278,33 +435,12 @@ bool HuffDicDecompressor::Decompress(uint8 *src, size_t srcSize, str::Str<char>&
         bits = br.Peek(32);
         if (br.BitsLeft() < 8 && 0 == bits)
             break;
-        uint32 v = cacheTable[bits >> 24];
-        uint32 codeLen = v & 0x1f;
-        if (!codeLen) {
-            lf("corrupted table, zero code len");
+        uint32 code, codeLen;
+        if (!LookupCode(bits, &code, &codeLen)) {
+            lf("corrupted table");
             return false;
         }
-        bool isTerminal = (v & 0x80) != 0;
-
-        uint32 code;
-        if (isTerminal) {
-            code = (v >> 8) - (bits >> (32 - codeLen));
-        } else {
-            uint32 baseVal;
-            codeLen -= 1;
-            do {
-                codeLen++;
-                if (codeLen > 32) {
-                    lf("code len > 32 bits");
-                    return false;
-                }
-                baseVal = baseTable[codeLen * 2 - 2];
-                code = (bits >> (32 - codeLen));
-            } while (baseVal > code);
-            code = baseTable[codeLen * 2 - 1] - (bits >> (32 - codeLen));
-        }
-
-        if (!DecodeOne(code, dst))
+        if (!DecodeOne(code, dst, recursionGuard, useTables))
             return false;
         bitsConsumed = codeLen;
     }
@@ -352,6 +488,7 @@ bool HuffDicDecompressor::SetHuffData(uint8 *huffData, size_t huffDataLen)
         baseTable[i] = d.UInt32();
     }
     CrashIf(d.Offset() != kHuffRecordMinLen);
+    BuildMultiSymTable();
     return true;
 }
 
@@ -379,8 +516,13 @@ bool HuffDicDecompressor::AddCdicData(uint8 *cdicData, uint32 cdicDataLen)
     uint32 maxSize = 1 << codeLength;
     if (maxSize >= size)
         return false;
+    ExpandedSym **expandedSyms = AllocArray<ExpandedSym *>(maxSize);
+    if (!expandedSyms)
+        return false;
     dicts[dictsCount] = cdicData + hdrLen;
     dictSize[dictsCount] = size;
+    expanded[dictsCount] = expandedSyms;
+    expandedCount[dictsCount] = maxSize;
     ++dictsCount;
     return true;
 }
@@ -466,7 +608,8 @@ MobiDoc::MobiDoc(const WCHAR *filePath) :
     fileName(str::Dup(filePath)), pdbReader(nullptr),
     docType(Pdb_Unknown), docRecCount(0), compressionType(0), docUncompressedSize(0),
     doc(nullptr), multibyte(false), trailersCount(0), imageFirstRec(0), coverImageRec(0),
-    imagesCount(0), images(nullptr), huffDic(nullptr), textEncoding(CP_UTF8), docTocIndex((size_t)-1)
+    imagesCount(0), images(nullptr), huffDic(nullptr), textEncoding(CP_UTF8), singleByteEncoding(false),
+    docTocIndex((size_t)-1)
 {
 }
 
@@ -819,25 +962,116 @@ bool MobiDoc::LoadDocRecordIntoBuffer(size_t recNo, str::Str<char>& strOut)
     return false;
 }
 
+// replaces unexpected \0 with spaces and converts single-byte
+// encoded text to UTF-8 (which can be done per record)
+void MobiDoc::FixupDocRecord(str::Str<char>& rec)
+{
+    // cf. https://code.google.com/p/sumatrapdf/issues/detail?id=2529
+    char *s = rec.Get(), *end = s + rec.Size();
+    while ((s = (char *)memchr(s, '\0', end - s)) != nullptr) {
+        *s = ' ';
+    }
+    if (textEncoding != CP_UTF8 && singleByteEncoding) {
+        char *recUtf8 = str::ToMultiByte(rec.Get(), textEncoding, CP_UTF8);
+        if (recUtf8) {
+            rec.Reset();
+            rec.AppendAndFree(recUtf8);
+        }
+    }
+}
+
+// decompresses text records until there are none left (all
+// threads decompressing share nextRecNo); returns false on error
+bool MobiDoc::DecompressNextDocRecords(LONG *nextRecNo, str::Str<char> *records, bool fixup)
+{
+    for (;;) {
+        size_t recNo = (size_t)InterlockedIncrement(nextRecNo);
+        if (recNo > docRecCount)
+            return true;
+        str::Str<char>& rec = records[recNo - 1];
+        if (!LoadDocRecordIntoBuffer(recNo, rec))
+            return false;
+        if (fixup)
+            FixupDocRecord(rec);
+    }
+}
+
+class MobiDecompressionThread : public ThreadBase {
+    MobiDoc *doc;
+    LONG *nextRecNo;
+    str::Str<char> *records;
+    bool fixup;
+
+public:
+    bool ok;
+
+    MobiDecompressionThread(MobiDoc *doc, LONG *nextRecNo, str::Str<char> *records, bool fixup) :
+        ThreadBase("MobiDecompressionThread"), doc(doc), nextRecNo(nextRecNo),
+        records(records), fixup(fixup), ok(false) { }
+
+    virtual void Run() {
+        ok = doc->DecompressNextDocRecords(nextRecNo, records, fixup);
+    }
+};
+
+// text records are compressed independently of each other, so larger
+// documents are decompressed on several threads at once
+bool MobiDoc::DecompressDocRecords(str::Str<char> *records, int threadCount, bool fixup)
+{
+    LONG nextRecNo = 0;
+    Vec<MobiDecompressionThread *> threads;
+    for (int i = 1; i < threadCount; i++) {
+        MobiDecompressionThread *thread = new MobiDecompressionThread(this, &nextRecNo, records, fixup);
+        threads.Append(thread);
+        thread->Start();
+    }
+    // the calling thread helps out
+    bool ok = DecompressNextDocRecords(&nextRecNo, records, fixup);
+    for (MobiDecompressionThread *thread : threads) {
+        thread->Join();
+        ok = ok && thread->ok;
+        delete thread;
+    }
+    return ok;
+}
+
+static int GetDecompressionThreadCount(size_t recCount)
+{
+    SYSTEM_INFO si;
+    GetSystemInfo(&si);
+    int count = limitValue((int)si.dwNumberOfProcessors, 1, MAX_DECOMPRESSION_THREADS);
+    // for smaller documents, starting threads isn't worth it
+    return limitValue((int)(recCount / MIN_RECORDS_PER_THREAD), 1, count);
+}
+
 bool MobiDoc::LoadDocument(PdbReader *pdbReader)
 {
     this->pdbReader = pdbReader;
     if (!ParseHeader())
         return false;
 
+    CPINFO cpInfo;
+    singleByteEncoding = GetCPInfo(textEncoding, &cpInfo) && 1 == cpInfo.MaxCharSize;
+
     assert(!doc);
-    doc = new str::Str<char>(docUncompressedSize);
-    for (size_t i = 1; i <= docRecCount; i++) {
-        if (!LoadDocRecordIntoBuffer(i, *doc))
-            return false;
-    }
-    // replace unexpected \0 with spaces
-    // cf. https://code.google.com/p/sumatrapdf/issues/detail?id=2529
-    char *s = doc->Get(), *end = s + doc->Size();
-    while ((s = (char *)memchr(s, '\0', end - s)) != nullptr) {
-        *s = ' ';
+    str::Str<char> *records = new str::Str<char>[docRecCount];
+    bool ok = DecompressDocRecords(records, GetDecompressionThreadCount(docRecCount), true);
+    if (ok) {
+        size_t size = 0;
+        for (size_t i = 0; i < docRecCount; i++) {
+            size += records[i].Size();
+        }
+        doc = new str::Str<char>(size);
+        for (size_t i = 0; i < docRecCount; i++) {
+            doc->Append(records[i].Get(), records[i].Size());
+        }
     }
-    if (textEncoding != CP_UTF8) {
+    delete[] records;
+    if (!ok)
+        return false;
+
+    if (textEncoding != CP_UTF8 && !singleByteEncoding) {
+        // characters of multi-byte encodings can span record boundaries
         char *docUtf8 = str::ToMultiByte(doc->Get(), textEncoding, CP_UTF8);
         if (docUtf8) {
             doc->Reset();
@@ -847,6 +1081,52 @@ bool MobiDoc::LoadDocument(PdbReader *pdbReader)
     return true;
 }
 
+// returns the time it takes to decompress all text records (or
+// a negative value on error)
+double MobiDoc::BenchDecompress(int threadCount, size_t *uncompressedSizeOut)
+{
+    str::Str<char> *records = new str::Str<char>[docRecCount];
+    Timer t;
+    bool ok = DecompressDocRecords(records, threadCount, false);
+    double timeMs = t.Stop();
+    *uncompressedSizeOut = 0;
+    for (size_t i = 0; i < docRecCount; i++) {
+        *uncompressedSizeOut += records[i].Size();
+    }
+    delete[] records;
+    return ok ? timeMs : -1;
+}
+
+// decodes all text records with both the table-driven and the one code at
+// a time HuffDic decoder; returns false if their output ever differs
+bool MobiDoc::BenchHuffDicDecoders(double *refTimeMs, double *tablesTimeMs)
+{
+    *refTimeMs = *tablesTimeMs = 0;
+    if (!huffDic)
+        return false;
+    for (size_t recNo = 1; recNo <= docRecCount; recNo++) {
+        size_t recSize;
+        const char *recData = pdbReader->GetRecord(recNo, &recSize);
+        if (!recData)
+            return false;
+        recSize = GetRealRecordSize((uint8*)recData, recSize, trailersCount, multibyte);
+        if ((size_t)-1 == recSize)
+            return false;
+        str::Str<char> ref, tables;
+        Timer t;
+        bool ok = huffDic->Decompress((uint8*)recData, recSize, ref, false);
+        *refTimeMs += t.Stop();
+        t.Start();
+        ok = huffDic->Decompress((uint8*)recData, recSize, tables, true) && ok;
+        *tablesTimeMs += t.Stop();
+        if (!ok || ref.Size() != tables.Size() || !memeq(ref.Get(), tables.Get(), ref.Size())) {
+            lf("HuffDic decoders differ for record %d", (int)recNo);
+            return false;
+        }
+    }
+    return true;
+}
+
 char *MobiDoc::GetHtmlData(size_t& lenOut) const
 {
     lenOut = doc->Size();
@@ -2,6 +2,7 @@
    License: Simplified BSD (see COPYING.BSD) */
 
 class HuffDicDecompressor;
+class MobiDecompressionThread;
 class PdbReader;
 
 enum PdbDocType { Pdb_Unknown, Pdb_Mobipocket, Pdb_PalmDoc, Pdb_TealDoc };
@@ -17,6 +18,8 @@ class MobiDoc
     int                 compressionType;
     size_t              docUncompressedSize;
     int                 textEncoding;
+    // set if text can be converted to UTF-8 one record at a time
+    bool                singleByteEncoding;
     size_t              docTocIndex;
 
     bool                multibyte;
@@ -38,11 +41,16 @@ class MobiDoc
 
     bool    ParseHeader();
     bool    LoadDocRecordIntoBuffer(size_t recNo, str::Str<char>& strOut);
+    void    FixupDocRecord(str::Str<char>& rec);
+    bool    DecompressNextDocRecords(LONG *nextRecNo, str::Str<char> *records, bool fixup);
+    bool    DecompressDocRecords(str::Str<char> *records, int threadCount, bool fixup);
     void    LoadImages();
     bool    LoadImage(size_t imageNo);
     bool    LoadDocument(PdbReader *pdbReader);
     bool    DecodeExthHeader(const char *data, size_t dataLen);
 
+    friend class MobiDecompressionThread;
+
 public:
     str::Str<char> *    doc;
 
@@ -61,6 +69,10 @@ public:
     bool                HasToc();
     bool                ParseToc(EbookTocVisitor *visitor);
 
+    double              BenchDecompress(int threadCount, size_t *uncompressedSizeOut);
+    bool                IsHuffDicCompressed() const { return huffDic != nullptr; }
+    bool                BenchHuffDicDecoders(double *refTimeMs, double *tablesTimeMs);
+
     static bool         IsSupportedFile(const WCHAR *fileName, bool sniff=false);
     static MobiDoc *    CreateFromFile(const WCHAR *fileName);
     static MobiDoc *    CreateFromStream(IStream *stream);
@@ -14,6 +14,8 @@ extern "C" {
 #include "FileUtil.h"
 #include "HtmlParserLookup.h"
 #include "HtmlPullParser.h"
+#include "ThreadUtil.h"
+#include "Timer.h"
 #include "TrivialHtmlParser.h"
 #include "WinUtil.h"
 #include "ZipUtil.h"
@@ -171,13 +173,106 @@ ProducingPaletteDone:
     return new RenderedBitmap(hbmp, SizeI(w, h), hMap);
 }
 
+// reading files can be throttled for simulating slow network shares
+static int gDebugThrottleBytesPerSec = 0;
+
+void DebugThrottleFileAccess(int bytesPerSec)
+{
+    gDebugThrottleBytesPerSec = bytesPerSec;
+}
+
+struct ThrottledState {
+    fz_stream *chain;
+    int bytesPerSec;
+    // how long reading should have taken but didn't yet (reads are too
+    // small to sleep for each one and Sleep doesn't return on time)
+    double debtMs;
+    unsigned char buffer[4096];
+};
+
+static int next_throttled(fz_stream *stm, int len)
+{
+    ThrottledState *state = (ThrottledState *)stm->state;
+    if (len > (int)sizeof(state->buffer))
+        len = sizeof(state->buffer);
+    int n = fz_read(state->chain, state->buffer, len);
+    if (n > 0)
+        state->debtMs += n * 1000.0 / state->bytesPerSec;
+    if (state->debtMs >= 1.0) {
+        Timer t;
+        Sleep((DWORD)state->debtMs);
+        state->debtMs -= t.Stop();
+    }
+    stm->rp = state->buffer;
+    stm->wp = state->buffer + n;
+    stm->pos += n;
+    if (n == 0)
+        return EOF;
+    return *stm->rp++;
+}
+
+static void seek_throttled(fz_stream *stm, int offset, int whence)
+{
+    ThrottledState *state = (ThrottledState *)stm->state;
+    fz_seek(state->chain, offset, whence);
+    stm->pos = fz_tell(state->chain);
+    stm->rp = stm->wp = state->buffer;
+}
+
+static void close_throttled(fz_context *ctx, void *state_)
+{
+    ThrottledState *state = (ThrottledState *)state_;
+    fz_close(state->chain);
+    fz_free(ctx, state);
+}
+
+static fz_stream *fz_open_throttled(fz_stream *chain, int bytesPerSec)
+{
+    fz_context *ctx = chain->ctx;
+    ThrottledState *state = nullptr;
+    fz_var(state);
+    fz_try(ctx) {
+        state = fz_malloc_struct(ctx, ThrottledState);
+        state->chain = chain;
+        state->bytesPerSec = bytesPerSec;
+    }
+    fz_catch(ctx) {
+        fz_close(chain);
+        fz_rethrow(ctx);
+    }
+    fz_stream *stm = fz_new_stream(ctx, state, next_throttled, close_throttled, nullptr);
+    stm->seek = seek_throttled;
+    return stm;
+}
+
+// makes MuPDF read linearized files "progressively" (without having to
+// wait for data, as it's all available): only the first page's xref
+// section and the hint tables are read at first, the main xref once
+// it's needed (cf. pdf_lookup_linear_page_obj)
+static int fz_meta_linear(fz_stream *stm, int key, int size, void *ptr)
+{
+    switch (key) {
+    case FZ_STREAM_META_PROGRESSIVE:
+    case FZ_STREAM_META_DATA_AVAILABLE:
+        return 1;
+    case FZ_STREAM_META_LENGTH: {
+        int pos = fz_tell(stm);
+        fz_seek(stm, 0, 2);
+        int len = fz_tell(stm);
+        fz_seek(stm, pos, 0);
+        return len;
+    }
+    }
+    return -1;
+}
+
 fz_stream *fz_open_file2(fz_context *ctx, const WCHAR *filePath)
 {
     fz_stream *file = nullptr;
     int64 fileSize = file::GetSize(filePath);
     // load small files entirely into memory so that they can be
     // overwritten even by programs that don't open files with FILE_SHARE_READ
-    if (fileSize > 0 && fileSize < MAX_MEMORY_FILE_SIZE) {
+    if (fileSize > 0 && fileSize < MAX_MEMORY_FILE_SIZE && !gDebugThrottleBytesPerSec) {
         fz_buffer *data = nullptr;
         fz_var(data);
         fz_try(ctx) {
@@ -196,6 +291,10 @@ fz_stream *fz_open_file2(fz_context *ctx, const WCHAR *filePath)
 
     fz_try(ctx) {
         file = fz_open_file_w(ctx, filePath);
+        if (gDebugThrottleBytesPerSec > 0)
+            file = fz_open_throttled(file, gDebugThrottleBytesPerSec);
+        // only large files are worth being loaded progressively
+        file->meta = fz_meta_linear;
     }
     fz_catch(ctx) {
         file = nullptr;
@@ -223,31 +322,29 @@ unsigned char *fz_extract_stream_data(fz_stream *stream, size_t *cbCount)
     return data;
 }
 
-void fz_stream_fingerprint(fz_stream *file, unsigned char digest[16])
+// returns false (and a nullptr fingerprint) if the stream can't be read
+bool fz_stream_fingerprint(fz_stream *file, unsigned char digest[16])
 {
-    int fileLen = -1;
-    fz_buffer *buffer = nullptr;
+    fz_md5 md5;
+    fz_md5_init(&md5);
 
+    // hash the data in chunks instead of reading the whole file into memory
+    unsigned char buf[16 * 1024];
     fz_try(file->ctx) {
-        fz_seek(file, 0, 2);
-        fileLen = fz_tell(file);
         fz_seek(file, 0, 0);
-        buffer = fz_read_all(file, fileLen);
+        int read;
+        while ((read = fz_read(file, buf, sizeof(buf))) > 0) {
+            fz_md5_update(&md5, buf, read);
+        }
     }
     fz_catch(file->ctx) {
         fz_warn(file->ctx, "couldn't read stream data, using a nullptr fingerprint instead");
         ZeroMemory(digest, 16);
-        return;
+        return false;
     }
-    CrashIf(nullptr == buffer);
-    CrashIf(fileLen != buffer->len);
 
-    fz_md5 md5;
-    fz_md5_init(&md5);
-    fz_md5_update(&md5, buffer->data, buffer->len);
     fz_md5_final(&md5, digest);
-
-    fz_drop_buffer(file->ctx, buffer);
+    return true;
 }
 
 static WCHAR *fz_text_page_to_str(fz_text_page *text, const WCHAR *lineSep, RectI **coords_out=nullptr)
@@ -769,6 +866,435 @@ static fz_device *fz_new_inspection_device(fz_context *ctx, ListInspectionData *
     return dev;
 }
 
+// Display lists of pages containing nothing but vector graphics can be
+// persisted to disk (cf. PdfEngine::SetDisplayListCache), so that expensive
+// pages don't have to be reinterpreted when a document is reopened or
+// when their list has been dropped from the run cache. Lists referring
+// to fonts, images or shadings aren't persisted.
+
+#define DISPLAY_LIST_MAGIC      "SuDL"
+#define DISPLAY_LIST_VERSION    1
+// only persist display lists which took at least this long to create
+#define DISPLAY_LIST_CACHE_MIN_MS 50
+// longer dash patterns are rejected when reading (so they aren't written either)
+#define DISPLAY_LIST_MAX_DASH_LEN 32
+
+enum ListSerializationCmd {
+    ListCmd_FillPath = 1, ListCmd_StrokePath, ListCmd_ClipPath, ListCmd_ClipStrokePath,
+    ListCmd_PopClip, ListCmd_BeginGroup, ListCmd_EndGroup,
+};
+
+struct ListSerializationData {
+    str::Str<char> data;
+    bool unsupported;
+
+    ListSerializationData() : unsupported(false) { }
+};
+
+static void fz_serialize(fz_device *dev, const void *data, size_t len)
+{
+    ((ListSerializationData *)dev->user)->data.Append((const char *)data, len);
+}
+
+static void fz_serialize_int(fz_device *dev, int value)
+{
+    fz_serialize(dev, &value, sizeof(value));
+}
+
+static void fz_serialize_unsupported(fz_device *dev)
+{
+    ((ListSerializationData *)dev->user)->unsupported = true;
+}
+
+static void fz_serialize_path(fz_device *dev, fz_path *path)
+{
+    fz_serialize_int(dev, path->cmd_len);
+    fz_serialize_int(dev, path->coord_len);
+    fz_serialize(dev, path->cmds, path->cmd_len);
+    fz_serialize(dev, path->coords, path->coord_len * sizeof(float));
+}
+
+static void fz_serialize_stroke(fz_device *dev, fz_stroke_state *stroke)
+{
+    if (stroke->dash_len > DISPLAY_LIST_MAX_DASH_LEN) {
+        fz_serialize_unsupported(dev);
+        return;
+    }
+    int values[] = { stroke->start_cap, stroke->dash_cap, stroke->end_cap, stroke->linejoin, stroke->dash_len };
+    float metrics[] = { stroke->linewidth, stroke->miterlimit, stroke->dash_phase };
+    fz_serialize(dev, values, sizeof(values));
+    fz_serialize(dev, metrics, sizeof(metrics));
+    fz_serialize(dev, stroke->dash_list, stroke->dash_len * sizeof(float));
+}
+
+// only device colorspaces can be restored without the document
+static void fz_serialize_color(fz_device *dev, fz_colorspace *colorspace, float *color)
+{
+    fz_context *ctx = dev->ctx;
+    int cs = colorspace == fz_device_gray(ctx) ? 1 : colorspace == fz_device_rgb(ctx) ? 2 :
+             colorspace == fz_device_cmyk(ctx) ? 3 : 0;
+    if (!cs) {
+        fz_serialize_unsupported(dev);
+        return;
+    }
+    fz_serialize_int(dev, cs);
+    fz_serialize(dev, color, colorspace->n * sizeof(float));
+}
+
+extern "C" static void
+fz_serialize_fill_path(fz_device *dev, fz_path *path, int even_odd, const fz_matrix *ctm, fz_colorspace *colorspace, float *color, float alpha)
+{
+    fz_serialize_int(dev, ListCmd_FillPath);
+    fz_serialize_int(dev, even_odd);
+    fz_serialize(dev, ctm, sizeof(*ctm));
+    fz_serialize_color(dev, colorspace, color);
+    fz_serialize(dev, &alpha, sizeof(alpha));
+    fz_serialize_path(dev, path);
+}
+
+extern "C" static void
+fz_serialize_stroke_path(fz_device *dev, fz_path *path, fz_stroke_state *stroke, const fz_matrix *ctm, fz_colorspace *colorspace, float *color, float alpha)
+{
+    fz_serialize_int(dev, ListCmd_StrokePath);
+    fz_serialize_stroke(dev, stroke);
+    fz_serialize(dev, ctm, sizeof(*ctm));
+    fz_serialize_color(dev, colorspace, color);
+    fz_serialize(dev, &alpha, sizeof(alpha));
+    fz_serialize_path(dev, path);
+}
+
+extern "C" static void
+fz_serialize_clip_path(fz_device *dev, fz_path *path, const fz_rect *rect, int even_odd, const fz_matrix *ctm)
+{
+    fz_serialize_int(dev, ListCmd_ClipPath);
+    fz_serialize_int(dev, rect != nullptr);
+    if (rect)
+        fz_serialize(dev, rect, sizeof(*rect));
+    fz_serialize_int(dev, even_odd);
+    fz_serialize(dev, ctm, sizeof(*ctm));
+    fz_serialize_path(dev, path);
+}
+
+extern "C" static void
+fz_serialize_clip_stroke_path(fz_device *dev, fz_path *path, const fz_rect *rect, fz_stroke_state *stroke, const fz_matrix *ctm)
+{
+    fz_serialize_int(dev, ListCmd_ClipStrokePath);
+    fz_serialize_int(dev, rect != nullptr);
+    if (rect)
+        fz_serialize(dev, rect, sizeof(*rect));
+    fz_serialize_stroke(dev, stroke);
+    fz_serialize(dev, ctm, sizeof(*ctm));
+    fz_serialize_path(dev, path);
+}
+
+extern "C" static void
+fz_serialize_pop_clip(fz_device *dev)
+{
+    fz_serialize_int(dev, ListCmd_PopClip);
+}
+
+extern "C" static void
+fz_serialize_begin_group(fz_device *dev, const fz_rect *rect, int isolated, int knockout, int blendmode, float alpha)
+{
+    fz_serialize_int(dev, ListCmd_BeginGroup);
+    fz_serialize(dev, rect, sizeof(*rect));
+    int values[] = { isolated, knockout, blendmode };
+    fz_serialize(dev, values, sizeof(values));
+    fz_serialize(dev, &alpha, sizeof(alpha));
+}
+
+extern "C" static void
+fz_serialize_end_group(fz_device *dev)
+{
+    fz_serialize_int(dev, ListCmd_EndGroup);
+}
+
+extern "C" static void
+fz_unsupported_begin_page(fz_device *dev, const fz_rect *rect, const fz_matrix *ctm) { fz_serialize_unsupported(dev); }
+extern "C" static void
+fz_unsupported_end_page(fz_device *dev) { fz_serialize_unsupported(dev); }
+extern "C" static void
+fz_unsupported_fill_text(fz_device *dev, fz_text *text, const fz_matrix *ctm, fz_colorspace *colorspace, float *color, float alpha) { fz_serialize_unsupported(dev); }
+extern "C" static void
+fz_unsupported_stroke_text(fz_device *dev, fz_text *text, fz_stroke_state *stroke, const fz_matrix *ctm, fz_colorspace *colorspace, float *color, float alpha) { fz_serialize_unsupported(dev); }
+extern "C" static void
+fz_unsupported_clip_text(fz_device *dev, fz_text *text, const fz_matrix *ctm, int accumulate) { fz_serialize_unsupported(dev); }
+extern "C" static void
+fz_unsupported_clip_stroke_text(fz_device *dev, fz_text *text, fz_stroke_state *stroke, const fz_matrix *ctm) { fz_serialize_unsupported(dev); }
+extern "C" static void
+fz_unsupported_ignore_text(fz_device *dev, fz_text *text, const fz_matrix *ctm) { fz_serialize_unsupported(dev); }
+extern "C" static void
+fz_unsupported_fill_shade(fz_device *dev, fz_shade *shade, const fz_matrix *ctm, float alpha) { fz_serialize_unsupported(dev); }
+extern "C" static void
+fz_unsupported_fill_image(fz_device *dev, fz_image *image, const fz_matrix *ctm, float alpha) { fz_serialize_unsupported(dev); }
+extern "C" static void
+fz_unsupported_fill_image_mask(fz_device *dev, fz_image *image, const fz_matrix *ctm, fz_colorspace *colorspace, float *color, float alpha) { fz_serialize_unsupported(dev); }
+extern "C" static void
+fz_unsupported_clip_image_mask(fz_device *dev, fz_image *image, const fz_rect *rect, const fz_matrix *ctm) { fz_serialize_unsupported(dev); }
+extern "C" static void
+fz_unsupported_begin_mask(fz_device *dev, const fz_rect *rect, int luminosity, fz_colorspace *colorspace, float *bc) { fz_serialize_unsupported(dev); }
+extern "C" static void
+fz_unsupported_end_mask(fz_device *dev) { fz_serialize_unsupported(dev); }
+extern "C" static int
+fz_unsupported_begin_tile(fz_device *dev, const fz_rect *area, const fz_rect *view, float xstep, float ystep, const fz_matrix *ctm, int id) { fz_serialize_unsupported(dev); return 0; }
+extern "C" static void
+fz_unsupported_end_tile(fz_device *dev) { fz_serialize_unsupported(dev); }
+extern "C" static void
+fz_unsupported_apply_transfer_function(fz_device *dev, fz_transfer_function *tr, int for_mask) { fz_serialize_unsupported(dev); }
+
+// all device methods must be set, so that no content can go missing
+static fz_device *fz_new_serialization_device(fz_context *ctx, ListSerializationData *data)
+{
+    fz_device *dev = fz_new_device(ctx, data);
+
+    dev->fill_path = fz_serialize_fill_path;
+    dev->stroke_path = fz_serialize_stroke_path;
+    dev->clip_path = fz_serialize_clip_path;
+    dev->clip_stroke_path = fz_serialize_clip_stroke_path;
+    dev->pop_clip = fz_serialize_pop_clip;
+    dev->begin_group = fz_serialize_begin_group;
+    dev->end_group = fz_serialize_end_group;
+
+    dev->begin_page = fz_unsupported_begin_page;
+    dev->end_page = fz_unsupported_end_page;
+    dev->fill_text = fz_unsupported_fill_text;
+    dev->stroke_text = fz_unsupported_stroke_text;
+    dev->clip_text = fz_unsupported_clip_text;
+    dev->clip_stroke_text = fz_unsupported_clip_stroke_text;
+    dev->ignore_text = fz_unsupported_ignore_text;
+    dev->fill_shade = fz_unsupported_fill_shade;
+    dev->fill_image = fz_unsupported_fill_image;
+    dev->fill_image_mask = fz_unsupported_fill_image_mask;
+    dev->clip_image_mask = fz_unsupported_clip_image_mask;
+    dev->begin_mask = fz_unsupported_begin_mask;
+    dev->end_mask = fz_unsupported_end_mask;
+    dev->begin_tile = fz_unsupported_begin_tile;
+    dev->end_tile = fz_unsupported_end_tile;
+    dev->apply_transfer_function = fz_unsupported_apply_transfer_function;
+
+    return dev;
+}
+
+// returns the serialized list or nullptr if it can't be serialized
+static char *fz_serialize_display_list(fz_context *ctx, fz_display_list *list, size_t *lenOut)
+{
+    ListSerializationData data;
+    data.data.Append(DISPLAY_LIST_MAGIC);
+    int version = DISPLAY_LIST_VERSION;
+    data.data.Append((const char *)&version, sizeof(version));
+
+    fz_device *dev = nullptr;
+    fz_var(dev);
+    fz_try(ctx) {
+        dev = fz_new_serialization_device(ctx, &data);
+        fz_run_display_list(list, dev, &fz_identity, nullptr, nullptr);
+    }
+    fz_catch(ctx) {
+        data.unsupported = true;
+    }
+    fz_free_device(dev);
+
+    if (data.unsupported)
+        return nullptr;
+    *lenOut = data.data.Size();
+    return data.data.StealData();
+}
+
+class ListDeserializer {
+    fz_context *ctx;
+    const char *data;
+    size_t len;
+    size_t pos;
+
+public:
+    ListDeserializer(fz_context *ctx, const char *data, size_t len) : ctx(ctx), data(data), len(len), pos(0) { }
+
+    bool AtEnd() const { return pos == len; }
+
+    void Read(void *out, size_t size) {
+        if (size > len - pos)
+            fz_throw(ctx, FZ_ERROR_GENERIC, "truncated display list");
+        memcpy(out, data + pos, size);
+        pos += size;
+    }
+    int ReadInt() {
+        int value;
+        Read(&value, sizeof(value));
+        return value;
+    }
+    float ReadFloat() {
+        float value;
+        Read(&value, sizeof(value));
+        return value;
+    }
+
+    fz_path *ReadPath() {
+        int cmdLen = ReadInt(), coordLen = ReadInt();
+        if (cmdLen < 0 || coordLen < 0 || (size_t)cmdLen > len - pos ||
+            (size_t)coordLen > (len - pos - cmdLen) / sizeof(float))
+            fz_throw(ctx, FZ_ERROR_GENERIC, "invalid path in display list");
+        // make sure that the draw device won't read beyond the coordinates
+        int coordsNeeded = 0;
+        for (int i = 0; i < cmdLen; i++) {
+            switch (data[pos + i]) {
+            case FZ_MOVETO: case FZ_LINETO: coordsNeeded += 2; break;
+            case FZ_CURVETO: coordsNeeded += 6; break;
+            case FZ_CLOSE_PATH: break;
+            default: fz_throw(ctx, FZ_ERROR_GENERIC, "invalid path in display list");
+            }
+        }
+        if (coordsNeeded != coordLen)
+            fz_throw(ctx, FZ_ERROR_GENERIC, "invalid path in display list");
+
+        fz_path *path = fz_new_path(ctx);
+        fz_try(ctx) {
+            path->cmds = (unsigned char *)fz_malloc_array(ctx, cmdLen, 1);
+            path->cmd_len = path->cmd_cap = cmdLen;
+            Read(path->cmds, cmdLen);
+            path->coords = (float *)fz_malloc_array(ctx, coordLen, sizeof(float));
+            path->coord_len = path->coord_cap = coordLen;
+            Read(path->coords, coordLen * sizeof(float));
+            path->last_cmd = cmdLen > 0 ? path->cmds[cmdLen - 1] : 0;
+        }
+        fz_catch(ctx) {
+            fz_free_path(ctx, path);
+            fz_rethrow(ctx);
+        }
+        return path;
+    }
+
+    fz_stroke_state *ReadStroke() {
+        int values[5];
+        float metrics[3];
+        Read(values, sizeof(values));
+        Read(metrics, sizeof(metrics));
+        if (values[4] < 0 || values[4] > DISPLAY_LIST_MAX_DASH_LEN)
+            fz_throw(ctx, FZ_ERROR_GENERIC, "invalid stroke state in display list");
+        fz_stroke_state *stroke = fz_new_stroke_state_with_dash_len(ctx, values[4]);
+        stroke->start_cap = (fz_linecap)values[0];
+        stroke->dash_cap = (fz_linecap)values[1];
+        stroke->end_cap = (fz_linecap)values[2];
+        stroke->linejoin = (fz_linejoin)values[3];
+        stroke->dash_len = values[4];
+        stroke->linewidth = metrics[0];
+        stroke->miterlimit = metrics[1];
+        stroke->dash_phase = metrics[2];
+        fz_try(ctx) {
+            Read(stroke->dash_list, stroke->dash_len * sizeof(float));
+        }
+        fz_catch(ctx) {
+            fz_drop_stroke_state(ctx, stroke);
+            fz_rethrow(ctx);
+        }
+        return stroke;
+    }
+
+    fz_colorspace *ReadColor(float color[FZ_MAX_COLORS]) {
+        int cs = ReadInt();
+        fz_colorspace *colorspace = 1 == cs ? fz_device_gray(ctx) : 2 == cs ? fz_device_rgb(ctx) :
+                                    3 == cs ? fz_device_cmyk(ctx) : nullptr;
+        if (!colorspace)
+            fz_throw(ctx, FZ_ERROR_GENERIC, "invalid colorspace in display list");
+        Read(color, colorspace->n * sizeof(float));
+        return colorspace;
+    }
+};
+
+// replays a serialized display list into <dev> (throws on invalid data)
+static void fz_deserialize_display_list(fz_context *ctx, const char *data, size_t len, fz_device *dev)
+{
+    ListDeserializer ds(ctx, data, len);
+    char magic[4];
+    ds.Read(magic, sizeof(magic));
+    if (memcmp(magic, DISPLAY_LIST_MAGIC, sizeof(magic)) != 0 || ds.ReadInt() != DISPLAY_LIST_VERSION)
+        fz_throw(ctx, FZ_ERROR_GENERIC, "unsupported display list");
+
+    fz_path *path = nullptr;
+    fz_stroke_state *stroke = nullptr;
+    fz_var(path);
+    fz_var(stroke);
+    fz_try(ctx) {
+        while (!ds.AtEnd()) {
+            fz_matrix ctm;
+            fz_rect rect;
+            float color[FZ_MAX_COLORS];
+            int cmd = ds.ReadInt();
+            switch (cmd) {
+            case ListCmd_FillPath: {
+                int even_odd = ds.ReadInt();
+                ds.Read(&ctm, sizeof(ctm));
+                fz_colorspace *colorspace = ds.ReadColor(color);
+                float alpha = ds.ReadFloat();
+                path = ds.ReadPath();
+                fz_fill_path(dev, path, even_odd, &ctm, colorspace, color, alpha);
+                break;
+            }
+            case ListCmd_StrokePath: {
+                stroke = ds.ReadStroke();
+                ds.Read(&ctm, sizeof(ctm));
+                fz_colorspace *colorspace = ds.ReadColor(color);
+                float alpha = ds.ReadFloat();
+                path = ds.ReadPath();
+                fz_stroke_path(dev, path, stroke, &ctm, colorspace, color, alpha);
+                break;
+            }
+            case ListCmd_ClipPath: {
+                bool hasRect = ds.ReadInt() != 0;
+                if (hasRect)
+                    ds.Read(&rect, sizeof(rect));
+                int even_odd = ds.ReadInt();
+                ds.Read(&ctm, sizeof(ctm));
+                path = ds.ReadPath();
+                fz_clip_path(dev, path, hasRect ? &rect : nullptr, even_odd, &ctm);
+                break;
+            }
+            case ListCmd_ClipStrokePath: {
+                bool hasRect = ds.ReadInt() != 0;
+                if (hasRect)
+                    ds.Read(&rect, sizeof(rect));
+                stroke = ds.ReadStroke();
+                ds.Read(&ctm, sizeof(ctm));
+                path = ds.ReadPath();
+                fz_clip_stroke_path(dev, path, hasRect ? &rect : nullptr, stroke, &ctm);
+                break;
+            }
+            case ListCmd_PopClip:
+                fz_pop_clip(dev);
+                break;
+            case ListCmd_BeginGroup: {
+                int values[3];
+                ds.Read(&rect, sizeof(rect));
+                ds.Read(values, sizeof(values));
+                float alpha = ds.ReadFloat();
+                fz_begin_group(dev, &rect, values[0], values[1], values[2], alpha);
+                break;
+            }
+            case ListCmd_EndGroup:
+                fz_end_group(dev);
+                break;
+            default:
+                fz_throw(ctx, FZ_ERROR_GENERIC, "unknown command in display list");
+            }
+            if (path) {
+                fz_free_path(ctx, path);
+                path = nullptr;
+            }
+            if (stroke) {
+                fz_drop_stroke_state(ctx, stroke);
+                stroke = nullptr;
+            }
+        }
+    }
+    fz_always(ctx) {
+        if (path)
+            fz_free_path(ctx, path);
+        fz_drop_stroke_state(ctx, stroke);
+    }
+    fz_catch(ctx) {
+        fz_rethrow(ctx);
+    }
+}
+
 class FitzAbortCookie : public AbortCookie {
 public:
     fz_cookie cookie;
@@ -799,6 +1325,23 @@ fz_unlock_context_cs(void *user, int lock)
     LeaveCriticalSection(cs);
 }
 
+// unlike fz_lock_context_cs, this uses a separate critical section
+// per lock (user points to FZ_LOCK_MAX of them), so that clones of
+// an fz_context can be used from several threads at once
+extern "C" static void
+fz_lock_context_multi(void *user, int lock)
+{
+    CRITICAL_SECTION *locks = (CRITICAL_SECTION *)user;
+    EnterCriticalSection(&locks[lock]);
+}
+
+extern "C" static void
+fz_unlock_context_multi(void *user, int lock)
+{
+    CRITICAL_SECTION *locks = (CRITICAL_SECTION *)user;
+    LeaveCriticalSection(&locks[lock]);
+}
+
 static Vec<PageAnnotation> fz_get_user_page_annots(Vec<PageAnnotation>& userAnnots, int pageNo)
 {
     Vec<PageAnnotation> result;
@@ -1084,73 +1627,100 @@ WStrVec *BuildPageLabelVec(pdf_obj *root, int pageCount)
     return labels;
 }
 
-struct PageTreeStackItem {
+// caches how many pages are below each /Kids entry of the page tree nodes
+// visited so far, so that looking up a page only has to resolve the nodes
+// on the path to that page (and each node's kids only up to that path)
+struct PageTreeNode {
     pdf_obj *kids;
-    int i, len;
-    int next_page_no;
+    int len;
+    // first_page[i] is the number of pages preceding kid i within this node
+    // (known for all kids scanned so far, plus one for the end of the last one)
+    Vec<int> first_page;
+    // nodes for /Pages kids are only created once they're descended into
+    Vec<PageTreeNode *> subtrees;
 
-    PageTreeStackItem() : kids(nullptr), i(-1), len(0), next_page_no(0) { }
-    explicit PageTreeStackItem(pdf_obj *kids, int next_page_no=0) :
-        kids(kids), i(-1), len(pdf_array_len(kids)), next_page_no(next_page_no) { }
+    explicit PageTreeNode(pdf_obj *kids) : kids(pdf_keep_obj(kids)), len(pdf_array_len(kids)) {
+        first_page.Append(0);
+    }
+    ~PageTreeNode() {
+        DeleteVecMembers(subtrees);
+        pdf_drop_obj(kids);
+    }
 };
 
-static void
-pdf_load_page_objs(pdf_document *doc, pdf_obj **page_objs)
+static bool
+pdf_is_page_tree_node(pdf_obj *kid)
 {
-    fz_context *ctx = doc->ctx;
-    int page_no = 0;
-
-    Vec<PageTreeStackItem> stack;
-    PageTreeStackItem top(pdf_dict_getp(pdf_trailer(doc), "Root/Pages/Kids"));
+    char *type = pdf_to_name(pdf_dict_gets(kid, "Type"));
+    if (*type)
+        return str::Eq(type, "Pages");
+    return pdf_dict_gets(kid, "Kids") && !pdf_dict_gets(kid, "MediaBox");
+}
 
-    if (pdf_mark_obj(top.kids))
-        fz_throw(ctx, FZ_ERROR_GENERIC, "cycle in page tree");
+static pdf_obj *
+pdf_lookup_page_obj_cached(pdf_document *doc, PageTreeNode *node, int needle)
+{
+    fz_context *ctx = doc->ctx;
+    pdf_obj *hit = nullptr;
+    int skip = needle;
+    Vec<pdf_obj *> marked;
 
+    fz_var(hit);
     fz_try(ctx) {
-        for (;;) {
-            top.i++;
-            if (top.i == top.len) {
-                pdf_unmark_obj(top.kids);
-                if (page_no < top.next_page_no)
-                    page_no = top.next_page_no;
-                if (stack.Size() == 0)
-                    break;
-                top = stack.Pop();
-                continue;
+        while (!hit) {
+            if (pdf_mark_obj(node->kids))
+                fz_throw(ctx, FZ_ERROR_GENERIC, "cycle in page tree");
+            marked.Append(node->kids);
+
+            // count the pages of further kids until the needle is covered
+            while ((int)node->subtrees.Count() < node->len && node->first_page.Last() <= skip) {
+                pdf_obj *kid = pdf_array_get(node->kids, (int)node->subtrees.Count());
+                int count = 1;
+                // like pdf_lookup_page_obj, this trusts the /Count of
+                // subtrees instead of counting their pages
+                if (pdf_is_page_tree_node(kid))
+                    count = std::max(pdf_to_int(pdf_dict_gets(kid, "Count")), 0);
+                node->first_page.Append(node->first_page.Last() + count);
+                node->subtrees.Append(nullptr);
+            }
+            if (node->first_page.Last() <= skip)
+                fz_throw(ctx, FZ_ERROR_GENERIC, "cannot find page %d in page tree", needle);
+
+            // find the last kid starting at or before the needle
+            int lo = 0, hi = (int)node->subtrees.Count() - 1;
+            while (lo < hi) {
+                int mid = (lo + hi + 1) / 2;
+                if (node->first_page.At(mid) <= skip)
+                    lo = mid;
+                else
+                    hi = mid - 1;
             }
 
-            pdf_obj *kid = pdf_array_get(top.kids, top.i);
-            char *type = pdf_to_name(pdf_dict_gets(kid, "Type"));
-            if (*type ? str::Eq(type, "Pages") : pdf_dict_gets(kid, "Kids") && !pdf_dict_gets(kid, "MediaBox")) {
-                int count = pdf_to_int(pdf_dict_gets(kid, "Count"));
-                if (count > 0) {
-                    stack.Push(top);
-                    top = PageTreeStackItem(pdf_dict_gets(kid, "Kids"), page_no + count);
-
-                    if (pdf_mark_obj(top.kids))
-                        fz_throw(ctx, FZ_ERROR_GENERIC, "cycle in page tree");
-                }
+            pdf_obj *kid = pdf_array_get(node->kids, lo);
+            skip -= node->first_page.At(lo);
+            if (pdf_is_page_tree_node(kid)) {
+                if (!node->subtrees.At(lo))
+                    node->subtrees.At(lo) = new PageTreeNode(pdf_dict_gets(kid, "Kids"));
+                node = node->subtrees.At(lo);
             }
             else {
+                char *type = pdf_to_name(pdf_dict_gets(kid, "Type"));
                 if (*type ? !str::Eq(type, "Page") : !pdf_dict_gets(kid, "MediaBox"))
                     fz_warn(ctx, "non-page object in page tree (%s)", type);
-                if (page_no >= pdf_count_pages(doc))
-                    fz_throw(ctx, FZ_ERROR_GENERIC, "found more /Page objects than anticipated");
-
-                page_objs[page_no] = pdf_keep_obj(kid);
-                page_no++;
+                hit = kid;
             }
         }
     }
-    fz_catch(ctx) {
-        for (size_t i = 0; i < stack.Size(); i++) {
-            pdf_unmark_obj(stack.At(i).kids);
+    fz_always(ctx) {
+        for (pdf_obj *kids : marked) {
+            pdf_unmark_obj(kids);
         }
-        pdf_unmark_obj(top.kids);
+    }
+    fz_catch(ctx) {
         fz_rethrow(ctx);
     }
 
-    doc->page_objs = page_objs;
+    return hit;
 }
 
 ///// Above are extensions to Fitz and MuPDF, now follows PdfEngine /////
@@ -1172,10 +1742,12 @@ struct PdfPageRun {
 class PdfTocItem;
 class PdfLink;
 class PdfImage;
+class PdfDocInfoLoader;
 
 class PdfEngineImpl : public BaseEngine {
     friend PdfLink;
     friend PdfImage;
+    friend PdfDocInfoLoader;
 
 public:
     PdfEngineImpl();
@@ -1194,11 +1766,18 @@ public:
 
     virtual RenderedBitmap *RenderBitmap(int pageNo, float zoom, int rotation,
                          RectD *pageRect=nullptr, /* if nullptr: defaults to the page's mediabox */
-                         RenderTarget target=Target_View, AbortCookie **cookie_out=nullptr);
+                         RenderTarget target=Target_View, AbortCookie **cookie_out=nullptr) {
+        return RenderPageBitmap(pageNo, zoom, rotation, pageRect, target, cookie_out, false);
+    }
     virtual bool RenderPage(HDC hDC, RectI screenRect, int pageNo, float zoom, int rotation,
                          RectD *pageRect=nullptr, RenderTarget target=Target_View, AbortCookie **cookie_out=nullptr) {
         return RenderPage(hDC, GetPdfPage(pageNo), screenRect, nullptr, zoom, rotation, pageRect, target, cookie_out);
     }
+    virtual bool AllowsConcurrentRendering() const { return true; }
+    virtual RenderedBitmap *RenderPreviewBitmap(int pageNo, float zoom, int rotation,
+                         RectD *pageRect=nullptr, AbortCookie **cookie_out=nullptr) {
+        return RenderPageBitmap(pageNo, zoom, rotation, pageRect, Target_View, cookie_out, true);
+    }
 
     virtual PointD Transform(PointD pt, int pageNo, float zoom, int rotation, bool inverse=false);
     virtual RectD Transform(RectD rect, int pageNo, float zoom, int rotation, bool inverse=false);
@@ -1228,17 +1807,26 @@ public:
     virtual const WCHAR *GetDefaultFileExt() const { return L".pdf"; }
 
     virtual bool BenchLoadPage(int pageNo) { return GetPdfPage(pageNo) != nullptr; }
+    // the glyph cache is shared with all ctxClones and locks itself
+    void SetGlyphCacheSize(size_t maxBytes) {
+        fz_set_glyph_cache_size(ctx, (unsigned int)std::min(maxBytes, (size_t)UINT_MAX));
+    }
+    void GetGlyphCacheStats(fz_glyph_cache_stats *stats) { fz_get_glyph_cache_stats(ctx, stats); }
 
     virtual Vec<PageElement *> *GetElements(int pageNo);
     virtual PageElement *GetElementAtPos(int pageNo, PointD pt);
 
     virtual PageDestination *GetNamedDest(const WCHAR *name);
     virtual bool HasTocTree() const {
+        WaitForDocInfo();
         return outline != nullptr || attachments != nullptr;
     }
     virtual DocTocItem *GetTocTree();
 
-    virtual bool HasPageLabels() const { return _pagelabels != nullptr; }
+    virtual bool HasPageLabels() const {
+        WaitForDocInfo();
+        return _pagelabels != nullptr;
+    }
     virtual WCHAR *GetPageLabel(int pageNo) const;
     virtual int GetPageByLabel(const WCHAR *label) const;
 
@@ -1258,11 +1846,24 @@ protected:
     CRITICAL_SECTION ctxAccess;
     fz_context *    ctx;
     fz_locks_context fz_locks_ctx;
+    CRITICAL_SECTION fzLocks[FZ_LOCK_MAX];
     pdf_document *  _doc;
 
     CRITICAL_SECTION pagesAccess;
     pdf_page **     _pages;
+    // page objects are only looked up in the page tree once they're needed
+    // (both protected by ctxAccess)
     pdf_obj **      _pageObjs;
+    PageTreeNode  * pageTree;
+    pdf_obj       * GetPageObj(int pageNo);
+
+    // idle clones of ctx for replaying cached page runs without
+    // holding ctxAccess (protected by pagesAccess)
+    Vec<fz_context *> ctxClones;
+    fz_context    * AcquireCtxClone();
+    void            ReleaseCtxClone(fz_context *clone);
+    RenderedBitmap *RenderPageBitmap(int pageNo, float zoom, int rotation, RectD *pageRect,
+                                     RenderTarget target, AbortCookie **cookie_out, bool preview);
 
     bool            Load(const WCHAR *fileName, PasswordUI *pwdUI=nullptr);
     bool            Load(IStream *stream, PasswordUI *pwdUI=nullptr);
@@ -1270,6 +1871,16 @@ protected:
     bool            LoadFromStream(fz_stream *stm, PasswordUI *pwdUI=nullptr);
     bool            FinishLoading();
 
+    // document properties, outline, attachments and page labels are loaded
+    // in the background so that they don't delay displaying the first pages
+    PdfDocInfoLoader * docInfoLoader;
+    void            WaitForDocInfo() const;
+    void            LoadFirstPage();
+    void            LoadInfoDict();
+    void            LoadOutline();
+    void            LoadAttachments();
+    void            LoadPageLabels();
+
     pdf_page      * GetPdfPage(int pageNo, bool failIfBusy=false);
     int             GetPageNo(pdf_page *page);
     fz_matrix       viewctm(int pageNo, float zoom, int rotation) {
@@ -1289,6 +1900,13 @@ protected:
 
     Vec<PdfPageRun *> runCache; // ordered most recently used first
     PdfPageRun    * CreatePageRun(pdf_page *page, fz_display_list *list);
+    // for the persistent display list cache (cf. PdfEngine::SetDisplayListCache)
+    // (set by PdfDocInfoLoader, access is protected by ctxAccess)
+    unsigned char   fingerprint[16];
+    bool            hasFingerprint;
+    WCHAR         * GetDisplayListCachePath(int pageNo);
+    fz_display_list * LoadCachedDisplayList(int pageNo);
+    void            SaveCachedDisplayList(int pageNo, fz_display_list *list);
     PdfPageRun    * GetPageRun(pdf_page *page, bool tryOnly=false);
     bool            RunPage(pdf_page *page, fz_device *dev, const fz_matrix *ctm,
                             RenderTarget target=Target_View,
@@ -1317,6 +1935,30 @@ protected:
     Vec<PageAnnotation> userAnnots;
 };
 
+class PdfDocInfoLoader : public ThreadBase {
+    PdfEngineImpl *engine;
+
+    void LoadFingerprint();
+
+public:
+    explicit PdfDocInfoLoader(PdfEngineImpl *engine) : ThreadBase("PdfDocInfoLoader"), engine(engine) { }
+
+    virtual void Run() override {
+        engine->LoadFirstPage();
+        if (!WasCancelRequested())
+            engine->LoadInfoDict();
+        // page labels are needed before the outline (for the toolbar)
+        if (!WasCancelRequested())
+            engine->LoadPageLabels();
+        if (!WasCancelRequested())
+            engine->LoadOutline();
+        if (!WasCancelRequested())
+            engine->LoadAttachments();
+        if (!WasCancelRequested())
+            LoadFingerprint();
+    }
+};
+
 class PdfLink : public PageElement, public PageDestination {
     PdfEngineImpl *engine;
     fz_link_dest *link; // owned by an fz_link or fz_outline
@@ -1393,17 +2035,21 @@ public:
 };
 
 PdfEngineImpl::PdfEngineImpl() : _fileName(nullptr), _doc(nullptr),
-    _pages(nullptr), _pageObjs(nullptr), _mediaboxes(nullptr), _info(nullptr),
+    _pages(nullptr), _pageObjs(nullptr), pageTree(nullptr), docInfoLoader(nullptr),
+    _mediaboxes(nullptr), _info(nullptr),
     outline(nullptr), attachments(nullptr), _pagelabels(nullptr),
     _decryptionKey(nullptr), isProtected(false),
-    pageAnnots(nullptr), imageRects(nullptr)
+    pageAnnots(nullptr), imageRects(nullptr), hasFingerprint(false)
 {
     InitializeCriticalSection(&pagesAccess);
     InitializeCriticalSection(&ctxAccess);
+    for (int i = 0; i < FZ_LOCK_MAX; i++) {
+        InitializeCriticalSection(&fzLocks[i]);
+    }
 
-    fz_locks_ctx.user = &ctxAccess;
-    fz_locks_ctx.lock = fz_lock_context_cs;
-    fz_locks_ctx.unlock = fz_unlock_context_cs;
+    fz_locks_ctx.user = fzLocks;
+    fz_locks_ctx.lock = fz_lock_context_multi;
+    fz_locks_ctx.unlock = fz_unlock_context_multi;
     ctx = fz_new_context(nullptr, &fz_locks_ctx, MAX_CONTEXT_MEMORY);
 
     if (ctx)
@@ -1412,9 +2058,19 @@ PdfEngineImpl::PdfEngineImpl() : _fileName(nullptr), _doc(nullptr),
 
 PdfEngineImpl::~PdfEngineImpl()
 {
+    if (docInfoLoader) {
+        docInfoLoader->RequestCancel();
+        docInfoLoader->Join();
+        delete docInfoLoader;
+    }
+
     EnterCriticalSection(&pagesAccess);
     EnterCriticalSection(&ctxAccess);
 
+    for (fz_context *clone : ctxClones) {
+        fz_free_context(clone);
+    }
+
     if (_pages) {
         for (int i = 0; i < PageCount(); i++) {
             pdf_free_page(_doc, _pages[i]);
@@ -1427,6 +2083,7 @@ PdfEngineImpl::~PdfEngineImpl()
         }
         free(_pageObjs);
     }
+    delete pageTree;
 
     fz_free_outline(ctx, outline);
     fz_free_outline(ctx, attachments);
@@ -1464,6 +2121,9 @@ PdfEngineImpl::~PdfEngineImpl()
     DeleteCriticalSection(&ctxAccess);
     LeaveCriticalSection(&pagesAccess);
     DeleteCriticalSection(&pagesAccess);
+    for (int i = 0; i < FZ_LOCK_MAX; i++) {
+        DeleteCriticalSection(&fzLocks[i]);
+    }
 }
 
 class PasswordCloner : public PasswordUI {
@@ -1482,27 +2142,42 @@ public:
 
 BaseEngine *PdfEngineImpl::Clone()
 {
-    ScopedCritSec scope(&ctxAccess);
-
+    unsigned char cryptKey[32];
+    bool hasCryptKey, keepDecryptionKey;
+    Vec<PageAnnotation> annots;
     // use this document's encryption key (if any) to load the clone
-    PasswordCloner *pwdUI = nullptr;
-    if (pdf_crypt_key(_doc))
-        pwdUI = new PasswordCloner(pdf_crypt_key(_doc));
+    PasswordCloner pwdCloner(cryptKey);
 
     PdfEngineImpl *clone = new PdfEngineImpl();
-    if (!clone || !(_fileName ? clone->Load(_fileName, pwdUI) : clone->Load(_doc->file, pwdUI))) {
+    if (!clone)
+        return nullptr;
+
+    bool ok = false;
+    {
+        // only hold ctxAccess while accessing this document, so that rendering
+        // isn't blocked while clones reload the file (e.g. for PageTextIndexer)
+        ScopedCritSec scope(&ctxAccess);
+        hasCryptKey = pdf_crypt_key(_doc) != nullptr;
+        if (hasCryptKey)
+            memcpy(cryptKey, pdf_crypt_key(_doc), sizeof(cryptKey));
+        keepDecryptionKey = _decryptionKey || !_doc->crypt;
+        annots = userAnnots;
+        if (!_fileName)
+            ok = clone->Load(_doc->file, hasCryptKey ? &pwdCloner : nullptr);
+    }
+    if (_fileName)
+        ok = clone->Load(_fileName, hasCryptKey ? &pwdCloner : nullptr);
+    if (!ok) {
         delete clone;
-        delete pwdUI;
         return nullptr;
     }
-    delete pwdUI;
 
-    if (!_decryptionKey && _doc->crypt) {
+    if (!keepDecryptionKey) {
         delete clone->_decryptionKey;
         clone->_decryptionKey = nullptr;
     }
 
-    clone->UpdateUserAnnotations(&userAnnots);
+    clone->UpdateUserAnnotations(&annots);
 
     return clone;
 }
@@ -1705,28 +2380,39 @@ bool PdfEngineImpl::FinishLoading()
 
     ScopedCritSec scope(&ctxAccess);
 
-    fz_try(ctx) {
-        pdf_load_page_objs(_doc, _pageObjs);
-    }
-    fz_catch(ctx) {
-        fz_warn(ctx, "Couldn't load all page objects");
-    }
-    fz_try(ctx) {
-        outline = pdf_load_outline(_doc);
-    }
-    fz_catch(ctx) {
-        // ignore errors from pdf_load_outline()
-        // this information is not critical and checking the
-        // error might prevent loading some pdfs that would
-        // otherwise get displayed
-        fz_warn(ctx, "Couldn't load outline");
-    }
-    fz_try(ctx) {
-        attachments = pdf_loadattachments(_doc);
-    }
-    fz_catch(ctx) {
-        fz_warn(ctx, "Couldn't load attachments");
-    }
+    AssertCrash(!pdf_js_supported(_doc));
+
+    docInfoLoader = new PdfDocInfoLoader(this);
+    docInfoLoader->Start();
+
+    return true;
+}
+
+void PdfEngineImpl::WaitForDocInfo() const
+{
+    if (docInfoLoader)
+        docInfoLoader->Join();
+}
+
+// ctxAccess is taken separately for each of the following, so that
+// pages can be rendered in between
+
+// for linearized files, page 1 can be displayed before the main xref
+// has been read, so make sure that it's ready before anything else is
+// loaded which might require the main xref
+void PdfEngineImpl::LoadFirstPage()
+{
+    if (!_doc->linear_data_available)
+        return;
+    pdf_page *page = GetPdfPage(1);
+    PdfPageRun *run = page ? GetPageRun(page) : nullptr;
+    if (run)
+        DropPageRun(run);
+}
+
+void PdfEngineImpl::LoadInfoDict()
+{
+    ScopedCritSec scope(&ctxAccess);
     fz_try(ctx) {
         // keep a copy of the Info dictionary, as accessing the original
         // isn't thread safe and we don't want to block for this when
@@ -1762,6 +2448,37 @@ bool PdfEngineImpl::FinishLoading()
         pdf_drop_obj(_info);
         _info = nullptr;
     }
+}
+
+void PdfEngineImpl::LoadOutline()
+{
+    ScopedCritSec scope(&ctxAccess);
+    fz_try(ctx) {
+        outline = pdf_load_outline(_doc);
+    }
+    fz_catch(ctx) {
+        // ignore errors from pdf_load_outline()
+        // this information is not critical and checking the
+        // error might prevent loading some pdfs that would
+        // otherwise get displayed
+        fz_warn(ctx, "Couldn't load outline");
+    }
+}
+
+void PdfEngineImpl::LoadAttachments()
+{
+    ScopedCritSec scope(&ctxAccess);
+    fz_try(ctx) {
+        attachments = pdf_loadattachments(_doc);
+    }
+    fz_catch(ctx) {
+        fz_warn(ctx, "Couldn't load attachments");
+    }
+}
+
+void PdfEngineImpl::LoadPageLabels()
+{
+    ScopedCritSec scope(&ctxAccess);
     fz_try(ctx) {
         pdf_obj *pagelabels = pdf_dict_getp(pdf_trailer(_doc), "Root/PageLabels");
         if (pagelabels)
@@ -1770,10 +2487,26 @@ bool PdfEngineImpl::FinishLoading()
     fz_catch(ctx) {
         fz_warn(ctx, "Couldn't load page labels");
     }
+}
 
-    AssertCrash(!pdf_js_supported(_doc));
-
-    return true;
+pdf_obj *PdfEngineImpl::GetPageObj(int pageNo)
+{
+    if (!_pageObjs[pageNo-1]) {
+        fz_try(ctx) {
+            // for linearized files, this doesn't require the main xref
+            pdf_obj *pageObj = pdf_lookup_linear_page_obj(_doc, pageNo - 1);
+            if (!pageObj) {
+                if (!pageTree)
+                    pageTree = new PageTreeNode(pdf_dict_getp(pdf_trailer(_doc), "Root/Pages/Kids"));
+                pageObj = pdf_lookup_page_obj_cached(_doc, pageTree, pageNo - 1);
+            }
+            _pageObjs[pageNo-1] = pdf_keep_obj(pageObj);
+        }
+        fz_catch(ctx) {
+            fz_warn(ctx, "Couldn't load page object %d", pageNo);
+        }
+    }
+    return _pageObjs[pageNo-1];
 }
 
 PdfTocItem *PdfEngineImpl::BuildTocTree(fz_outline *entry, int& idCounter)
@@ -1802,6 +2535,7 @@ PdfTocItem *PdfEngineImpl::BuildTocTree(fz_outline *entry, int& idCounter)
 
 DocTocItem *PdfEngineImpl::GetTocTree()
 {
+    WaitForDocInfo();
     PdfTocItem *node = nullptr;
     int idCounter = 0;
 
@@ -1865,7 +2599,10 @@ pdf_page *PdfEngineImpl::GetPdfPage(int pageNo, bool failIfBusy)
         ScopedCritSec ctxScope(&ctxAccess);
         fz_var(page);
         fz_try(ctx) {
-            page = pdf_load_page_by_obj(_doc, pageNo - 1, _pageObjs[pageNo-1]);
+            pdf_obj *pageObj = GetPageObj(pageNo);
+            if (!pageObj)
+                fz_throw(ctx, FZ_ERROR_GENERIC, "page %d not found", pageNo);
+            page = pdf_load_page_by_obj(_doc, pageNo - 1, pageObj);
             _pages[pageNo-1] = page;
             LinkifyPageText(page);
             pageAnnots[pageNo-1] = ProcessPageAnnotations(page);
@@ -1884,6 +2621,94 @@ int PdfEngineImpl::GetPageNo(pdf_page *page)
     return 0;
 }
 
+static WCHAR *gDisplayListCacheDir = nullptr;
+
+// must be called with ctxAccess held
+WCHAR *PdfEngineImpl::GetDisplayListCachePath(int pageNo)
+{
+    // don't leak the content of encrypted documents to disk
+    if (!gDisplayListCacheDir || !pageNo || pdf_crypt_key(_doc))
+        return nullptr;
+    // the fingerprint is missing until PdfDocInfoLoader is done (and for
+    // unreadable documents, which would all share the same one)
+    if (!hasFingerprint)
+        return nullptr;
+    ScopedMem<char> digest(_MemToHex(&fingerprint));
+    return str::Format(L"%s\\%S-%d.dl", gDisplayListCacheDir, digest.Get(), pageNo);
+}
+
+// hashes the file through a handle of its own, so that rendering
+// (which needs ctxAccess) isn't blocked for the whole time
+void PdfDocInfoLoader::LoadFingerprint()
+{
+    // embedded documents and documents loaded from a stream aren't cached
+    const WCHAR *fileName = engine->FileName();
+    if (!gDisplayListCacheDir || !fileName || findEmbedMarks(fileName))
+        return;
+    ScopedHandle h(file::OpenReadOnly(fileName));
+    if (h == INVALID_HANDLE_VALUE)
+        return;
+
+    fz_md5 md5;
+    fz_md5_init(&md5);
+    unsigned char buf[16 * 1024];
+    DWORD read;
+    while (!WasCancelRequested()) {
+        if (!ReadFile(h, buf, sizeof(buf), &read, nullptr))
+            return;
+        if (0 == read)
+            break;
+        fz_md5_update(&md5, buf, read);
+    }
+    if (WasCancelRequested())
+        return;
+
+    ScopedCritSec scope(&engine->ctxAccess);
+    fz_md5_final(&md5, engine->fingerprint);
+    engine->hasFingerprint = true;
+}
+
+fz_display_list *PdfEngineImpl::LoadCachedDisplayList(int pageNo)
+{
+    ScopedMem<WCHAR> path(GetDisplayListCachePath(pageNo));
+    if (!path)
+        return nullptr;
+    size_t len;
+    ScopedMem<char> data(file::ReadAll(path, &len));
+    if (!data)
+        return nullptr;
+
+    fz_display_list *list = nullptr;
+    fz_device *dev = nullptr;
+    fz_var(list);
+    fz_var(dev);
+    fz_try(ctx) {
+        list = fz_new_display_list(ctx);
+        dev = fz_new_list_device(ctx, list);
+        fz_deserialize_display_list(ctx, data, len, dev);
+    }
+    fz_catch(ctx) {
+        fz_drop_display_list(ctx, list);
+        list = nullptr;
+    }
+    fz_free_device(dev);
+
+    if (!list)
+        file::Delete(path);
+    return list;
+}
+
+void PdfEngineImpl::SaveCachedDisplayList(int pageNo, fz_display_list *list)
+{
+    ScopedMem<WCHAR> path(GetDisplayListCachePath(pageNo));
+    if (!path)
+        return;
+    size_t len;
+    ScopedMem<char> data(fz_serialize_display_list(ctx, list, &len));
+    if (data)
+        file::WriteAll(path, data, len);
+}
+
 PdfPageRun *PdfEngineImpl::CreatePageRun(pdf_page *page, fz_display_list *list)
 {
     Vec<FitzImagePos> positions;
@@ -1943,20 +2768,27 @@ PdfPageRun *PdfEngineImpl::GetPageRun(pdf_page *page, bool tryOnly)
 
         ScopedCritSec scope2(&ctxAccess);
 
-        fz_display_list *list = nullptr;
-        fz_device *dev = nullptr;
-        fz_var(list);
-        fz_var(dev);
-        fz_try(ctx) {
-            list = fz_new_display_list(ctx);
-            dev = fz_new_list_device(ctx, list);
-            pdf_run_page(_doc, page, dev, &fz_identity, nullptr);
-        }
-        fz_catch(ctx) {
-            fz_drop_display_list(ctx, list);
-            list = nullptr;
+        int pageNo = GetPageNo(page);
+        fz_display_list *list = LoadCachedDisplayList(pageNo);
+        if (!list) {
+            Timer t;
+            fz_device *dev = nullptr;
+            fz_var(list);
+            fz_var(dev);
+            fz_try(ctx) {
+                list = fz_new_display_list(ctx);
+                dev = fz_new_list_device(ctx, list);
+                pdf_run_page(_doc, page, dev, &fz_identity, nullptr);
+            }
+            fz_catch(ctx) {
+                fz_drop_display_list(ctx, list);
+                list = nullptr;
+            }
+            fz_free_device(dev);
+
+            if (list && t.Stop() >= DISPLAY_LIST_CACHE_MIN_MS)
+                SaveCachedDisplayList(pageNo, list);
         }
-        fz_free_device(dev);
 
         if (list) {
             result = CreatePageRun(page, list);
@@ -1978,11 +2810,18 @@ bool PdfEngineImpl::RunPage(pdf_page *page, fz_device *dev, const fz_matrix *ctm
 {
     bool ok = true;
 
-    PdfPageRun *run;
-    if (Target_View == target && (run = GetPageRun(page, !cacheRun)) != nullptr) {
+    // devices created for a clone of ctx (cf. RenderBitmap) may only
+    // replay display lists which don't call back into the document
+    fz_context *devCtx = dev->ctx;
+    bool isClone = devCtx != ctx;
+
+    PdfPageRun *run = nullptr;
+    if (Target_View == target && (run = GetPageRun(page, !cacheRun)) != nullptr && (!isClone || !run->req_t3_fonts)) {
         EnterCriticalSection(&ctxAccess);
         Vec<PageAnnotation> pageAnnots = fz_get_user_page_annots(userAnnots, GetPageNo(page));
-        fz_try(ctx) {
+        if (isClone)
+            LeaveCriticalSection(&ctxAccess);
+        fz_try(devCtx) {
             fz_rect pagerect;
             fz_begin_page(dev, pdf_bound_page(_doc, page, &pagerect), ctm);
             fz_run_page_transparency(pageAnnots, dev, cliprect, false, page->transparency);
@@ -1991,12 +2830,18 @@ bool PdfEngineImpl::RunPage(pdf_page *page, fz_device *dev, const fz_matrix *ctm
             fz_run_user_page_annots(pageAnnots, dev, ctm, cliprect, cookie ? &cookie->cookie : nullptr);
             fz_end_page(dev);
         }
-        fz_catch(ctx) {
+        fz_catch(devCtx) {
             ok = false;
         }
-        LeaveCriticalSection(&ctxAccess);
+        if (!isClone)
+            LeaveCriticalSection(&ctxAccess);
         DropPageRun(run);
     }
+    else if (isClone) {
+        if (run)
+            DropPageRun(run);
+        ok = false;
+    }
     else {
         ScopedCritSec scope(&ctxAccess);
         char *targetName = target == Target_Print ? "Print" :
@@ -2016,9 +2861,14 @@ bool PdfEngineImpl::RunPage(pdf_page *page, fz_device *dev, const fz_matrix *ctm
         }
     }
 
-    EnterCriticalSection(&ctxAccess);
-    fz_free_device(dev);
-    LeaveCriticalSection(&ctxAccess);
+    if (isClone) {
+        fz_free_device(dev);
+    }
+    else {
+        EnterCriticalSection(&ctxAccess);
+        fz_free_device(dev);
+        LeaveCriticalSection(&ctxAccess);
+    }
 
     return ok && !(cookie && cookie->cookie.abort);
 }
@@ -2038,18 +2888,34 @@ void PdfEngineImpl::DropPageRun(PdfPageRun *run, bool forceRemove)
     }
 }
 
+fz_context *PdfEngineImpl::AcquireCtxClone()
+{
+    ScopedCritSec scope(&pagesAccess);
+    if (ctxClones.Count() > 0)
+        return ctxClones.Pop();
+
+    ScopedCritSec ctxScope(&ctxAccess);
+    return fz_clone_context(ctx);
+}
+
+void PdfEngineImpl::ReleaseCtxClone(fz_context *clone)
+{
+    ScopedCritSec scope(&pagesAccess);
+    ctxClones.Append(clone);
+}
+
 RectD PdfEngineImpl::PageMediabox(int pageNo)
 {
     assert(1 <= pageNo && pageNo <= PageCount());
     if (!_mediaboxes[pageNo-1].IsEmpty())
         return _mediaboxes[pageNo-1];
 
-    pdf_obj *page = _pageObjs[pageNo - 1];
+    ScopedCritSec scope(&ctxAccess);
+
+    pdf_obj *page = GetPageObj(pageNo);
     if (!page)
         return RectD();
 
-    ScopedCritSec scope(&ctxAccess);
-
     // cf. pdf-page.c's pdf_load_page
     fz_rect mbox = fz_empty_rect, cbox = fz_empty_rect;
     int rotate = 0;
@@ -2216,7 +3082,12 @@ bool PdfEngineImpl::PreferGdiPlusDevice(pdf_page *page, float zoom, fz_rect clip
     return result;
 }
 
-RenderedBitmap *PdfEngineImpl::RenderBitmap(int pageNo, float zoom, int rotation, RectD *pageRect, RenderTarget target, AbortCookie **cookie_out)
+// number of bits of antialiasing used for preview bitmaps
+// (the full quality default is 8 bits)
+#define PREVIEW_AA_LEVEL 2
+
+RenderedBitmap *PdfEngineImpl::RenderPageBitmap(int pageNo, float zoom, int rotation, RectD *pageRect,
+                                                RenderTarget target, AbortCookie **cookie_out, bool preview)
 {
     pdf_page* page = GetPdfPage(pageNo);
     if (!page || !pdf_is_dict(page->me))
@@ -2255,41 +3126,60 @@ RenderedBitmap *PdfEngineImpl::RenderBitmap(int pageNo, float zoom, int rotation
         return new RenderedBitmap(hbmp, SizeI(w, h), hMap);
     }
 
-    fz_pixmap *image = nullptr;
-    EnterCriticalSection(&ctxAccess);
-    fz_try(ctx) {
-        fz_colorspace *colorspace = fz_device_rgb(ctx);
-        image = fz_new_pixmap_with_bbox(ctx, colorspace, &bbox);
-        fz_clear_pixmap_with_value(ctx, image, 0xFF); // initialize white background
-    }
-    fz_catch(ctx) {
-        LeaveCriticalSection(&ctxAccess);
-        return nullptr;
+    // cached page runs without Type 3 fonts can be replayed on a clone of ctx
+    // outside of ctxAccess, so that several pages can be rasterized in parallel
+    PdfPageRun *run = Target_View == target ? GetPageRun(page) : nullptr;
+    fz_context *renderCtx = run && !run->req_t3_fonts ? AcquireCtxClone() : nullptr;
+    bool isClone = renderCtx != nullptr;
+    if (!isClone) {
+        renderCtx = ctx;
+        EnterCriticalSection(&ctxAccess);
     }
+    // the antialiasing level is private to a clone (and can't be changed
+    // for ctx which other threads might be rendering with at the same time)
+    else if (preview)
+        fz_set_aa_level(renderCtx, PREVIEW_AA_LEVEL);
 
+    fz_pixmap *image = nullptr;
     fz_device *dev = nullptr;
-    fz_try(ctx) {
-        dev = fz_new_draw_device(ctx, image);
-    }
-    fz_catch(ctx) {
-        fz_drop_pixmap(ctx, image);
+    fz_var(image);
+    fz_try(renderCtx) {
+        fz_colorspace *colorspace = fz_device_rgb(renderCtx);
+        image = fz_new_pixmap_with_bbox(renderCtx, colorspace, &bbox);
+        fz_clear_pixmap_with_value(renderCtx, image, 0xFF); // initialize white background
+        dev = fz_new_draw_device(renderCtx, image);
+    }
+    fz_catch(renderCtx) {
+        fz_drop_pixmap(renderCtx, image);
+        image = nullptr;
+    }
+    if (!isClone)
         LeaveCriticalSection(&ctxAccess);
-        return nullptr;
-    }
-    LeaveCriticalSection(&ctxAccess);
-
-    FitzAbortCookie *cookie = nullptr;
-    if (cookie_out)
-        *cookie_out = cookie = new FitzAbortCookie();
-    fz_rect cliprect;
-    bool ok = RunPage(page, dev, &ctm, target, fz_rect_from_irect(&cliprect, &bbox), true, cookie);
 
-    ScopedCritSec scope(&ctxAccess);
+    bool ok = false;
+    if (dev) {
+        FitzAbortCookie *cookie = nullptr;
+        if (cookie_out)
+            *cookie_out = cookie = new FitzAbortCookie();
+        fz_rect cliprect;
+        ok = RunPage(page, dev, &ctm, target, fz_rect_from_irect(&cliprect, &bbox), true, cookie);
+    }
 
+    if (!isClone)
+        EnterCriticalSection(&ctxAccess);
     RenderedBitmap *bitmap = nullptr;
     if (ok)
-        bitmap = new_rendered_fz_pixmap(ctx, image);
-    fz_drop_pixmap(ctx, image);
+        bitmap = new_rendered_fz_pixmap(renderCtx, image);
+    fz_drop_pixmap(renderCtx, image);
+    if (isClone && preview)
+        fz_set_aa_level(renderCtx, fz_aa_level(ctx));
+    if (isClone)
+        ReleaseCtxClone(renderCtx);
+    else
+        LeaveCriticalSection(&ctxAccess);
+
+    if (run)
+        DropPageRun(run);
     return bitmap;
 }
 
@@ -2547,7 +3437,10 @@ WCHAR *PdfEngineImpl::ExtractPageText(int pageNo, const WCHAR *lineSep, RectI **
 
     EnterCriticalSection(&ctxAccess);
     fz_try(ctx) {
-        page = pdf_load_page_by_obj(_doc, pageNo - 1, _pageObjs[pageNo-1]);
+        pdf_obj *pageObj = GetPageObj(pageNo);
+        if (!pageObj)
+            fz_throw(ctx, FZ_ERROR_GENERIC, "page %d not found", pageNo);
+        page = pdf_load_page_by_obj(_doc, pageNo - 1, pageObj);
     }
     fz_catch(ctx) {
         LeaveCriticalSection(&ctxAccess);
@@ -2567,6 +3460,9 @@ WCHAR *PdfEngineImpl::ExtractPageText(int pageNo, const WCHAR *lineSep, RectI **
 bool PdfEngineImpl::IsLinearizedFile()
 {
     ScopedCritSec scope(&ctxAccess);
+    // MuPDF has already verified the linearization dictionary
+    if (_doc->linear_obj)
+        return true;
     // determine the object number of the very first object in the file
     fz_seek(_doc->file, 0, 0);
     int tok = pdf_lex(_doc->file, &_doc->lexbuf.base);
@@ -2592,7 +3488,7 @@ bool PdfEngineImpl::IsLinearizedFile()
     if (pdf_to_int(pdf_dict_gets(obj, "L")) != _doc->file_size)
         return false;
     // /O must be the object number of the first page
-    if (pdf_to_int(pdf_dict_gets(obj, "O")) != pdf_to_num(_pageObjs[0]))
+    if (pdf_to_int(pdf_dict_gets(obj, "O")) != pdf_to_num(GetPageObj(1)))
         return false;
     // /N must be the total number of pages
     if (pdf_to_int(pdf_dict_gets(obj, "N")) != PageCount())
@@ -2729,6 +3625,7 @@ WCHAR *PdfEngineImpl::GetProperty(DocumentProperty prop)
 {
     if (!_doc)
         return nullptr;
+    WaitForDocInfo();
 
     if (Prop_PdfVersion == prop) {
         int major = _doc->version / 10, minor = _doc->version % 10;
@@ -2790,8 +3687,11 @@ bool PdfEngineImpl::SupportsAnnotation(bool forSaving) const
 {
     if (forSaving) {
         // TODO: support updating of documents where pages aren't all numbered objects?
-        for (int i = 0; i < PageCount(); i++) {
-            if (pdf_to_num(_pageObjs[i]) == 0)
+        // (this requires looking up all page objects which needs ctxAccess)
+        PdfEngineImpl *self = const_cast<PdfEngineImpl *>(this);
+        ScopedCritSec scope(&self->ctxAccess);
+        for (int pageNo = 1; pageNo <= PageCount(); pageNo++) {
+            if (pdf_to_num(self->GetPageObj(pageNo)) == 0)
                 return false;
         }
     }
@@ -3014,7 +3914,8 @@ bool PdfEngineImpl::SaveUserAnnots(const WCHAR *fileName)
         for (int pageNo = 1; pageNo <= PageCount(); pageNo++) {
             pdf_page *page = GetPdfPage(pageNo);
             // TODO: this will skip annotations for broken documents
-            if (!page || !pdf_to_num(_pageObjs[pageNo - 1])) {
+            pdf_obj *pageObj = GetPageObj(pageNo);
+            if (!page || !pdf_to_num(pageObj)) {
                 ok = false;
                 break;
             }
@@ -3022,18 +3923,18 @@ bool PdfEngineImpl::SaveUserAnnots(const WCHAR *fileName)
             if (pageAnnots.Count() == 0)
                 continue;
             // get the page's /Annots array for appending
-            pdf_obj *annots = pdf_dict_gets(_pageObjs[pageNo - 1], "Annots");
+            pdf_obj *annots = pdf_dict_gets(pageObj, "Annots");
             if (!pdf_is_array(annots)) {
-                pdf_dict_puts_drop(_pageObjs[pageNo - 1], "Annots", pdf_new_array(_doc, (int)pageAnnots.Count()));
-                annots = pdf_dict_gets(_pageObjs[pageNo - 1], "Annots");
+                pdf_dict_puts_drop(pageObj, "Annots", pdf_new_array(_doc, (int)pageAnnots.Count()));
+                annots = pdf_dict_gets(pageObj, "Annots");
             }
             if (!pdf_is_indirect(annots)) {
                 // make /Annots indirect for the current /Page
-                pdf_dict_puts_drop(_pageObjs[pageNo - 1], "Annots", pdf_new_ref(_doc, annots));
+                pdf_dict_puts_drop(pageObj, "Annots", pdf_new_ref(_doc, annots));
             }
             // append all annotations for the current page
             for (size_t i = 0; i < pageAnnots.Count(); i++) {
-                ok &= pdf_file_update_add_annotation(_doc, page, _pageObjs[pageNo - 1], pageAnnots.At(i), annots);
+                ok &= pdf_file_update_add_annotation(_doc, page, pageObj, pageAnnots.At(i), annots);
             }
         }
         if (ok) {
@@ -3082,6 +3983,7 @@ bool PdfEngineImpl::HasClipOptimizations(int pageNo)
 
 WCHAR *PdfEngineImpl::GetPageLabel(int pageNo) const
 {
+    WaitForDocInfo();
     if (!_pagelabels || pageNo < 1 || PageCount() < pageNo)
         return BaseEngine::GetPageLabel(pageNo);
 
@@ -3090,6 +3992,7 @@ WCHAR *PdfEngineImpl::GetPageLabel(int pageNo) const
 
 int PdfEngineImpl::GetPageByLabel(const WCHAR *label) const
 {
+    WaitForDocInfo();
     int pageNo = _pagelabels ? _pagelabels->Find(label) + 1 : 0;
     if (!pageNo)
         return BaseEngine::GetPageByLabel(label);
@@ -3327,6 +4230,66 @@ BaseEngine *CreateFromStream(IStream *stream, PasswordUI *pwdUI)
     return PdfEngineImpl::CreateFromStream(stream, pwdUI);
 }
 
+void SetGlyphCacheSize(BaseEngine *engine, size_t maxBytes)
+{
+    static_cast<PdfEngineImpl *>(engine)->SetGlyphCacheSize(maxBytes);
+}
+
+void GetGlyphCacheStats(BaseEngine *engine, int *hitsOut, int *missesOut, int *evictionsOut)
+{
+    fz_glyph_cache_stats stats;
+    static_cast<PdfEngineImpl *>(engine)->GetGlyphCacheStats(&stats);
+    *hitsOut = stats.hits;
+    *missesOut = stats.misses;
+    *evictionsOut = stats.evictions;
+}
+
+struct CachedListFile {
+    WCHAR *path;
+    FILETIME modified;
+    int64 size;
+};
+
+static int cmpCachedListFiles(const void *a, const void *b)
+{
+    // most recently modified first
+    return CompareFileTime(&((CachedListFile *)b)->modified, &((CachedListFile *)a)->modified);
+}
+
+void SetDisplayListCache(const WCHAR *dir, size_t maxBytes)
+{
+    free(gDisplayListCacheDir);
+    gDisplayListCacheDir = nullptr;
+    if (!dir || 0 == maxBytes || !dir::CreateAll(dir))
+        return;
+    gDisplayListCacheDir = str::Dup(dir);
+
+    // remove the least recently created lists exceeding the given size
+    Vec<CachedListFile> files;
+    ScopedMem<WCHAR> pattern(path::Join(dir, L"*.dl"));
+    WIN32_FIND_DATA fdata;
+    HANDLE hfind = FindFirstFile(pattern, &fdata);
+    if (INVALID_HANDLE_VALUE == hfind)
+        return;
+    do {
+        if (fdata.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)
+            continue;
+        CachedListFile file = { path::Join(dir, fdata.cFileName), fdata.ftLastWriteTime,
+                                ((int64)fdata.nFileSizeHigh << 32) + fdata.nFileSizeLow };
+        files.Append(file);
+    } while (FindNextFile(hfind, &fdata));
+    FindClose(hfind);
+
+    files.Sort(cmpCachedListFiles);
+    int64 total = 0;
+    for (CachedListFile& file : files) {
+        total += file.size;
+        if (total > (int64)maxBytes)
+            file::Delete(file.path);
+        free(file.path);
+    }
+}
+
 }
 
 ///// XPS-specific extensions to Fitz/MuXPS /////
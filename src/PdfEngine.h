@@ -6,6 +6,13 @@ namespace PdfEngine {
 bool IsSupportedFile(const WCHAR *fileName, bool sniff=false);
 BaseEngine *CreateFromFile(const WCHAR *fileName, PasswordUI *pwdUI=nullptr);
 BaseEngine *CreateFromStream(IStream *stream, PasswordUI *pwdUI=nullptr);
+// persists the parsed content of pages taking long to interpret in <dir>
+// (using at most <maxBytes> of disk space; nullptr disables the cache)
+void SetDisplayListCache(const WCHAR *dir, size_t maxBytes);
+// for -bench: changes the glyph cache budget of a PDF engine (0 empties
+// the cache) resp. returns its counters (accumulated since its creation)
+void SetGlyphCacheSize(BaseEngine *engine, size_t maxBytes);
+void GetGlyphCacheStats(BaseEngine *engine, int *hitsOut, int *missesOut, int *evictionsOut);
 
 }
 
@@ -19,3 +26,6 @@ BaseEngine *CreateFromStream(IStream *stream);
 
 // swaps Fitz' draw device with the GDI+ device
 void DebugGdiPlusDevice(bool enable);
+// throttles reading files to <bytesPerSec> (0 disables throttling)
+// for simulating slow network shares
+void DebugThrottleFileAccess(int bytesPerSec);
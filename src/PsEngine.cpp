@@ -240,6 +240,13 @@ public:
                          RectD *pageRect=nullptr, RenderTarget target=Target_View, AbortCookie **cookie_out=nullptr) {
         return pdfEngine->RenderPage(hDC, screenRect, pageNo, zoom, rotation, pageRect, target, cookie_out);
     }
+    virtual bool AllowsConcurrentRendering() const {
+        return pdfEngine->AllowsConcurrentRendering();
+    }
+    virtual RenderedBitmap *RenderPreviewBitmap(int pageNo, float zoom, int rotation,
+                         RectD *pageRect=nullptr, AbortCookie **cookie_out=nullptr) {
+        return pdfEngine->RenderPreviewBitmap(pageNo, zoom, rotation, pageRect, cookie_out);
+    }
 
     virtual PointD Transform(PointD pt, int pageNo, float zoom, int rotation, bool inverse=false) {
         return pdfEngine->Transform(pt, pageNo, zoom, rotation, inverse);
@@ -18,28 +18,29 @@
 #pragma warning(disable: 28159) // silence /analyze: Consider using 'GetTickCount64' instead of 'GetTickCount'
 
 // TODO: remove this and always conserve memory?
-/* Define if you want to conserve memory by always freeing cached bitmaps
-   for pages not visible. Disabling this might lead to pages not rendering
-   due to insufficient (GDI) memory. */
+/* Define if you want to conserve memory by freeing cached bitmaps for pages
+   not visible as soon as the cache exceeds FixedPageUI.BitmapCacheSize.
+   Disabling this might lead to pages not rendering due to insufficient
+   (GDI) memory. */
 #define CONSERVE_MEMORY
 
 // define to view the tile boundaries
 #undef SHOW_TILE_LAYOUT
 
 RenderCache::RenderCache()
-    : cacheCount(0), requestCount(0),
+    : requestCount(0), renderThreadCount(0),
       maxTileSize(GetSystemMetrics(SM_CXSCREEN), GetSystemMetrics(SM_CYSCREEN)),
       isRemoteSession(GetSystemMetrics(SM_REMOTESESSION))
 {
     textColor = WIN_COL_BLACK;
     backgroundColor = WIN_COL_WHITE;
+    ZeroMemory(cacheIndex, sizeof(cacheIndex));
+    ZeroMemory(&stats, sizeof(stats));
 
     InitializeCriticalSection(&cacheAccess);
     InitializeCriticalSection(&requestAccess);
 
     startRendering = CreateEvent(nullptr, FALSE, FALSE, nullptr);
-    renderThread = CreateThread(nullptr, 0, RenderCacheThread, this, 0, 0);
-    assert(nullptr != renderThread);
 }
 
 RenderCache::~RenderCache()
@@ -47,9 +48,12 @@ RenderCache::~RenderCache()
     EnterCriticalSection(&requestAccess);
     EnterCriticalSection(&cacheAccess);
 
-    CloseHandle(renderThread);
+    for (int i = 0; i < renderThreadCount; i++) {
+        CloseHandle(renderThreads[i].hThread);
+        assert(!renderThreads[i].curReq);
+    }
     CloseHandle(startRendering);
-    assert(!curReq && 0 == requestCount && 0 == cacheCount);
+    assert(0 == requestCount && 0 == cache.Count());
 
     LeaveCriticalSection(&cacheAccess);
     DeleteCriticalSection(&cacheAccess);
@@ -57,6 +61,42 @@ RenderCache::~RenderCache()
     DeleteCriticalSection(&requestAccess);
 }
 
+static size_t GetIndexBucket(DisplayModel *dm, int pageNo)
+{
+    return (((size_t)dm >> 4) + pageNo * 31) % CACHE_INDEX_SIZE;
+}
+
+void RenderCache::AddToIndex(BitmapCacheEntry *entry)
+{
+    ScopedCritSec scope(&cacheAccess);
+    size_t bucket = GetIndexBucket(entry->dm, entry->pageNo);
+    entry->nextInIndex = cacheIndex[bucket];
+    cacheIndex[bucket] = entry;
+}
+
+void RenderCache::RemoveFromIndex(BitmapCacheEntry *entry)
+{
+    ScopedCritSec scope(&cacheAccess);
+    BitmapCacheEntry **prev = &cacheIndex[GetIndexBucket(entry->dm, entry->pageNo)];
+    for (; *prev && *prev != entry; prev = &(*prev)->nextInIndex);
+    CrashIf(!*prev);
+    if (*prev)
+        *prev = entry->nextInIndex;
+    entry->nextInIndex = nullptr;
+}
+
+// removes an entry from the cache (the bitmap is deleted
+// as soon as the entry is no longer in use)
+void RenderCache::RemoveEntry(size_t idx)
+{
+    ScopedCritSec scope(&cacheAccess);
+    BitmapCacheEntry *entry = cache.At(idx);
+    cache.RemoveAt(idx);
+    RemoveFromIndex(entry);
+    stats.bytesUsed -= entry->size;
+    DropCacheEntry(entry);
+}
+
 /* Find a bitmap for a page defined by <dm> and <pageNo> and optionally also
    <rotation> and <zoom> in the cache - call DropCacheEntry when you
    no longer need a found entry. */
@@ -64,8 +104,7 @@ BitmapCacheEntry *RenderCache::Find(DisplayModel *dm, int pageNo, int rotation,
 {
     ScopedCritSec scope(&cacheAccess);
     rotation = NormalizeRotation(rotation);
-    for (int i = 0; i < cacheCount; i++) {
-        BitmapCacheEntry *entry = cache[i];
+    for (BitmapCacheEntry *entry = cacheIndex[GetIndexBucket(dm, pageNo)]; entry; entry = entry->nextInIndex) {
         if ((dm == entry->dm) && (pageNo == entry->pageNo) && (rotation == entry->rotation) &&
             (INVALID_ZOOM == zoom || zoom == entry->zoom) && (!tile || entry->tile == *tile)) {
             entry->refs++;
@@ -93,42 +132,50 @@ void RenderCache::DropCacheEntry(BitmapCacheEntry *entry)
     }
 }
 
+static size_t GetBitmapMemorySize(RenderedBitmap *bmp)
+{
+    if (!bmp || !bmp->GetBitmap())
+        return 0;
+    BITMAP info;
+    if (GetObject(bmp->GetBitmap(), sizeof(info), &info) == sizeof(info))
+        return (size_t)info.bmWidthBytes * info.bmHeight;
+    return (size_t)bmp->Size().dx * bmp->Size().dy * 4;
+}
+
 void RenderCache::Add(PageRenderRequest &req, RenderedBitmap *bitmap)
 {
     ScopedCritSec scope(&cacheAccess);
     assert(req.dm);
 
     req.rotation = NormalizeRotation(req.rotation);
-    assert(cacheCount <= MAX_BITMAPS_CACHED);
+    assert(cache.Count() <= MAX_BITMAPS_CACHED);
+
+    // a preview is useless once the page has been rendered at full quality
+    if (req.preview && Exists(req.dm, req.pageNo, req.rotation, req.dm->GetZoomReal(req.pageNo), &req.tile)) {
+        delete bitmap;
+        return;
+    }
 
     /* It's possible there still is a cached bitmap with different zoom/rotation */
     FreePage(req.dm, req.pageNo, &req.tile);
 
-    if (cacheCount >= MAX_BITMAPS_CACHED) {
-        // free an invisible page of the same DisplayModel ...
-        for (int i = 0; i < cacheCount; i++) {
-            if (cache[i]->dm == req.dm && !req.dm->PageVisibleNearby(cache[i]->pageNo)) {
-                DropCacheEntry(cache[i]);
-                cacheCount--;
-                memmove(&cache[i], &cache[i + 1], (cacheCount - i) * sizeof(cache[0]));
-                break;
-            }
-        }
-        // ... or just the oldest cached page
-        if (cacheCount >= MAX_BITMAPS_CACHED) {
-            DropCacheEntry(cache[0]);
-            cacheCount--;
-            memmove(&cache[0], &cache[1], cacheCount * sizeof(cache[0]));
-        }
-    }
+    size_t size = GetBitmapMemorySize(bitmap);
+    FreeCacheSpace(size, true);
 
     // Copy the PageRenderRequest as it will be reused
-    cache[cacheCount] = new BitmapCacheEntry(req.dm, req.pageNo, req.rotation, req.zoom, req.tile, bitmap);
-    CrashIf(!cache[cacheCount]);
-    if (!cache[cacheCount])
-        delete bitmap;
-    else
-        cacheCount++;
+    BitmapCacheEntry *entry = new BitmapCacheEntry(req.dm, req.pageNo, req.rotation, req.zoom, req.tile, bitmap, size);
+    entry->isPreview = req.preview;
+    cache.Append(entry);
+    AddToIndex(entry);
+    stats.bytesUsed += size;
+}
+
+RenderCacheStats RenderCache::GetStats()
+{
+    ScopedCritSec scope(&cacheAccess);
+    RenderCacheStats result = stats;
+    result.bitmapCount = cache.Count();
+    return result;
 }
 
 static RectD GetTileRect(RectD pagerect, TilePosition tile)
@@ -181,17 +228,16 @@ static bool IsTileVisible(DisplayModel *dm, int pageNo, TilePosition tile, float
 }
 
 /* Free all bitmaps in the cache that are of a specific page (or all pages
-   of the given DisplayModel, or even all invisible pages). */
+   of the given DisplayModel). */
 void RenderCache::FreePage(DisplayModel *dm, int pageNo, TilePosition *tile)
 {
     ScopedCritSec scope(&cacheAccess);
-    int cacheCountTmp = cacheCount;
-    int curPos = 0;
+    assert(dm);
 
-    for (int i = 0; i < cacheCountTmp; i++) {
-        BitmapCacheEntry* entry = cache[i];
+    for (size_t i = 0; i < cache.Count(); i++) {
+        BitmapCacheEntry* entry = cache.At(i);
         bool shouldFree;
-        if (dm && pageNo != INVALID_PAGE_NO) {
+        if (pageNo != INVALID_PAGE_NO) {
             // a specific page
             shouldFree = (entry->dm == dm) && (entry->pageNo == pageNo);
             if (tile) {
@@ -199,28 +245,59 @@ void RenderCache::FreePage(DisplayModel *dm, int pageNo, TilePosition *tile)
                 // (and at resolution 0 for quick zoom previews)
                 shouldFree = shouldFree && (entry->tile == *tile ||
                     tile->row == (USHORT)-1 && entry->tile.res > 0 && entry->tile.res != tile->res ||
-                    tile->row == (USHORT)-1 && entry->tile.res == 0 && entry->outOfDate);
+                    tile->row == (USHORT)-1 && entry->tile.res == 0 && (entry->outOfDate || entry->isPreview));
             }
-        } else if (dm) {
-            // all pages of this DisplayModel
-            shouldFree = (cache[i]->dm == dm);
         } else {
-            // all invisible pages resp. page tiles
-            shouldFree = !entry->dm->PageVisibleNearby(entry->pageNo);
-            if (!shouldFree && entry->tile.res > 1)
-                shouldFree = !IsTileVisible(entry->dm, entry->pageNo, entry->tile, 2.0);
+            // all pages of this DisplayModel
+            shouldFree = (entry->dm == dm);
         }
 
-        if (shouldFree) {
-            DropCacheEntry(entry);
-            cache[i] = nullptr;
-            cacheCount--;
-        }
+        if (shouldFree)
+            RemoveEntry(i--);
+    }
+}
 
-        if (curPos != i)
-            cache[curPos] = cache[i];
-        if (!shouldFree)
-            curPos++;
+static size_t GetCacheBudget()
+{
+    return (size_t)limitValue(gGlobalPrefs->fixedPageUI.bitmapCacheSize, 16, 1024) * 1024 * 1024;
+}
+
+// the cost of keeping a bitmap is its size weighed by how far the page
+// is from the visible part of the document (visible bitmaps cost nothing)
+static double GetRetentionCost(BitmapCacheEntry *entry)
+{
+    DisplayModel *dm = entry->dm;
+    double distance = 0;
+    if (!dm->PageVisibleNearby(entry->pageNo))
+        distance = abs(entry->pageNo - dm->CurrentPageNo()) + 1;
+    else if (entry->tile.res > 1 && !IsTileVisible(dm, entry->pageNo, entry->tile, 2.0))
+        distance = 1;
+    return distance * std::max(entry->size, (size_t)1);
+}
+
+/* Free the most costly bitmaps until there's room for <bytesNeeded> more bytes
+   without exceeding the budget. Bitmaps of visible pages are only freed
+   if room is needed for a new entry (oldest first). */
+void RenderCache::FreeCacheSpace(size_t bytesNeeded, bool forNewEntry)
+{
+    ScopedCritSec scope(&cacheAccess);
+    size_t maxBytes = GetCacheBudget();
+
+    while (cache.Count() > 0 && (stats.bytesUsed + bytesNeeded > maxBytes ||
+                                 forNewEntry && cache.Count() >= MAX_BITMAPS_CACHED)) {
+        size_t idx = 0;
+        double maxCost = GetRetentionCost(cache.At(0));
+        for (size_t i = 1; i < cache.Count(); i++) {
+            double cost = GetRetentionCost(cache.At(i));
+            if (cost > maxCost) {
+                idx = i;
+                maxCost = cost;
+            }
+        }
+        if (0 == maxCost && !forNewEntry)
+            break;
+        RemoveEntry(idx);
+        stats.evictions++;
     }
 }
 
@@ -229,13 +306,16 @@ void RenderCache::FreePage(DisplayModel *dm, int pageNo, TilePosition *tile)
 void RenderCache::KeepForDisplayModel(DisplayModel *oldDm, DisplayModel *newDm)
 {
     ScopedCritSec scope(&cacheAccess);
-    for (int i = 0; i < cacheCount; i++) {
-        if (cache[i]->dm == oldDm) {
-            if (oldDm->PageVisible(cache[i]->pageNo))
-                cache[i]->dm = newDm;
+    for (BitmapCacheEntry *entry : cache) {
+        if (entry->dm == oldDm) {
+            if (oldDm->PageVisible(entry->pageNo) && oldDm != newDm) {
+                RemoveFromIndex(entry);
+                entry->dm = newDm;
+                AddToIndex(entry);
+            }
             // make sure that the page is rerendered eventually
-            cache[i]->zoom = INVALID_ZOOM;
-            cache[i]->outOfDate = true;
+            entry->zoom = INVALID_ZOOM;
+            entry->outOfDate = true;
         }
     }
 }
@@ -246,17 +326,16 @@ void RenderCache::Invalidate(DisplayModel *dm, int pageNo, RectD rect)
     ScopedCritSec scopeReq(&requestAccess);
 
     ClearQueueForDisplayModel(dm, pageNo);
-    if (curReq && curReq->dm == dm && curReq->pageNo == pageNo)
-        AbortCurrentRequest();
+    AbortRequests(dm, pageNo);
 
     ScopedCritSec scopeCache(&cacheAccess);
 
     RectD mediabox = dm->GetEngine()->PageMediabox(pageNo);
-    for (int i = 0; i < cacheCount; i++) {
-        if (cache[i]->dm == dm && cache[i]->pageNo == pageNo &&
-            !GetTileRect(mediabox, cache[i]->tile).Intersect(rect).IsEmpty()) {
-            cache[i]->zoom = INVALID_ZOOM;
-            cache[i]->outOfDate = true;
+    for (BitmapCacheEntry *entry = cacheIndex[GetIndexBucket(dm, pageNo)]; entry; entry = entry->nextInIndex) {
+        if (entry->dm == dm && entry->pageNo == pageNo &&
+            !GetTileRect(mediabox, entry->tile).Intersect(rect).IsEmpty()) {
+            entry->zoom = INVALID_ZOOM;
+            entry->outOfDate = true;
         }
     }
 }
@@ -295,11 +374,9 @@ USHORT RenderCache::GetMaxTileRes(DisplayModel *dm, int pageNo, int rotation)
 {
     ScopedCritSec scope(&cacheAccess);
     USHORT maxRes = 0;
-    for (int i = 0; i < cacheCount; i++) {
-        if (cache[i]->dm == dm && cache[i]->pageNo == pageNo &&
-            cache[i]->rotation == rotation) {
-            maxRes = std::max(cache[i]->tile.res, maxRes);
-        }
+    for (BitmapCacheEntry *entry = cacheIndex[GetIndexBucket(dm, pageNo)]; entry; entry = entry->nextInIndex) {
+        if (entry->dm == dm && entry->pageNo == pageNo && entry->rotation == rotation)
+            maxRes = std::max(entry->tile.res, maxRes);
     }
     return maxRes;
 }
@@ -320,11 +397,11 @@ bool RenderCache::ReduceTileSize()
         maxTileSize.dy /= 2;
 
     // invalidate all rendered bitmaps and all requests
-    while (cacheCount > 0)
-        FreeForDisplayModel(cache[0]->dm);
+    while (cache.Count() > 0)
+        FreeForDisplayModel(cache.At(0)->dm);
     while (requestCount > 0)
         ClearQueueForDisplayModel(requests[0].dm);
-    AbortCurrentRequest();
+    AbortRequests();
 
     return true;
 }
@@ -337,17 +414,107 @@ void RenderCache::RequestRendering(DisplayModel *dm, int pageNo)
     if (tile.res > 1)
         return;
 
-    RequestRendering(dm, pageNo, tile);
+    RenderPriority priority = dm->PageVisible(pageNo) ? Priority_Visible : Priority_Nearby;
+    RequestRendering(dm, pageNo, tile, true, priority);
     // render both tiles of the first row when splitting a page in four
     // (which always happens on larger displays for Fit Width)
     if (tile.res == 1 && !IsRenderQueueFull()) {
         tile.col = 1;
-        RequestRendering(dm, pageNo, tile, false);
+        RequestRendering(dm, pageNo, tile, false, priority);
+    }
+}
+
+/* Render the pages from <fromPageNo> to <toPageNo> (in that order) at low
+   priority, as long as their bitmaps fit into half of the cache's budget
+   (the other half remains for the visible and nearby pages) */
+void RenderCache::RequestPrefetching(DisplayModel *dm, int fromPageNo, int toPageNo)
+{
+    ScopedCritSec scope(&requestAccess);
+    size_t maxBytes = GetCacheBudget() / 2;
+    size_t bytes = 0;
+    int step = fromPageNo <= toPageNo ? 1 : -1;
+
+    for (int pageNo = fromPageNo; pageNo != toPageNo + step && !IsRenderQueueFull(); pageNo += step) {
+        if (!dm->ShouldCacheRendering(pageNo))
+            continue;
+        TilePosition tile(GetTileRes(dm, pageNo), 0, 0);
+        // at high zoom levels, only a fraction of the page would be prerendered
+        if (tile.res > 1)
+            break;
+        RectD pixelbox = dm->GetEngine()->Transform(dm->GetEngine()->PageMediabox(pageNo), pageNo, dm->GetZoomReal(pageNo), dm->GetRotation());
+        bytes += (size_t)(pixelbox.dx * pixelbox.dy * 4);
+        if (bytes > maxBytes)
+            break;
+        // nearby pages are requested at a higher priority anyway
+        if (dm->PageVisibleNearby(pageNo))
+            continue;
+
+        RequestRendering(dm, pageNo, tile, true, Priority_Prefetch);
+        if (tile.res == 1 && !IsRenderQueueFull()) {
+            tile.col = 1;
+            RequestRendering(dm, pageNo, tile, false, Priority_Prefetch);
+        }
+    }
+}
+
+// drops all prefetching requests for <dm> (e.g. when the scroll direction changes)
+void RenderCache::CancelPrefetching(DisplayModel *dm)
+{
+    ScopedCritSec scope(&requestAccess);
+    int curPos = 0;
+    for (int i = 0; i < requestCount; i++) {
+        PageRenderRequest *req = &requests[i];
+        if (req->dm == dm && Priority_Prefetch == req->priority) {
+            CrashIf(req->renderCb);
+            continue;
+        }
+        if (i != curPos)
+            requests[curPos] = *req;
+        curPos++;
+    }
+    requestCount = curPos;
+
+    for (int i = 0; i < renderThreadCount; i++) {
+        PageRenderRequest *req = renderThreads[i].curReq;
+        if (req && req->dm == dm && Priority_Prefetch == req->priority) {
+            if (req->abortCookie)
+                req->abortCookie->Abort();
+            req->abort = true;
+        }
+    }
+}
+
+/* Quickly render the whole page at a fraction of the current resolution
+   (and at reduced quality), so that there's something to display (scaled up)
+   while the tiles at the current zoom level are still being rendered. */
+void RenderCache::RequestPreview(DisplayModel *dm, int pageNo)
+{
+    ScopedCritSec scope(&requestAccess);
+    for (int i = 0; i < renderThreadCount; i++) {
+        PageRenderRequest *req = renderThreads[i].curReq;
+        if (req && req->preview && req->dm == dm && req->pageNo == pageNo)
+            return;
+    }
+    for (int i = 0; i < requestCount; i++) {
+        if (requests[i].preview && requests[i].dm == dm && requests[i].pageNo == pageNo)
+            return;
     }
+
+    int rotation = NormalizeRotation(dm->GetRotation());
+    float zoom = dm->GetZoomReal(pageNo);
+    RectD pixelbox = dm->GetEngine()->Transform(dm->GetEngine()->PageMediabox(pageNo), pageNo, zoom, rotation);
+    if (pixelbox.IsEmpty())
+        return;
+    // render at most a quarter of a tile's pixels
+    double factor = sqrt(maxTileSize.dx * maxTileSize.dy / 4.0 / (pixelbox.dx * pixelbox.dy));
+    zoom *= (float)std::min(factor, 0.5);
+
+    TilePosition tile(0, 0, 0);
+    Render(dm, pageNo, rotation, zoom, &tile, nullptr, nullptr, Priority_Visible, true);
 }
 
 /* Render a bitmap for page <pageNo> in <dm>. */
-void RenderCache::RequestRendering(DisplayModel *dm, int pageNo, TilePosition tile, bool clearQueueForPage)
+void RenderCache::RequestRendering(DisplayModel *dm, int pageNo, TilePosition tile, bool clearQueueForPage, RenderPriority priority)
 {
     ScopedCritSec scope(&requestAccess);
     assert(dm);
@@ -357,14 +524,27 @@ void RenderCache::RequestRendering(DisplayModel *dm, int pageNo, TilePosition ti
     int rotation = NormalizeRotation(dm->GetRotation());
     float zoom = dm->GetZoomReal(pageNo);
 
-    if (curReq && (curReq->pageNo == pageNo) && (curReq->dm == dm) && (curReq->tile == tile)) {
-        if ((curReq->zoom == zoom) && (curReq->rotation == rotation)) {
-            /* we're already rendering exactly the same page */
-            return;
+    for (int i = 0; i < renderThreadCount; i++) {
+        PageRenderRequest *req = renderThreads[i].curReq;
+        if (!req || req->dm != dm)
+            continue;
+        if (req->pageNo == pageNo && req->tile == tile && !req->preview) {
+            if ((req->zoom == zoom) && (req->rotation == rotation)) {
+                /* we're already rendering exactly the same page */
+                return;
+            }
+            /* This thread renders the same page but with different zoom
+               or rotation, so abort it */
+            AbortRequests(dm, pageNo, &tile);
+        }
+        else if (Priority_Visible == priority && !req->renderCb && req->priority != Priority_Prefetch &&
+                 !dm->PageVisibleNearby(req->pageNo)) {
+            /* The page has been scrolled out of view (the bitmap would be
+               freed right away), so make the thread available again */
+            if (req->abortCookie)
+                req->abortCookie->Abort();
+            req->abort = true;
         }
-        /* Currently rendered page is for the same page but with different zoom
-        or rotation, so abort it */
-        AbortCurrentRequest();
     }
 
     // clear requests for tiles of different resolution and invisible tiles
@@ -373,7 +553,7 @@ void RenderCache::RequestRendering(DisplayModel *dm, int pageNo, TilePosition ti
 
     for (int i = 0; i < requestCount; i++) {
         PageRenderRequest* req = &(requests[i]);
-        if ((req->pageNo == pageNo) && (req->dm == dm) && (req->tile == tile)) {
+        if ((req->pageNo == pageNo) && (req->dm == dm) && (req->tile == tile) && !req->preview) {
             if ((req->zoom == zoom) && (req->rotation == rotation)) {
                 /* Request with exactly the same parameters already queued for
                    rendering. Move it to the top of the queue so that it'll
@@ -382,12 +562,14 @@ void RenderCache::RequestRendering(DisplayModel *dm, int pageNo, TilePosition ti
                 tmp = requests[requestCount-1];
                 requests[requestCount-1] = *req;
                 *req = tmp;
+                req = &requests[requestCount-1];
             } else {
                 /* There was a request queued for the same page but with different
                    zoom or rotation, so only replace this request */
                 req->zoom = zoom;
                 req->rotation = rotation;
             }
+            req->priority = std::min(req->priority, priority);
             return;
         }
     }
@@ -398,7 +580,7 @@ void RenderCache::RequestRendering(DisplayModel *dm, int pageNo, TilePosition ti
         return;
     }
 
-    Render(dm, pageNo, rotation, zoom, &tile);
+    Render(dm, pageNo, rotation, zoom, &tile, nullptr, nullptr, priority);
 }
 
 void RenderCache::Render(DisplayModel *dm, int pageNo, int rotation, float zoom, RectD pageRect, RenderingCallback& callback)
@@ -409,7 +591,8 @@ void RenderCache::Render(DisplayModel *dm, int pageNo, int rotation, float zoom,
 }
 
 bool RenderCache::Render(DisplayModel *dm, int pageNo, int rotation, float zoom,
-                         TilePosition *tile, RectD *pageRect, RenderingCallback *renderCb)
+                         TilePosition *tile, RectD *pageRect, RenderingCallback *renderCb,
+                         RenderPriority priority, bool preview)
 {
     assert(dm);
     if (!dm || dm->dontRenderFlag)
@@ -422,12 +605,23 @@ bool RenderCache::Render(DisplayModel *dm, int pageNo, int rotation, float zoom,
     ScopedCritSec scope(&requestAccess);
     PageRenderRequest* newRequest;
 
+    if (0 == renderThreadCount)
+        StartRenderThreads();
+
     /* add request to the queue */
     if (requestCount == MAX_PAGE_REQUESTS) {
-        /* queue is full -> remove the oldest items on the queue */
-        if (requests[0].renderCb)
-            requests[0].renderCb->Callback();
-        memmove(&(requests[0]), &(requests[1]), sizeof(PageRenderRequest) * (MAX_PAGE_REQUESTS - 1));
+        /* queue is full -> remove the oldest of the least important items
+           on the queue (unless they're all more important than this one) */
+        int drop = 0;
+        for (int i = 1; i < requestCount; i++) {
+            if (requests[i].priority > requests[drop].priority)
+                drop = i;
+        }
+        if (requests[drop].priority < priority)
+            return false;
+        if (requests[drop].renderCb)
+            requests[drop].renderCb->Callback();
+        memmove(&(requests[drop]), &(requests[drop + 1]), sizeof(PageRenderRequest) * (MAX_PAGE_REQUESTS - drop - 1));
         newRequest = &(requests[MAX_PAGE_REQUESTS-1]);
     } else {
         newRequest = &(requests[requestCount]);
@@ -450,6 +644,8 @@ bool RenderCache::Render(DisplayModel *dm, int pageNo, int rotation, float zoom,
     }
     else
         assert(0);
+    newRequest->priority = priority;
+    newRequest->preview = preview;
     newRequest->abort = false;
     newRequest->abortCookie = nullptr;
     newRequest->timestamp = GetTickCount();
@@ -464,43 +660,111 @@ UINT RenderCache::GetRenderDelay(DisplayModel *dm, int pageNo, TilePosition tile
 {
     ScopedCritSec scope(&requestAccess);
 
-    if (curReq && curReq->pageNo == pageNo && curReq->dm == dm && curReq->tile == tile)
-        return GetTickCount() - curReq->timestamp;
+    for (int i = 0; i < renderThreadCount; i++) {
+        PageRenderRequest *req = renderThreads[i].curReq;
+        if (req && req->pageNo == pageNo && req->dm == dm && req->tile == tile && !req->preview)
+            return GetTickCount() - req->timestamp;
+    }
 
     for (int i = 0; i < requestCount; i++)
-        if (requests[i].pageNo == pageNo && requests[i].dm == dm && requests[i].tile == tile)
+        if (requests[i].pageNo == pageNo && requests[i].dm == dm && requests[i].tile == tile && !requests[i].preview)
             return GetTickCount() - requests[i].timestamp;
 
     return RENDER_DELAY_UNDEFINED;
 }
 
-bool RenderCache::GetNextRequest(PageRenderRequest *req)
+void RenderCache::StartRenderThreads()
 {
     ScopedCritSec scope(&requestAccess);
+    if (renderThreadCount > 0)
+        return;
+
+    int count = gGlobalPrefs->fixedPageUI.renderThreads;
+    if (count <= 0) {
+        SYSTEM_INFO si;
+        GetSystemInfo(&si);
+        count = std::min((int)si.dwNumberOfProcessors, 4);
+    }
+    count = limitValue(count, 1, MAX_RENDER_THREADS);
+
+    for (int i = 0; i < count; i++) {
+        RenderThreadInfo *thread = &renderThreads[renderThreadCount];
+        thread->cache = this;
+        thread->curReq = nullptr;
+        thread->hThread = CreateThread(nullptr, 0, RenderCacheThread, thread, 0, 0);
+        assert(nullptr != thread->hThread);
+        if (thread->hThread)
+            renderThreadCount++;
+    }
+}
 
-    if (requestCount == 0)
+// engines which can't render several pages at once only get one thread at a time
+// (so that the other threads remain available for other documents)
+bool RenderCache::IsEngineBusy(BaseEngine *engine)
+{
+    ScopedCritSec scope(&requestAccess);
+    if (engine->AllowsConcurrentRendering())
         return false;
+    for (int i = 0; i < renderThreadCount; i++) {
+        PageRenderRequest *req = renderThreads[i].curReq;
+        if (req && req->dm->GetEngine() == engine)
+            return true;
+    }
+    return false;
+}
+
+bool RenderCache::IsRendering(DisplayModel *dm)
+{
+    ScopedCritSec scope(&requestAccess);
+    for (int i = 0; i < renderThreadCount; i++) {
+        if (renderThreads[i].curReq && renderThreads[i].curReq->dm == dm)
+            return true;
+    }
+    return false;
+}
+
+// picks the most recently added request of the highest priority
+// that can be rendered right away
+bool RenderCache::GetNextRequest(PageRenderRequest *req, RenderThreadInfo *thread)
+{
+    ScopedCritSec scope(&requestAccess);
 
-    assert(requestCount > 0);
     assert(requestCount <= MAX_PAGE_REQUESTS);
+    int next = -1;
+    for (int i = requestCount - 1; i >= 0; i--) {
+        if (next != -1 && requests[i].priority >= requests[next].priority)
+            continue;
+        if (!IsEngineBusy(requests[i].dm->GetEngine()))
+            next = i;
+    }
+    if (-1 == next)
+        return false;
+
+    *req = requests[next];
     requestCount--;
-    *req = requests[requestCount];
-    curReq = req;
+    memmove(&(requests[next]), &(requests[next + 1]), sizeof(PageRenderRequest) * (requestCount - next));
+    thread->curReq = req;
     assert(requestCount >= 0);
     assert(!req->abort);
 
+    // wake up another thread for the remaining requests
+    if (requestCount > 0)
+        SetEvent(startRendering);
+
     return true;
 }
 
-bool RenderCache::ClearCurrentRequest()
+void RenderCache::ClearCurrentRequest(RenderThreadInfo *thread)
 {
     ScopedCritSec scope(&requestAccess);
-    if (curReq)
-        delete curReq->abortCookie;
-    curReq = nullptr;
+    if (!thread->curReq)
+        return;
+    delete thread->curReq->abortCookie;
+    thread->curReq = nullptr;
 
-    bool isQueueEmpty = requestCount == 0;
-    return isQueueEmpty;
+    // requests might have been waiting for this thread's engine to become available
+    if (requestCount > 0)
+        SetEvent(startRendering);
 }
 
 /* Wait until rendering of a page beloging to <dm> has finished. */
@@ -512,14 +776,14 @@ void RenderCache::CancelRendering(DisplayModel *dm)
 
     for (;;) {
         EnterCriticalSection(&requestAccess);
-        if (!curReq || (curReq->dm != dm)) {
+        if (!IsRendering(dm)) {
             // to be on the safe side
             ClearQueueForDisplayModel(dm);
             LeaveCriticalSection(&requestAccess);
             return;
         }
 
-        AbortCurrentRequest();
+        AbortRequests(dm);
         LeaveCriticalSection(&requestAccess);
 
         /* TODO: busy loop is not good, but I don't have a better idea */
@@ -535,7 +799,7 @@ void RenderCache::ClearQueueForDisplayModel(DisplayModel *dm, int pageNo, TilePo
     for (int i = 0; i < reqCount; i++) {
         PageRenderRequest *req = &(requests[i]);
         bool shouldRemove = req->dm == dm && (pageNo == INVALID_PAGE_NO || req->pageNo == pageNo) &&
-            (!tile || req->tile.res != tile->res || !IsTileVisible(dm, req->pageNo, *tile, 0.5));
+            (!tile || !req->preview && (req->tile.res != tile->res || !IsTileVisible(dm, req->pageNo, *tile, 0.5)));
         if (i != curPos)
             requests[curPos] = requests[i];
         if (shouldRemove) {
@@ -547,33 +811,37 @@ void RenderCache::ClearQueueForDisplayModel(DisplayModel *dm, int pageNo, TilePo
     }
 }
 
-void RenderCache::AbortCurrentRequest()
+// aborts the requests currently being rendered for <dm> (or for all
+// DisplayModels), optionally only those for <pageNo> and <tile>
+void RenderCache::AbortRequests(DisplayModel *dm, int pageNo, TilePosition *tile)
 {
     ScopedCritSec scope(&requestAccess);
-    if (!curReq)
-        return;
-    if (curReq->abortCookie)
-        curReq->abortCookie->Abort();
-    curReq->abort = true;
+    for (int i = 0; i < renderThreadCount; i++) {
+        PageRenderRequest *req = renderThreads[i].curReq;
+        if (!req || (dm && req->dm != dm))
+            continue;
+        if ((pageNo != INVALID_PAGE_NO && req->pageNo != pageNo) || (tile && !(req->tile == *tile)))
+            continue;
+        if (req->abortCookie)
+            req->abortCookie->Abort();
+        req->abort = true;
+    }
 }
 
 DWORD WINAPI RenderCache::RenderCacheThread(LPVOID data)
 {
-    RenderCache *cache = (RenderCache *)data;
+    RenderThreadInfo *thread = (RenderThreadInfo *)data;
+    RenderCache *cache = thread->cache;
     PageRenderRequest   req;
     RenderedBitmap *    bmp;
 
     for (;;) {
-        if (cache->ClearCurrentRequest()) {
-            DWORD waitResult = WaitForSingleObject(cache->startRendering, INFINITE);
-            // Is it not a page render request?
-            if (WAIT_OBJECT_0 != waitResult)
-                continue;
-        }
-
-        if (!cache->GetNextRequest(&req))
+        cache->ClearCurrentRequest(thread);
+        if (!cache->GetNextRequest(&req, thread)) {
+            WaitForSingleObject(cache->startRendering, INFINITE);
             continue;
-        if (!req.dm->PageVisibleNearby(req.pageNo) && !req.renderCb)
+        }
+        if (!req.dm->PageVisibleNearby(req.pageNo) && !req.renderCb && req.priority != Priority_Prefetch)
             continue;
         if (req.dm->dontRenderFlag) {
             if (req.renderCb)
@@ -584,11 +852,15 @@ DWORD WINAPI RenderCache::RenderCacheThread(LPVOID data)
         // make sure that we have extracted page text for
         // all rendered pages to allow text selection and
         // searching without any further delays
-        if (!req.dm->textCache->HasData(req.pageNo))
+        // (previews should be displayed as soon as possible, though)
+        if (!req.preview && !req.dm->textCache->HasData(req.pageNo))
             req.dm->textCache->GetData(req.pageNo);
 
         CrashIf(req.abortCookie != nullptr);
-        bmp = req.dm->GetEngine()->RenderBitmap(req.pageNo, req.zoom, req.rotation, &req.pageRect, Target_View, &req.abortCookie);
+        if (req.preview)
+            bmp = req.dm->GetEngine()->RenderPreviewBitmap(req.pageNo, req.zoom, req.rotation, &req.pageRect, &req.abortCookie);
+        else
+            bmp = req.dm->GetEngine()->RenderBitmap(req.pageNo, req.zoom, req.rotation, &req.pageRect, Target_View, &req.abortCookie);
         if (req.abort) {
             delete bmp;
             if (req.renderCb)
@@ -620,6 +892,13 @@ UINT RenderCache::PaintTile(HDC hdc, RectI bounds, DisplayModel *dm, int pageNo,
     BitmapCacheEntry *entry = Find(dm, pageNo, dm->GetRotation(), dm->GetZoomReal(), &tile);
     UINT renderDelay = 0;
 
+    EnterCriticalSection(&cacheAccess);
+    if (entry)
+        stats.hits++;
+    else
+        stats.misses++;
+    LeaveCriticalSection(&cacheAccess);
+
     if (!entry) {
         if (!isRemoteSession) {
             if (renderedReplacement)
@@ -734,6 +1013,11 @@ UINT RenderCache::Paint(HDC hdc, RectI bounds, DisplayModel *dm, int pageNo,
             queue.Sort(cmpTilePosition);
     }
 
+    // display a quick preview while waiting for the tiles at the current zoom level
+    TilePosition previewTile(0, 0, 0);
+    if (neededScaling && !isRemoteSession && !Exists(dm, pageNo, rotation, INVALID_ZOOM, &previewTile))
+        RequestPreview(dm, pageNo);
+
 #ifdef CONSERVE_MEMORY
     if (!neededScaling) {
         if (renderOutOfDateCue)
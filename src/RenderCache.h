@@ -5,10 +5,14 @@
 #define RENDER_DELAY_FAILED    ((UINT)-2)
 #define INVALID_TILE_RES       ((USHORT)-1)
 
-#define MAX_PAGE_REQUESTS 8
-// keep this value reasonably low, else we'll run out of
-// GDI resources/memory when caching many larger bitmaps
-#define MAX_BITMAPS_CACHED 64
+#define MAX_PAGE_REQUESTS 32
+// upper limit for FixedPageUI.RenderThreads
+#define MAX_RENDER_THREADS 8
+// the cache is limited by FixedPageUI.BitmapCacheSize; this additionally
+// limits the number of bitmaps so that we don't run out of GDI resources
+#define MAX_BITMAPS_CACHED 256
+// number of buckets for looking up cached bitmaps by page
+#define CACHE_INDEX_SIZE 128
 
 class RenderingCallback {
 public:
@@ -40,14 +44,37 @@ struct BitmapCacheEntry {
 
     // owned by the BitmapCacheEntry
     RenderedBitmap * bitmap;
+    size_t           size; // memory used by bitmap (in bytes)
     bool             outOfDate;
+    // a quickly rendered low resolution bitmap (cf. RenderCache::RequestPreview)
+    bool             isPreview;
     int              refs;
+    // next entry in the same RenderCache::cacheIndex bucket
+    BitmapCacheEntry * nextInIndex;
 
-    BitmapCacheEntry(DisplayModel *dm, int pageNo, int rotation, float zoom, TilePosition tile, RenderedBitmap *bitmap) :
-        dm(dm), pageNo(pageNo), rotation(rotation), zoom(zoom), tile(tile), bitmap(bitmap), outOfDate(false), refs(1) { }
+    BitmapCacheEntry(DisplayModel *dm, int pageNo, int rotation, float zoom, TilePosition tile, RenderedBitmap *bitmap, size_t size) :
+        dm(dm), pageNo(pageNo), rotation(rotation), zoom(zoom), tile(tile), bitmap(bitmap), size(size),
+        outOfDate(false), isPreview(false), refs(1), nextInIndex(nullptr) { }
     ~BitmapCacheEntry() { delete bitmap; }
 };
 
+/* Counters for diagnosing how well the bitmap cache works */
+struct RenderCacheStats {
+    size_t hits;        // tiles painted from a bitmap at the right zoom level
+    size_t misses;      // tiles which had to be (re)rendered before painting
+    size_t evictions;   // bitmaps freed in order to stay within the budget
+    size_t bytesUsed;
+    size_t bitmapCount;
+};
+
+/* Requests for visible tiles are rendered before requests for pages
+   next to the visible ones, which in turn are rendered before prefetched
+   pages (the order matters when choosing which request to drop from a full
+   queue as well) */
+enum RenderPriority {
+    Priority_Visible, Priority_Nearby, Priority_Prefetch
+};
+
 /* Even though this looks a lot like a BitmapCacheEntry, we keep it
    separate for clarity in the code (PageRenderRequests are reused,
    while BitmapCacheEntries are ref-counted) */
@@ -57,6 +84,9 @@ struct PageRenderRequest {
     int                 rotation;
     float               zoom;
     TilePosition        tile;
+    RenderPriority      priority;
+    // whether to render quickly at reduced quality (zoom is reduced as well)
+    bool                preview;
 
     RectD               pageRect; // calculated from TilePosition
     bool                abort;
@@ -67,20 +97,33 @@ struct PageRenderRequest {
     RenderingCallback * renderCb;
 };
 
+class RenderCache;
+
+/* State of one of the threads rendering requests in parallel */
+struct RenderThreadInfo {
+    RenderCache *       cache;
+    HANDLE              hThread;
+    // the request this thread is currently working on (or nullptr)
+    PageRenderRequest * curReq;
+};
+
 class RenderCache
 {
 private:
-    BitmapCacheEntry *  cache[MAX_BITMAPS_CACHED];
-    int                 cacheCount;
+    Vec<BitmapCacheEntry *> cache; // oldest entries first
+    // all entries hashed by DisplayModel and page number
+    BitmapCacheEntry *  cacheIndex[CACHE_INDEX_SIZE];
+    RenderCacheStats    stats;
     // make sure to never ask for requestAccess in a cacheAccess
     // protected critical section in order to avoid deadlocks
     CRITICAL_SECTION    cacheAccess;
 
     PageRenderRequest   requests[MAX_PAGE_REQUESTS];
     int                 requestCount;
-    PageRenderRequest * curReq;
     CRITICAL_SECTION    requestAccess;
-    HANDLE              renderThread;
+    // threads are only started with the first request (after the prefs have been loaded)
+    RenderThreadInfo    renderThreads[MAX_RENDER_THREADS];
+    int                 renderThreadCount;
 
     SizeI               maxTileSize;
     bool                isRemoteSession;
@@ -93,6 +136,8 @@ public:
     ~RenderCache();
 
     void    RequestRendering(DisplayModel *dm, int pageNo);
+    void    RequestPrefetching(DisplayModel *dm, int fromPageNo, int toPageNo);
+    void    CancelPrefetching(DisplayModel *dm);
     void    Render(DisplayModel *dm, int pageNo, int rotation, float zoom,
                    RectD pageRect, RenderingCallback& callback);
     void    CancelRendering(DisplayModel *dm);
@@ -106,13 +151,14 @@ public:
     // painted, 0 if something has been painted and RENDER_DELAY_FAILED on failure
     UINT    Paint(HDC hdc, RectI bounds, DisplayModel *dm, int pageNo,
                   PageInfo *pageInfo, bool *renderOutOfDateCue);
+    RenderCacheStats GetStats();
 
 protected:
-    /* Interface for page rendering thread */
+    /* Interface for page rendering threads */
     HANDLE  startRendering;
 
-    bool    ClearCurrentRequest();
-    bool    GetNextRequest(PageRenderRequest *req);
+    void    ClearCurrentRequest(RenderThreadInfo *thread);
+    bool    GetNextRequest(PageRenderRequest *req, RenderThreadInfo *thread);
     void    Add(PageRenderRequest &req, RenderedBitmap *bitmap);
 
 private:
@@ -122,21 +168,32 @@ private:
 
     bool    IsRenderQueueFull() const { return requestCount == MAX_PAGE_REQUESTS; }
     UINT    GetRenderDelay(DisplayModel *dm, int pageNo, TilePosition tile);
-    void    RequestRendering(DisplayModel *dm, int pageNo, TilePosition tile, bool clearQueueForPage=true);
+    void    RequestRendering(DisplayModel *dm, int pageNo, TilePosition tile, bool clearQueueForPage=true,
+                             RenderPriority priority=Priority_Visible);
+    void    RequestPreview(DisplayModel *dm, int pageNo);
     bool    Render(DisplayModel *dm, int pageNo, int rotation, float zoom,
                    TilePosition *tile=nullptr, RectD *pageRect=nullptr,
-                   RenderingCallback *callback=nullptr);
+                   RenderingCallback *callback=nullptr, RenderPriority priority=Priority_Visible,
+                   bool preview=false);
     void    ClearQueueForDisplayModel(DisplayModel *dm, int pageNo=INVALID_PAGE_NO,
                                       TilePosition *tile=nullptr);
-    void    AbortCurrentRequest();
+    void    AbortRequests(DisplayModel *dm=nullptr, int pageNo=INVALID_PAGE_NO,
+                          TilePosition *tile=nullptr);
+    bool    IsRendering(DisplayModel *dm);
+    bool    IsEngineBusy(BaseEngine *engine);
+    void    StartRenderThreads();
 
     static DWORD WINAPI RenderCacheThread(LPVOID data);
 
     BitmapCacheEntry *  Find(DisplayModel *dm, int pageNo, int rotation,
                              float zoom=INVALID_ZOOM, TilePosition *tile=nullptr);
     void    DropCacheEntry(BitmapCacheEntry *entry);
-    void    FreePage(DisplayModel *dm=nullptr, int pageNo=-1, TilePosition *tile=nullptr);
-    void    FreeNotVisible() { FreePage(); }
+    void    AddToIndex(BitmapCacheEntry *entry);
+    void    RemoveFromIndex(BitmapCacheEntry *entry);
+    void    RemoveEntry(size_t idx);
+    void    FreePage(DisplayModel *dm, int pageNo=-1, TilePosition *tile=nullptr);
+    void    FreeCacheSpace(size_t bytesNeeded, bool forNewEntry);
+    void    FreeNotVisible() { FreeCacheSpace(0, false); }
 
     UINT    PaintTile(HDC hdc, RectI bounds, DisplayModel *dm, int pageNo,
                       TilePosition tile, RectI tileOnScreen, bool renderMissing,
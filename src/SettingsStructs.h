@@ -56,6 +56,15 @@ struct FixedPageUI {
     Vec<COLORREF> * gradientColors;
     // if true, TextColor and BackgroundColor will be temporarily swapped
     bool invertColors;
+    // number of threads rendering pages in the background (if this value
+    // isn't positive, one thread per processor core is used, up to 4)
+    int renderThreads;
+    // maximum amount of memory (in MB) used for caching rendered pages and
+    // tiles (between 16 and 1024)
+    int bitmapCacheSize;
+    // maximum amount of disk space (in MB) used for caching the parsed
+    // content of PDF pages which take long to load (0 disables this cache)
+    int displayListCacheSize;
 };
 
 // customization options for eBooks (EPUB, Mobi, FictionBook) UI. If
@@ -418,14 +427,17 @@ static const FieldInfo gSizeIFields[] = {
 static const StructInfo gSizeIInfo = { sizeof(SizeI), 2, gSizeIFields, "Dx\0Dy" };
 
 static const FieldInfo gFixedPageUIFields[] = {
-    { offsetof(FixedPageUI, textColor),       Type_Color,      0x000000                     },
-    { offsetof(FixedPageUI, backgroundColor), Type_Color,      0xffffff                     },
-    { offsetof(FixedPageUI, selectionColor),  Type_Color,      0x0cfcf5                     },
-    { offsetof(FixedPageUI, windowMargin),    Type_Compact,    (intptr_t)&gWindowMarginInfo },
-    { offsetof(FixedPageUI, pageSpacing),     Type_Compact,    (intptr_t)&gSizeIInfo        },
-    { offsetof(FixedPageUI, gradientColors),  Type_ColorArray, 0                            },
-};
-static const StructInfo gFixedPageUIInfo = { sizeof(FixedPageUI), 6, gFixedPageUIFields, "TextColor\0BackgroundColor\0SelectionColor\0WindowMargin\0PageSpacing\0GradientColors" };
+    { offsetof(FixedPageUI, textColor),            Type_Color,      0x000000                     },
+    { offsetof(FixedPageUI, backgroundColor),      Type_Color,      0xffffff                     },
+    { offsetof(FixedPageUI, selectionColor),       Type_Color,      0x0cfcf5                     },
+    { offsetof(FixedPageUI, windowMargin),         Type_Compact,    (intptr_t)&gWindowMarginInfo },
+    { offsetof(FixedPageUI, pageSpacing),          Type_Compact,    (intptr_t)&gSizeIInfo        },
+    { offsetof(FixedPageUI, gradientColors),       Type_ColorArray, 0                            },
+    { offsetof(FixedPageUI, renderThreads),        Type_Int,        0                            },
+    { offsetof(FixedPageUI, bitmapCacheSize),      Type_Int,        256                          },
+    { offsetof(FixedPageUI, displayListCacheSize), Type_Int,        0                            },
+};
+static const StructInfo gFixedPageUIInfo = { sizeof(FixedPageUI), 9, gFixedPageUIFields, "TextColor\0BackgroundColor\0SelectionColor\0WindowMargin\0PageSpacing\0GradientColors\0RenderThreads\0BitmapCacheSize\0DisplayListCacheSize" };
 
 static const FieldInfo gEbookUIFields[] = {
     { offsetof(EbookUI, fontName),        Type_String, (intptr_t)L"Georgia" },
@@ -1,23 +1,32 @@
 /* Copyright 2014 the SumatraPDF project authors (see AUTHORS file).
    License: GPLv3 */
 
+extern "C" {
+#include <mupdf/fitz.h>
+}
+
 // utils
 #include "BaseUtil.h"
+#include <psapi.h>
 #include "DirIter.h"
 #include "FileUtil.h"
 #include "HtmlParserLookup.h"
 #include "HtmlWindow.h"
 #include "Mui.h"
 #include "SimpleLog.h"
+#include "ThreadUtil.h"
 #include "Timer.h"
 #include "WinUtil.h"
 // rendering engines
 #include "BaseEngine.h"
 #include "EngineManager.h"
+#include "ImagesEngine.h"
 #include "EbookBase.h"
+#include "MobiDoc.h"
 #include "HtmlFormatter.h"
 #include "EbookFormatter.h"
 #include "Doc.h"
+#include "PdfEngine.h"
 // layout controllers
 #include "SettingsStructs.h"
 #include "Controller.h"
@@ -128,6 +137,307 @@ static void BenchLoadRender(BaseEngine *engine, int pagenum)
     logbench(L"pagerender %3d: %.2f ms", pagenum, timeMs);
 }
 
+class BenchRenderThread : public ThreadBase {
+    BaseEngine *engine;
+    Vec<int> *pages;
+    LONG *nextIdx;
+
+public:
+    BenchRenderThread(BaseEngine *engine, Vec<int> *pages, LONG *nextIdx) :
+        ThreadBase("BenchRenderThread"), engine(engine), pages(pages), nextIdx(nextIdx) { }
+
+    virtual void Run() override {
+        for (;;) {
+            size_t idx = (size_t)InterlockedIncrement(nextIdx) - 1;
+            if (idx >= pages->Count())
+                break;
+            delete engine->RenderBitmap(pages->At(idx), 1.0, 0);
+        }
+    }
+};
+
+// renders all pages with 1 to (number of cores) threads sharing the same
+// engine, so that the scaling of concurrent rendering can be measured
+static void BenchRenderThroughput(BaseEngine *engine, Vec<int>& pages)
+{
+    if (pages.Count() == 0)
+        return;
+
+    SYSTEM_INFO si;
+    GetSystemInfo(&si);
+    int maxThreads = std::max((int)si.dwNumberOfProcessors, 1);
+
+    for (int threadCount = 1; threadCount <= maxThreads; threadCount *= 2) {
+        if (threadCount * 2 > maxThreads)
+            threadCount = maxThreads;
+        LONG nextIdx = 0;
+        Vec<BenchRenderThread *> threads;
+        Timer t;
+        for (int i = 0; i < threadCount; i++) {
+            threads.Append(new BenchRenderThread(engine, &pages, &nextIdx));
+            threads.Last()->Start();
+        }
+        for (BenchRenderThread *thread : threads) {
+            thread->Join();
+            delete thread;
+        }
+        double timeMs = t.Stop();
+        logbench(L"threads %2d: %.2f pages/sec (%.2f ms)", threadCount, pages.Count() * 1000.0 / timeMs, timeMs);
+    }
+}
+
+// number of points per row and column at which glyphs are hit-tested
+#define BENCH_HIT_TEST_RASTER 32
+
+// compares hit-testing glyphs with a GlyphGrid against testing all
+// glyphs (as done for every mouse move over text)
+static void BenchGlyphHitTest(BaseEngine *engine, Vec<int>& pages)
+{
+    double buildMs = 0, linearMs = 0, gridMs = 0;
+    int queries = 0, mismatches = 0;
+
+    for (int pageNo : pages) {
+        RectI *coords = nullptr;
+        ScopedMem<WCHAR> text(engine->ExtractPageText(pageNo, L"\n", &coords));
+        ScopedMem<RectI> scope(coords);
+        if (!text || !coords)
+            continue;
+        int len = (int)str::Len(text);
+
+        Timer t;
+        GlyphGrid grid(coords, len);
+        buildMs += t.Stop();
+
+        RectD mediabox = engine->PageMediabox(pageNo);
+        Vec<PointD> points;
+        for (int row = 0; row < BENCH_HIT_TEST_RASTER; row++) {
+            for (int col = 0; col < BENCH_HIT_TEST_RASTER; col++) {
+                points.Append(PointD(mediabox.x + mediabox.dx * (col + 0.5) / BENCH_HIT_TEST_RASTER,
+                                     mediabox.y + mediabox.dy * (row + 0.5) / BENCH_HIT_TEST_RASTER));
+            }
+        }
+
+        Vec<int> expected;
+        t.Start();
+        for (PointD& pt : points) {
+            expected.Append(FindClosestGlyphLinear(coords, len, pt.x, pt.y));
+        }
+        linearMs += t.Stop();
+
+        t.Start();
+        for (size_t i = 0; i < points.Count(); i++) {
+            if (grid.FindClosest(coords, len, points.At(i).x, points.At(i).y) != expected.At(i))
+                mismatches++;
+        }
+        gridMs += t.Stop();
+        queries += (int)points.Count();
+    }
+
+    if (0 == queries)
+        return;
+    logbench(L"glyph hit-testing (%d points): linear %.2f ms, grid %.2f ms (built in %.2f ms)",
+             queries, linearMs, gridMs, buildMs);
+    if (mismatches > 0)
+        logbench(L"Error: %d glyph hit-tests differ between linear and grid", mismatches);
+}
+
+static size_t gBenchGlyphCacheSizes[] = { 1 << 20, 4 << 20, 16 << 20 };
+
+// renders the benched pages of a PDF document with different
+// glyph cache budgets (starting with an empty cache each time)
+static void BenchGlyphCache(BaseEngine *engine, Vec<int>& pages)
+{
+    for (size_t i = 0; i < dimof(gBenchGlyphCacheSizes); i++) {
+        PdfEngine::SetGlyphCacheSize(engine, 0);
+        PdfEngine::SetGlyphCacheSize(engine, gBenchGlyphCacheSizes[i]);
+        int hits, misses, evictions;
+        PdfEngine::GetGlyphCacheStats(engine, &hits, &misses, &evictions);
+        Timer t;
+        for (int pageNo : pages) {
+            delete engine->RenderBitmap(pageNo, 1.0, 0);
+        }
+        double timeMs = t.Stop();
+        int hits2, misses2, evictions2;
+        PdfEngine::GetGlyphCacheStats(engine, &hits2, &misses2, &evictions2);
+        logbench(L"glyph cache %d kB: %.2f ms (%d hits, %d misses, %d evictions)", (int)(gBenchGlyphCacheSizes[i] >> 10),
+                 timeMs, hits2 - hits, misses2 - misses, evictions2 - evictions);
+    }
+}
+
+// minimal replacement for the UI, rendering through gRenderCache
+class BenchControllerCallback : public ControllerCallback {
+public:
+    DisplayModel *dm;
+
+    BenchControllerCallback() : dm(nullptr) { }
+
+    virtual void PageNoChanged(int pageNo) { }
+    virtual void GotoLink(PageDestination *dest) { }
+    virtual void Repaint() { }
+    virtual void UpdateScrollbars(SizeI canvas) { }
+    virtual void RequestRendering(int pageNo) {
+        if (dm && dm->ShouldCacheRendering(pageNo))
+            gRenderCache.RequestRendering(dm, pageNo);
+    }
+    virtual void RequestPrefetching(int fromPageNo, int toPageNo) {
+        if (dm)
+            gRenderCache.RequestPrefetching(dm, fromPageNo, toPageNo);
+    }
+    virtual void CancelPrefetching() {
+        if (dm)
+            gRenderCache.CancelPrefetching(dm);
+    }
+    virtual void CleanUp(DisplayModel *dm) {
+        gRenderCache.CancelRendering(dm);
+        gRenderCache.FreeForDisplayModel(dm);
+    }
+    virtual void RenderThumbnail(DisplayModel *dm, SizeI size, const std::function<void(RenderedBitmap*)>& saveThumbnail) {
+        saveThumbnail(nullptr);
+    }
+    virtual void FocusFrame(bool always) { }
+    virtual void SaveDownload(const WCHAR *url, const unsigned char *data, size_t len) { }
+    virtual void HandleLayoutedPages(EbookController *ctrl, EbookFormattingData *data) { }
+    virtual void RequestDelayedLayout(int delay) { }
+};
+
+// a scroll trace to replay at 60 frames per second: for <frames> frames,
+// the document is scrolled by <dy> pixels per frame
+struct BenchScrollStep {
+    int frames, dy;
+};
+
+static BenchScrollStep gBenchScrollTrace[] = {
+    { 120, 15 },    // reading
+    { 30, 0 },      // pausing
+    { 90, 60 },     // skimming
+    { 60, -40 },    // scrolling back
+    { 30, 0 },
+    { 120, 150 },   // flicking through
+    { 60, -150 },
+};
+
+#define BENCH_FRAME_MS 16
+
+// paints all visible pages of <dm> as the canvas would and returns
+// false if any of them isn't available at the current zoom level yet
+static bool BenchPaintFrame(DisplayModel *dm, HDC hdc)
+{
+    bool complete = true;
+    RectI screen(PointI(), dm->GetViewPort().Size());
+    for (int pageNo = 1; pageNo <= dm->PageCount(); pageNo++) {
+        PageInfo *pageInfo = dm->GetPageInfo(pageNo);
+        if (!pageInfo->shown || 0.0 == pageInfo->visibleRatio || !dm->ShouldCacheRendering(pageNo))
+            continue;
+        RectI bounds = pageInfo->pageOnScreen.Intersect(screen);
+        bool renderOutOfDateCue = false;
+        gRenderCache.Paint(hdc, bounds, dm, pageNo, pageInfo, &renderOutOfDateCue);
+        if (!gRenderCache.Exists(dm, pageNo, dm->GetRotation(), dm->GetZoomReal(pageNo)))
+            complete = false;
+    }
+    return complete;
+}
+
+// replays gBenchScrollTrace and reports how often the user would have
+// seen placeholders instead of fully rendered pages
+static void BenchScrollTrace(const WCHAR *filePath)
+{
+    EngineType engineType;
+    BaseEngine *engine = EngineManager::CreateEngine(filePath, nullptr, &engineType);
+    if (!engine)
+        return;
+
+    BenchControllerCallback cb;
+    DisplayModel *dm = new DisplayModel(engine, engineType, &cb);
+    cb.dm = dm;
+    dm->SetInitialViewSettings(DM_CONTINUOUS, 1, SizeI(1024, 768), 96);
+    dm->Relayout(ZOOM_FIT_WIDTH, 0);
+    dm->ScrollYTo(0);
+
+    HDC hdcScreen = GetDC(nullptr);
+    HDC hdc = CreateCompatibleDC(hdcScreen);
+    HBITMAP hbmp = CreateCompatibleBitmap(hdcScreen, 1024, 768);
+    ReleaseDC(nullptr, hdcScreen);
+    HGDIOBJ prevBmp = SelectObject(hdc, hbmp);
+
+    RenderCacheStats before = gRenderCache.GetStats();
+    int frames = 0, placeholderFrames = 0;
+    for (size_t i = 0; i < dimof(gBenchScrollTrace); i++) {
+        for (int j = 0; j < gBenchScrollTrace[i].frames; j++) {
+            Timer t;
+            if (gBenchScrollTrace[i].dy != 0)
+                dm->ScrollYBy(gBenchScrollTrace[i].dy, false);
+            if (!BenchPaintFrame(dm, hdc))
+                placeholderFrames++;
+            frames++;
+            double timeMs = t.Stop();
+            if (timeMs < BENCH_FRAME_MS)
+                Sleep(BENCH_FRAME_MS - (DWORD)timeMs);
+        }
+    }
+    RenderCacheStats after = gRenderCache.GetStats();
+
+    SelectObject(hdc, prevBmp);
+    DeleteObject(hbmp);
+    DeleteDC(hdc);
+    delete dm;
+
+    logbench(L"scroll trace: %d of %d frames with placeholders (%.1f%%)", placeholderFrames, frames, placeholderFrames * 100.0 / frames);
+    logbench(L"scroll trace: %d cache hits, %d misses, %d evictions", (int)(after.hits - before.hits),
+             (int)(after.misses - before.misses), (int)(after.evictions - before.evictions));
+}
+
+// give up waiting for the first page after this many ms
+#define BENCH_FIRST_PIXEL_TIMEOUT_MS 60000
+// reading speed of a slow network share
+#define BENCH_THROTTLE_BYTES_PER_SEC (4 * 1024 * 1024)
+
+// measures how long it takes from opening a document until the first
+// screen has been painted completely (as it would in the UI) and until
+// the document's outline is available
+static void BenchTimeToFirstPixel(const WCHAR *filePath, const WCHAR *variant=L"")
+{
+    Timer t;
+    EngineType engineType;
+    BaseEngine *engine = EngineManager::CreateEngine(filePath, nullptr, &engineType);
+    if (!engine)
+        return;
+    double loadMs = t.GetTimeInMs();
+
+    BenchControllerCallback cb;
+    DisplayModel *dm = new DisplayModel(engine, engineType, &cb);
+    cb.dm = dm;
+    dm->SetInitialViewSettings(DM_CONTINUOUS, 1, SizeI(1024, 768), 96);
+    dm->Relayout(ZOOM_FIT_WIDTH, 0);
+    dm->ScrollYTo(0);
+    double layoutMs = t.GetTimeInMs();
+
+    HDC hdcScreen = GetDC(nullptr);
+    HDC hdc = CreateCompatibleDC(hdcScreen);
+    HBITMAP hbmp = CreateCompatibleBitmap(hdcScreen, 1024, 768);
+    ReleaseDC(nullptr, hdcScreen);
+    HGDIOBJ prevBmp = SelectObject(hdc, hbmp);
+
+    bool complete;
+    while (!(complete = BenchPaintFrame(dm, hdc)) && t.GetTimeInMs() < BENCH_FIRST_PIXEL_TIMEOUT_MS) {
+        Sleep(1);
+    }
+    double firstPixelMs = t.GetTimeInMs();
+    engine->HasTocTree();
+    double tocMs = t.Stop();
+
+    SelectObject(hdc, prevBmp);
+    DeleteObject(hbmp);
+    DeleteDC(hdc);
+    delete dm;
+
+    if (!complete) {
+        logbench(L"Error: first page not rendered within %d ms%s", BENCH_FIRST_PIXEL_TIMEOUT_MS, variant);
+        return;
+    }
+    logbench(L"time to first pixel%s: %.2f ms (load: %.2f ms, layout: %.2f ms)", variant, firstPixelMs, loadMs, layoutMs - loadMs);
+    logbench(L"time to outline%s: %.2f ms", variant, tocMs);
+}
+
 // <s> can be:
 // * "loadonly"
 // * description of page ranges e.g. "1", "1-5", "2-3,6,8-10"
@@ -156,10 +466,13 @@ static int FormatWholeDoc(Doc& doc) {
 
 static int TimeOneMethod(Doc&doc, TextRenderMethod method, const WCHAR *methodName) {
     SetTextRenderMethod(method);
+    int measureCount, cacheHits;
+    GetTextMeasureStats(&measureCount, &cacheHits);
     Timer t;
     int nPages = FormatWholeDoc(doc);
     double timesms = t.Stop();
-    logbench(L"%s: %.2f ms", methodName, timesms);
+    GetTextMeasureStats(&measureCount, &cacheHits);
+    logbench(L"%s: %.2f ms (%d measurements, %d from cache)", methodName, timesms, measureCount, cacheHits);
     return nPages;
 }
 
@@ -191,6 +504,7 @@ void BenchEbookLayout(const WCHAR *filePath) {
     double timeMs = t.Stop();
     logbench(L"load: %.2f ms", timeMs);
 
+    EnableTextMeasureCache(false);
     int nPages = TimeOneMethod(doc, TextRenderMethodGdi,          L"gdi       ");
     TimeOneMethod(doc, TextRenderMethodGdiplus,      L"gdi+      ");
     TimeOneMethod(doc, TextRenderMethodGdiplusQuick, L"gdi+ quick");
@@ -201,6 +515,17 @@ void BenchEbookLayout(const WCHAR *filePath) {
     TimeOneMethod(doc, TextRenderMethodGdiplus,      L"gdi+      ");
     TimeOneMethod(doc, TextRenderMethodGdiplusQuick, L"gdi+ quick");
 
+    // the first run per method fills the measurement cache, the second one
+    // corresponds to reflowing a document that has been laid out before
+    EnableTextMeasureCache(true);
+    logbench(L"with measurement cache:");
+    TimeOneMethod(doc, TextRenderMethodGdi,          L"gdi       ");
+    TimeOneMethod(doc, TextRenderMethodGdiplus,      L"gdi+      ");
+    TimeOneMethod(doc, TextRenderMethodGdiplusQuick, L"gdi+ quick");
+    TimeOneMethod(doc, TextRenderMethodGdi,          L"gdi       ");
+    TimeOneMethod(doc, TextRenderMethodGdiplus,      L"gdi+      ");
+    TimeOneMethod(doc, TextRenderMethodGdiplusQuick, L"gdi+ quick");
+
     doc.Delete();
 
     logbench(L"pages: %d", nPages);
@@ -230,12 +555,145 @@ static void BenchChmLoadOnly(const WCHAR *filePath)
     logbench(L"Finished (in %.2f ms): %s", total.GetTimeInMs(), filePath);
 }
 
+// compares decompressing the text of a MOBI document (PalmDoc or HuffDic)
+// on a single thread and on several threads at once (and for HuffDic also
+// validates the table-driven decoder against the reference decoder)
+static void BenchMobiDecompression(const WCHAR *filePath)
+{
+    MobiDoc *doc = MobiDoc::CreateFromFile(filePath);
+    if (!doc) {
+        logbench(L"Error: failed to load %s", filePath);
+        return;
+    }
+    SYSTEM_INFO si;
+    GetSystemInfo(&si);
+    int maxThreads = std::max((int)si.dwNumberOfProcessors, 1);
+    for (int threadCount = 1; threadCount <= maxThreads; threadCount *= 2) {
+        if (threadCount * 2 > maxThreads)
+            threadCount = maxThreads;
+        size_t size;
+        double timeMs = doc->BenchDecompress(threadCount, &size);
+        if (timeMs < 0) {
+            logbench(L"Error: failed to decompress %s", filePath);
+            break;
+        }
+        logbench(L"decompression threads %2d: %.2f ms (%.1f MB/sec)", threadCount, timeMs,
+                 size / 1024.0 / 1024.0 * 1000.0 / std::max(timeMs, 0.001));
+    }
+    if (doc->IsHuffDicCompressed()) {
+        double refTimeMs, tablesTimeMs;
+        if (doc->BenchHuffDicDecoders(&refTimeMs, &tablesTimeMs))
+            logbench(L"HuffDic reference decoder: %.2f ms, table-driven decoder: %.2f ms", refTimeMs, tablesTimeMs);
+        else
+            logbench(L"Error: HuffDic decoders differ for %s", filePath);
+    }
+    delete doc;
+}
+
+typedef BOOL (WINAPI *GetProcessMemoryInfoProc)(HANDLE, PPROCESS_MEMORY_COUNTERS, DWORD);
+
+static bool GetMemoryCounters(PROCESS_MEMORY_COUNTERS *pmc)
+{
+    static GetProcessMemoryInfoProc _GetProcessMemoryInfo = nullptr;
+    if (!_GetProcessMemoryInfo)
+        _GetProcessMemoryInfo = (GetProcessMemoryInfoProc)LoadDllFunc(L"psapi.dll", "GetProcessMemoryInfo");
+    ZeroMemory(pmc, sizeof(*pmc));
+    return _GetProcessMemoryInfo && _GetProcessMemoryInfo(GetCurrentProcess(), pmc, sizeof(*pmc));
+}
+
+// returns the largest working set of the process so far in kB (or 0 if unknown)
+static size_t GetPeakWorkingSetKB()
+{
+    PROCESS_MEMORY_COUNTERS pmc;
+    if (!GetMemoryCounters(&pmc))
+        return 0;
+    return pmc.PeakWorkingSetSize / 1024;
+}
+
+// returns the current working set of the process in kB (or 0 if unknown)
+static size_t GetWorkingSetKB()
+{
+    PROCESS_MEMORY_COUNTERS pmc;
+    if (!GetMemoryCounters(&pmc))
+        return 0;
+    return pmc.WorkingSetSize / 1024;
+}
+
+// zoom levels at which images are decoded at reduced resolution (or not at all)
+static float gBenchZoomLevels[] = { 0.15f, 0.5f, 1.0f };
+#define BENCH_ZOOM_MAX_PAGES 10
+
+// measures how rendering time and memory depend on the zoom level, mostly
+// for image heavy documents (which don't have to decode images at full
+// resolution when zoomed out); every zoom level starts with a new engine
+// so that no decoded images are cached
+static void BenchZoomLevels(const WCHAR *filePath, Vec<int>& pages)
+{
+    size_t count = std::min(pages.Count(), (size_t)BENCH_ZOOM_MAX_PAGES);
+    for (size_t i = 0; i < dimof(gBenchZoomLevels); i++) {
+        BaseEngine *engine = EngineManager::CreateEngine(filePath);
+        if (!engine) {
+            logbench(L"Error: failed to load %s", filePath);
+            return;
+        }
+        size_t startKB = GetWorkingSetKB();
+        Timer t;
+        for (size_t j = 0; j < count; j++) {
+            delete engine->RenderBitmap(pages.At(j), gBenchZoomLevels[i], 0);
+        }
+        double timeMs = t.Stop();
+        int growthKB = (int)(GetWorkingSetKB() - startKB);
+        delete engine;
+        logbench(L"zoom %d%%: %.2f ms, working set %+d kB (%d pages)", (int)(gBenchZoomLevels[i] * 100 + 0.5f), timeMs, growthKB, (int)count);
+    }
+}
+
+// number of pages turned and time spent "reading" each page
+#define BENCH_PAGE_TURNS        20
+#define BENCH_PAGE_TURN_READ_MS 250
+
+static void BenchPageTurnsWith(const WCHAR *filePath, bool readAhead)
+{
+    CbxEngine::DebugDisableReadAhead(!readAhead);
+    BaseEngine *engine = CbxEngine::CreateFromFile(filePath);
+    if (!engine) {
+        logbench(L"Error: failed to load %s", filePath);
+        CbxEngine::DebugDisableReadAhead(false);
+        return;
+    }
+    int pages = std::min(engine->PageCount(), BENCH_PAGE_TURNS);
+    double totalMs = 0, maxMs = 0;
+    for (int pageNo = 1; pageNo <= pages; pageNo++) {
+        Timer t;
+        delete engine->RenderBitmap(pageNo, 0.5f, 0);
+        double timeMs = t.Stop();
+        totalMs += timeMs;
+        maxMs = std::max(maxMs, timeMs);
+        Sleep(BENCH_PAGE_TURN_READ_MS);
+    }
+    delete engine;
+    CbxEngine::DebugDisableReadAhead(false);
+    if (pages > 0)
+        logbench(L"page turns%s: %.2f ms average, %.2f ms max (%d pages)", readAhead ? L"" : L" (no read-ahead)", totalMs / pages, maxMs, pages);
+}
+
+// measures how long turning to the next page of a comic book takes
+// (when the user spends some time on each page)
+static void BenchPageTurns(const WCHAR *filePath)
+{
+    BenchPageTurnsWith(filePath, false);
+    BenchPageTurnsWith(filePath, true);
+}
+
 static void BenchFile(const WCHAR *filePath, const WCHAR *pagesSpec)
 {
     if (!file::Exists(filePath)) {
         return;
     }
 
+    if (MobiDoc::IsSupportedFile(filePath))
+        BenchMobiDecompression(filePath);
+
     // ad-hoc: if enabled times layout instead of rendering and does layout
     // using all text rendering methods, so that we can compare and find
     // docs that take a long time to load
@@ -254,7 +712,8 @@ static void BenchFile(const WCHAR *filePath, const WCHAR *pagesSpec)
     logbench(L"Starting: %s", filePath);
 
     Timer t;
-    BaseEngine *engine = EngineManager::CreateEngine(filePath);
+    EngineType engineType;
+    BaseEngine *engine = EngineManager::CreateEngine(filePath, nullptr, &engineType);
     if (!engine) {
         logbench(L"Error: failed to load %s", filePath);
         return;
@@ -262,12 +721,23 @@ static void BenchFile(const WCHAR *filePath, const WCHAR *pagesSpec)
 
     double timeMs = t.Stop();
     logbench(L"load: %.2f ms", timeMs);
+    // engines laying out their pages in the background can show the first pages earlier
+    Timer layout;
+    if (engine->UpdatePageCount()) {
+        logbench(L"first pages: %d", engine->PageCount());
+        engine->UpdatePageCount(INT_MAX);
+        logbench(L"background layout: %.2f ms", layout.Stop());
+    }
     int pages = engine->PageCount();
     logbench(L"page count: %d", pages);
+    // note: this is the peak for the whole process (i.e. for all files benched so far)
+    logbench(L"peak working set: %d kB", (int)GetPeakWorkingSetKB());
 
+    Vec<int> benchedPages;
     if (nullptr == pagesSpec) {
         for (int i = 1; i <= pages; i++) {
             BenchLoadRender(engine, i);
+            benchedPages.Append(i);
         }
     }
 
@@ -276,13 +746,32 @@ static void BenchFile(const WCHAR *filePath, const WCHAR *pagesSpec)
     if (ParsePageRanges(pagesSpec, ranges)) {
         for (size_t i = 0; i < ranges.Count(); i++) {
             for (int j = ranges.At(i).start; j <= ranges.At(i).end; j++) {
-                if (1 <= j && j <= pages)
+                if (1 <= j && j <= pages) {
                     BenchLoadRender(engine, j);
+                    benchedPages.Append(j);
+                }
             }
         }
     }
 
+    BenchRenderThroughput(engine, benchedPages);
+    BenchGlyphHitTest(engine, benchedPages);
+    if (Engine_PDF == engineType)
+        BenchGlyphCache(engine, benchedPages);
+
     delete engine;
+    BenchZoomLevels(filePath, benchedPages);
+    BenchTimeToFirstPixel(filePath);
+    if (PdfEngine::IsSupportedFile(filePath)) {
+        // linearized files should show their first page much sooner
+        // than others when read from a slow network share
+        DebugThrottleFileAccess(BENCH_THROTTLE_BYTES_PER_SEC);
+        BenchTimeToFirstPixel(filePath, L" (throttled)");
+        DebugThrottleFileAccess(0);
+    }
+    BenchScrollTrace(filePath);
+    if (CbxEngine::IsSupportedFile(filePath))
+        BenchPageTurns(filePath);
     total.Stop();
 
     logbench(L"Finished (in %.2f ms): %s", total.GetTimeInMs(), filePath);
@@ -316,10 +805,55 @@ static void BenchDir(WCHAR *dir)
     }
 }
 
+#define BENCH_SPAN_PAINTER_ITERATIONS 20000
+
+// compares mupdf's vectorized span painters against the scalar ones
+static void BenchSpanPainters()
+{
+    fz_context *ctx = fz_new_context(nullptr, nullptr, FZ_STORE_UNLIMITED);
+    if (!ctx)
+        return;
+    fz_span_painter_bench results[32];
+    int count = fz_bench_span_painters(ctx, results, dimof(results), BENCH_SPAN_PAINTER_ITERATIONS);
+    if (0 == count)
+        logbench(L"span painters: no vectorized versions available");
+    for (int i = 0; i < count; i++) {
+        fz_span_painter_bench& r = results[i];
+        logbench(L"span painter %S (%S): scalar %.2f ms, vectorized %.2f ms", r.painter, r.simd, r.scalar_ms, r.simd_ms);
+        if (r.mismatches != 0)
+            logbench(L"Error: %d bytes differ between scalar and vectorized %S (%S)", r.mismatches, r.painter, r.simd);
+    }
+    fz_free_context(ctx);
+}
+
+#define BENCH_SCALE_ITERATIONS 20
+
+static void BenchImageScaling()
+{
+    fz_context *ctx = fz_new_context(nullptr, nullptr, FZ_STORE_UNLIMITED);
+    if (!ctx)
+        return;
+    fz_scale_bench results[16];
+    int count = fz_bench_scale_pixmap(ctx, results, dimof(results), BENCH_SCALE_ITERATIONS);
+    for (int i = 0; i < count; i++) {
+        fz_scale_bench& r = results[i];
+        double mpixels = (double)r.src_w * r.src_h * BENCH_SCALE_ITERATIONS / 1000000;
+        logbench(L"image scaling n=%d %dx%d -> %dx%d (%S): reference %.1f Mpixel/s, %S %.1f Mpixel/s",
+                 r.n, r.src_w, r.src_h, r.dst_w, r.dst_h, r.method,
+                 mpixels * 1000 / r.reference_ms, r.method, mpixels * 1000 / r.method_ms);
+        if (r.mismatches != 0)
+            logbench(L"Error: %d bytes differ between scalar and %S image scaling (n=%d)", r.mismatches, r.method, r.n);
+    }
+    fz_free_context(ctx);
+}
+
 void BenchFileOrDir(WStrVec& pathsToBench)
 {
     gLog = new slog::StderrLogger();
 
+    BenchSpanPainters();
+    BenchImageScaling();
+
     size_t n = pathsToBench.Count() / 2;
     for (size_t i = 0; i < n; i++) {
         WCHAR *path = pathsToBench.At(2 * i);
@@ -639,7 +1173,9 @@ void StressTest::Finished(bool success)
     if (success) {
         int secs = SecsSinceSystemTime(stressStartTime);
         ScopedMem<WCHAR> tm(FormatTime(secs));
-        ScopedMem<WCHAR> s(str::Format(L"Stress test complete, rendered %d files in %s", filesCount, tm));
+        RenderCacheStats stats = gRenderCache.GetStats();
+        ScopedMem<WCHAR> s(str::Format(L"Stress test complete, rendered %d files in %s (bitmap cache: %d hits, %d misses, %d evictions)",
+                                       filesCount, tm, (int)stats.hits, (int)stats.misses, (int)stats.evictions));
         win->ShowNotification(s, NOS_PERSIST, NG_STRESS_TEST_SUMMARY);
     }
 
@@ -649,6 +649,8 @@ public:
     virtual void PageNoChanged(int pageNo);
     virtual void UpdateScrollbars(SizeI canvas);
     virtual void RequestRendering(int pageNo);
+    virtual void RequestPrefetching(int fromPageNo, int toPageNo);
+    virtual void CancelPrefetching();
     virtual void CleanUp(DisplayModel *dm);
     virtual void RenderThumbnail(DisplayModel *dm, SizeI size, const std::function<void(RenderedBitmap*)>&);
     virtual void GotoLink(PageDestination *dest) { win->linkHandler->GotoLink(dest); }
@@ -717,6 +719,22 @@ void ControllerCallbackHandler::RequestRendering(int pageNo)
         gRenderCache.RequestRendering(dm, pageNo);
 }
 
+void ControllerCallbackHandler::RequestPrefetching(int fromPageNo, int toPageNo)
+{
+    CrashIf(!win->AsFixed());
+    if (!win->AsFixed()) return;
+
+    gRenderCache.RequestPrefetching(win->AsFixed(), fromPageNo, toPageNo);
+}
+
+void ControllerCallbackHandler::CancelPrefetching()
+{
+    CrashIf(!win->AsFixed());
+    if (!win->AsFixed()) return;
+
+    gRenderCache.CancelPrefetching(win->AsFixed());
+}
+
 void ControllerCallbackHandler::CleanUp(DisplayModel *dm)
 {
     gRenderCache.CancelRendering(dm);
@@ -1074,6 +1092,10 @@ static bool LoadDocIntoCurrentTab(LoadArgs& args, PasswordUI *pwdUI, DisplayStat
     else if (win->IsDocLoaded())
         win->ctrl->SetZoomVirtual(zoomVirtual);
 
+    // ebooks are laid out in the background, so periodically add the new pages
+    if (win->AsFixed() && win->AsFixed()->UpdatePageCount())
+        SetTimer(win->hwndCanvas, PAGE_COUNT_TIMER_ID, PAGE_COUNT_UPDATE_DELAY_IN_MS, nullptr);
+
     // TODO: why is this needed?
     if (!args.isNewWindow && win->IsDocLoaded())
         win->RedrawAll();
@@ -1611,6 +1633,8 @@ void LoadModelIntoTab(WindowInfo *win, TabInfo *tdata)
         dm->SetScrollState(dm->GetScrollState());
         if (dm->GetPresentationMode() != (win->presentation != PM_DISABLED))
             dm->SetPresentationMode(!dm->GetPresentationMode());
+        // continue adding pages laid out in the background (if there are any)
+        SetTimer(win->hwndCanvas, PAGE_COUNT_TIMER_ID, PAGE_COUNT_UPDATE_DELAY_IN_MS, nullptr);
     }
     else if (win->AsChm()) {
         win->ctrl->GoToPage(win->ctrl->CurrentPageNo(), false);
@@ -44,6 +44,9 @@
 
 #define EBOOK_LAYOUT_TIMER_ID       7
 
+#define PAGE_COUNT_TIMER_ID         8
+#define PAGE_COUNT_UPDATE_DELAY_IN_MS 500
+
 // permissions that can be revoked through sumatrapdfrestrict.ini or the -restrict command line flag
 enum {
     // enables Update checks, crash report submitting and hyperlinks
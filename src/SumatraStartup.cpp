@@ -26,10 +26,12 @@
 #include "BaseEngine.h"
 #include "PdfEngine.h"
 #include "EngineManager.h"
+#include "Doc.h"
 // layout controllers
 #include "SettingsStructs.h"
 #include "Controller.h"
 #include "DisplayModel.h"
+#include "EbookController.h"
 #include "FileHistory.h"
 #include "GlobalPrefs.h"
 #include "PdfSync.h"
@@ -647,6 +649,16 @@ int APIENTRY WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, LPSTR lpCmdLi
     SetCurrentLang(i.lang ? i.lang : gGlobalPrefs->uiLanguage);
     InitializePolicies(i.restrictedUse);
 
+    if (gGlobalPrefs->fixedPageUI.displayListCacheSize > 0 &&
+        HasPermission(Perm_DiskAccess) && HasPermission(Perm_SavePreferences)) {
+        ScopedMem<WCHAR> cacheDir(AppGenDataFilename(L"sumatrapdfcache\\displaylists"));
+        PdfEngine::SetDisplayListCache(cacheDir, (size_t)gGlobalPrefs->fixedPageUI.displayListCacheSize * 1024 * 1024);
+    }
+    if (HasPermission(Perm_DiskAccess) && HasPermission(Perm_SavePreferences)) {
+        ScopedMem<WCHAR> cacheDir(AppGenDataFilename(L"sumatrapdfcache\\layouts"));
+        SetEbookLayoutCacheDir(cacheDir);
+    }
+
     // This allows ad-hoc comparison of gdi, gdi+ and gdi+ quick when used
     // in layout
 #if 0
@@ -11,9 +11,6 @@
 enum { SEARCH_PAGE, SKIP_PAGE };
 
 #define SkipWhitespace(c) for (; str::IsWs(*(c)); (c)++)
-// ignore spaces between CJK glyphs but not between Latin, Greek, Cyrillic, etc. letters
-// cf. http://code.google.com/p/sumatrapdf/issues/detail?id=959
-#define isnoncjkwordchar(c) (isWordChar(c) && (unsigned short)(c) < 0x2E80)
 
 TextSearch::TextSearch(BaseEngine *engine, PageTextCache *textCache) :
     TextSelection(engine, textCache),
@@ -22,7 +19,8 @@ TextSearch::TextSearch(BaseEngine *engine, PageTextCache *textCache) :
     matchWordStart(false), matchWordEnd(false),
     findPage(0), findIndex(0), lastText(nullptr)
 {
-    findCache = AllocArray<BYTE>(this->engine->PageCount());
+    findCacheCount = this->engine->PageCount();
+    findCache = AllocArray<BYTE>(findCacheCount);
 }
 
 TextSearch::~TextSearch()
@@ -89,6 +87,18 @@ void TextSearch::SetSensitive(bool sensitive)
     memset(this->findCache, SEARCH_PAGE, this->engine->PageCount());
 }
 
+void TextSearch::UpdatePageCount()
+{
+    // only the new pages have to be searched (SEARCH_PAGE is 0), while
+    // pages already known not to contain findText can still be skipped
+    static_assert(SEARCH_PAGE == 0, "GrowArrayCrash zeroes the new pages");
+    int count = this->engine->PageCount();
+    if (count <= findCacheCount)
+        return;
+    GrowArrayCrash(&this->findCache, findCacheCount, count);
+    findCacheCount = count;
+}
+
 void TextSearch::SetDirection(TextSearchDirection direction)
 {
     bool forward = FIND_FORWARD == direction;
@@ -210,11 +220,13 @@ bool TextSearch::FindStartingAtPage(int pageNo, ProgressUpdateUI *tracker)
         return false;
 
     int total = engine->PageCount();
+    bool indexing = false;
     while (1 <= pageNo && pageNo <= total && (!tracker || !tracker->WasCanceled())) {
         if (tracker)
             tracker->UpdateProgress(pageNo, total);
 
-        if (SKIP_PAGE == findCache[pageNo - 1]) {
+        if (SKIP_PAGE == findCache[pageNo - 1] || !textCache->MightContain(pageNo, findText)) {
+            findCache[pageNo - 1] = SKIP_PAGE;
             pageNo += forward ? 1 : -1;
             continue;
         }
@@ -231,6 +243,12 @@ bool TextSearch::FindStartingAtPage(int pageNo, ProgressUpdateUI *tracker)
         }
 
         pageNo += forward ? 1 : -1;
+        // the search continues beyond a single page, so extract the
+        // remaining pages' text in parallel ahead of the search
+        if (!indexing && 1 <= pageNo && pageNo <= total) {
+            textCache->StartIndexing(pageNo, forward);
+            indexing = true;
+        }
     }
 
     // allow for the first/last page to be included in the next search
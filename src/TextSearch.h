@@ -25,6 +25,8 @@ public:
     void SetLastResult(TextSelection *sel);
     TextSel *FindFirst(int page, const WCHAR *text, ProgressUpdateUI *tracker=nullptr);
     TextSel *FindNext(ProgressUpdateUI *tracker=nullptr);
+    // grows the cache for engines which lay out pages in the background
+    void UpdatePageCount();
 
     // note: the result might not be a valid page number!
     int GetCurrentPageNo() const { return findPage; }
@@ -61,4 +63,5 @@ private:
 
     WCHAR *lastText;
     BYTE *findCache;
+    int findCacheCount;
 };
@@ -3,111 +3,274 @@
 
 // utils
 #include "BaseUtil.h"
+#include "ThreadUtil.h"
 // layout controllers
 #include "BaseEngine.h"
 #include "TextSelection.h"
 
-PageTextCache::PageTextCache(BaseEngine *engine) : engine(engine)
+// extracts the text of pages which haven't been extracted yet
+// (ordered by PageTextCache::StartIndexing) using its own engine
+class PageTextIndexer : public ThreadBase {
+    PageTextCache *cache;
+
+public:
+    explicit PageTextIndexer(PageTextCache *cache) : ThreadBase("PageTextIndexer"), cache(cache) { }
+
+    virtual void Run() {
+        // a clone of the engine allows to extract text without
+        // blocking the original engine (used for rendering)
+        BaseEngine *clone = cache->engine->Clone();
+        if (!clone)
+            return;
+        int pageNo;
+        while (!WasCancelRequested() && (pageNo = cache->ClaimPageToIndex()) != 0) {
+            RectI *coords = nullptr;
+            WCHAR *text = clone->ExtractPageText(pageNo, L"\n", &coords);
+            cache->SetData(pageNo, text, coords);
+        }
+        delete clone;
+    }
+};
+
+PageTextCache::PageTextCache(BaseEngine *engine) : engine(engine),
+    pageCount(engine->PageCount()), dataWaiters(0), indexStartPage(1), indexForward(true), indexNext(0)
 {
-    int count = engine->PageCount();
+    int count = pageCount;
     coords = AllocArray<RectI *>(count);
     text = AllocArray<WCHAR *>(count);
     lens = AllocArray<int>(count);
+    ngrams = AllocArray<BYTE *>(count);
+    grids = AllocArray<GlyphGrid *>(count);
+    pending = AllocArray<bool>(count);
 #ifdef DEBUG
-    debug_size = count * (sizeof(RectI *) + sizeof(WCHAR *) + sizeof(int));
+    debug_size = count * (sizeof(RectI *) + sizeof(WCHAR *) + sizeof(int) + sizeof(BYTE *) + sizeof(GlyphGrid *) + sizeof(bool));
 #endif
 
     InitializeCriticalSection(&access);
+    dataStored = CreateEvent(nullptr, TRUE, FALSE, nullptr);
 }
 
 PageTextCache::~PageTextCache()
 {
+    for (PageTextIndexer *indexer : indexers) {
+        indexer->RequestCancel();
+    }
+    for (PageTextIndexer *indexer : indexers) {
+        indexer->Join();
+        delete indexer;
+    }
+
     EnterCriticalSection(&access);
 
-    for (int i = 0; i < engine->PageCount(); i++) {
+    for (int i = 0; i < pageCount; i++) {
         free(coords[i]);
         free(text[i]);
+        free(ngrams[i]);
+        delete grids[i];
     }
 
     free(coords);
     free(text);
     free(lens);
+    free(ngrams);
+    free(grids);
+    free(pending);
 
     LeaveCriticalSection(&access);
     DeleteCriticalSection(&access);
+    CloseHandle(dataStored);
+}
+
+void PageTextCache::UpdatePageCount()
+{
+    ScopedCritSec scope(&access);
+
+    int count = engine->PageCount();
+    if (count <= pageCount)
+        return;
+    GrowArrayCrash(&coords, pageCount, count);
+    GrowArrayCrash(&text, pageCount, count);
+    GrowArrayCrash(&lens, pageCount, count);
+    GrowArrayCrash(&ngrams, pageCount, count);
+    GrowArrayCrash(&grids, pageCount, count);
+    GrowArrayCrash(&pending, pageCount, count);
+#ifdef DEBUG
+    debug_size += (count - pageCount) * (sizeof(RectI *) + sizeof(WCHAR *) + sizeof(int) + sizeof(BYTE *) + sizeof(GlyphGrid *) + sizeof(bool));
+#endif
+    pageCount = count;
+    // let the PageTextIndexers continue with the new pages
+    indexNext = 0;
 }
 
 bool PageTextCache::HasData(int pageNo)
 {
-    CrashIf(pageNo < 1 || pageNo > engine->PageCount());
+    CrashIf(pageNo < 1 || pageNo > pageCount);
     return text[pageNo - 1] != nullptr;
 }
 
-const WCHAR *PageTextCache::GetData(int pageNo, int *lenOut, RectI **coordsOut)
+const WCHAR *PageTextCache::GetData(int pageNo, int *lenOut, RectI **coordsOut, GlyphGrid **gridOut)
 {
-    ScopedCritSec scope(&access);
+    EnterCriticalSection(&access);
+
+    // the page is being extracted by a PageTextIndexer
+    while (!text[pageNo - 1] && pending[pageNo - 1]) {
+        if (0 == dataWaiters)
+            ResetEvent(dataStored);
+        dataWaiters++;
+        LeaveCriticalSection(&access);
+        WaitForSingleObject(dataStored, INFINITE);
+        EnterCriticalSection(&access);
+        dataWaiters--;
+    }
 
     if (!text[pageNo - 1]) {
-        text[pageNo - 1] = engine->ExtractPageText(pageNo, L"\n", &coords[pageNo - 1]);
-        if (!text[pageNo - 1]) {
-            text[pageNo - 1] = str::Dup(L"");
-            lens[pageNo - 1] = 0;
-        }
-        else {
-            lens[pageNo - 1] = (int)str::Len(text[pageNo - 1]);
-        }
-#ifdef DEBUG
-        debug_size += (lens[pageNo - 1] + 1) * (sizeof(WCHAR) + sizeof(RectI));
-#endif
+        // extract without holding the lock so that PageTextIndexers
+        // can continue to claim pages and store their results
+        pending[pageNo - 1] = true;
+        LeaveCriticalSection(&access);
+        RectI *pageCoords = nullptr;
+        WCHAR *pageText = engine->ExtractPageText(pageNo, L"\n", &pageCoords);
+        SetData(pageNo, pageText, pageCoords);
+        EnterCriticalSection(&access);
     }
 
     if (lenOut)
         *lenOut = lens[pageNo - 1];
     if (coordsOut)
         *coordsOut = coords[pageNo - 1];
-    return text[pageNo - 1];
+    if (gridOut)
+        *gridOut = grids[pageNo - 1];
+    const WCHAR *result = text[pageNo - 1];
+
+    LeaveCriticalSection(&access);
+    return result;
 }
 
-TextSelection::TextSelection(BaseEngine *engine, PageTextCache *textCache) :
-    engine(engine), textCache(textCache), startPage(-1),
-    endPage(-1), startGlyph(-1), endGlyph(-1)
+inline WCHAR LowerChar(WCHAR c)
 {
-    result.len = 0;
-    result.pages = nullptr;
-    result.rects = nullptr;
+    return (WCHAR)(UINT_PTR)CharLower((LPWSTR)(UINT_PTR)c);
 }
 
-TextSelection::~TextSelection()
+inline int HashBigram(WCHAR c1, WCHAR c2)
 {
-    Reset();
+    return (int)((((UINT)c1 * 0x9E3779B1) ^ ((UINT)c2 * 0x85EBCA6B)) >> 20) % PAGE_NGRAM_BITS;
 }
 
-void TextSelection::Reset()
+// returns a set of all (hashed) bigrams of the lower-cased text
+static BYTE *ExtractNgrams(const WCHAR *text, int len)
 {
-    result.len = 0;
-    free(result.pages);
-    result.pages = nullptr;
-    free(result.rects);
-    result.rects = nullptr;
+    BYTE *bits = AllocArray<BYTE>(PAGE_NGRAM_BITS / 8);
+    ScopedMem<WCHAR> lower(str::DupN(text, len));
+    if (!bits || !lower)
+        return bits;
+    CharLowerBuff(lower, len);
+    for (int i = 1; i < len; i++) {
+        int hash = HashBigram(lower[i - 1], lower[i]);
+        bits[hash / 8] |= 1 << (hash % 8);
+    }
+    return bits;
 }
 
-// returns the index of the glyph closest to the right of the given coordinates
-// (i.e. when over the right half of a glyph, the returned index will be for the
-// glyph following it, which will be the first glyph (not) to be selected)
-int TextSelection::FindClosestGlyph(int pageNo, double x, double y)
+// takes ownership of pageText and pageCoords
+void PageTextCache::SetData(int pageNo, WCHAR *pageText, RectI *pageCoords)
 {
-    int textLen;
-    RectI *coords;
-    textCache->GetData(pageNo, &textLen, &coords);
-    PointD pt = PointD(x, y);
+    if (!pageText)
+        pageText = str::Dup(L"");
+    int len = (int)str::Len(pageText);
+    BYTE *pageNgrams = ExtractNgrams(pageText, len);
+    GlyphGrid *pageGrid = pageCoords ? new GlyphGrid(pageCoords, len) : nullptr;
+
+    ScopedCritSec scope(&access);
+    CrashIf(text[pageNo - 1] || !pending[pageNo - 1]);
+    text[pageNo - 1] = pageText;
+    coords[pageNo - 1] = pageCoords;
+    lens[pageNo - 1] = len;
+    ngrams[pageNo - 1] = pageNgrams;
+    grids[pageNo - 1] = pageGrid;
+    pending[pageNo - 1] = false;
+#ifdef DEBUG
+    debug_size += (len + 1) * (sizeof(WCHAR) + sizeof(RectI)) + PAGE_NGRAM_BITS / 8;
+#endif
+    SetEvent(dataStored);
+}
+
+// starts extracting the text of all pages in the background (pages are
+// extracted in order from startPage, wrapping around at the end)
+void PageTextCache::StartIndexing(int startPage, bool forward)
+{
+    ScopedCritSec scope(&access);
+
+    indexStartPage = limitValue(startPage, 1, pageCount);
+    indexForward = forward;
+    indexNext = 0;
+    // the PageTextIndexers pick up the new order when claiming their next page
+    if (indexers.Count() > 0 || engine->IsImageCollection())
+        return;
 
+    SYSTEM_INFO si;
+    GetSystemInfo(&si);
+    // leave one processor for the search itself
+    int count = limitValue((int)si.dwNumberOfProcessors - 1, 1, MAX_TEXT_INDEXERS);
+    for (int i = 0; i < count; i++) {
+        PageTextIndexer *indexer = new PageTextIndexer(this);
+        indexers.Append(indexer);
+        indexer->Start();
+    }
+}
+
+// returns the next page to extract (or 0 if there are no more)
+int PageTextCache::ClaimPageToIndex()
+{
+    ScopedCritSec scope(&access);
+
+    int count = pageCount;
+    while (indexNext < count) {
+        int pageNo = indexStartPage + (indexForward ? indexNext : -indexNext);
+        pageNo = (pageNo - 1 + count) % count + 1;
+        indexNext++;
+        if (!text[pageNo - 1] && !pending[pageNo - 1]) {
+            pending[pageNo - 1] = true;
+            return pageNo;
+        }
+    }
+    return 0;
+}
+
+bool PageTextCache::MightContain(int pageNo, const WCHAR *needle)
+{
+    ScopedCritSec scope(&access);
+
+    BYTE *bits = ngrams[pageNo - 1];
+    if (!bits || !needle)
+        return true;
+    for (const WCHAR *c = needle; *c && c[1]; c++) {
+        // TextSearch::MatchLen requires characters following a non-CJK word
+        // character to directly follow in the page's text as well
+        if (!isnoncjkwordchar(c[0]) || !isWordChar(c[1]))
+            continue;
+        int hash = HashBigram(LowerChar(c[0]), LowerChar(c[1]));
+        if (!(bits[hash / 8] & (1 << (hash % 8))))
+            return false;
+    }
+    return true;
+}
+
+// a grid cell should contain about this many glyphs
+#define GLYPHS_PER_GRID_CELL 4
+// glyphs overlapping more cells are kept in GlyphGrid::large instead
+#define MAX_CELLS_PER_GLYPH 16
+
+inline bool IsGlyph(const RectI& c) { return c.x || c.dx; }
+
+int FindClosestGlyphLinear(const RectI *coords, int len, double x, double y)
+{
     unsigned int maxDist = UINT_MAX;
-    PointI pti = pt.ToInt();
+    PointI pti = PointD(x, y).ToInt();
     bool overGlyph = false;
     int result = -1;
 
-    for (int i = 0; i < textLen; i++) {
-        if (!coords[i].x && !coords[i].dx)
+    for (int i = 0; i < len; i++) {
+        if (!IsGlyph(coords[i]))
             continue;
         if (overGlyph && !coords[i].Contains(pti))
             continue;
@@ -126,6 +289,209 @@ int TextSelection::FindClosestGlyph(int pageNo, double x, double y)
         }
     }
 
+    return result;
+}
+
+struct GlyphHit {
+    PointI pt;
+    int x, y;
+    // whether to only consider glyphs containing pt
+    bool overOnly;
+    int result;
+    unsigned int dist;
+
+    GlyphHit(double x, double y, bool overOnly) : pt(PointD(x, y).ToInt()),
+        x((int)x), y((int)y), overOnly(overOnly), result(-1), dist(UINT_MAX) { }
+
+    void Test(const RectI *coords, int i) {
+        if (overOnly && !coords[i].Contains(pt))
+            return;
+        unsigned int d = distSq(x - coords[i].x - coords[i].dx / 2,
+                                y - coords[i].y - coords[i].dy / 2);
+        // glyphs can be tested more than once and in any order, so
+        // break ties the way FindClosestGlyphLinear does (lowest index)
+        if (d < dist || (d == dist && i < result)) {
+            result = i;
+            dist = d;
+        }
+    }
+};
+
+GlyphGrid::GlyphGrid(const RectI *coords, int len) :
+    cols(0), rows(0), cellStart(nullptr), cellGlyphs(nullptr)
+{
+    int x0 = INT_MAX, y0 = INT_MAX, x1 = INT_MIN, y1 = INT_MIN;
+    int count = 0;
+    for (int i = 0; i < len; i++) {
+        if (!IsGlyph(coords[i]))
+            continue;
+        x0 = std::min(x0, std::min(coords[i].x, coords[i].x + coords[i].dx));
+        y0 = std::min(y0, std::min(coords[i].y, coords[i].y + coords[i].dy));
+        x1 = std::max(x1, std::max(coords[i].x, coords[i].x + coords[i].dx));
+        y1 = std::max(y1, std::max(coords[i].y, coords[i].y + coords[i].dy));
+        count++;
+    }
+    if (0 == count)
+        return;
+
+    bounds = RectI(x0, y0, x1 - x0 + 1, y1 - y0 + 1);
+    int cells = std::max(count / GLYPHS_PER_GRID_CELL, 1);
+    cols = limitValue((int)sqrt((double)cells * bounds.dx / bounds.dy), 1, bounds.dx);
+    rows = limitValue(cells / cols, 1, bounds.dy);
+    cellSize = SizeI((bounds.dx + cols - 1) / cols, (bounds.dy + rows - 1) / rows);
+
+    cellStart = AllocArray<int>(cols * rows + 1);
+    ScopedMem<int> cellNext(AllocArray<int>(cols * rows));
+    if (!cellStart || !cellNext) {
+        free(cellStart);
+        cellStart = nullptr;
+        return;
+    }
+
+    // count the glyphs per cell first, so that they fit into a single array
+    for (int pass = 0; pass < 2; pass++) {
+        for (int i = 0; i < len; i++) {
+            if (!IsGlyph(coords[i]))
+                continue;
+            const RectI& c = coords[i];
+            int col0 = Col(std::min(c.x, c.x + c.dx)), col1 = Col(std::max(c.x, c.x + c.dx));
+            int row0 = Row(std::min(c.y, c.y + c.dy)), row1 = Row(std::max(c.y, c.y + c.dy));
+            if ((col1 - col0 + 1) * (row1 - row0 + 1) > MAX_CELLS_PER_GLYPH) {
+                if (0 == pass)
+                    large.Append(i);
+                continue;
+            }
+            for (int row = row0; row <= row1; row++) {
+                for (int col = col0; col <= col1; col++) {
+                    if (0 == pass)
+                        cellStart[row * cols + col + 1]++;
+                    else
+                        cellGlyphs[cellNext[row * cols + col]++] = i;
+                }
+            }
+        }
+        if (0 == pass) {
+            for (int i = 0; i < cols * rows; i++) {
+                cellStart[i + 1] += cellStart[i];
+                cellNext[i] = cellStart[i];
+            }
+            cellGlyphs = AllocArray<int>(cellStart[cols * rows]);
+            if (!cellGlyphs)
+                return;
+        }
+    }
+}
+
+GlyphGrid::~GlyphGrid()
+{
+    free(cellStart);
+    free(cellGlyphs);
+}
+
+int GlyphGrid::Col(int x) const
+{
+    return limitValue((x - bounds.x) / cellSize.dx, 0, cols - 1);
+}
+
+int GlyphGrid::Row(int y) const
+{
+    return limitValue((y - bounds.y) / cellSize.dy, 0, rows - 1);
+}
+
+void GlyphGrid::TestCell(const RectI *coords, int col, int row, GlyphHit& hit) const
+{
+    if (col < 0 || col >= cols || row < 0 || row >= rows)
+        return;
+    int cell = row * cols + col;
+    for (int i = cellStart[cell]; i < cellStart[cell + 1]; i++) {
+        hit.Test(coords, cellGlyphs[i]);
+    }
+}
+
+int GlyphGrid::FindClosest(const RectI *coords, int len, double x, double y) const
+{
+    if (!cellGlyphs)
+        return FindClosestGlyphLinear(coords, len, x, y);
+
+    // all glyphs containing the point overlap the point's cell
+    GlyphHit over(x, y, true);
+    for (size_t i = 0; i < large.Count(); i++) {
+        over.Test(coords, large.At(i));
+    }
+    if (bounds.Contains(over.pt))
+        TestCell(coords, Col(over.pt.x), Row(over.pt.y), over);
+    if (over.result != -1)
+        return over.result;
+
+    // else search the cells in rings of growing distance around the point's
+    // cell: a glyph in ring k is at least (k - 1) cells away from the point
+    GlyphHit closest(x, y, false);
+    for (size_t i = 0; i < large.Count(); i++) {
+        closest.Test(coords, large.At(i));
+    }
+    int col0 = Col(closest.x), row0 = Row(closest.y);
+    int minCellSize = std::min(cellSize.dx, cellSize.dy);
+    int maxRing = std::max(cols, rows);
+    for (int k = 0; k <= maxRing; k++) {
+        double minDist = (double)(k - 1) * minCellSize;
+        if (k > 0 && closest.result != -1 && closest.dist < minDist * minDist)
+            break;
+        if (0 == k) {
+            TestCell(coords, col0, row0, closest);
+            continue;
+        }
+        for (int col = col0 - k; col <= col0 + k; col++) {
+            TestCell(coords, col, row0 - k, closest);
+            TestCell(coords, col, row0 + k, closest);
+        }
+        for (int row = row0 - k + 1; row <= row0 + k - 1; row++) {
+            TestCell(coords, col0 - k, row, closest);
+            TestCell(coords, col0 + k, row, closest);
+        }
+    }
+    return closest.result;
+}
+
+TextSelection::TextSelection(BaseEngine *engine, PageTextCache *textCache) :
+    engine(engine), textCache(textCache), startPage(-1),
+    endPage(-1), startGlyph(-1), endGlyph(-1)
+{
+    result.len = 0;
+    result.pages = nullptr;
+    result.rects = nullptr;
+}
+
+TextSelection::~TextSelection()
+{
+    Reset();
+}
+
+void TextSelection::Reset()
+{
+    result.len = 0;
+    free(result.pages);
+    result.pages = nullptr;
+    free(result.rects);
+    result.rects = nullptr;
+}
+
+// returns the index of the glyph closest to the right of the given coordinates
+// (i.e. when over the right half of a glyph, the returned index will be for the
+// glyph following it, which will be the first glyph (not) to be selected)
+int TextSelection::FindClosestGlyph(int pageNo, double x, double y)
+{
+    int textLen;
+    RectI *coords;
+    GlyphGrid *grid;
+    textCache->GetData(pageNo, &textLen, &coords, &grid);
+    PointD pt = PointD(x, y);
+
+    int result;
+    if (grid)
+        result = grid->FindClosest(coords, textLen, x, y);
+    else
+        result = FindClosestGlyphLinear(coords, textLen, x, y);
+
     if (-1 == result)
         return 0;
     CrashIf(result < 0 || result >= textLen);
@@ -4,24 +4,94 @@
 inline unsigned int distSq(int x, int y) { return x * x + y * y; }
 // underscore is mainly used for programming and is thus considered a word character
 inline bool isWordChar(WCHAR c) { return IsCharAlphaNumeric(c) || c == '_'; }
+// ignore spaces between CJK glyphs but not between Latin, Greek, Cyrillic, etc. letters
+// cf. http://code.google.com/p/sumatrapdf/issues/detail?id=959
+#define isnoncjkwordchar(c) (isWordChar(c) && (unsigned short)(c) < 0x2E80)
+
+// number of bits in the per-page bigram signatures (cf. PageTextCache::MightContain)
+#define PAGE_NGRAM_BITS 4096
+// upper limit for the number of threads extracting text in the background
+#define MAX_TEXT_INDEXERS 4
+
+class PageTextIndexer;
+struct GlyphHit;
+
+// returns the index of the glyph the point is over or else of the glyph
+// with the closest center (or -1 for pages without glyphs) by comparing
+// the point against all glyphs (cf. GlyphGrid::FindClosest)
+int FindClosestGlyphLinear(const RectI *coords, int len, double x, double y);
+
+/* Buckets a page's glyphs into a grid of cells, so that hit-testing
+   only has to look at the glyphs in the cells close to a point */
+class GlyphGrid {
+    RectI   bounds;
+    int     cols, rows;
+    SizeI   cellSize;
+    // the glyphs overlapping cell i are cellGlyphs[cellStart[i] .. cellStart[i+1]-1]
+    int   * cellStart;
+    int   * cellGlyphs;
+    // glyphs overlapping too many cells are always tested
+    Vec<int> large;
+
+    int  Col(int x) const;
+    int  Row(int y) const;
+    void TestCell(const RectI *coords, int col, int row, GlyphHit& hit) const;
+
+public:
+    GlyphGrid(const RectI *coords, int len);
+    ~GlyphGrid();
+
+    // returns the same result as FindClosestGlyphLinear
+    int FindClosest(const RectI *coords, int len, double x, double y) const;
+};
 
 class PageTextCache {
     BaseEngine* engine;
+    int         pageCount;
     RectI    ** coords;
     WCHAR    ** text;
     int       * lens;
+    // set of hashed lower-case bigrams per page (allocated with the text)
+    BYTE     ** ngrams;
+    GlyphGrid** grids;
+    // pages currently being extracted (by a PageTextIndexer or GetData)
+    bool      * pending;
 #ifdef DEBUG
     size_t      debug_size;
 #endif
 
     CRITICAL_SECTION access;
+    // signaled whenever SetData has stored a page's text
+    // (only reset while no thread is waiting for it)
+    HANDLE      dataStored;
+    int         dataWaiters;
+
+    // text is extracted in the background on clones of the engine,
+    // starting at indexStartPage (cf. StartIndexing)
+    Vec<PageTextIndexer *> indexers;
+    int         indexStartPage;
+    bool        indexForward;
+    int         indexNext;
+
+    friend class PageTextIndexer;
+    int  ClaimPageToIndex();
+    void SetData(int pageNo, WCHAR *pageText, RectI *pageCoords);
 
 public:
     explicit PageTextCache(BaseEngine *engine);
     ~PageTextCache();
 
+    // grows the cache for engines which lay out pages in the background
+    void UpdatePageCount();
+
     bool HasData(int pageNo);
-    const WCHAR *GetData(int pageNo, int *lenOut=nullptr, RectI **coordsOut=nullptr);
+    const WCHAR *GetData(int pageNo, int *lenOut=nullptr, RectI **coordsOut=nullptr,
+                         GlyphGrid **gridOut=nullptr);
+
+    void StartIndexing(int startPage, bool forward);
+    // returns false if the (already extracted) text of pageNo can't contain
+    // the given text when searching whitespace tolerantly and case insensitively
+    bool MightContain(int pageNo, const WCHAR *needle);
 };
 
 struct TextSel {
@@ -11,6 +11,8 @@ using namespace Gdiplus;
 
 namespace mui {
 
+#include "TextRender.h"
+
 HFONT CachedFont::GetHFont()
 {
     if (!hFont) {
@@ -34,11 +36,13 @@ public:
 
     CachedFontItem(const WCHAR *name, float sizePt, FontStyle style, Font *font) : _next(nullptr) {
         this->name = str::Dup(name); this->sizePt = sizePt; this->style = style; this->font = font;
+        this->measureCache = new TextMeasureCache();
     }
     ~CachedFontItem() {
         free(name);
         ::delete font;
         DeleteObject(hFont);
+        delete measureCache;
         delete _next;
     }
 };
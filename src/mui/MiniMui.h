@@ -9,6 +9,8 @@ namespace mui {
 void Initialize();
 void Destroy();
 
+class TextMeasureCache;
+
 struct CachedFont {
     WCHAR *             name;
     float               sizePt;
@@ -17,6 +19,8 @@ struct CachedFont {
     Gdiplus::Font *     font;
     // hFont is created out of font
     HFONT               hFont;
+    // results of measuring text with this font (cf. ITextRender::cacheMeasure)
+    TextMeasureCache *  measureCache;
 
     HFONT               GetHFont();
     Gdiplus::FontStyle  GetStyle() const { return style; }
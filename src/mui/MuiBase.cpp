@@ -30,11 +30,13 @@ public:
         cf.style = style;
         cf.font = font;
         cf.hFont = hFont;
+        cf.measureCache = new TextMeasureCache();
     }
     ~FontListItem() {
         free((void *)cf.name);
         ::delete cf.font;
         DeleteObject(cf.hFont);
+        delete cf.measureCache;
         delete next;
     }
 
@@ -19,6 +19,8 @@ public:
     }
 };
 
+class TextMeasureCache;
+
 struct CachedFont {
     const WCHAR *       name;
     float               sizePt;
@@ -27,6 +29,8 @@ struct CachedFont {
     Gdiplus::Font *     font;
     // hFont is created out of font
     HFONT               hFont;
+    // results of measuring text with this font (cf. ITextRender::cacheMeasure)
+    TextMeasureCache *  measureCache;
 
     HFONT               GetHFont();
     Gdiplus::FontStyle  GetStyle() const { return style; }
@@ -29,6 +29,130 @@ be in mui to avoid circular dependency */
 
 namespace mui {
 
+// only short strings (i.e. words) are likely to be measured repeatedly
+#define MAX_CACHED_MEASURE_LEN 64
+// the cache is cleared once a font has this many entries
+#define MAX_CACHED_MEASURES (64 * 1024)
+
+static bool gMeasureCacheEnabled = true;
+static LONG gMeasureCount = 0;
+static LONG gMeasureCacheHits = 0;
+
+TextMeasureCache::TextMeasureCache() : entries(nullptr), size(0), count(0) {
+    InitializeCriticalSection(&access);
+}
+
+TextMeasureCache::~TextMeasureCache() {
+    free(entries);
+    DeleteCriticalSection(&access);
+}
+
+void TextMeasureCache::Reset(size_t newSize) {
+    free(entries);
+    entries = AllocArray<Entry>(newSize);
+    size = entries ? newSize : 0;
+    count = 0;
+    allocator.FreeAll();
+}
+
+// returns either the matching or the (unused) entry to insert into;
+// must be called with access held and size > 0
+TextMeasureCache::Entry *TextMeasureCache::FindEntry(TextRenderMethod method, const WCHAR *s, size_t len, uint32_t hash) {
+    for (size_t i = hash & (size - 1); ; i = (i + 1) & (size - 1)) {
+        Entry *e = &entries[i];
+        if (!e->s)
+            return e;
+        if (e->hash == hash && e->method == method && e->len == len && memeq(e->s, s, len * sizeof(WCHAR)))
+            return e;
+    }
+}
+
+bool TextMeasureCache::Get(TextRenderMethod method, const WCHAR *s, size_t len, Gdiplus::RectF *bboxOut) {
+    if (0 == len || len > MAX_CACHED_MEASURE_LEN)
+        return false;
+    uint32_t hash = MurmurHash2(s, len * sizeof(WCHAR));
+    ScopedCritSec scope(&access);
+    if (0 == size)
+        return false;
+    Entry *e = FindEntry(method, s, len, hash);
+    if (!e->s)
+        return false;
+    *bboxOut = e->bbox;
+    return true;
+}
+
+void TextMeasureCache::Add(TextRenderMethod method, const WCHAR *s, size_t len, Gdiplus::RectF bbox) {
+    if (0 == len || len > MAX_CACHED_MEASURE_LEN)
+        return;
+    uint32_t hash = MurmurHash2(s, len * sizeof(WCHAR));
+    ScopedCritSec scope(&access);
+    if (count >= MAX_CACHED_MEASURES) {
+        Reset(size);
+    } else if (2 * (count + 1) > size) {
+        // keep the load factor below 1/2
+        Entry *oldEntries = entries;
+        size_t oldSize = size;
+        entries = AllocArray<Entry>(size ? 2 * size : 256);
+        if (!entries) {
+            entries = oldEntries;
+            return;
+        }
+        size = oldSize ? 2 * oldSize : 256;
+        for (size_t i = 0; i < oldSize; i++) {
+            if (oldEntries[i].s)
+                *FindEntry(oldEntries[i].method, oldEntries[i].s, oldEntries[i].len, oldEntries[i].hash) = oldEntries[i];
+        }
+        free(oldEntries);
+    }
+    if (0 == size)
+        return;
+    Entry *e = FindEntry(method, s, len, hash);
+    if (e->s)
+        return;
+    WCHAR *copy = (WCHAR *)allocator.Alloc(len * sizeof(WCHAR));
+    if (!copy)
+        return;
+    memcpy(copy, s, len * sizeof(WCHAR));
+    e->s = copy;
+    e->len = len;
+    e->hash = hash;
+    e->method = method;
+    e->bbox = bbox;
+    count++;
+}
+
+bool ITextRender::GetCachedMeasure(CachedFont *font, const WCHAR *s, size_t sLen, Gdiplus::RectF *bboxOut) {
+    if (!cacheMeasure)
+        return false;
+    if (!font->measureCache)
+        return false;
+    InterlockedIncrement(&gMeasureCount);
+    if (!gMeasureCacheEnabled || !font->measureCache->Get(method, s, sLen, bboxOut))
+        return false;
+    InterlockedIncrement(&gMeasureCacheHits);
+    return true;
+}
+
+void ITextRender::CacheMeasure(CachedFont *font, const WCHAR *s, size_t sLen, Gdiplus::RectF bbox) {
+    if (cacheMeasure && gMeasureCacheEnabled && font->measureCache)
+        font->measureCache->Add(method, s, sLen, bbox);
+}
+
+void EnableTextMeasureCache(bool enable) {
+    gMeasureCacheEnabled = enable;
+}
+
+// returns how often text has been measured with cacheMeasure set
+// and how many of these measurements were answered from the cache
+void GetTextMeasureStats(int *measureCountOut, int *cacheHitsOut, bool reset) {
+    *measureCountOut = (int)gMeasureCount;
+    *cacheHitsOut = (int)gMeasureCacheHits;
+    if (reset) {
+        InterlockedExchange(&gMeasureCount, 0);
+        InterlockedExchange(&gMeasureCacheHits, 0);
+    }
+}
+
 TextRenderGdi *TextRenderGdi::Create(Graphics *gfx) {
     TextRenderGdi *res = new TextRenderGdi();
     res->gfx = gfx;
@@ -85,9 +209,13 @@ float TextRenderGdi::GetCurrFontLineSpacing() {
 }
 
 RectF TextRenderGdi::Measure(const WCHAR *s, size_t sLen) {
+    RectF res;
+    if (GetCachedMeasure(currFont, s, sLen, &res))
+        return res;
     SIZE txtSize;
     GetTextExtentPoint32W(hdcForTextMeasure, s, (int) sLen, &txtSize);
-    RectF res(0.0f, 0.0f, (float) txtSize.cx, (float) txtSize.cy);
+    res = RectF(0.0f, 0.0f, (float) txtSize.cx, (float) txtSize.cy);
+    CacheMeasure(currFont, s, sLen, res);
     return res;
 }
 
@@ -273,13 +401,18 @@ float TextRenderGdiplus::GetCurrFontLineSpacing() {
 
 RectF TextRenderGdiplus::Measure(const WCHAR *s, size_t sLen) {
     CrashIf(!currFont);
-    return MeasureText(gfx, currFont->font, s, sLen, measureAlgo);
+    RectF res;
+    if (GetCachedMeasure(currFont, s, sLen, &res))
+        return res;
+    res = MeasureText(gfx, currFont->font, s, sLen, measureAlgo);
+    CacheMeasure(currFont, s, sLen, res);
+    return res;
 }
 
 RectF TextRenderGdiplus::Measure(const char *s, size_t sLen) {
     CrashIf(!currFont);
     size_t strLen = str::Utf8ToWcharBuf(s, sLen, txtConvBuf, dimof(txtConvBuf));
-    return MeasureText(gfx, currFont->font, txtConvBuf, strLen, measureAlgo);
+    return Measure(txtConvBuf, strLen);
 }
 
 TextRenderGdiplus::~TextRenderGdiplus() {
@@ -397,10 +530,14 @@ Gdiplus::RectF TextRenderHdc::Measure(const char *s, size_t sLen) {
 }
 
 Gdiplus::RectF TextRenderHdc::Measure(const WCHAR *s, size_t sLen) {
-    SIZE txtSize;
     CrashIf(!hdc);
+    RectF res;
+    if (GetCachedMeasure(currFont, s, sLen, &res))
+        return res;
+    SIZE txtSize;
     GetTextExtentPoint32W(hdc, s, (int) sLen, &txtSize);
-    RectF res(0.0f, 0.0f, (float) txtSize.cx, (float) txtSize.cy);
+    res = RectF(0.0f, 0.0f, (float) txtSize.cx, (float) txtSize.cy);
+    CacheMeasure(currFont, s, sLen, res);
     return res;
 }
 
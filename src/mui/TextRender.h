@@ -10,8 +10,40 @@ enum TextRenderMethod {
     //TextRenderDirectDraw
 };
 
+// caches the results of measuring strings with a given font, since reflowing
+// a document measures the same words over and over again (thread-safe)
+class TextMeasureCache {
+    struct Entry {
+        const WCHAR *       s; // nullptr for unused entries
+        size_t              len;
+        uint32_t            hash;
+        TextRenderMethod    method;
+        Gdiplus::RectF      bbox;
+    };
+
+    // open addressing with linear probing, size is always a power of 2
+    Entry *             entries;
+    size_t              size;
+    size_t              count;
+    // for the strings of all entries
+    PoolAllocator       allocator;
+    CRITICAL_SECTION    access;
+
+    Entry *             FindEntry(TextRenderMethod method, const WCHAR *s, size_t len, uint32_t hash);
+    void                Reset(size_t newSize);
+
+public:
+    TextMeasureCache();
+    ~TextMeasureCache();
+
+    bool                Get(TextRenderMethod method, const WCHAR *s, size_t len, Gdiplus::RectF *bboxOut);
+    void                Add(TextRenderMethod method, const WCHAR *s, size_t len, Gdiplus::RectF bbox);
+};
+
 class ITextRender {
 public:
+    ITextRender() : cacheMeasure(false) { }
+
     virtual void            SetFont(CachedFont *font) = 0;
     virtual void            SetTextColor(Gdiplus::Color col) = 0;
 
@@ -39,6 +71,14 @@ public:
     virtual ~ITextRender() {};
 
     TextRenderMethod method;
+    // if set, Measure() results are cached per font. Only set this if all text
+    // is measured on Graphics from AllocGraphicsForMeasureText (which are all
+    // set up the same way), as results can differ for other Graphics
+    bool cacheMeasure;
+
+protected:
+    bool GetCachedMeasure(CachedFont *font, const WCHAR *s, size_t sLen, Gdiplus::RectF *bboxOut);
+    void CacheMeasure(CachedFont *font, const WCHAR *s, size_t sLen, Gdiplus::RectF bbox);
 };
 
 class TextRenderGdi : public ITextRender {
@@ -171,3 +211,7 @@ ITextRender *CreateTextRender(TextRenderMethod method, Graphics *gfx, int dx, in
 
 size_t  StringLenForWidth(ITextRender *textRender, const WCHAR *s, size_t len, float dx);
 REAL    GetSpaceDx(ITextRender *textRender);
+
+// for benchmarking the measurement cache
+void    EnableTextMeasureCache(bool enable);
+void    GetTextMeasureStats(int *measureCountOut, int *cacheHitsOut, bool reset=true);
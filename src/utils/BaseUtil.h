@@ -155,6 +155,19 @@ inline void CrashMe()
 // CrashIf() requires inverting the condition, which can introduce bugs)
 #define AssertCrash(exp) CrashIf(!(exp))
 
+// grows an array allocated with AllocArray from oldCount to newCount elements
+// (zeroing the new ones) and crashes if there isn't enough memory for it
+template <typename T>
+inline void GrowArrayCrash(T **array, size_t oldCount, size_t newCount)
+{
+    CrashAlwaysIf(newCount > SIZE_MAX / sizeof(T));
+    T *newArray = (T *)realloc(*array, newCount * sizeof(T));
+    CrashAlwaysIf(!newArray);
+    if (newCount > oldCount)
+        ZeroMemory(&newArray[oldCount], (newCount - oldCount) * sizeof(T));
+    *array = newArray;
+}
+
 template <typename T>
 inline T limitValue(T val, T min, T max)
 {